@@ -29,13 +29,46 @@ typedef struct {
 #include <termios.h>
 #include <unistd.h>
 
+/** \brief Replay state of a port opened with serialOpenReplay() (private to serial.c). */
+typedef struct SerialReplay SerialReplay;
+
 typedef struct {
    int comPort;
    struct termios oldTermios;
+   /** \brief Original FTDI latency timer (ms) to restore on close, or -1 if unchanged. */
+   int oldLatencyTimer;
+   /** \brief File descriptor of the capture file, or -1 if not capturing (see serialCaptureStart()). */
+   int captureFd;
+   /** \brief Replay state if the port replays a capture file (see serialOpenReplay()), NULL otherwise. */
+   SerialReplay *replay;
 } SerialPort;
 
 #endif
 
+/** \brief Magic string at the start of capture files (see serialCaptureStart()). */
+#define SERIAL_CAPTURE_MAGIC "SERCAP1"
+/** \brief Direction of a capture record: bytes received from the port. */
+#define SERIAL_CAPTURE_RX 0
+/** \brief Direction of a capture record: bytes written to the port. */
+#define SERIAL_CAPTURE_TX 1
+
+/** 
+ * \brief Header of a capture record.
+ *
+ * A capture file starts with SERIAL_CAPTURE_MAGIC (8 bytes, including the
+ * terminating zero), followed by records, each consisting of this header and
+ * length data bytes, zero padded to a multiple of 8 bytes. Fields are in host
+ * byte order.
+ */
+typedef struct {
+   /** \brief Time (CLOCK_MONOTONIC, in nanoseconds) at which the bytes were read/written. */
+   long long time;
+   /** \brief Number of data bytes. */
+   unsigned int length;
+   /** \brief SERIAL_CAPTURE_RX or SERIAL_CAPTURE_TX. */
+   unsigned int direction;
+} SerialCaptureRecord;
+
 int serialOpenByNumber(SerialPort *SP, int port);
 /** 
  * \brief Open serial port by name. 
@@ -44,6 +77,43 @@ int serialOpenByNumber(SerialPort *SP, int port);
  * \return 1 if opening is successful, 0 otherwise.
 */
 int serialOpenByName(SerialPort *SP, const char *name);
+/** 
+ * \brief Open a capture file for replay, in place of a serial port. 
+ * \param[out] SP Serial port struct.
+ * \param[in] filename Capture file recorded with serialCaptureStart().
+ * \param[in] speed Replay speed: 1 for real time, >1 for accelerated
+ * replay, 0 to deliver the data as fast as it is read.
+ * \return 1 if opening is successful, 0 otherwise.
+ *
+ * The file is memory-mapped. The received (RX) bytes are returned by
+ * serialRead/serialWaitInput at the times they were originally received
+ * (scaled by speed); bytes written to the port are discarded (or captured,
+ * if a capture is running). Parameter, flush and low-latency calls succeed
+ * without effect. Once all data has been replayed the port behaves like a
+ * silent line (reads time out).
+ *
+ * \note Only implemented on POSIX systems. Elsewhere this returns 0.
+*/
+int serialOpenReplay(SerialPort *SP, const char *filename, double speed);
+/** 
+ * \brief Start capturing all bytes read from/written to the serial port. 
+ * \param[in] SP Serial port struct.
+ * \param[in] filename Capture file. Records are appended if it exists
+ * (it must then be a capture file, i.e., start with SERIAL_CAPTURE_MAGIC).
+ * \return 1 if the file could be opened, 0 otherwise (also if it exists but is not a capture file).
+ *
+ * Every successful read/write is appended to the file as one
+ * SerialCaptureRecord with a monotonic timestamp. The capture stops when
+ * the port is closed (or with serialCaptureStop()).
+ *
+ * \note Only implemented on POSIX systems. Elsewhere this returns 0.
+*/
+int serialCaptureStart(SerialPort *SP, const char *filename);
+/** 
+ * \brief Stop capturing (see serialCaptureStart()). 
+ * \param[in] SP Serial port struct.
+*/
+void serialCaptureStop(SerialPort *SP);
 int serialClose(SerialPort *SP);
 /** 
  * \brief Write to serial port. 
@@ -64,7 +134,9 @@ int serialRead(SerialPort *SP, int size, void *buffer);
 /** 
  * \brief Set serial port parameters. 
  * \param[in] SP Serial port struct.
- * \param[in] baudrate Baudrate.
+ * \param[in] baudrate Baudrate. On Linux, rates outside the standard table
+ * (300...230400) such as 500000, 1000000 or 2000000 are set through
+ * termios2/BOTHER, if the driver supports them.
  * \param[in] bits No. data bits.
  * \param[in] parity Parity (0 or 1).
  * \param[in] stops No. stop bits (1 or 2).
@@ -72,8 +144,61 @@ int serialRead(SerialPort *SP, int size, void *buffer);
  * \return 1 if setting is successful, 0 otherwise.
 */
 int serialSetParameters(SerialPort *SP, int baudrate, int bits, int parity, int stops, int timeout);
+/** 
+ * \brief Wait until data is available for reading from the serial port. 
+ * \param[in] SP Serial port struct.
+ * \param[in] timeout Timeout (in milliseconds, negative to wait indefinitely).
+ * \return 1 if data is available, 0 on timeout, -1 on error.
+ *
+ * \note On Windows this returns 1 immediately, and the timeouts set by
+ * serialSetParameters apply to the subsequent serialRead instead.
+*/
+int serialWaitInput(SerialPort *SP, int timeout);
+/** 
+ * \brief Wait until data is available for reading from the serial port (microsecond resolution). 
+ * \param[in] SP Serial port struct.
+ * \param[in] timeout Timeout (in microseconds, negative to wait indefinitely).
+ * \return 1 if data is available, 0 on timeout, -1 on error.
+*/
+int serialWaitInputUsec(SerialPort *SP, long timeout);
+/** 
+ * \brief Read from serial port with a timeout in microseconds. 
+ * \param[in] SP Serial port struct.
+ * \param[in] size Number of bytes to read.
+ * \param[out] buffer Pointer to data buffer.
+ * \param[in] timeout Overall timeout (in microseconds).
+ * \return Number of bytes read (less than size if the timeout expired), -1 on error.
+ *
+ * Unlike serialRead, this does not depend on the (decisecond) VTIME timeout
+ * set by serialSetParameters.
+*/
+int serialReadTimeout(SerialPort *SP, int size, void *buffer, long timeout);
+/** 
+ * \brief Switch low-latency mode on or off. 
+ * \param[in] SP Serial port struct.
+ * \param[in] enable 1 to enable, 0 to restore the default behaviour.
+ * \return 1 if the driver accepted the ASYNC_LOW_LATENCY flag, 0 otherwise.
+ *
+ * This sets ASYNC_LOW_LATENCY through TIOCSSERIAL and, for FTDI USB-serial
+ * converters, reduces the latency timer in sysfs
+ * (/sys/class/tty/ttyUSBx/device/latency_timer) from the default 16 ms to
+ * 1 ms, so that short frames are not held back by the converter. Writing
+ * the latency timer usually requires write permission on the sysfs file; if
+ * it cannot be changed a warning is printed. The original latency timer is
+ * restored by serialClose.
+ *
+ * \note Only implemented on Linux. Elsewhere this returns 0.
+*/
+int serialSetLowLatency(SerialPort *SP, int enable);
 void serialFlushInput(SerialPort *SP);
 void serialFlushOutput(SerialPort *SP);
+/** 
+ * \brief Block until all data written to the serial port has been transmitted. 
+ * \param[in] SP Serial port struct.
+ *
+ * Unlike serialFlushOutput, this does not discard pending data.
+*/
+void serialDrainOutput(SerialPort *SP);
 
 #ifdef __cplusplus
 }
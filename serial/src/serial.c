@@ -4,8 +4,12 @@
 	(C) 2008 Stefan Klanke
 */
 
+#ifndef WIN32
+#define _GNU_SOURCE /* for ppoll */
+#endif
 #include <serial.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 
@@ -122,6 +126,22 @@ int serialWrite(SerialPort *SP, int size, void *buffer) {
    return numWritten;
 }
 
+int serialWaitInput(SerialPort *SP, int timeout) {
+   return 1;
+}
+
+int serialWaitInputUsec(SerialPort *SP, long timeout) {
+   return 1;
+}
+
+int serialReadTimeout(SerialPort *SP, int size, void *buffer, long timeout) {
+   return serialRead(SP, size, buffer);
+}
+
+int serialSetLowLatency(SerialPort *SP, int enable) {
+   return 0;
+}
+
 void serialFlushInput(SerialPort *SP) {
    PurgeComm(SP->comPort, PURGE_RXCLEAR);
 }
@@ -130,6 +150,23 @@ void serialFlushOutput(SerialPort *SP) {
    PurgeComm(SP->comPort, PURGE_TXCLEAR);
 }
 
+void serialDrainOutput(SerialPort *SP) {
+   FlushFileBuffers(SP->comPort);
+}
+
+int serialOpenReplay(SerialPort *SP, const char *filename, double speed) {
+   fputs("Serial replay is not supported on this platform.\n",stderr);
+   return 0;
+}
+
+int serialCaptureStart(SerialPort *SP, const char *filename) {
+   fputs("Serial capture is not supported on this platform.\n",stderr);
+   return 0;
+}
+
+void serialCaptureStop(SerialPort *SP) {
+}
+
 int serialRead(SerialPort *SP, int size, void *buffer) {
    DWORD numRead;
 
@@ -141,11 +178,270 @@ int serialRead(SerialPort *SP, int size, void *buffer) {
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#include <libgen.h>
+
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
 
+/** \brief Kernel termios2 struct (from <asm/termbits.h>, which clashes with <termios.h>),
+ *  used with TCGETS2/TCSETS2 for setting baudrates outside the Bxxx table. */
+struct termios2 {
+   tcflag_t c_iflag;
+   tcflag_t c_oflag;
+   tcflag_t c_cflag;
+   tcflag_t c_lflag;
+   cc_t c_line;
+   cc_t c_cc[19];
+   speed_t c_ispeed;
+   speed_t c_ospeed;
+};
+
+/** 
+ * \brief Set an arbitrary baudrate (e.g., 500000, 1000000) through termios2/BOTHER.
+ * \return 1 if the driver accepted the rate, 0 otherwise.
+ */
+static int serialSetCustomBaudrate(SerialPort *SP, int baudrate) {
+   struct termios2 tio2;
+
+   if (ioctl(SP->comPort, TCGETS2, &tio2)) return 0;
+   tio2.c_cflag &= ~CBAUD;
+   tio2.c_cflag |= BOTHER;
+   tio2.c_ispeed = baudrate;
+   tio2.c_ospeed = baudrate;
+   if (ioctl(SP->comPort, TCSETS2, &tio2)) return 0;
+
+   /* Read back: the driver silently rounds to the nearest rate its divisor can generate. */
+   if (ioctl(SP->comPort, TCGETS2, &tio2)) return 0;
+   if (tio2.c_ospeed == 0) return 0;
+   if (abs((int)tio2.c_ospeed - baudrate) > baudrate/50) {
+      fprintf(stderr,"Warning: requested baudrate %d, driver set %u.\n", baudrate, tio2.c_ospeed);
+   }
+   return 1;
+}
+
+/** 
+ * \brief Get the sysfs path of the FTDI latency timer of a serial port.
+ * \return 1 if the port has a latency timer, 0 otherwise.
+ */
+static int serialLatencyTimerPath(SerialPort *SP, char *path, int size) {
+   char device[64];
+
+   if (ttyname_r(SP->comPort, device, sizeof(device))) return 0;
+   snprintf(path, size, "/sys/class/tty/%s/device/latency_timer", basename(device));
+   return access(path, F_OK) == 0;
+}
+
+/** 
+ * \brief Read (if value<0) or write (if value>=0) the FTDI latency timer (in ms).
+ * \return The latency timer value, or -1 if not available.
+ */
+static int serialLatencyTimer(SerialPort *SP, int value) {
+   char path[128];
+   FILE *f;
+   int ret = -1;
+
+   if (!serialLatencyTimerPath(SP, path, sizeof(path))) return -1;
+   if (value < 0) {
+      f = fopen(path, "r");
+      if (f == NULL) return -1;
+      if (fscanf(f, "%d", &ret) != 1) ret = -1;
+   } else {
+      f = fopen(path, "w");
+      if (f == NULL) return -1;
+      if (fprintf(f, "%d", value) > 0) ret = value;
+   }
+   if (fclose(f)) ret = -1;
+   return ret;
+}
+#endif
+
+
+/** \brief Replay state (see serialOpenReplay()). */
+struct SerialReplay {
+   /** \brief Memory-mapped capture file. */
+   const unsigned char *data;
+   size_t size;
+   /** \brief Offset of the current record in data. */
+   size_t position;
+   /** \brief Number of data bytes of the current record already returned by serialRead. */
+   unsigned int offset;
+   /** \brief Replay speed (0 for as fast as possible). */
+   double speed;
+   /** \brief Time stamp of the first record (ns). */
+   long long t0;
+   /** \brief Time at which the replay started. */
+   struct timespec start;
+};
+
+/** \brief Size of a record with length data bytes (padded to a multiple of 8 bytes). */
+#define CAPTURE_RECORD_SIZE(length) (sizeof(SerialCaptureRecord) + (((length) + 7) & ~7u))
+
+static long long serialNow(void) {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+/** 
+ * \brief Append a record to the capture file (if capturing).
+ */
+static void serialCapture(SerialPort *SP, unsigned int direction, const void *buffer, int size) {
+   static const char zeros[8] = {0};
+   SerialCaptureRecord rec;
+   struct iovec iov[3];
+
+   if (SP->captureFd < 0 || size <= 0) return;
+   rec.time      = serialNow();
+   rec.length    = size;
+   rec.direction = direction;
+   iov[0].iov_base = &rec;            iov[0].iov_len = sizeof(rec);
+   iov[1].iov_base = (void *)buffer;  iov[1].iov_len = size;
+   iov[2].iov_base = (void *)zeros;   iov[2].iov_len = CAPTURE_RECORD_SIZE(size) - sizeof(rec) - size;
+   /* One writev per record, so that (with O_APPEND) records are never interleaved. */
+   if (writev(SP->captureFd, iov, 3) < 0) {
+      perror("serial capture");
+      serialCaptureStop(SP);
+   }
+}
+
+/** 
+ * \brief Get the next record of received data that has not been (fully) read yet.
+ * \return The record, or NULL at the end of the capture.
+ */
+static const SerialCaptureRecord *serialReplayNext(SerialReplay *R) {
+   const SerialCaptureRecord *rec;
+
+   while (R->position + sizeof(SerialCaptureRecord) <= R->size) {
+      rec = (const SerialCaptureRecord *)(R->data + R->position);
+      if (R->position + CAPTURE_RECORD_SIZE(rec->length) > R->size) break; /* truncated record */
+      if (rec->direction == SERIAL_CAPTURE_RX && R->offset < rec->length) return rec;
+      R->position += CAPTURE_RECORD_SIZE(rec->length);
+      R->offset    = 0;
+   }
+   return NULL;
+}
+
+/** 
+ * \brief Time (in microseconds) until the data of a record is due.
+ */
+static long serialReplayDelay(SerialReplay *R, const SerialCaptureRecord *rec) {
+   long long due;
+
+   if (R->speed <= 0) return 0;
+   due = (R->start.tv_sec*1000000000LL + R->start.tv_nsec) + (long long)((rec->time - R->t0)/R->speed);
+   due -= serialNow();
+   return due > 0 ? due/1000 : 0;
+}
+
+static void serialSleepUsec(long us) {
+   struct timespec ts;
+
+   ts.tv_sec  = us / 1000000L;
+   ts.tv_nsec = (us % 1000000L) * 1000L;
+   while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR);
+}
+
+int serialOpenReplay(SerialPort *SP, const char *filename, double speed) {
+   SerialReplay *R;
+   struct stat st;
+   void *data;
+   int fd;
+
+   SP->comPort = -1;
+   SP->oldLatencyTimer = -1;
+   SP->captureFd = -1;
+   SP->replay = NULL;
+
+   fd = open(filename, O_RDONLY);
+   if (fd < 0) {
+      perror(filename);
+      return 0;
+   }
+   if (fstat(fd, &st) || st.st_size < (off_t)sizeof(SERIAL_CAPTURE_MAGIC)) {
+      fprintf(stderr,"%s is not a capture file.\n", filename);
+      close(fd);
+      return 0;
+   }
+   data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (data == MAP_FAILED) {
+      perror(filename);
+      return 0;
+   }
+   if (memcmp(data, SERIAL_CAPTURE_MAGIC, sizeof(SERIAL_CAPTURE_MAGIC))) {
+      fprintf(stderr,"%s is not a capture file.\n", filename);
+      munmap(data, st.st_size);
+      return 0;
+   }
+
+   R = (SerialReplay *) calloc(1, sizeof(SerialReplay));
+   if (R == NULL) {
+      munmap(data, st.st_size);
+      return 0;
+   }
+   R->data     = (const unsigned char *) data;
+   R->size     = st.st_size;
+   R->position = sizeof(SERIAL_CAPTURE_MAGIC);
+   R->speed    = speed;
+   if (R->position + sizeof(SerialCaptureRecord) <= R->size) {
+      R->t0 = ((const SerialCaptureRecord *)(R->data + R->position))->time;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &R->start);
+   SP->replay = R;
+   return 1;
+}
+
+int serialCaptureStart(SerialPort *SP, const char *filename) {
+   struct stat st;
+   char magic[sizeof(SERIAL_CAPTURE_MAGIC)];
+   int fd;
+
+   serialCaptureStop(SP);
+   fd = open(filename, O_RDWR | O_CREAT | O_APPEND, 0644);
+   if (fd < 0) {
+      perror(filename);
+      return 0;
+   }
+   if (fstat(fd, &st) != 0) {
+      perror(filename);
+      close(fd);
+      return 0;
+   }
+   /* Only append to capture files (replay would reject anything else). */
+   if (st.st_size > 0 && (pread(fd, magic, sizeof(magic), 0) != sizeof(magic) || memcmp(magic, SERIAL_CAPTURE_MAGIC, sizeof(magic)) != 0)) {
+      fprintf(stderr,"%s is not a capture file.\n", filename);
+      close(fd);
+      return 0;
+   }
+   if (st.st_size == 0) {
+      if (write(fd, SERIAL_CAPTURE_MAGIC, sizeof(SERIAL_CAPTURE_MAGIC)) != sizeof(SERIAL_CAPTURE_MAGIC)) {
+         perror(filename);
+         close(fd);
+         return 0;
+      }
+   }
+   SP->captureFd = fd;
+   return 1;
+}
+
+void serialCaptureStop(SerialPort *SP) {
+   if (SP->captureFd < 0) return;
+   close(SP->captureFd);
+   SP->captureFd = -1;
+}
 
 int serialOpenByNumber(SerialPort *SP, int port) {
    char device[16];
@@ -156,8 +452,11 @@ int serialOpenByNumber(SerialPort *SP, int port) {
 
 
 int serialOpenByName(SerialPort *SP, const char *device) {
+   SP->oldLatencyTimer = -1;
+   SP->captureFd = -1;
+   SP->replay = NULL;
    SP->comPort = open(device, O_RDWR | O_NOCTTY );
-   if (!SP->comPort) {
+   if (SP->comPort < 0) {
       fputs(serialErrOpen, stderr);
       return 0;
    }
@@ -175,7 +474,10 @@ int serialOpenByName(SerialPort *SP, const char *device) {
 
 int serialSetParameters(SerialPort *SP, int baudrate, int bits, int parity, int stops, int timeout) {
    struct termios newtio;
+   int customBaudrate = 0;
    
+   if (SP->replay != NULL) return 1;
+
    memset(&newtio, 0, sizeof(newtio)); /* clear struct for new port settings */
 
    newtio.c_cflag = CLOCAL | CREAD;
@@ -195,7 +497,14 @@ int serialSetParameters(SerialPort *SP, int baudrate, int bits, int parity, int
       case  57600: newtio.c_cflag |= B57600; break;
       case 115200: newtio.c_cflag |= B115200; break;
       case 230400: newtio.c_cflag |= B230400; break;
+#ifdef __linux__
+      default: 
+         /* Any other rate is set with termios2 after tcsetattr (below). */
+         if (baudrate <= 0) { fputs("Unrecognized baudrate\n.",stderr); return 0; }
+         newtio.c_cflag |= B38400; customBaudrate = 1; break;
+#else
       default: fputs("Unrecognized baudrate\n.",stderr); return 0;
+#endif
    }
    switch(bits) {
       case 5: newtio.c_cflag |= CS5; break;
@@ -219,11 +528,30 @@ int serialSetParameters(SerialPort *SP, int baudrate, int bits, int parity, int
       fputs("Couldn't change serial port settings\n",stderr);
       return 0;
    }
+#ifdef __linux__
+   if (customBaudrate && !serialSetCustomBaudrate(SP, baudrate)) {
+      fputs("Couldn't set custom baudrate\n",stderr);
+      return 0;
+   }
+#endif
    return 1;	
 }
 
 int serialClose(SerialPort *SP) {
 
+   serialCaptureStop(SP);
+   if (SP->replay != NULL) {
+      munmap((void *)SP->replay->data, SP->replay->size);
+      free(SP->replay);
+      SP->replay = NULL;
+      return 1;
+   }
+#ifdef __linux__
+   if (SP->oldLatencyTimer >= 0) {
+      serialLatencyTimer(SP, SP->oldLatencyTimer);
+      SP->oldLatencyTimer = -1;
+   }
+#endif
    tcflush(SP->comPort, TCIOFLUSH);
    tcsetattr(SP->comPort,TCSANOW,&(SP->oldTermios));
    close(SP->comPort);
@@ -231,21 +559,141 @@ int serialClose(SerialPort *SP) {
 }
 
 int serialWrite(SerialPort *SP, int size, void *buffer) {
-   int numWrite = write(SP->comPort, buffer, size);
+   int numWrite = SP->replay != NULL ? size : write(SP->comPort, buffer, size);
+   serialCapture(SP, SERIAL_CAPTURE_TX, buffer, numWrite);
    return numWrite;
 }
 
+/** 
+ * \brief Read the received bytes of the replay that are due (without blocking).
+ */
+static int serialReplayRead(SerialReplay *R, int size, void *buffer) {
+   const SerialCaptureRecord *rec = serialReplayNext(R);
+   int n;
+
+   if (rec == NULL || serialReplayDelay(R, rec) > 0) return 0;
+   n = rec->length - R->offset;
+   if (n > size) n = size;
+   memcpy(buffer, (const unsigned char *)(rec + 1) + R->offset, n);
+   R->offset += n;
+   return n;
+}
+
 int serialRead(SerialPort *SP, int size, void *buffer) {
-   return read(SP->comPort, buffer, size);
+   int numRead = SP->replay != NULL ? serialReplayRead(SP->replay, size, buffer) : read(SP->comPort, buffer, size);
+   serialCapture(SP, SERIAL_CAPTURE_RX, buffer, numRead);
+   return numRead;
+}
+
+int serialWaitInput(SerialPort *SP, int timeout) {
+   return serialWaitInputUsec(SP, timeout < 0 ? -1 : 1000L*timeout);
+}
+
+int serialWaitInputUsec(SerialPort *SP, long timeout) {
+   struct pollfd pfd;
+   struct timespec ts;
+   int ret;
+
+   if (SP->replay != NULL) {
+      const SerialCaptureRecord *rec = serialReplayNext(SP->replay);
+      long delay = rec != NULL ? serialReplayDelay(SP->replay, rec) : -1;
+
+      if (delay == 0) return 1;
+      if (delay < 0 || (timeout >= 0 && delay > timeout)) { /* nothing (more) due within the timeout */
+         serialSleepUsec(timeout >= 0 ? timeout : 1000000L);
+         return 0;
+      }
+      serialSleepUsec(delay);
+      return 1;
+   }
+
+   pfd.fd      = SP->comPort;
+   pfd.events  = POLLIN;
+   pfd.revents = 0;
+
+   ts.tv_sec  = timeout / 1000000L;
+   ts.tv_nsec = (timeout % 1000000L) * 1000L;
+
+   do {
+      ret = ppoll(&pfd, 1, timeout < 0 ? NULL : &ts, NULL);
+   } while (ret < 0 && errno == EINTR);
+
+   if (ret < 0) return -1;
+   if (ret == 0) return 0;
+   if (pfd.revents & POLLIN) return 1;
+   return -1; /* POLLERR, POLLHUP or POLLNVAL without pending data */
+}
+
+int serialReadTimeout(SerialPort *SP, int size, void *buffer, long timeout) {
+   struct timespec t0, t;
+   long remaining = timeout;
+   int numRead = 0, n;
+
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   while (numRead < size) {
+      n = serialWaitInputUsec(SP, remaining);
+      if (n < 0) return -1;
+      if (n == 0) break;
+      n = serialRead(SP, size - numRead, (char *)buffer + numRead);
+      if (n < 0 && errno != EINTR && errno != EAGAIN) return -1;
+      if (n > 0) numRead += n;
+
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      remaining = timeout - ((t.tv_sec - t0.tv_sec)*1000000L + (t.tv_nsec - t0.tv_nsec)/1000L);
+      if (remaining <= 0) break;
+   }
+   return numRead;
+}
+
+int serialSetLowLatency(SerialPort *SP, int enable) {
+#ifdef __linux__
+   struct serial_struct ss;
+   int ok = 1;
+
+   if (SP->replay != NULL) return 1;
+
+   if (ioctl(SP->comPort, TIOCGSERIAL, &ss) == 0) {
+      if (enable) ss.flags |=  ASYNC_LOW_LATENCY;
+      else        ss.flags &= ~ASYNC_LOW_LATENCY;
+      if (ioctl(SP->comPort, TIOCSSERIAL, &ss)) ok = 0;
+   } else {
+      ok = 0;
+   }
+
+   /* FTDI converters buffer data for up to latency_timer ms before passing it on to the host. */
+   if (enable) {
+      int old = serialLatencyTimer(SP, -1);
+      if (old > 1) {
+         if (serialLatencyTimer(SP, 1) == 1) {
+            if (SP->oldLatencyTimer < 0) SP->oldLatencyTimer = old;
+         } else {
+            fprintf(stderr,"Warning: couldn't set FTDI latency timer (currently %d ms).\n", old);
+         }
+      }
+   } else if (SP->oldLatencyTimer >= 0) {
+      serialLatencyTimer(SP, SP->oldLatencyTimer);
+      SP->oldLatencyTimer = -1;
+   }
+   return ok;
+#else
+   return 0;
+#endif
 }
 
 void serialFlushInput(SerialPort *SP) {
+   if (SP->replay != NULL) return;
    tcflush(SP->comPort, TCIFLUSH);
 }
 
 void serialFlushOutput(SerialPort *SP) {
+   if (SP->replay != NULL) return;
    tcflush(SP->comPort, TCOFLUSH);
 }
 
+void serialDrainOutput(SerialPort *SP) {
+   if (SP->replay != NULL) return;
+   while (tcdrain(SP->comPort) < 0 && errno == EINTR);
+}
+
 #endif
  
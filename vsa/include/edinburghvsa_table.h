@@ -0,0 +1,168 @@
+/**
+ * \file edinburghvsa_table.h
+ * \brief Precomputed maps of the equilibrium position and stiffness of the Edinburgh VSA over the motor positions.
+ * \ingroup edinburghvsa
+ *
+ * The equilibrium position \f$q_0(\mathbf{u})\f$ needs an iterative search
+ * (edinburghvsa_model_solve_equilibrium_position()). For real-time use, the
+ * table samples \f$q_0\f$ and the stiffness at the equilibrium
+ * \f$k_0(\mathbf{u})=k(q_0(\mathbf{u}),\mathbf{u})\f$, with their gradients,
+ * on a regular grid over the servo ranges (umin to umax of the model), and
+ * interpolates them with bicubic Hermite patches, which are smooth across the
+ * cells.
+ *
+ * When the table is built, the interpolation error of each cell is measured
+ * against the model at the midpoints of its edges and on a 3x3 grid inside
+ * it. A lookup with a tolerance uses the table only where this error is
+ * within the tolerance, and otherwise (or outside the grid) falls back to the
+ * model.
+ *
+ * Building a table takes about 14 equilibrium searches per node (30 ms for
+ * 64x64 nodes). It may be cached in a binary file (in the byte order of the
+ * machine), which is reused only if it was made with the same model
+ * parameters and grid.
+ *
+ * Usage (build/edinburghvsa_table.o):
+ * \code
+ * edinburghvsa_model M;
+ * edinburghvsa_table T;
+ * double tolerance[2] = { 1e-4, 1e-3 }, q0, k;
+ * edinburghvsa_model_init(&M);
+ * if (!edinburghvsa_table_init(&T, &M, 64, 64, "/tmp/edinburghvsa.table")) { ... }
+ * edinburghvsa_table_lookup(&T, u, tolerance, &q0, &k, NULL, NULL);
+ * edinburghvsa_table_free(&T);
+ * \endcode
+ */
+#ifndef __edinburghvsa_table_h
+#define __edinburghvsa_table_h
+#include <libedinburghvsa.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** \brief Lookup status: the result was interpolated from the table. */
+#define EDINBURGHVSA_TABLE_INTERPOLATED 0
+/** \brief Lookup status: the result was computed with the model (outside the grid or the tolerance). */
+#define EDINBURGHVSA_TABLE_EXACT        1
+/** \brief Lookup status: the result was computed with the model, but the equilibrium search failed. */
+#define EDINBURGHVSA_TABLE_FAILED       2
+
+/** \brief Status of edinburghvsa_table_solve_command(): the target is reached. */
+#define EDINBURGHVSA_COMMAND_EXACT         0
+/** \brief Status of edinburghvsa_table_solve_command(): the target is out of reach (u is the closest command found). */
+#define EDINBURGHVSA_COMMAND_CLIPPED       1
+/** \brief Status of edinburghvsa_table_solve_command(): the Newton iterations did not converge. */
+#define EDINBURGHVSA_COMMAND_NOT_CONVERGED 2
+/** \brief Inverse model: maximum number of Newton iterations. */
+#define EDINBURGHVSA_COMMAND_MAX_ITER      20
+
+/** \brief Number of values stored per grid node (q0, k0, each with two first derivatives and the mixed second derivative). */
+#define EDINBURGHVSA_TABLE_FIELDS       8
+
+/** \brief Table of equilibrium position and stiffness. */
+typedef struct {
+	/** \brief Model the table was computed with. */
+	edinburghvsa_model model;
+	/** \brief Number of grid nodes along u[0] and u[1] (at least 2). */
+	int n[DIMU];
+	/** \brief Grid spacing along u[0] and u[1] (rad). */
+	double h[DIMU];
+	/** \brief Node values, EDINBURGHVSA_TABLE_FIELDS per node, node (i,j) at (j*n[0]+i)*EDINBURGHVSA_TABLE_FIELDS. */
+	double *node;
+	/** \brief Non-zero for nodes where the equilibrium search converged. */
+	unsigned char *valid;
+	/** \brief Measured interpolation error of q0 and k0 in each cell (infinite if a corner is not valid), cell (i,j) at 2*(j*(n[0]-1)+i).
+	 *
+	 * The largest error at 13 points of the cell (edge midpoints and a 3x3 grid inside), so it may be exceeded slightly between them. */
+	double *error;
+} edinburghvsa_table;
+
+/**
+ * \brief Build the table, or load it from a cache file.
+ * \param[out] T table.
+ * \param[in] model model parameters (copied).
+ * \param[in] n0,n1 number of grid nodes along u[0] and u[1] (at least 2).
+ * \param[in] cache cache file, or NULL. If it holds a table for the same model and grid, it is loaded; otherwise the table is built and saved to it.
+ * \return non-zero on success, zero if out of memory or n0, n1 are too small.
+ */
+int  edinburghvsa_table_init   ( edinburghvsa_table *T, edinburghvsa_model *model, int n0, int n1, const char *cache );
+/**
+ * \brief Free the memory of the table.
+ * \param T table.
+ */
+void edinburghvsa_table_free   ( edinburghvsa_table *T );
+/**
+ * \brief Save the table to a binary file.
+ * \param[in] T table.
+ * \param[in] path file name.
+ * \return non-zero on success.
+ */
+int  edinburghvsa_table_save   ( const edinburghvsa_table *T, const char *path );
+/**
+ * \brief Load a table from a binary file.
+ * \param[out] T table.
+ * \param[in] path file name.
+ * \param[in] model model parameters the table must have been computed with.
+ * \param[in] n0,n1 grid size the table must have.
+ * \return non-zero on success, zero if the file could not be read or is for a different model or grid.
+ */
+int  edinburghvsa_table_load   ( edinburghvsa_table *T, const char *path, edinburghvsa_model *model, int n0, int n1 );
+/**
+ * \brief Equilibrium position and stiffness for a command.
+ * \param[in] T table.
+ * \param[in] u command (motor positions in radiens).
+ * \param[in] tolerance largest acceptable error of q0 (rad) and k (Nm/rad), or NULL to always interpolate (with u clipped to the grid).
+ * \param[out] q0 equilibrium position.
+ * \param[out] k stiffness at the equilibrium.
+ * \param[out] Jq0 gradient of q0 with respect to u, or NULL.
+ * \param[out] Jk gradient of k with respect to u (including the motion of the equilibrium), or NULL.
+ * \return EDINBURGHVSA_TABLE_INTERPOLATED, EDINBURGHVSA_TABLE_EXACT or EDINBURGHVSA_TABLE_FAILED.
+ *
+ * \note The table is not modified, so lookups may run concurrently (e.g., in
+ * the i/o thread of the Arduino interface).
+ */
+int  edinburghvsa_table_lookup ( const edinburghvsa_table *T, double *u, const double *tolerance, double *q0, double *k, double *Jq0, double *Jk );
+
+/**
+ * \brief Calculate the command giving a desired equilibrium position and stiffness (inverse model).
+ * \param[in] T table.
+ * \param[in,out] u command (motor positions in radiens), used as the initial guess if warm is non-zero.
+ * \param[in] target desired equilibrium position (rad) and stiffness at the equilibrium (Nm/rad).
+ * \param[in] tolerance acceptable error of q0 (rad) and k (Nm/rad), or NULL to solve on the interpolated table to within 1e-6 rad and 1e-5 Nm/rad.
+ * \param[in] warm non-zero to start from u, zero to start from the best grid node.
+ * \return EDINBURGHVSA_COMMAND_EXACT, EDINBURGHVSA_COMMAND_CLIPPED or EDINBURGHVSA_COMMAND_NOT_CONVERGED.
+ *
+ * Newton steps \f$\Delta\mathbf{u}=-\mathbf{J}^{-1}(q_0-q_0^{*},k_0-k^{*})\f$,
+ * with \f$\mathbf{J}\f$ the gradients of \f$q_0\f$ and \f$k_0\f$ from
+ * edinburghvsa_table_lookup(), are limited to two grid cells and clipped to
+ * umin, umax, and halved while they increase the residual. A motor at its
+ * limit is held there while the other one fits the target as well as it can.
+ * Lookups use half the tolerance, and the iteration stops when the residual
+ * is within the other half.
+ *
+ * Without a warm start (or if it fails), the search starts from the four grid
+ * nodes closest to the target, until one reaches it. Each search takes 2-5
+ * iterations, about 3 us with a 64x64 table.
+ */
+int  edinburghvsa_table_solve_command       ( const edinburghvsa_table *T, double *u, double *target, const double *tolerance, int warm );
+/**
+ * \brief Calculate the commands for a batch of desired equilibrium positions and stiffnesses (see edinburghvsa_table_solve_command()).
+ * \param[in] T table.
+ * \param[out] U commands (DIMU arrays of n elements).
+ * \param[out] status n status values, or NULL.
+ * \param[in] target desired equilibrium positions, then stiffnesses (2 arrays of n elements).
+ * \param[in] n number of samples.
+ * \param[in] tolerance as for edinburghvsa_table_solve_command().
+ * \return number of targets that were not reached.
+ *
+ * Each search starts from the previous solution if that was reached (as
+ * suits targets along a trajectory), and from the grid otherwise.
+ */
+int  edinburghvsa_table_solve_command_batch ( const edinburghvsa_table *T, double *U, int *status, double *target, int n, const double *tolerance );
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
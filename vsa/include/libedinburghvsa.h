@@ -10,6 +10,10 @@
 #include <string.h>
 #include "../sketchbook/edinburghvsa/defines.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
 /** \brief Dimensionality of joint space. */
 #define DIMQ 1
 /** \brief State dimensionality. */
@@ -62,6 +66,59 @@ typedef struct {
 	double b_filter[2*FILTER_DIMENSION];      
 } edinburghvsa_model;
 
+/** \brief Warm start for the equilibrium search (see edinburghvsa_model_solve_equilibrium_position()), e.g., one per controller. */
+typedef struct {
+	/** \brief Last equilibrium position found (rad). */
+	double q0;
+	/** \brief Non-zero if q0 is set (initialise to zero). */
+	int valid;
+} edinburghvsa_equilibrium_cache;
+
+/** \brief Status of edinburghvsa_model_solve_equilibrium_position(): the last Newton/bisection step was below EDINBURGHVSA_EQUILIBRIUM_TOLERANCE (rad). */
+#define EDINBURGHVSA_EQUILIBRIUM_CONVERGED      0
+/** \brief Status of edinburghvsa_model_solve_equilibrium_position(): EDINBURGHVSA_EQUILIBRIUM_MAX_ITER iterations were not enough. */
+#define EDINBURGHVSA_EQUILIBRIUM_NOT_CONVERGED  1
+/** \brief Status of edinburghvsa_model_solve_equilibrium_position(): the torque does not change sign within \f$|q|\le\f$ EDINBURGHVSA_EQUILIBRIUM_RANGE. */
+#define EDINBURGHVSA_EQUILIBRIUM_NOT_FOUND      2
+/** \brief Equilibrium search: maximum number of iterations. */
+#define EDINBURGHVSA_EQUILIBRIUM_MAX_ITER       50
+/** \brief Equilibrium search: the search stops when the step is below this (rad). */
+#define EDINBURGHVSA_EQUILIBRIUM_TOLERANCE      1e-10
+/** \brief Equilibrium search: maximum step (rad) before the equilibrium is bracketed. */
+#define EDINBURGHVSA_EQUILIBRIUM_STEP           0.2
+/** \brief Equilibrium search: joint positions searched (\f$|q|\le\f$ this, in rad). */
+#define EDINBURGHVSA_EQUILIBRIUM_RANGE          (M_PI/2)
+
+/** \brief Model quantities for one state and command, see edinburghvsa_model_evaluate(). */
+typedef struct {
+	/** \brief Total joint torque (see edinburghvsa_model_get_torque()). */
+	double torque;
+	/** \brief Torque due to the actuators (see edinburghvsa_model_get_actuator_torque()). */
+	double actuator_torque;
+	/** \brief Torque due to damping (see edinburghvsa_model_get_damping_torque()). */
+	double damping_torque;
+	/** \brief Torque due to gravity (see edinburghvsa_model_get_gravity_torque()). */
+	double gravity_torque;
+	/** \brief Torque due to friction (see edinburghvsa_model_get_friction_torque()). */
+	double friction_torque;
+	/** \brief Joint acceleration (see edinburghvsa_model_get_acceleration()). */
+	double acceleration;
+	/** \brief Joint stiffness (see edinburghvsa_model_get_stiffness()). */
+	double stiffness;
+	/** \brief Jacobian of the stiffness with respect to the command (see edinburghvsa_model_get_stiffness_jacobian()). */
+	double stiffness_jacobian[DIMU];
+	/** \brief Derivative of the stiffness with respect to the joint position, \f$\partial k/\partial q\f$. */
+	double stiffness_position_derivative;
+	/** \brief Equilibrium position (see edinburghvsa_model_solve_equilibrium_position()). */
+	double equilibrium_position;
+	/** \brief Convergence status of the equilibrium search (EDINBURGHVSA_EQUILIBRIUM_CONVERGED etc.). */
+	int equilibrium_status;
+	/** \brief Jacobian of the equilibrium position with respect to the command (see edinburghvsa_model_get_equilibrium_position_jacobian()). */
+	double equilibrium_position_jacobian[DIMU];
+	/** \brief Tensions of the two springs \f$\kappa(s_i-s_0)\f$. */
+	double spring_force[2];
+} edinburghvsa_model_evaluation;
+
 void edinburghvsa_model_init                              ( edinburghvsa_model * model);
 void edinburghvsa_model_get_torque                        ( double * tau, double * x, double * u, edinburghvsa_model * model );
 void edinburghvsa_model_get_actuator_torque               ( double * tau, double * x, double * u, edinburghvsa_model * model );
@@ -70,10 +127,31 @@ void edinburghvsa_model_get_gravity_torque                ( double * tau, double
 void edinburghvsa_model_get_friction_torque               ( double * tau, double * x, double * u, edinburghvsa_model * model );
 void edinburghvsa_model_get_acceleration                  ( double * acc, double * x, double * u, edinburghvsa_model * model );
 void edinburghvsa_model_get_equilibrium_position          ( double *  q0, double * x, double * u, edinburghvsa_model * model );
+int  edinburghvsa_model_solve_equilibrium_position        ( double *  q0, double * x, double * u, edinburghvsa_model * model, edinburghvsa_equilibrium_cache * cache );
+int  edinburghvsa_model_get_equilibrium_position_batch    ( double *  q0, int * status, double * X, double * U, int n, edinburghvsa_model * model, edinburghvsa_equilibrium_cache * cache );
 void edinburghvsa_model_get_equilibrium_position_jacobian ( double *   J, double * x, double * u, edinburghvsa_model * model );
+void edinburghvsa_model_get_equilibrium_position_jacobian_fd ( double *   J, double * x, double * u, edinburghvsa_model * model );
 void edinburghvsa_model_get_stiffness                     ( double *   k, double * x, double * u, edinburghvsa_model * model );
 void edinburghvsa_model_get_stiffness_jacobian            ( double *   J, double * x, double * u, edinburghvsa_model * model );
+void edinburghvsa_model_get_stiffness_jacobian_fd         ( double *   J, double * x, double * u, edinburghvsa_model * model );
 void edinburghvsa_model_get_motor_positions               ( double *   m, double * x, edinburghvsa_model * model             );
+void edinburghvsa_model_evaluate                          ( edinburghvsa_model_evaluation * e, double * x, double * u, edinburghvsa_model * model, edinburghvsa_equilibrium_cache * cache );
 
-#endif
+/**
+ * \brief Exact linearisation of the dynamics by automatic differentiation (src/vsa_dynamics_edinburghvsa.cpp, build/edinburghvsa_dynamics.o, see vsa_dynamics.h).
+ *
+ * A (DIMX x DIMX) and B (DIMX x DIMU), row major, are the derivatives of
+ * \f$\mathbf{f}(\mathbf{x},\mathbf{u})=(\dot{q},\ddot{q})\f$ with respect to
+ * x and u. H ((DIMX+DIMU) x (DIMX+DIMU)) is the Hessian of the acceleration
+ * with respect to (x, u). The batch version takes structures of arrays (A
+ * holds DIMX*DIMX arrays of n elements, B DIMX*DIMU).
+ */
+void edinburghvsa_model_get_linearization             ( double * A, double * B, double * x, double * u, edinburghvsa_model * model );
+void edinburghvsa_model_get_linearization_batch       ( double * A, double * B, double * X, double * U, int n, edinburghvsa_model * model );
+void edinburghvsa_model_get_acceleration_hessian      ( double * H, double * x, double * u, edinburghvsa_model * model );
 
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
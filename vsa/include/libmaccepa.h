@@ -10,6 +10,10 @@
 #include <string.h>
 #include "../sketchbook/maccepa/defines.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
 /** \brief State dimensionality. */
 #define DIMX 2*DIMQ
 
@@ -56,6 +60,43 @@ typedef struct {
 	double b_filter[2*FILTER_DIMENSION];      
 } maccepa_model;
 
+/** \brief Status of maccepa_model_solve_command(): the target is reached. */
+#define MACCEPA_COMMAND_EXACT     0
+/** \brief Status of maccepa_model_solve_command(): the target is outside the range of the motors. */
+#define MACCEPA_COMMAND_CLIPPED   1
+/** \brief Inverse model: maximum number of Newton iterations. */
+#define MACCEPA_COMMAND_MAX_ITER  5
+/** \brief Inverse model: tolerance on the stiffness (Nm/rad). */
+#define MACCEPA_COMMAND_TOLERANCE 1e-9
+
+/** \brief Model quantities for one state and command, see maccepa_model_evaluate(). */
+typedef struct {
+	/** \brief Total joint torque (see maccepa_model_get_torque()). */
+	double torque;
+	/** \brief Torque due to the actuator (see maccepa_model_get_actuator_torque()). */
+	double actuator_torque;
+	/** \brief Torque due to damping (see maccepa_model_get_damping_torque()). */
+	double damping_torque;
+	/** \brief Torque due to gravity (see maccepa_model_get_gravity_torque()). */
+	double gravity_torque;
+	/** \brief Torque due to friction (see maccepa_model_get_friction_torque()). */
+	double friction_torque;
+	/** \brief Joint acceleration (see maccepa_model_get_acceleration()). */
+	double acceleration;
+	/** \brief Joint stiffness (see maccepa_model_get_stiffness()). */
+	double stiffness;
+	/** \brief Jacobian of the stiffness with respect to the command (see maccepa_model_get_stiffness_jacobian()). */
+	double stiffness_jacobian[DIMU];
+	/** \brief Equilibrium position (see maccepa_model_get_equilibrium_position()). */
+	double equilibrium_position;
+	/** \brief Jacobian of the equilibrium position with respect to the command (see maccepa_model_get_equilibrium_position_jacobian()). */
+	double equilibrium_position_jacobian[DIMU];
+	/** \brief Damping (see maccepa_model_get_damping()). */
+	double damping;
+	/** \brief Spring force (see maccepa_model_get_spring_force()). */
+	double spring_force;
+} maccepa_model_evaluation;
+
 void maccepa_model_init                              ( maccepa_model * model);
 void maccepa_model_get_torque                        ( double * tau, double * x, double * u, maccepa_model * model );
 void maccepa_model_get_actuator_torque               ( double * tau, double * x, double * u, maccepa_model * model );
@@ -67,9 +108,44 @@ void maccepa_model_get_equilibrium_position          ( double *  q0, double * x,
 void maccepa_model_get_equilibrium_position_jacobian ( double *   J, double * x, double * u, maccepa_model * model );
 void maccepa_model_get_stiffness                     ( double *   k, double * x, double * u, maccepa_model * model );
 void maccepa_model_get_stiffness_jacobian            ( double *   J, double * x, double * u, maccepa_model * model );
+void maccepa_model_get_stiffness_jacobian_fd         ( double *   J, double * x, double * u, maccepa_model * model );
 void maccepa_model_get_damping                       ( double *   b, double * x, double * u, maccepa_model * model );
 void maccepa_model_get_spring_force                  ( double *   f, double * x, double * u, maccepa_model * model );
 void maccepa_model_get_motor_positions               ( double *   m, double * x, maccepa_model * model             );
+void maccepa_model_evaluate                          ( maccepa_model_evaluation * e, double * x, double * u, maccepa_model * model );
+int  maccepa_model_solve_command                     ( double *   u, double * target, maccepa_model * model );
+int  maccepa_model_solve_command_batch               ( double *   U, int * status, double * target, int n, maccepa_model * model );
 
-#endif
+/** \brief Number of samples the batched model functions process per block (size of their temporary arrays). */
+#define MACCEPA_BATCH_BLOCK 256
 
+/**
+ * \brief Batched versions of the model functions, for evaluating many states at once (e.g., in trajectory optimisation).
+ *
+ * The inputs are structures of arrays: X holds DIMX arrays of n elements
+ * (all positions, then all velocities, i.e., component i of sample j is
+ * X[i*n+j]), U holds DIMU arrays of n elements in the same way. Output j is
+ * that of the scalar function for sample j.
+ */
+void maccepa_model_get_torque_batch                  ( double * tau, double * X, double * U, int n, maccepa_model * model );
+void maccepa_model_get_acceleration_batch            ( double * acc, double * X, double * U, int n, maccepa_model * model );
+void maccepa_model_get_stiffness_batch               ( double *   k, double * X, double * U, int n, maccepa_model * model );
+
+/**
+ * \brief Exact linearisation of the dynamics by automatic differentiation (src/vsa_dynamics_maccepa.cpp, build/maccepa_dynamics.o, see vsa_dynamics.h).
+ *
+ * A (DIMX x DIMX) and B (DIMX x DIMU), row major, are the derivatives of
+ * \f$\mathbf{f}(\mathbf{x},\mathbf{u})=(\dot{q},\ddot{q})\f$ with respect to
+ * x and u. H ((DIMX+DIMU) x (DIMX+DIMU)) is the Hessian of the acceleration
+ * with respect to (x, u). The batch version takes structures of arrays (A
+ * holds DIMX*DIMX arrays of n elements, B DIMX*DIMU).
+ */
+void maccepa_model_get_linearization             ( double * A, double * B, double * x, double * u, maccepa_model * model );
+void maccepa_model_get_linearization_batch       ( double * A, double * B, double * X, double * U, int n, maccepa_model * model );
+void maccepa_model_get_acceleration_hessian      ( double * H, double * x, double * u, maccepa_model * model );
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
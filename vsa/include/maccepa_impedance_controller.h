@@ -0,0 +1,76 @@
+/**
+ * \file maccepa_impedance_controller.h
+ * \brief Example PD/impedance controller for the MACCEPA, run in the i/o thread of the Arduino interface.
+ * \ingroup MACCEPA
+ *
+ * The stiffness motor (servo 1) is set so that the passive stiffness of the
+ * joint at the target is the requested one. The equilibrium position motor
+ * (servo 0) is then moved with every frame so that the spring produces the
+ * PD torque
+ * \f$\tau^{*} = K_p(q^*-q) - K_d\dot{q}\f$, using the stiffness of the
+ * current configuration (maccepa_model_get_stiffness()) to convert the torque
+ * to an equilibrium offset, \f$u_0 = q + \tau^{*}/k(q,\mathbf{u})\f$. With
+ * \f$K_p=k\f$ and \f$K_d=0\f$ this is the passive MACCEPA; \f$K_d>0\f$ adds
+ * damping.
+ *
+ * Usage:
+ * \code
+ * maccepa_impedance_controller C;
+ * maccepa_impedance_controller_init(&C);
+ * maccepa_impedance_controller_set_target(&C, 0.3, 2.0);
+ * C.gain_d = 0.02;
+ * vsa_arduino_interface_set_controller(&AI, maccepa_impedance_controller_step, &C);
+ * \endcode
+ */
+#ifndef __maccepa_impedance_controller_h
+#define __maccepa_impedance_controller_h
+#include <libmaccepa.h>
+
+/** \brief Controller parameters and state. */
+typedef struct {
+	/** \brief Model used for the stiffness calculations. */
+	maccepa_model model;
+	/** \brief Target joint position \f$q^*\f$ (rad). */
+	double position;
+	/** \brief Proportional gain \f$K_p\f$ (Nm/rad), by default the passive stiffness set with maccepa_impedance_controller_set_target(). */
+	double gain_p;
+	/** \brief Derivative gain \f$K_d\f$ (Nms/rad). Default 0. */
+	double gain_d;
+	/** \brief Smoothing factor (0 < a <= 1) of the low-pass filtered velocity estimate (1: raw finite differences). Default 0.3. */
+	double velocity_filter;
+	/** \brief Below this stiffness (Nm/rad) the equilibrium is simply put at the target (the torque cannot be controlled). Default 0.01. */
+	double min_stiffness;
+	/** \brief Current command (motor positions in rad, damper duty cycle). */
+	double u[DIMU];
+	/** \brief Estimated state (position, velocity). */
+	double x[DIMX];
+	/** \brief Time stamp of the previous frame (s), negative before the first frame. */
+	double time;
+} maccepa_impedance_controller;
+
+/**
+ * \brief Initialise the controller (the target is the centre position with the lowest stiffness).
+ * \param C controller.
+ */
+void maccepa_impedance_controller_init       ( maccepa_impedance_controller *C );
+/**
+ * \brief Set the target position and passive stiffness (also sets gain_p to the stiffness).
+ * \param C controller.
+ * \param[in] position target joint position (rad).
+ * \param[in] stiffness desired passive stiffness at the target (Nm/rad), clipped to what the stiffness motor can reach.
+ *
+ * \note This may be called while the controller is running; the fields are
+ * aligned doubles, so the i/o thread sees either the old or the new value of
+ * each.
+ */
+void maccepa_impedance_controller_set_target ( maccepa_impedance_controller *C, double position, double stiffness );
+/**
+ * \brief Compute the command for the next frame (an ArduinoInterfaceController, see vsa_arduino_interface_set_controller()).
+ * \param context controller (maccepa_impedance_controller *).
+ * \param[in] y sensor readings (see vsa_arduino_interface_read()).
+ * \param[out] u command.
+ * \return 1 (u is always set).
+ */
+int  maccepa_impedance_controller_step       ( void *context, const double *y, double *u );
+
+#endif
@@ -7,119 +7,62 @@
 #ifndef __vsa_arduino_interface_h
 #define __vsa_arduino_interface_h
 
-#include <math.h>
-#include <stdio.h>
-#include <string.h>
+#include <vsa_link.h>
 
-#ifdef WIN32
-#else
-#include <pthread.h>
-#endif
-
-#ifdef MACCEPA_INTERFACE
-/* MACCEPA-specific defines */
-#include "../sketchbook/maccepa/defines.h"
-/** \brief Macro for converting commands to Servo 0 in radiens (with a range of  -pi/2 < u < pi/2) to units of 0.5 microseconds. */
-#define RAD2USEC_SERVO0(u) U_MIN_SERVO0+(int)((U_MAX_SERVO0-U_MIN_SERVO0)*((-u+(M_PI/2))/M_PI)) /* Equilibrium position motor in range -pi/2 < u1 < pi/2 */
-/** \brief Macro for converting commands to Servo 1 in radiens (with a range of  0 < u < pi/2) to units of 0.5 microseconds. */
+/* robot defines and command conversions (RAD2USEC_SERVO0() etc.) */
+#include <vsa_commands.h>
 
-#define RAD2USEC_SERVO1(u) U_MIN_SERVO1+(int)((U_MAX_SERVO1-U_MIN_SERVO1)*(u-U_MIN_RAD_SERVO1)/(U_MAX_RAD_SERVO1-U_MIN_RAD_SERVO1)) 
-/** Alex: change calculation of command depending on orientation of drum winding. Will default to clockwise
- * unless DRUM_WINDING_COUNTERCLOCKWISE is defined */
-#ifdef DRUM_WINDING_COUNTERCLOCKWISE
-#define RAD2USEC_SERVO1(u) U_MIN_SERVO1+(int)((U_MAX_SERVO1-U_MIN_SERVO1)*(-u+U_MAX_RAD_SERVO1)/(U_MAX_RAD_SERVO1-U_MIN_RAD_SERVO1)) 
+/** \brief Mean age of the sensor readings of a frame when it is sent, as a fraction of the frame period
+ * (the sketches average four ADC samples, taken at the Timer 2 overflows, over the period before the frame). */
+#ifndef SENSOR_DELAY
+#define SENSOR_DELAY (3.0/8.0)
 #endif
 
-/** \brief Macro for converting commands to Servo 1 in radiens (with a range of  -pi/2 < u < pi/2) to units of 0.5 microseconds. */
-#define DUTY2PWM_DAMPER0(u) U_MIN_DAMPER0+(int)((U_MAX_DAMPER0-U_MIN_DAMPER0)*(u-U_MIN_DUTY_DAMPER0)/(U_MAX_DUTY_DAMPER0-U_MIN_DUTY_DAMPER0)) 
-/* \brief Dimension of observation vector (number of sensors). */
-/* #define DIMY 5 
- */
-/* \brief Dimension of control vector (number of servos). */
-/* #define DIMU 2
- */
-#endif
-
-#ifdef MACCEPA2DOF_INTERFACE
-/* MACCEPA2DOF-specific defines */
-#include "../sketchbook/maccepa2dof/defines.h"
-/** \brief Macro for converting commands to Servo 0 in radiens (with a range of  -pi/2 < u < pi/2) to units of 0.5 microseconds. */
-#define RAD2USEC_SERVO0(u) U_MIN_SERVO0+(int)((U_MAX_SERVO0-U_MIN_SERVO0)*((-u+(M_PI/2))/M_PI)) 
-/** \brief Macro for converting commands to Servo 1 in radiens (with a range of  0 < u < pi) to units of 0.5 microseconds. */
-#define RAD2USEC_SERVO1(u) U_MIN_SERVO1+(int)((U_MAX_SERVO1-U_MIN_SERVO1)*(u-U_MIN_RAD_SERVO1)/(U_MAX_RAD_SERVO1-U_MIN_RAD_SERVO1)) 
-/** \brief Macro for converting commands to Servo 2 in radiens (with a range of  -pi/2 < u < pi/2) to units of 0.5 microseconds. */
-#define RAD2USEC_SERVO2(u) U_MIN_SERVO2+(int)((U_MAX_SERVO2-U_MIN_SERVO2)*((u+(M_PI/2))/M_PI)) 
-/** \brief Macro for converting commands to Servo 3 in radiens (with a range of  0 < u < pi) to units of 0.5 microseconds. */
-#define RAD2USEC_SERVO3(u) U_MIN_SERVO3+(int)((U_MAX_SERVO3-U_MIN_SERVO3)*(u-U_MIN_RAD_SERVO3)/(U_MAX_RAD_SERVO3-U_MIN_RAD_SERVO3)) 
+#include <vsa_estimator.h>
+#ifdef MACCEPA_INTERFACE
+#include <libmaccepa.h>
+/** \brief Defined if the robot has an accelerometer and a process model for the state estimator. */
+#define ESTIMATOR_INTERFACE
+/** \brief Process model of the state estimator. */
+typedef maccepa_model EstimatorModel;
 #endif
-
 #ifdef EDINBURGHVSA_INTERFACE
-/* Edinburgh VSA-specific defines */
-#include "../sketchbook/edinburghvsa/defines.h"
-#define RAD2USEC_SERVO0(u) U_MIN_SERVO0+(int)((U_MAX_SERVO0-U_MIN_SERVO0)*((M_PI-u)/M_PI)) 
-#define RAD2USEC_SERVO1(u) U_MIN_SERVO1+(int)((U_MAX_SERVO1-U_MIN_SERVO1)*(u/M_PI)) 
-/* \brief Dimension of observation vector (number of sensors + 1 element for time stamps). */
-/* #define DIMY 4 
- */
-/* \brief Dimension of control vector (number of servos). */
-/* #define DIMU 2
- */
+#include <libedinburghvsa.h>
+#define ESTIMATOR_INTERFACE
+typedef edinburghvsa_model EstimatorModel;
 #endif
 
-#define ARDUINO_DISCONNECTED 0
-#define ARDUINO_CONNECTED 1
-#define THREAD_KILLED 1
-/* \brief Timeout in milliseconds when waiting for serial communication from Arduino. */
-#define TIMEOUT 100
-
-/* Define locking of shared data for windows/linux */
-#ifdef WIN32
-#define LOCK(AI)      EnterCriticalSection(&((AI)->threadLock))
-#define UNLOCK(AI)    LeaveCriticalSection(&((AI)->threadLock))
-#else
-#include <unistd.h>
-#include <time.h>
-#define LOCK(AI)      pthread_mutex_lock(&((AI)->threadLock))
-#define UNLOCK(AI)    pthread_mutex_unlock(&((AI)->threadLock))
-#endif   
-
-#include <serial.h>
+/** 
+ * \brief Controller called by the i/o thread with every frame (see vsa_arduino_interface_set_controller()).
+ * \param context pointer given to vsa_arduino_interface_set_controller().
+ * \param[in] y sensor readings (same units as read).
+ * \param[out] u new command (same units as write), to be sent in reply to this frame.
+ * \return non-zero if u was set, 0 to keep the current command.
+ */
+typedef int (*ArduinoInterfaceController) ( void *context, const double *y, double *u );
 
 /** \brief Arduino Interface for handling communications between user programs and the arduino control boards of
  * variable stiffness actuators.
 */
 typedef struct {
-	/** \brief Serial port struct. */
-	SerialPort port;
-	/* \brief Flag for determining when reading a package from the serial port is complete. */
-	int readComplete;
-	/** \brief Arduino connection state. connection_state=ARDUINO_DISCONNECTED, 
-	 * if no connection, connection_state=ARDUINO_CONNECTED if connection has 
-	 * been made (connection_state=2 kills the thread)  */
-	int connection_state;
-
-	/** \brief Buffer for sending motor commands. The first element of this is
-	 * the 'header' char RECEIVE_HEADER, the remaining elements contain motor
-	 * commands. 
-	 */
-	unsigned char command_buffer[RECEIVE_LENGTH+1];	
-	/** \brief Array containing measured state (i.e., readings from the Arduino ADCs). */
-	int measured_state[DIMY];
-	/** \brief Timestamp at which measured state is read (i.e., when ADC readings are received from Arduino). */
-	double timestamp;
-
-#ifdef WIN32
-	CRITICAL_SECTION threadLock;
-	HANDLE thread;
-#else
-	/** \brief Mutex (for locking shared data structures.) */
-	pthread_mutex_t threadLock;
-	/** \brief I/O thread */
-	pthread_t thread;
+	/** \brief Serial link (port, i/o thread and the latest raw frame). */
+	VsaLink link;
+	/** \brief Controller run in the i/o thread, NULL if none (see vsa_arduino_interface_set_controller()). */
+	ArduinoInterfaceController controller;
+	/** \brief Context passed to controller. */
+	void *controller_context;
+	/** \brief Non-zero while the state estimator is running (see vsa_arduino_interface_start_estimator()). */
+	int estimating;
+	/** \brief Latest estimate (position, velocity, acceleration, time stamp), protected by the link's threadLock. */
+	double estimate[VSA_ESTIMATOR_DIMX+1];
+	/** \brief Predicted state when the next command takes effect (position, velocity, acceleration, time), protected by the link's threadLock. */
+	double prediction[VSA_ESTIMATOR_DIMX+1];
+#ifdef ESTIMATOR_INTERFACE
+	/** \brief State estimator, updated by the i/o thread. */
+	VsaEstimator estimator;
+	/** \brief Process model of the estimator. */
+	EstimatorModel model;
 #endif
-	/** \brief I/O thread state. Thread runs while thread_state!=THREAD_KILLED. */
-	int thread_state;
-
 } ArduinoInterface;
 
 
@@ -129,6 +72,18 @@ typedef struct {
  * \param AI arduino interface.
  */
 int  vsa_arduino_interface_init       ( ArduinoInterface *AI, char *device );
+/** 
+ * \brief Fill options struct with default settings (e.g., baudrate=BAUDRATE).
+ * \param[out] options interface options.
+ */
+void vsa_arduino_interface_default_options ( ArduinoInterfaceOptions *options );
+/** 
+ * \brief Initialise serial connection with Arduino board using the given options, start i/o thread in the background. 
+ * \param AI arduino interface.
+ * \param[in] device Name of serial port to which Arduino is connected.
+ * \param[in] options interface options (if NULL, defaults are used).
+ */
+int  vsa_arduino_interface_init_options ( ArduinoInterface *AI, char *device, ArduinoInterfaceOptions *options );
 /** 
  * \brief Close serial connection with Arduino board, shutdown background i/o thread. 
  * \param AI arduino interface.
@@ -148,8 +103,8 @@ int vsa_arduino_interface_check       ( ArduinoInterface *AI );
  * Commands are clipped to within U_LLIM_RAD_SERVOx < u[x] < U_ULIM_RAD_SERVOx,
  * and converted to units of .5 usec, before being sent to the Arduino.
  *
- * \note This function will NOT block, and there is no guarantee about when the
- * new positions will be sent to the servos.
+ * \note This function will NOT block. The new positions are sent by the i/o
+ * thread in reply to the next frame received from the Arduino.
  *
  */
 void vsa_arduino_interface_write      ( ArduinoInterface *AI, double * u );
@@ -162,33 +117,169 @@ void vsa_arduino_interface_write      ( ArduinoInterface *AI, double * u );
  * Commands are sent directly to the Arduino. This command mode is meant only
  * for configuring the servos. NO SAFETY LIMITS ARE APPLIED!
  *
- * \note This function will NOT block, and there is no guarantee about when the
- * new positions will be sent to the servos.
+ * \note This function will NOT block. The new positions are sent by the i/o
+ * thread in reply to the next frame received from the Arduino.
  */
 void vsa_arduino_interface_write_usec ( ArduinoInterface *AI, int * u );
+/** 
+ * \brief Run a controller in the i/o thread, computing the command in reply to every frame. 
+ * \param AI arduino interface.
+ * \param controller controller (NULL to stop the controller, the last command is then held).
+ * \param context pointer passed to controller.
+ *
+ * The controller is called right after each frame has been decoded, with
+ * the sensor readings, and its command is clipped, converted and sent in
+ * reply to that same frame. The sensor-to-command latency is then well
+ * under a millisecond, instead of one or two frames for a loop through
+ * read()/run_step(). The controller runs in the i/o thread, so it must be
+ * quick and must not block (or call other functions of this interface,
+ * except vsa_arduino_interface_read_estimate() and
+ * vsa_arduino_interface_read_prediction(): if the estimator is running, they
+ * have already been updated with the frame).
+ * Commands from write() are overridden while a controller is running.
+ *
+ * When this returns, the previous controller is no longer running.
+ */
+void vsa_arduino_interface_set_controller ( ArduinoInterface *AI, ArduinoInterfaceController controller, void *context );
+/** 
+ * \brief Run the state estimator (see vsa_estimator.h) in the i/o thread, updating it with every frame. 
+ * \param AI arduino interface.
+ * \param[in] noise noise parameters, NULL for the defaults (see vsa_estimator_default_noise()).
+ *
+ * The estimator fuses the joint angle and accelerometer readings with the
+ * robot's dynamics model (at the measured motor positions), giving
+ * position, velocity and acceleration estimates that are smoother than the
+ * raw readings and than finite differences, without assuming a fixed frame
+ * period. If the estimator is already running, it is restarted.
+ *
+ * \note Only robots with an accelerometer and a dynamics model (the MACCEPA
+ * and the Edinburgh VSA) have an estimator.
+ */
+void vsa_arduino_interface_start_estimator ( ArduinoInterface *AI, const VsaEstimatorNoise *noise );
+/** 
+ * \brief Stop the state estimator. 
+ * \param AI arduino interface.
+ */
+void vsa_arduino_interface_stop_estimator ( ArduinoInterface *AI );
+/** 
+ * \brief Get the latest state estimate, without waiting. 
+ * \param AI arduino interface.
+ * \param[out] x estimated joint position (rad), velocity (rad/s), acceleration (rad/s^2) and the time stamp of the frame it is based on.
+ * \return 1 if the estimator is running, 0 otherwise (x is then not set).
+ *
+ * The estimate is updated before read() and run_step() return, so after
+ * these it belongs to the same frame as the sensor readings (same time stamp).
+ */
+int  vsa_arduino_interface_read_estimate ( ArduinoInterface *AI, double *x );
+/** 
+ * \brief Get the state predicted for the time at which a command sent now takes effect, without waiting. 
+ * \param AI arduino interface.
+ * \param[out] x predicted joint position (rad), velocity (rad/s), acceleration (rad/s^2) and the time (same clock as the time stamps of read()).
+ * \return 1 if the estimator is running and the frame period has been measured, 0 otherwise (x is then not set).
+ *
+ * The sketches send the readings averaged over the last frame period, and
+ * apply the command received in reply only at the next frame, so there is a
+ * transport delay of about SENSOR_DELAY+1 frame periods between measurement
+ * and action. With every frame, the state estimate is integrated with the
+ * dynamics model over this delay (with the measured frame period): over the
+ * sensor delay at the measured motor positions, then over one period with
+ * the command that the robot is about to apply (the one sent in reply to the
+ * previous frame). Controllers (in the i/o thread or looping over
+ * run_step()) may act on this instead of the latest readings, which allows
+ * higher gains before the delay causes oscillation.
+ */
+int  vsa_arduino_interface_read_prediction ( ArduinoInterface *AI, double *x );
 /** 
  * \brief Read sensors. Values returned will be converted into appropriate units (e.g., angles in radiens, power in W, etc.). 
  * \param AI arduino interface.
  * \param[out] y double array, containing sensor readings.
+ * \return 1 if a new frame was read, 0 on timeout (y then holds the last frame received).
  *
- * \note Calling this function will block until the next frame of data has arrived from the Arduino.
+ * \note Calling this function will block until the next frame of data has
+ * arrived from the Arduino, or for at most TIMEOUT milliseconds.
  */
-void vsa_arduino_interface_read       ( ArduinoInterface *AI, double *y );
+int vsa_arduino_interface_read       ( ArduinoInterface *AI, double *y );
 /** 
  * \brief Read sensors. Values returned will be as steps of the ADCs. 
  * \param AI arduino interface.
  * \param[out] y double array, containing sensor readings.
+ * \return 1 if a new frame was read, 0 on timeout (y then holds the last frame received).
  *
- * \note Calling this function will block until the next frame of data has arrived from the Arduino.
+ * \note Calling this function will block until the next frame of data has
+ * arrived from the Arduino, or for at most TIMEOUT milliseconds.
  */
-void vsa_arduino_interface_read_adc ( ArduinoInterface *AI, int *y );
+int vsa_arduino_interface_read_adc ( ArduinoInterface *AI, int *y );
 /** 
  * \brief Read sensors from the arm, and command new motor positions. 
  * \param AI arduino interface.
  * \param[in] u desired motor positions (rad).
  * \param[out] y sensor readings (same units as read).
+ * \return 1 if a new frame was read, 0 on timeout (y then holds the last
+ * frame received; the command is still sent with the next frame).
+ *
+ */
+int vsa_arduino_interface_run_step ( ArduinoInterface *AI, double *u, double *y );
+/** 
+ * \brief Execute a command trajectory, one step per frame, and record the sensor readings. 
+ * \param AI arduino interface.
+ * \param[in,out] u DIMU x length array of commands (same units as write), step k
+ * at u[k*DIMU] (i.e., column-major as in Matlab). Commands are clipped in place.
+ * \param[out] y (DIMY+1) x length array of sensor readings (same units as read), step k at y[k*(DIMY+1)].
+ * \param[in] length number of steps.
+ * \return number of steps executed (0 if length < 1, less than length if the robot stopped
+ * sending frames for TIMEOUT milliseconds).
+ *
+ * The trajectory is executed by the i/o thread: command k is sent in reply
+ * to sensor frame k (which is recorded in y), so the timing is exact to the
+ * frame regardless of the scheduling of the caller. This function blocks
+ * until the trajectory is complete; afterwards the last command is held.
+ */
+int vsa_arduino_interface_run_trajectory ( ArduinoInterface *AI, double *u, double *y, int length );
+/** 
+ * \brief Get the most recent sensor readings without waiting for a new frame. 
+ * \param AI arduino interface.
+ * \param[out] y sensor readings (same units as read).
+ * \param[out] timestamp arrival time of the readings in nanoseconds since the interface was opened (may be NULL).
+ * \return number of frames received so far (readings are only valid if this is non-zero).
  *
+ * \note This never blocks (neither the caller nor the i/o thread), so it can
+ * be called at any rate, e.g., from a monitoring thread.
+ */
+unsigned int vsa_arduino_interface_snapshot ( ArduinoInterface *AI, double *y, long long *timestamp );
+/** 
+ * \brief Take all sensor readings received since the last call (oldest first), without waiting. 
+ * \param AI arduino interface.
+ * \param[out] y (DIMY+1) x max_frames array of sensor readings (same units as read), frame k at y[k*(DIMY+1)].
+ * \param[out] sequence frame numbers (max_frames elements, may be NULL). These count from 0 for the first
+ * frame received; gaps indicate frames lost on the serial line.
+ * \param[in] max_frames maximum number of frames to return (the rest are left for the next call).
+ * \return number of frames returned.
+ *
+ * Every frame received is kept in a history of HISTORY_LENGTH frames,
+ * independently of read() and run_step(), so a logging or estimation thread
+ * can call this at its own rate without losing frames. Frames not drained
+ * within HISTORY_LENGTH frames are overwritten (counted in
+ * statistics.history_overruns). The history should be drained by one thread only.
+ */
+int vsa_arduino_interface_drain ( ArduinoInterface *AI, double *y, unsigned long *sequence, int max_frames );
+
+/** 
+ * \brief Get communication statistics (frames received, dropped, resyncs, CRC errors, write errors, history overruns). 
+ * \param AI arduino interface.
+ * \param[out] statistics copy of the current statistics.
+ */
+void vsa_arduino_interface_get_statistics ( ArduinoInterface *AI, ArduinoInterfaceStatistics *statistics );
+/** 
+ * \brief Get frame timing statistics (inter-frame intervals, jitter and interval histogram). 
+ * \param AI arduino interface.
+ * \param[out] timing copy of the current timing statistics.
+ */
+void vsa_arduino_interface_get_timing ( ArduinoInterface *AI, ArduinoInterfaceTiming *timing );
+/** 
+ * \brief Get the scheduling settings in effect for the i/o thread (e.g., to verify that options.thread_priority, thread_cpu, lock_memory and prefault_stack were applied). 
+ * \param AI arduino interface.
+ * \param[out] settings current settings.
  */
-void vsa_arduino_interface_run_step ( ArduinoInterface *AI, double *u, double *y );
+void vsa_arduino_interface_get_thread_settings ( ArduinoInterface *AI, ArduinoInterfaceThreadSettings *settings );
 
 #endif
@@ -0,0 +1,71 @@
+/** 
+ * \file vsa_commands.h
+ *
+ * \brief Robot defines and the conversions of commands between radiens and
+ * servo pulse widths (RAD2USEC_SERVO0() etc.), for the robot selected with
+ * -DMACCEPA_INTERFACE, -DEDINBURGHVSA_INTERFACE or -DMACCEPA2DOF_INTERFACE.
+ *
+ * These are included by vsa_arduino_interface.h, and on their own by code
+ * that needs the conversions of a robot without its ArduinoInterface (e.g.,
+ * the robot traits of libvsa, src/vsa_robot_<robot>.cpp, several of which
+ * are linked into one library).
+ */
+#ifndef __vsa_commands_h
+#define __vsa_commands_h
+
+#include <math.h>
+
+#ifdef MACCEPA_INTERFACE
+/* MACCEPA-specific defines */
+#include "../sketchbook/maccepa/defines.h"
+/** \brief Macro for converting commands to Servo 0 in radiens (with a range of  -pi/2 < u < pi/2) to units of 0.5 microseconds. */
+#define RAD2USEC_SERVO0(u) U_MIN_SERVO0+(int)((U_MAX_SERVO0-U_MIN_SERVO0)*((-u+(M_PI/2))/M_PI)) /* Equilibrium position motor in range -pi/2 < u1 < pi/2 */
+/** \brief Macro for converting commands to Servo 1 in radiens (with a range of  0 < u < pi/2) to units of 0.5 microseconds. */
+
+#define RAD2USEC_SERVO1(u) U_MIN_SERVO1+(int)((U_MAX_SERVO1-U_MIN_SERVO1)*(u-U_MIN_RAD_SERVO1)/(U_MAX_RAD_SERVO1-U_MIN_RAD_SERVO1)) 
+/** Alex: change calculation of command depending on orientation of drum winding. Will default to clockwise
+ * unless DRUM_WINDING_COUNTERCLOCKWISE is defined */
+#ifdef DRUM_WINDING_COUNTERCLOCKWISE
+#define RAD2USEC_SERVO1(u) U_MIN_SERVO1+(int)((U_MAX_SERVO1-U_MIN_SERVO1)*(-u+U_MAX_RAD_SERVO1)/(U_MAX_RAD_SERVO1-U_MIN_RAD_SERVO1)) 
+#endif
+
+/** \brief Macro for converting commands to Servo 1 in radiens (with a range of  -pi/2 < u < pi/2) to units of 0.5 microseconds. */
+#define DUTY2PWM_DAMPER0(u) U_MIN_DAMPER0+(int)((U_MAX_DAMPER0-U_MIN_DAMPER0)*(u-U_MIN_DUTY_DAMPER0)/(U_MAX_DUTY_DAMPER0-U_MIN_DUTY_DAMPER0)) 
+/* \brief Dimension of observation vector (number of sensors). */
+/* #define DIMY 5 
+ */
+/* \brief Dimension of control vector (number of servos). */
+/* #define DIMU 2
+ */
+#endif
+
+#ifdef MACCEPA2DOF_INTERFACE
+/* MACCEPA2DOF-specific defines */
+#include "../sketchbook/maccepa2dof/defines.h"
+/** \brief Macro for converting commands to Servo 0 in radiens (with a range of  -pi/2 < u < pi/2) to units of 0.5 microseconds. */
+#define RAD2USEC_SERVO0(u) U_MIN_SERVO0+(int)((U_MAX_SERVO0-U_MIN_SERVO0)*((-u+(M_PI/2))/M_PI)) 
+/** \brief Macro for converting commands to Servo 1 in radiens (with a range of  0 < u < pi) to units of 0.5 microseconds. */
+#define RAD2USEC_SERVO1(u) U_MIN_SERVO1+(int)((U_MAX_SERVO1-U_MIN_SERVO1)*(u-U_MIN_RAD_SERVO1)/(U_MAX_RAD_SERVO1-U_MIN_RAD_SERVO1)) 
+/** \brief Macro for converting commands to Servo 2 in radiens (with a range of  -pi/2 < u < pi/2) to units of 0.5 microseconds. */
+#define RAD2USEC_SERVO2(u) U_MIN_SERVO2+(int)((U_MAX_SERVO2-U_MIN_SERVO2)*((u+(M_PI/2))/M_PI)) 
+/** \brief Macro for converting commands to Servo 3 in radiens (with a range of  0 < u < pi) to units of 0.5 microseconds. */
+#define RAD2USEC_SERVO3(u) U_MIN_SERVO3+(int)((U_MAX_SERVO3-U_MIN_SERVO3)*(u-U_MIN_RAD_SERVO3)/(U_MAX_RAD_SERVO3-U_MIN_RAD_SERVO3)) 
+#endif
+
+#ifdef EDINBURGHVSA_INTERFACE
+/* Edinburgh VSA-specific defines */
+#include "../sketchbook/edinburghvsa/defines.h"
+#define RAD2USEC_SERVO0(u) U_MIN_SERVO0+(int)((U_MAX_SERVO0-U_MIN_SERVO0)*((M_PI-u)/M_PI)) 
+#define RAD2USEC_SERVO1(u) U_MIN_SERVO1+(int)((U_MAX_SERVO1-U_MIN_SERVO1)*(u/M_PI)) 
+/* \brief Dimension of observation vector (number of sensors + 1 element for time stamps). */
+/* #define DIMY 4 
+ */
+/* \brief Dimension of control vector (number of servos). */
+/* #define DIMU 2
+ */
+#endif
+
+/** \brief Convert a command (units of 0.5 usec) back to radiens, by inverting the (linear) RAD2USEC_SERVOx macro TO_USEC over its range [UA, UB]. */
+#define USEC2RAD(M,TO_USEC,UA,UB) ((UA) + ((M) - (double)(TO_USEC(UA)))*((UB)-(UA))/((double)(TO_USEC(UB)) - (double)(TO_USEC(UA))))
+
+#endif
@@ -0,0 +1,201 @@
+/**
+ * \file vsa_dynamics.h
+ *
+ * \brief Exact derivatives of the robot dynamics by forward-mode automatic
+ * differentiation (e.g., for the linearisations of iLQR/DDP).
+ *
+ * The joint acceleration of each robot is written as a template over the
+ * scalar type. Evaluated with VsaDual<double,N>, whose N derivative
+ * components are seeded with the state and command, one evaluation gives the
+ * acceleration and all of its first derivatives exactly (no finite difference
+ * steps), at a few times the cost of one evaluation. Nesting the duals,
+ * VsaDual<VsaDual<double,N>,N>, gives the second derivatives as well.
+ *
+ * VsaDynamics<Robot> builds the linearisation of
+ * \f$\dot{\mathbf{x}}=\mathbf{f}(\mathbf{x},\mathbf{u})=(\dot{q},\ddot{q}(\mathbf{x},\mathbf{u}))\f$
+ * from a traits class
+ * \code
+ * struct Robot {
+ *   typedef ... model;                       // model parameters (e.g., maccepa_model)
+ *   static const int dim_u = ...;            // number of commands
+ *   template <typename S> static S acceleration ( const S *x, const S *u, const model *m );
+ * };
+ * \endcode
+ * The traits of the robots are defined in src/vsa_dynamics_<robot>.cpp (each
+ * of which includes only its own defines.h), which also provide the C entry
+ * points declared in the robots' model headers (e.g.,
+ * maccepa_model_get_linearization() in libmaccepa.h).
+ *
+ * The templated accelerations duplicate the C model code (e.g.,
+ * maccepa_model_get_acceleration()) rather than replace it. test/test_dynamics.c
+ * checks the linearisations against central differences of the C functions.
+ */
+#ifndef __vsa_dynamics_h
+#define __vsa_dynamics_h
+
+#include <math.h>
+
+/** \brief Dual number: value v and the derivatives d with respect to N variables (T is double, or a VsaDual for higher derivatives). */
+template <typename T, int N> struct VsaDual {
+	T v;
+	T d[N];
+
+	VsaDual () {}
+	/** \brief Constant. */
+	VsaDual ( double c ) : v(c) { for ( int i = 0; i < N; i += 1 ) d[i] = 0; }
+	/** \brief Variable number i with value c. */
+	static VsaDual variable ( const T &c, int i ) {
+		VsaDual r;
+		r.v = c;
+		for ( int j = 0; j < N; j += 1 ) r.d[j] = 0;
+		r.d[i] = 1;
+		return r;
+	}
+};
+
+/** \brief Value of a (possibly nested) dual number, without derivatives. */
+inline double vsa_value ( double a ) { return a; }
+template <typename T, int N> inline double vsa_value ( const VsaDual<T,N> &a ) { return vsa_value(a.v); }
+
+template <typename T, int N> inline VsaDual<T,N> operator- ( const VsaDual<T,N> &a ) {
+	VsaDual<T,N> r;
+	r.v = -a.v;
+	for ( int i = 0; i < N; i += 1 ) r.d[i] = -a.d[i];
+	return r;
+}
+template <typename T, int N> inline VsaDual<T,N> operator+ ( const VsaDual<T,N> &a, const VsaDual<T,N> &b ) {
+	VsaDual<T,N> r;
+	r.v = a.v + b.v;
+	for ( int i = 0; i < N; i += 1 ) r.d[i] = a.d[i] + b.d[i];
+	return r;
+}
+template <typename T, int N> inline VsaDual<T,N> operator- ( const VsaDual<T,N> &a, const VsaDual<T,N> &b ) {
+	VsaDual<T,N> r;
+	r.v = a.v - b.v;
+	for ( int i = 0; i < N; i += 1 ) r.d[i] = a.d[i] - b.d[i];
+	return r;
+}
+template <typename T, int N> inline VsaDual<T,N> operator* ( const VsaDual<T,N> &a, const VsaDual<T,N> &b ) {
+	VsaDual<T,N> r;
+	r.v = a.v*b.v;
+	for ( int i = 0; i < N; i += 1 ) r.d[i] = a.v*b.d[i] + a.d[i]*b.v;
+	return r;
+}
+template <typename T, int N> inline VsaDual<T,N> operator/ ( const VsaDual<T,N> &a, const VsaDual<T,N> &b ) {
+	VsaDual<T,N> r;
+	T inv = 1/b.v;
+	r.v = a.v*inv;
+	for ( int i = 0; i < N; i += 1 ) r.d[i] = (a.d[i] - r.v*b.d[i])*inv;
+	return r;
+}
+template <typename T, int N> inline VsaDual<T,N> operator+ ( const VsaDual<T,N> &a, double b ) { VsaDual<T,N> r = a; r.v = r.v + b; return r; }
+template <typename T, int N> inline VsaDual<T,N> operator+ ( double a, const VsaDual<T,N> &b ) { return b + a; }
+template <typename T, int N> inline VsaDual<T,N> operator- ( const VsaDual<T,N> &a, double b ) { VsaDual<T,N> r = a; r.v = r.v - b; return r; }
+template <typename T, int N> inline VsaDual<T,N> operator- ( double a, const VsaDual<T,N> &b ) { return -b + a; }
+template <typename T, int N> inline VsaDual<T,N> operator* ( const VsaDual<T,N> &a, double b ) {
+	VsaDual<T,N> r;
+	r.v = a.v*b;
+	for ( int i = 0; i < N; i += 1 ) r.d[i] = a.d[i]*b;
+	return r;
+}
+template <typename T, int N> inline VsaDual<T,N> operator* ( double a, const VsaDual<T,N> &b ) { return b*a; }
+template <typename T, int N> inline VsaDual<T,N> operator/ ( const VsaDual<T,N> &a, double b ) { return a*(1/b); }
+template <typename T, int N> inline VsaDual<T,N> operator/ ( double a, const VsaDual<T,N> &b ) { return VsaDual<T,N>(a)/b; }
+
+template <typename T, int N> inline VsaDual<T,N> sin ( const VsaDual<T,N> &a ) {
+	VsaDual<T,N> r;
+	T c = cos(a.v);
+	r.v = sin(a.v);
+	for ( int i = 0; i < N; i += 1 ) r.d[i] = c*a.d[i];
+	return r;
+}
+template <typename T, int N> inline VsaDual<T,N> cos ( const VsaDual<T,N> &a ) {
+	VsaDual<T,N> r;
+	T s = -sin(a.v);
+	r.v = cos(a.v);
+	for ( int i = 0; i < N; i += 1 ) r.d[i] = s*a.d[i];
+	return r;
+}
+template <typename T, int N> inline VsaDual<T,N> sqrt ( const VsaDual<T,N> &a ) {
+	VsaDual<T,N> r;
+	r.v = sqrt(a.v);
+	T g = 0.5/r.v;
+	for ( int i = 0; i < N; i += 1 ) r.d[i] = g*a.d[i];
+	return r;
+}
+
+/** \brief Linearisation of the dynamics of the robot described by the traits class Robot. */
+template <class Robot> struct VsaDynamics {
+	/** \brief State dimension (position, velocity). */
+	static const int dim_x = 2;
+	/** \brief Number of commands. */
+	static const int dim_u = Robot::dim_u;
+	/** \brief Number of variables the acceleration is differentiated with respect to (state, then commands). */
+	static const int dim_z = dim_x + dim_u;
+
+	/**
+	 * \brief Linearisation \f$\mathbf{A}=\partial\mathbf{f}/\partial\mathbf{x}\f$, \f$\mathbf{B}=\partial\mathbf{f}/\partial\mathbf{u}\f$ of the continuous-time dynamics.
+	 * \param[out] A dim_x x dim_x, row major.
+	 * \param[out] B dim_x x dim_u, row major.
+	 * \param[out] acc joint acceleration, or NULL.
+	 * \param[in] x state, u command, model model parameters.
+	 */
+	static void linearization ( double *A, double *B, double *acc, const double *x, const double *u, const typename Robot::model *model ) {
+		typedef VsaDual<double,dim_z> D;
+		D xd[dim_x], ud[dim_u], a;
+		int i;
+
+		for ( i = 0; i < dim_x; i += 1 ) xd[i] = D::variable(x[i], i);
+		for ( i = 0; i < dim_u; i += 1 ) ud[i] = D::variable(u[i], dim_x+i);
+		a = Robot::acceleration(xd, ud, model);
+
+		A[0] = 0; A[1] = 1;
+		A[2] = a.d[0]; A[3] = a.d[1];
+		for ( i = 0; i < dim_u; i += 1 ) {
+			B[i]       = 0;
+			B[dim_u+i] = a.d[dim_x+i];
+		}
+		if (acc != NULL) acc[0] = a.v;
+	}
+
+	/**
+	 * \brief Linearisations along a trajectory (structures of arrays, like the other batch functions of the models).
+	 * \param[out] A dim_x*dim_x arrays of n elements, A[(i*dim_x+j)*n+k] is element (i,j) at point k.
+	 * \param[out] B dim_x*dim_u arrays of n elements, B[(i*dim_u+j)*n+k] is element (i,j) at point k.
+	 * \param[in] X dim_x arrays of n elements (X[i*n+k]), U dim_u arrays of n elements, n number of points, model model parameters.
+	 */
+	static void linearization_batch ( double *A, double *B, const double *X, const double *U, int n, const typename Robot::model *model ) {
+		double x[dim_x], u[dim_u], a[dim_x*dim_x], b[dim_x*dim_u];
+		int i, k;
+
+		for ( k = 0; k < n; k += 1 ) {
+			for ( i = 0; i < dim_x; i += 1 ) x[i] = X[i*n+k];
+			for ( i = 0; i < dim_u; i += 1 ) u[i] = U[i*n+k];
+			linearization(a, b, NULL, x, u, model);
+			for ( i = 0; i < dim_x*dim_x; i += 1 ) A[i*n+k] = a[i];
+			for ( i = 0; i < dim_x*dim_u; i += 1 ) B[i*n+k] = b[i];
+		}
+	}
+
+	/**
+	 * \brief Hessian of the joint acceleration with respect to (x, u).
+	 * \param[out] H dim_z x dim_z, row major.
+	 * \param[in] x state, u command, model model parameters.
+	 */
+	static void acceleration_hessian ( double *H, const double *x, const double *u, const typename Robot::model *model ) {
+		typedef VsaDual<double,dim_z> D1;
+		typedef VsaDual<D1,dim_z> D2;
+		D2 xd[dim_x], ud[dim_u], a;
+		int i, j;
+
+		for ( i = 0; i < dim_x; i += 1 ) xd[i] = D2::variable(D1::variable(x[i], i), i);
+		for ( i = 0; i < dim_u; i += 1 ) ud[i] = D2::variable(D1::variable(u[i], dim_x+i), dim_x+i);
+		a = Robot::acceleration(xd, ud, model);
+
+		for ( i = 0; i < dim_z; i += 1 ) {
+			for ( j = 0; j < dim_z; j += 1 ) H[i*dim_z+j] = a.d[i].d[j];
+		}
+	}
+};
+
+#endif
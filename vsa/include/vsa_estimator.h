@@ -0,0 +1,114 @@
+/**
+ * \file vsa_estimator.h
+ *
+ * \brief State estimator for 1-DoF variable stiffness actuators, fusing the
+ * joint potentiometer and the accelerometer with an extended Kalman filter.
+ *
+ * The state is \f$\mathbf{x}=(q,\dot{q},\ddot{q})\f$. Between frames, q and
+ * \f$\dot{q}\f$ are propagated with constant acceleration, and the
+ * acceleration is predicted with the process model of the robot (e.g.,
+ * maccepa_model_get_acceleration()) at the propagated position and velocity
+ * and the measured motor positions, linearised by finite differences. Without
+ * a model, the acceleration is assumed constant. Each frame then corrects the
+ * state with the measured joint angle and acceleration.
+ *
+ * All matrices have fixed size, so an update costs a few hundred flops and
+ * no memory allocation (it is run by the i/o thread with every frame, see
+ * vsa_arduino_interface_start_estimator()). The estimator does not depend on
+ * the robot type and is not thread safe by itself.
+ */
+#ifndef __vsa_estimator_h
+#define __vsa_estimator_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** \brief Dimension of the estimated state (position, velocity, acceleration). */
+#define VSA_ESTIMATOR_DIMX 3
+
+/** \brief Frames further apart than this (in seconds) restart the estimator. */
+#define VSA_ESTIMATOR_MAX_GAP 0.25
+
+/** \brief Largest step (in seconds) for integrating the process model (see vsa_estimator_integrate()). */
+#define VSA_ESTIMATOR_STEP 0.001
+
+/**
+ * \brief Process model: joint acceleration as a function of state and command.
+ * \param model model parameters (e.g., a maccepa_model).
+ * \param[in] x state (position, velocity).
+ * \param[in] u motor positions (and damping command).
+ * \param[out] acc joint acceleration.
+ */
+typedef void (*VsaEstimatorModel) ( void *model, double *x, double *u, double *acc );
+
+/** \brief Noise parameters of the estimator (standard deviations, see vsa_estimator_default_noise()). */
+typedef struct {
+	/** \brief Noise of the joint potentiometer (rad). Default 0.002. */
+	double position;
+	/** \brief Noise of the accelerometer (rad/s^2). Default 1. */
+	double acceleration;
+	/** \brief Spectral density of the white jerk driving the state (rad/s^3/sqrt(Hz)). Default 20. */
+	double jerk;
+	/** \brief Error of the acceleration predicted by the process model (rad/s^2). Default 5. */
+	double model;
+} VsaEstimatorNoise;
+
+/** \brief Estimator state. */
+typedef struct {
+	/** \brief Noise parameters. */
+	VsaEstimatorNoise noise;
+	/** \brief Process model, NULL for a constant acceleration model. */
+	VsaEstimatorModel model;
+	/** \brief Parameters passed to model. */
+	void *model_data;
+	/** \brief Estimated position (rad), velocity (rad/s) and acceleration (rad/s^2). */
+	double x[VSA_ESTIMATOR_DIMX];
+	/** \brief Covariance of the estimate. */
+	double P[VSA_ESTIMATOR_DIMX][VSA_ESTIMATOR_DIMX];
+	/** \brief Time (s) of the last update, negative before the first. */
+	double time;
+	/** \brief Mean interval (s) between updates, smoothed with gain 1/16 (0 until it has been measured). */
+	double period;
+} VsaEstimator;
+
+/**
+ * \brief Set the default noise parameters.
+ * \param[out] noise noise parameters.
+ */
+void vsa_estimator_default_noise ( VsaEstimatorNoise *noise );
+/**
+ * \brief Initialise the estimator (the first update then sets the state from the measurements).
+ * \param E estimator.
+ * \param[in] noise noise parameters, NULL for the defaults.
+ * \param[in] model process model, NULL for a constant acceleration model.
+ * \param model_data parameters passed to model.
+ */
+void vsa_estimator_init ( VsaEstimator *E, const VsaEstimatorNoise *noise, VsaEstimatorModel model, void *model_data );
+/**
+ * \brief Update the estimate with the measurements of a frame.
+ * \param E estimator.
+ * \param[in] time time stamp of the frame (s).
+ * \param[in] position measured joint angle (rad).
+ * \param[in] acceleration measured joint acceleration (rad/s^2).
+ * \param[in] u motor positions (and damping command) for the process model.
+ */
+void vsa_estimator_update ( VsaEstimator *E, double time, double position, double acceleration, double *u );
+/**
+ * \brief Integrate the process model forward in time, e.g., to predict the state at the time a command takes effect.
+ * \param[in] E estimator (for its process model).
+ * \param[in,out] x position, velocity and acceleration (e.g., a copy of E->x), advanced by duration.
+ * \param[in] duration time to integrate over (s).
+ * \param[in] u motor positions (and damping command) during that time.
+ *
+ * The model is integrated with semi-implicit Euler steps of at most
+ * VSA_ESTIMATOR_STEP. Without a process model, the acceleration is held
+ * constant.
+ */
+void vsa_estimator_integrate ( const VsaEstimator *E, double *x, double duration, double *u );
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
@@ -0,0 +1,309 @@
+/**
+ * \file vsa_interface.h
+ *
+ * \brief C++ front end for the variable stiffness actuators, specialised at
+ * compile time for each robot type.
+ *
+ * VsaInterface<Robot> drives one robot over a VsaLink (see vsa_link.h). All
+ * robot-specific code (payload parsing, sensor calibration, command limits
+ * and conversion) is taken from the traits class Robot and unrolled at
+ * compile time, so several robots of different types can be driven from one
+ * process (and one shared library) without any runtime dispatch.
+ *
+ * A traits class provides
+ * \code
+ * struct Robot {
+ *   static const int dim_y = ...;            // number of sensors
+ *   static const int dim_u = ...;            // number of commands
+ *   static const int baudrate = ...;         // default baudrate
+ *   static constexpr double sensor_gain[dim_y] = { ... };   // y = gain*adc + offset
+ *   static constexpr double sensor_offset[dim_y] = { ... };
+ *   static constexpr double u_llim[dim_u] = { ... };        // command limits
+ *   static constexpr double u_ulim[dim_u] = { ... };
+ *   static constexpr int u_init[dim_u] = { ... };           // initial command (device units)
+ *   static int command ( int i, double u );  // command i in device units (e.g., .5 usec)
+ * };
+ * \endcode
+ * The traits of the robots in sketchbook/ are defined in
+ * src/vsa_robot_<robot>.cpp (each of which includes only its own
+ * defines.h and command conversions, through vsa_commands.h, and not
+ * vsa_arduino_interface.h, whose ArduinoInterface struct differs between the
+ * robots), which also provide the C entry points declared in vsa_robots.h.
+ */
+#ifndef __vsa_interface_h
+#define __vsa_interface_h
+
+#include <vsa_link.h>
+#include <type_traits>
+#include <vector>
+
+/** \brief Compile-time loop: calls f(std::integral_constant<int,i>()) for i = 0..N-1, i.e., the body is expanded N times with a constant index. */
+template <int N> struct VsaUnroll {
+	template <class F> static inline void run ( F f ) {
+		VsaUnroll<N-1>::run(f);
+		f(std::integral_constant<int,N-1>());
+	}
+};
+template <> struct VsaUnroll<0> {
+	template <class F> static inline void run ( F ) {}
+};
+
+/** \brief Interface to one robot of the type described by the traits class Robot. */
+template <class Robot> class VsaInterface {
+public:
+	/** \brief Number of sensors (the readings returned have one more element, the time stamp). */
+	static const int dim_y = Robot::dim_y;
+	/** \brief Number of commands. */
+	static const int dim_u = Robot::dim_u;
+	/** \brief Payload length of sensor frames (2 bytes per sensor, lsb first). */
+	static const int transmit_length = 2*dim_y;
+	/** \brief Payload length of command frames (2 bytes per command, lsb first). */
+	static const int receive_length  = 2*dim_u;
+
+	/** \brief Controller run in the i/o thread (see setController()): sets u (dim_u) from y (dim_y+1), returns non-zero if u was set. */
+	typedef int (*Controller) ( void *context, const double *y, double *u );
+
+	VsaInterface () : controller(NULL), controller_context(NULL) { link.connection_state = ARDUINO_DISCONNECTED; }
+	~VsaInterface () { close(); }
+
+	/**
+	 * \brief Open the serial connection and start the i/o thread.
+	 * \param[in] device name of the serial port.
+	 * \param[in] options link options (if NULL, defaults with the robot's baudrate are used).
+	 * \return true on success.
+	 */
+	bool open ( const char *device, const ArduinoInterfaceOptions *options = NULL ) {
+		ArduinoInterfaceOptions defaults;
+		unsigned char command[receive_length];
+
+		if (options == NULL) {
+			vsa_link_default_options(&defaults, Robot::baudrate);
+			options = &defaults;
+		}
+		VsaUnroll<dim_u>::run([&](auto i) {
+			command[2*i  ] = Robot::u_init[i] & 0xFF;
+			command[2*i+1] = Robot::u_init[i] >> 8;
+		});
+		return vsa_link_open(&link, device, transmit_length, receive_length, command, options) != 0;
+	}
+	/** \brief Stop the i/o thread and close the serial connection. */
+	void close () { vsa_link_close(&link); }
+	/** \brief True if the connection is open. */
+	bool isOpen () const { return link.connection_state == ARDUINO_CONNECTED; }
+
+	/**
+	 * \brief Read sensors and command new motor positions (see vsa_arduino_interface_run_step()).
+	 * \param[in,out] u commands (dim_u, clipped to the robot's limits).
+	 * \param[out] y sensor readings (dim_y+1, the last element is the time stamp in seconds).
+	 * \return 1 if a new frame was read, 0 on timeout.
+	 */
+	int runStep ( double *u, double *y ) {
+		unsigned char command[receive_length];
+		int ok;
+
+		clip(u);
+		encode(u, command);
+		ok = vsa_link_wait(&link, command);
+		snapshot(y);
+		return ok;
+	}
+	/**
+	 * \brief Execute a command trajectory in the i/o thread, one step per frame (see vsa_arduino_interface_run_trajectory()).
+	 * \param[in,out] u commands (dim_u x length, step k at u[k*dim_u], clipped to the robot's limits).
+	 * \param[out] y sensor readings (dim_y+1 x length, step k at y[k*(dim_y+1)]).
+	 * \param[in] length number of steps.
+	 * \return number of steps executed.
+	 */
+	int runTrajectory ( double *u, double *y, int length ) {
+		if (length < 1) return 0;
+		std::vector<unsigned char> commands(length*receive_length), sensors(length*transmit_length);
+		std::vector<long long> timestamps(length);
+		int m[dim_y], steps = 0;
+
+		for (int k = 0; k < length; k++) {
+			clip(u + k*dim_u);
+			encode(u + k*dim_u, &commands[k*receive_length]);
+		}
+		if (vsa_link_trajectory_start(&link, &commands[0], &sensors[0], &timestamps[0], length)) {
+			steps = vsa_link_trajectory_wait(&link);
+		}
+		for (int k = 0; k < steps; k++) {
+			parse(&sensors[k*transmit_length], m);
+			convert(m, timestamps[k], y + k*(dim_y+1));
+		}
+		return steps;
+	}
+	/**
+	 * \brief Wait for the next frame and read sensors (see vsa_arduino_interface_read()).
+	 * \param[out] y sensor readings (dim_y+1).
+	 * \return 1 if a new frame was read, 0 on timeout.
+	 */
+	int read ( double *y ) {
+		int ok = vsa_link_wait(&link, NULL);
+		snapshot(y);
+		return ok;
+	}
+	/**
+	 * \brief Wait for the next frame and read sensors as ADC steps.
+	 * \param[out] m ADC readings (dim_y).
+	 * \return 1 if a new frame was read, 0 on timeout.
+	 */
+	int readAdc ( int *m ) {
+		unsigned char payload[transmit_length];
+		int ok = vsa_link_wait(&link, NULL);
+
+		vsa_link_read(&link, payload, NULL);
+		parse(payload, m);
+		return ok;
+	}
+	/**
+	 * \brief Command new motor positions, sent with the reply to the next frame (does not block).
+	 * \param[in,out] u commands (dim_u, clipped to the robot's limits).
+	 */
+	void write ( double *u ) {
+		unsigned char command[receive_length];
+
+		clip(u);
+		encode(u, command);
+		vsa_link_set_command(&link, command);
+	}
+	/**
+	 * \brief Get the latest sensor readings without waiting.
+	 * \param[out] y sensor readings (dim_y+1).
+	 * \param[out] timestamp arrival time in nanoseconds (may be NULL).
+	 * \return number of frames received so far.
+	 */
+	unsigned int snapshot ( double *y, long long *timestamp = NULL ) {
+		unsigned char payload[transmit_length];
+		int m[dim_y];
+		long long timestamp_ns;
+		unsigned int sequence = vsa_link_read(&link, payload, &timestamp_ns);
+
+		parse(payload, m);
+		convert(m, timestamp_ns, y);
+		if (timestamp != NULL) *timestamp = timestamp_ns;
+		return sequence/2;
+	}
+
+	/**
+	 * \brief Take all sensor readings received since the last call (see vsa_arduino_interface_drain()).
+	 * \param[out] y sensor readings (dim_y+1 x max_frames, frame k at y[k*(dim_y+1)]).
+	 * \param[out] sequence frame numbers (may be NULL).
+	 * \param[in] max_frames maximum number of frames to return.
+	 * \return number of frames returned.
+	 */
+	int drain ( double *y, unsigned long *sequence, int max_frames ) {
+		VsaLinkFrame frames[16];
+		int m[dim_y], n, count = 0;
+
+		while (count < max_frames && (n = vsa_link_drain(&link, frames, max_frames - count < 16 ? max_frames - count : 16)) > 0) {
+			for (int k = 0; k < n; k++, count++) {
+				parse(frames[k].payload, m);
+				convert(m, frames[k].timestamp_ns, y + count*(dim_y+1));
+				if (sequence != NULL) sequence[count] = frames[k].sequence;
+			}
+		}
+		return count;
+	}
+
+	/**
+	 * \brief Run a controller in the i/o thread, computing the command in reply to every frame (see vsa_arduino_interface_set_controller()).
+	 * \param c controller (NULL to stop it).
+	 * \param context pointer passed to c.
+	 */
+	void setController ( Controller c, void *context ) {
+		vsa_link_set_frame_handler(&link, NULL, NULL);
+		controller = c;
+		controller_context = context;
+		if (c != NULL) vsa_link_set_frame_handler(&link, controlFrame, this);
+	}
+
+	/** \brief Get communication statistics. */
+	void getStatistics ( ArduinoInterfaceStatistics *statistics ) { vsa_link_get_statistics(&link, statistics); }
+	/** \brief Get frame timing statistics. */
+	void getTiming ( ArduinoInterfaceTiming *timing ) { vsa_link_get_timing(&link, timing); }
+	/** \brief Get the scheduling settings of the i/o thread. */
+	void getThreadSettings ( ArduinoInterfaceThreadSettings *settings ) { vsa_link_get_thread_settings(&link, settings); }
+
+	/** \brief Clip commands to [Robot::u_llim, Robot::u_ulim]. */
+	static inline void clip ( double *u ) {
+		VsaUnroll<dim_u>::run([&](auto i) {
+			if (u[i] < Robot::u_llim[i]) u[i] = Robot::u_llim[i];
+			if (u[i] > Robot::u_ulim[i]) u[i] = Robot::u_ulim[i];
+		});
+	}
+	/** \brief Convert commands to device units and pack them into a command payload. */
+	static inline void encode ( const double *u, unsigned char *command ) {
+		VsaUnroll<dim_u>::run([&](auto i) {
+			int M = Robot::command(i, u[i]);
+			command[2*i  ] = M & 0xFF;
+			command[2*i+1] = M >> 8;
+		});
+	}
+	/** \brief Unpack ADC readings from a sensor payload. */
+	static inline void parse ( const unsigned char *payload, int *m ) {
+		VsaUnroll<dim_y>::run([&](auto i) {
+			m[i] = payload[2*i] + 256*payload[2*i+1];
+		});
+	}
+	/** \brief Convert ADC readings to sensor values (and append the time stamp in seconds). */
+	static inline void convert ( const int *m, long long timestamp_ns, double *y ) {
+		VsaUnroll<dim_y>::run([&](auto i) {
+			y[i] = Robot::sensor_gain[i]*m[i] + Robot::sensor_offset[i];
+		});
+		y[dim_y] = 1e-9*timestamp_ns;
+	}
+
+private:
+	VsaLink link;
+	Controller controller;
+	void *controller_context;
+
+	/** \brief Frame handler running the controller (in the i/o thread). */
+	static void controlFrame ( void *data, const unsigned char *payload, long long timestamp_ns, unsigned char *command ) {
+		VsaInterface *R = static_cast<VsaInterface *>(data);
+		int m[dim_y];
+		double y[dim_y+1], u[dim_u];
+
+		parse(payload, m);
+		convert(m, timestamp_ns, y);
+		if (R->controller(R->controller_context, y, u)) {
+			clip(u);
+			encode(u, command);
+		}
+	}
+
+	VsaInterface ( const VsaInterface & );
+	VsaInterface &operator= ( const VsaInterface & );
+};
+
+/**
+ * \brief Define the C entry points declared with VSA_ROBOT_DECLARE (see
+ * vsa_robots.h) for the robot with the given traits.
+ */
+#define VSA_ROBOT_DEFINE(prefix, Type, Robot) \
+	struct Type : public VsaInterface<Robot> {}; \
+	extern "C" { \
+	Type *prefix##_interface_open ( const char *device, const ArduinoInterfaceOptions *options ) { \
+		Type *R = new Type; \
+		if (!R->open(device, options)) { delete R; return NULL; } \
+		return R; \
+	} \
+	void prefix##_interface_default_options ( ArduinoInterfaceOptions *options ) { vsa_link_default_options(options, Robot::baudrate); } \
+	void prefix##_interface_close ( Type *R ) { delete R; } \
+	int  prefix##_interface_dim_u ( void ) { return Robot::dim_u; } \
+	int  prefix##_interface_dim_y ( void ) { return Robot::dim_y; } \
+	int  prefix##_interface_run_step ( Type *R, double *u, double *y ) { return R->runStep(u, y); } \
+	int  prefix##_interface_run_trajectory ( Type *R, double *u, double *y, int length ) { return R->runTrajectory(u, y, length); } \
+	int  prefix##_interface_read ( Type *R, double *y ) { return R->read(y); } \
+	int  prefix##_interface_read_adc ( Type *R, int *y ) { return R->readAdc(y); } \
+	void prefix##_interface_write ( Type *R, double *u ) { R->write(u); } \
+	unsigned int prefix##_interface_snapshot ( Type *R, double *y, long long *timestamp ) { return R->snapshot(y, timestamp); } \
+	int  prefix##_interface_drain ( Type *R, double *y, unsigned long *sequence, int max_frames ) { return R->drain(y, sequence, max_frames); } \
+	void prefix##_interface_set_controller ( Type *R, VsaRobotController controller, void *context ) { R->setController(controller, context); } \
+	void prefix##_interface_get_statistics ( Type *R, ArduinoInterfaceStatistics *statistics ) { R->getStatistics(statistics); } \
+	void prefix##_interface_get_timing ( Type *R, ArduinoInterfaceTiming *timing ) { R->getTiming(timing); } \
+	void prefix##_interface_get_thread_settings ( Type *R, ArduinoInterfaceThreadSettings *settings ) { R->getThreadSettings(settings); } \
+	}
+
+#endif
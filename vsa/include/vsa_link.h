@@ -0,0 +1,412 @@
+/** 
+ * \file vsa_link.h
+ *
+ * \brief Serial link to the Arduino control boards of the variable stiffness
+ * actuators, independent of the robot type.
+ *
+ * The link owns the serial port and the i/o thread, which decodes sensor
+ * frames (see vsa_frame.h), publishes their raw payload and time stamp, and
+ * replies to each of them with the latest command payload. It knows nothing
+ * about what the payload bytes mean: the number of payload bytes per frame is
+ * set when the link is opened, and parsing, calibration and command limits
+ * are left to the robot-specific front ends (vsa_arduino_interface.c, which
+ * is compiled once per robot, and the VsaInterface template in
+ * vsa_interface.h). Several links can be open at the same time.
+ */
+#ifndef __vsa_link_h
+#define __vsa_link_h
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WIN32
+#else
+#include <pthread.h>
+#endif
+
+#define ARDUINO_DISCONNECTED 0
+#define ARDUINO_CONNECTED 1
+#define THREAD_KILLED 1
+/* \brief Timeout in milliseconds when waiting for serial communication from Arduino. */
+#define TIMEOUT 100
+/** \brief Length of the receive ring buffer in bytes (must be a power of two). */
+#define RX_BUFFER_LENGTH 512
+/** \brief Nominal period (in seconds) at which the Arduino sends sensor frames (Timer 1 period of the sketches). */
+#define FRAME_PERIOD 0.02
+/** \brief Number of bytes of stack the i/o thread touches on start-up if options.prefault_stack is set. */
+#define PREFAULT_STACK_SIZE (64*1024)
+/** \brief Number of frames kept in the sensor history (about 5 s at 50 frames/s, see vsa_link_drain()). Must be a power of 2. */
+#define HISTORY_LENGTH 256
+
+/* Define locking of shared data for windows/linux */
+#ifdef WIN32
+#define LOCK(AI)      EnterCriticalSection(&((AI)->threadLock))
+#define UNLOCK(AI)    LeaveCriticalSection(&((AI)->threadLock))
+#define SIGNAL_FRAME(AI) WakeAllConditionVariable(&((AI)->frameReady))
+#define SEQLOCK_LOAD(p)     (*(volatile unsigned int *)(p))
+#define SEQLOCK_STORE(p,v)  (*(volatile unsigned int *)(p) = (v))
+#define SEQLOCK_FENCE()     MemoryBarrier()
+#else
+#include <unistd.h>
+#include <time.h>
+#define LOCK(AI)      pthread_mutex_lock(&((AI)->threadLock))
+#define UNLOCK(AI)    pthread_mutex_unlock(&((AI)->threadLock))
+#define SIGNAL_FRAME(AI) pthread_cond_broadcast(&((AI)->frameReady))
+#define SEQLOCK_LOAD(p)     __atomic_load_n((p), __ATOMIC_RELAXED)
+#define SEQLOCK_STORE(p,v)  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define SEQLOCK_FENCE()     __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif   
+
+#include <serial.h>
+#include "../sketchbook/libraries/vsa_frame/vsa_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** \brief Options for setting up the Arduino interface (see vsa_arduino_interface_init_options()). */
+typedef struct {
+	/** \brief Baudrate used for serial communication. This must match the
+	 * rate the sketch was built with (BAUDRATE in the robot's defines.h). */
+	int baudrate;
+	/** \brief If non-zero, put the serial port into low-latency mode
+	 * (ASYNC_LOW_LATENCY and a 1 ms FTDI latency timer, see serialSetLowLatency()). Default 0. */
+	int low_latency;
+	/** \brief If not NULL, record all serial traffic (with timestamps) to
+	 * this file (see serialCaptureStart()). Default NULL. */
+	const char *capture_file;
+	/** \brief If not NULL, replay this capture file instead of opening the
+	 * serial device, e.g., for reproducing problems offline or benchmarking
+	 * without a robot (see serialOpenReplay()). Default NULL. */
+	const char *replay_file;
+	/** \brief Replay speed: 1 for real time, >1 for accelerated replay, 0
+	 * for as fast as possible (for benchmarking the parser; readers will
+	 * miss frames). Default 1. */
+	double replay_speed;
+	/** \brief If >0, run the i/o thread with real-time scheduling
+	 * (SCHED_FIFO) at this priority (1-99; on Windows any value >0 selects
+	 * THREAD_PRIORITY_TIME_CRITICAL). This usually needs CAP_SYS_NICE or an
+	 * rtprio entry in /etc/security/limits.conf. Default 0 (normal scheduling). */
+	int thread_priority;
+	/** \brief If >=0, pin the i/o thread to this CPU (ideally one isolated
+	 * with isolcpus=). Default -1 (no pinning). */
+	int thread_cpu;
+	/** \brief If non-zero, lock all current and future memory of the
+	 * process into RAM (mlockall()), so that the i/o thread never waits for
+	 * page faults. The lock is shared by all links that ask for it, and
+	 * released (munlockall()) when the last of them is closed. Default 0. */
+	int lock_memory;
+	/** \brief If non-zero, the i/o thread touches PREFAULT_STACK_SIZE bytes
+	 * of its stack on start-up, so that no stack page faults occur later
+	 * (only useful together with lock_memory). Default 0. */
+	int prefault_stack;
+} ArduinoInterfaceOptions;
+
+/** \brief Number of bins of the inter-frame interval histogram (see ArduinoInterfaceTiming). */
+#define TIMING_HISTOGRAM_BINS 80
+/** \brief Width (in nanoseconds) of the bins of the inter-frame interval histogram. */
+#define TIMING_HISTOGRAM_BIN_NS 500000
+
+/** \brief Frame timing statistics (see vsa_arduino_interface_get_timing()).
+ *
+ * Frames are time stamped on arrival with CLOCK_MONOTONIC_RAW (the
+ * performance counter on Windows), which is not affected by NTP. Only
+ * intervals between consecutive frames (no frames dropped in between) are
+ * counted.
+ */
+typedef struct {
+	/** \brief Number of inter-frame intervals measured. */
+	unsigned long intervals;
+	/** \brief Shortest interval (ns). */
+	long long interval_min_ns;
+	/** \brief Longest interval (ns). */
+	long long interval_max_ns;
+	/** \brief Mean interval (ns). */
+	double interval_mean_ns;
+	/** \brief Standard deviation of the intervals (ns). */
+	double interval_std_ns;
+	/** \brief Running estimate of the mean deviation of the intervals from FRAME_PERIOD (ns), smoothed with gain 1/16 as for RTP (RFC 3550), so it tracks recent conditions. */
+	double jitter_ns;
+	/** \brief Histogram of intervals: bin i counts intervals in [i, i+1)*TIMING_HISTOGRAM_BIN_NS; the last bin also counts all longer intervals. */
+	unsigned long histogram[TIMING_HISTOGRAM_BINS];
+} ArduinoInterfaceTiming;
+
+/** \brief Scheduling settings in effect for the i/o thread (see vsa_arduino_interface_get_thread_settings()). */
+typedef struct {
+	/** \brief Non-zero if the thread runs with real-time scheduling (SCHED_FIFO or SCHED_RR; on Windows, time-critical priority). */
+	int realtime;
+	/** \brief Scheduling priority of the thread (0 for normal scheduling). */
+	int priority;
+	/** \brief CPU the thread is pinned to, or -1 if it may run on more than one CPU. */
+	int cpu;
+	/** \brief Non-zero if the process memory is locked into RAM. */
+	int memory_locked;
+	/** \brief Non-zero if the thread has prefaulted its stack. */
+	int stack_prefaulted;
+} ArduinoInterfaceThreadSettings;
+
+/** \brief Communication statistics (see vsa_arduino_interface_get_statistics()). */
+typedef struct {
+	/** \brief Number of complete frames decoded. */
+	unsigned long frames_received;
+	/** \brief Number of frames missed, from gaps in the frame sequence numbers. */
+	unsigned long frames_dropped;
+	/** \brief Number of invalid frames discarded (bad encoding, length, type, version or CRC; the parser resynchronises at the next frame delimiter). */
+	unsigned long resyncs;
+	/** \brief Number of frames discarded due to a CRC mismatch (included in resyncs). */
+	unsigned long crc_errors;
+	/** \brief Number of commands that could not be written (completely) to the serial port. */
+	unsigned long write_errors;
+	/** \brief Number of frames lost from the sensor history because it was not drained in time (see vsa_arduino_interface_drain()). */
+	unsigned long history_overruns;
+} ArduinoInterfaceStatistics;
+
+/** \brief A sensor frame in the history of a link (see vsa_link_drain()). */
+typedef struct {
+	/** \brief Sensor payload (transmit_length bytes). */
+	unsigned char payload[VSA_FRAME_MAX_PAYLOAD];
+	/** \brief Time (in nanoseconds, since the link was opened) at which the frame was received. */
+	long long timestamp_ns;
+	/** \brief Frame number, counted from 0 for the first frame received. It
+	 * is derived from the frame sequence numbers sent by the Arduino, so it
+	 * also counts frames lost on the serial line (these show as gaps). */
+	unsigned long sequence;
+} VsaLinkFrame;
+
+/** 
+ * \brief Function called by the i/o thread with every sensor frame, to compute the command sent in reply (see vsa_link_set_frame_handler()).
+ * \param context pointer given to vsa_link_set_frame_handler().
+ * \param[in] payload sensor payload (transmit_length bytes).
+ * \param[in] timestamp_ns arrival time of the frame (nanoseconds since the link was opened).
+ * \param[in,out] command command payload (receive_length bytes), initially the current command
+ * (which is not necessarily the one sent in reply to the previous frame, see VsaLink::sent_command).
+ */
+typedef void (*VsaLinkFrameHandler) ( void *context, const unsigned char *payload, long long timestamp_ns, unsigned char *command );
+
+/** \brief Serial link to an Arduino control board (see vsa_link_open()). */
+typedef struct {
+	/** \brief Serial port struct. */
+	SerialPort port;
+	/* \brief Flag for determining when reading a package from the serial port is complete (protected by threadLock, signalled through frameReady). */
+	int readComplete;
+	/** \brief Arduino connection state. connection_state=ARDUINO_DISCONNECTED, 
+	 * if no connection, connection_state=ARDUINO_CONNECTED if connection has 
+	 * been made (connection_state=2 kills the thread)  */
+	int connection_state;
+	/** \brief Payload length of sensor frames (frames of any other length are discarded). */
+	int transmit_length;
+	/** \brief Payload length of command frames. */
+	int receive_length;
+
+	/** \brief Buffer for sending motor commands (the payload of the command
+	 * frames, see vsa_frame.h). The i/o thread is the only writer to the
+	 * serial port: it encodes the latest contents of this buffer and sends
+	 * it in reply to every frame received.
+	 */
+	unsigned char command_buffer[VSA_FRAME_MAX_PAYLOAD];
+	/** \brief Command payload last sent to the robot, i.e., the one it applies
+	 * next (initially the command the link was opened with, which the robot
+	 * starts with). Written only by the i/o thread, just before sending, so a
+	 * frame handler may read it without the lock. */
+	unsigned char sent_command[VSA_FRAME_MAX_PAYLOAD];
+	/** \brief Command trajectory being executed by the i/o thread
+	 * (receive_length bytes per step), NULL if none (see
+	 * vsa_link_trajectory_start()). This and the other trajectory_* fields
+	 * are protected by threadLock. */
+	const unsigned char *trajectory_commands;
+	/** \brief Sensor payloads recorded while executing the trajectory (transmit_length bytes per step). */
+	unsigned char *trajectory_sensors;
+	/** \brief Time stamps (nanoseconds) of the recorded sensor frames (may be NULL). */
+	long long *trajectory_timestamps;
+	/** \brief Number of steps of the trajectory. */
+	int trajectory_length;
+	/** \brief Number of steps executed so far (signalled through frameReady). */
+	int trajectory_position;
+	/** \brief Function computing the command in reply to each frame in the i/o thread, NULL if none (see vsa_link_set_frame_handler()). Protected by threadLock. */
+	VsaLinkFrameHandler frame_handler;
+	/** \brief Context passed to frame_handler. */
+	void *frame_handler_context;
+	/** \brief Non-zero while the i/o thread is calling frame_handler (cleared and signalled through frameReady when it returns). */
+	int frame_handler_busy;
+	/** \brief Payload of the latest sensor frame. Written by the i/o thread only, protected by state_sequence. */
+	volatile unsigned char sensor_payload[VSA_FRAME_MAX_PAYLOAD];
+	/** \brief Time (in nanoseconds, since the link was opened) at which the latest sensor frame was received. Protected by state_sequence. */
+	volatile long long timestamp_ns;
+	/** \brief Sequence lock for sensor_payload and timestamp_ns: odd while the
+	 * i/o thread is updating them, incremented by 2 with every frame. Readers
+	 * never block the i/o thread; they retry if the sequence changed while
+	 * they were copying. */
+	unsigned int state_sequence;
+
+	/** \brief History of the latest HISTORY_LENGTH sensor frames, so that
+	 * no frame is lost if readers are busy (see vsa_link_drain()). Written
+	 * by the i/o thread, protected by threadLock. When full, the oldest
+	 * frame is overwritten (counted in statistics.history_overruns). */
+	VsaLinkFrame history[HISTORY_LENGTH];
+	/** \brief Free-running write index into history. */
+	unsigned int history_head;
+	/** \brief Free-running read index into history (oldest frame not yet drained). */
+	unsigned int history_tail;
+
+	/** \brief Receive ring buffer. Bytes read from the serial port are
+	 * stored here by the i/o thread until they have been parsed. */
+	unsigned char rx_buffer[RX_BUFFER_LENGTH];
+	/** \brief Free-running write index into rx_buffer (next byte received is stored at rx_head % RX_BUFFER_LENGTH). */
+	unsigned int rx_head;
+	/** \brief Free-running read index into rx_buffer (next byte to be parsed is at rx_tail % RX_BUFFER_LENGTH). */
+	unsigned int rx_tail;
+
+	/** \brief Communication statistics (updated by the i/o thread). */
+	ArduinoInterfaceStatistics statistics;
+	/** \brief Frame timing statistics (updated by the i/o thread). */
+	ArduinoInterfaceTiming timing;
+	/** \brief Sum of squared deviations of the inter-frame intervals from their mean (for timing.interval_std_ns). */
+	double timing_m2;
+
+#ifdef WIN32
+	CRITICAL_SECTION threadLock;
+	CONDITION_VARIABLE frameReady;
+	HANDLE thread;
+#else
+	/** \brief Mutex (for locking shared data structures.) */
+	pthread_mutex_t threadLock;
+	/** \brief Condition variable signalled by the i/o thread when a frame has been completed (readComplete set). */
+	pthread_cond_t frameReady;
+	/** \brief I/O thread */
+	pthread_t thread;
+#endif
+	/** \brief I/O thread state. Thread runs while thread_state!=THREAD_KILLED. */
+	int thread_state;
+	/** \brief Settings applied to the i/o thread (memory_locked and
+	 * stack_prefaulted; priority and cpu are queried from the thread). */
+	ArduinoInterfaceThreadSettings thread_settings;
+
+} VsaLink;
+
+/** 
+ * \brief Fill options struct with default settings.
+ * \param[out] options link options.
+ * \param[in] baudrate default baudrate (BAUDRATE of the robot's defines.h).
+ */
+void vsa_link_default_options ( ArduinoInterfaceOptions *options, int baudrate );
+/** 
+ * \brief Open the serial connection with an Arduino board, start the i/o thread in the background. 
+ * \param L link.
+ * \param[in] device Name of serial port to which Arduino is connected.
+ * \param[in] transmit_length payload length of sensor frames.
+ * \param[in] receive_length payload length of command frames.
+ * \param[in] command initial command payload (receive_length bytes).
+ * \param[in] options link options (see vsa_link_default_options()).
+ * \return 1 on success, 0 on failure.
+ */
+int  vsa_link_open ( VsaLink *L, const char *device, int transmit_length, int receive_length, const unsigned char *command, const ArduinoInterfaceOptions *options );
+/** 
+ * \brief Stop the i/o thread and close the serial connection (does nothing if the link is not open). 
+ * \param L link.
+ */
+void vsa_link_close ( VsaLink *L );
+/** 
+ * \brief Wait for the next sensor frame and (optionally) set the command sent in reply to the following one.
+ * \param L link.
+ * \param[in] command new command payload (receive_length bytes), or NULL to leave the command unchanged.
+ * \return 1 if a new frame arrived, 0 if none arrived within TIMEOUT milliseconds.
+ *
+ * The frame is consumed, i.e., the next call waits for the frame after it.
+ */
+int  vsa_link_wait ( VsaLink *L, const unsigned char *command );
+/** 
+ * \brief Set the command sent in reply to the next sensor frame (does not block). 
+ * \param L link.
+ * \param[in] command command payload (receive_length bytes).
+ */
+void vsa_link_set_command ( VsaLink *L, const unsigned char *command );
+/** 
+ * \brief Start executing a command trajectory in the i/o thread (does not block).
+ * \param L link.
+ * \param[in] commands command payloads, receive_length bytes for each of the length steps.
+ * \param[out] sensors buffer for the sensor payloads, transmit_length bytes for each step.
+ * \param[out] timestamps buffer for the arrival times of the sensor frames in nanoseconds, one per step (may be NULL).
+ * \param[in] length number of steps.
+ * \return 1 if the trajectory was started, 0 if another one is still running (or length < 1).
+ *
+ * With each sensor frame received, the i/o thread records the frame in
+ * sensors (and timestamps), and replies with the next command, i.e., command
+ * k is sent in reply to sensor frame k. After the last step, the last
+ * command is held (as with vsa_link_set_command()). The buffers must remain
+ * valid until vsa_link_trajectory_wait() has returned.
+ */
+int  vsa_link_trajectory_start ( VsaLink *L, const unsigned char *commands, unsigned char *sensors, long long *timestamps, int length );
+/** 
+ * \brief Wait until the trajectory started with vsa_link_trajectory_start() has been executed.
+ * \param L link.
+ * \return number of steps executed. This is less than the length of the
+ * trajectory if no frame arrived for TIMEOUT milliseconds, in which case the
+ * rest of the trajectory is cancelled.
+ */
+int  vsa_link_trajectory_wait ( VsaLink *L );
+/** 
+ * \brief Install a function that computes the command in the i/o thread, in reply to each sensor frame.
+ * \param L link.
+ * \param handler function to call with every frame (NULL to remove).
+ * \param context pointer passed to handler.
+ *
+ * The handler is called right after a frame has been decoded and published,
+ * and the command it leaves in its command buffer is sent in reply to that
+ * frame (and kept as the current command), so the sensor-to-command latency
+ * is that of the handler itself. It runs in the i/o thread and must not
+ * block. Commands set with vsa_link_set_command() are overridden by those of
+ * the handler; while a trajectory is executed (see
+ * vsa_link_trajectory_start()) the handler is still called, but its command
+ * is discarded. vsa_link_wait() returns only after the handler is done with
+ * the frame, so the handler may also be used to process frames for readers.
+ *
+ * When this returns, the previous handler is no longer running (so its
+ * context may be released). It must not be called from a handler.
+ */
+void vsa_link_set_frame_handler ( VsaLink *L, VsaLinkFrameHandler handler, void *context );
+/** 
+ * \brief Get a consistent copy of the latest sensor payload without locking. 
+ * \param L link.
+ * \param[out] payload sensor payload (transmit_length bytes).
+ * \param[out] timestamp_ns arrival time of the frame in nanoseconds since the link was opened (may be NULL).
+ * \return sequence number of the snapshot (incremented by 2 with every frame, so half of it is the number of frames received).
+ */
+unsigned int vsa_link_read ( VsaLink *L, unsigned char *payload, long long *timestamp_ns );
+/** 
+ * \brief Take all frames received since the last call from the sensor history (oldest first, does not block). 
+ * \param L link.
+ * \param[out] frames buffer for up to max_frames frames.
+ * \param[in] max_frames size of frames (frames that do not fit are left for the next call).
+ * \return number of frames copied to frames.
+ *
+ * The history is independent of vsa_link_wait() and vsa_link_read(), so a
+ * (single) logging or estimation thread can drain it at its own rate
+ * without losing frames, as long as it does so at least every
+ * HISTORY_LENGTH frames (see statistics.history_overruns).
+ */
+int  vsa_link_drain ( VsaLink *L, VsaLinkFrame *frames, int max_frames );
+/** 
+ * \brief Get communication statistics. 
+ * \param L link.
+ * \param[out] statistics copy of the current statistics.
+ */
+void vsa_link_get_statistics ( VsaLink *L, ArduinoInterfaceStatistics *statistics );
+/** 
+ * \brief Get frame timing statistics. 
+ * \param L link.
+ * \param[out] timing copy of the current timing statistics.
+ */
+void vsa_link_get_timing ( VsaLink *L, ArduinoInterfaceTiming *timing );
+/** 
+ * \brief Get the scheduling settings in effect for the i/o thread. 
+ * \param L link.
+ * \param[out] settings current settings.
+ */
+void vsa_link_get_thread_settings ( VsaLink *L, ArduinoInterfaceThreadSettings *settings );
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
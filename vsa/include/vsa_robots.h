@@ -0,0 +1,59 @@
+/**
+ * \file vsa_robots.h
+ *
+ * \brief C entry points to the robot interfaces of build/libvsa.so.
+ *
+ * Unlike vsa_arduino_interface.h (which is compiled once per robot, selected
+ * with -DMACCEPA_INTERFACE etc.), all robots are available side by side, e.g.,
+ * \code
+ * MaccepaInterface      *a = maccepa_interface_open("/dev/ttyUSB0", NULL);
+ * EdinburghVsaInterface *b = edinburghvsa_interface_open("/dev/ttyUSB1", NULL);
+ * \endcode
+ * For each robot <prefix> (maccepa, edinburghvsa, maccepa2dof) the functions
+ * <prefix>_interface_*() behave as the corresponding vsa_arduino_interface_*()
+ * functions. Sensor readings y have <prefix>_interface_dim_y()+1 elements (the
+ * last is the time stamp), commands u have <prefix>_interface_dim_u() elements.
+ *
+ * The interfaces are implemented by VsaInterface<Robot> (see vsa_interface.h).
+ */
+#ifndef __vsa_robots_h
+#define __vsa_robots_h
+
+#include <vsa_link.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** \brief Controller run in the i/o thread (see vsa_arduino_interface_set_controller()): sets u from y, returns non-zero if u was set. */
+typedef int (*VsaRobotController) ( void *context, const double *y, double *u );
+
+/** \brief Declare the C entry points for the robot interface Type. */
+#define VSA_ROBOT_DECLARE(prefix, Type) \
+	typedef struct Type Type; \
+	Type *prefix##_interface_open ( const char *device, const ArduinoInterfaceOptions *options ); \
+	void prefix##_interface_default_options ( ArduinoInterfaceOptions *options ); \
+	void prefix##_interface_close ( Type *R ); \
+	int  prefix##_interface_dim_u ( void ); \
+	int  prefix##_interface_dim_y ( void ); \
+	int  prefix##_interface_run_step ( Type *R, double *u, double *y ); \
+	int  prefix##_interface_run_trajectory ( Type *R, double *u, double *y, int length ); \
+	int  prefix##_interface_read ( Type *R, double *y ); \
+	int  prefix##_interface_read_adc ( Type *R, int *y ); \
+	void prefix##_interface_write ( Type *R, double *u ); \
+	unsigned int prefix##_interface_snapshot ( Type *R, double *y, long long *timestamp ); \
+	int  prefix##_interface_drain ( Type *R, double *y, unsigned long *sequence, int max_frames ); \
+	void prefix##_interface_set_controller ( Type *R, VsaRobotController controller, void *context ); \
+	void prefix##_interface_get_statistics ( Type *R, ArduinoInterfaceStatistics *statistics ); \
+	void prefix##_interface_get_timing ( Type *R, ArduinoInterfaceTiming *timing ); \
+	void prefix##_interface_get_thread_settings ( Type *R, ArduinoInterfaceThreadSettings *settings );
+
+VSA_ROBOT_DECLARE(maccepa,      MaccepaInterface)
+VSA_ROBOT_DECLARE(edinburghvsa, EdinburghVsaInterface)
+VSA_ROBOT_DECLARE(maccepa2dof,  Maccepa2DofInterface)
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
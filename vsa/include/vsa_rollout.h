@@ -0,0 +1,142 @@
+/**
+ * \file vsa_rollout.h
+ *
+ * \brief Forward-dynamics rollouts of the robot models, run in parallel on a
+ * pool of threads (e.g., for sampling-based planners).
+ *
+ * A rollout integrates the state \f$\mathbf{x}=(q,\dot{q})\f$ from an initial
+ * state under a sequence of commands, each held for one command period
+ * (FRAME_PERIOD by default, as on the robot). Each period is integrated with
+ * a fixed number of RK4 or semi-implicit Euler steps of the model
+ * acceleration (e.g., maccepa_model_get_acceleration()).
+ *
+ * Optionally, the servos are simulated with their FIR models
+ * (maccepa_model_get_motor_positions()): the filter holds the last
+ * FILTER_DIMENSION commands of each servo (oldest first, sampled once per
+ * command period, initially all equal to the first command), and the model
+ * is driven with the filtered motor positions instead of the commands.
+ *
+ * Like vsa_arduino_interface.c, the engine is compiled once per robot (with
+ * MACCEPA_INTERFACE or EDINBURGHVSA_INTERFACE defined). The threads are
+ * started once by vsa_rollout_init() and wait between batches; each rollout
+ * works in fixed-size buffers on the stack of its thread, so a batch
+ * allocates no memory.
+ *
+ * Usage (build/maccepa_rollout.o):
+ * \code
+ * VsaRollout R;
+ * vsa_rollout_init(&R, 0);        // one thread per CPU
+ * R.method = VSA_ROLLOUT_RK4;
+ * vsa_rollout_run(&R, X, x0, U, steps, n);
+ * vsa_rollout_free(&R);
+ * \endcode
+ */
+#ifndef __vsa_rollout_h
+#define __vsa_rollout_h
+
+#include <vsa_link.h>
+
+#ifdef MACCEPA_INTERFACE
+#include "../sketchbook/maccepa/defines.h"
+#include <libmaccepa.h>
+/** \brief Model integrated by the rollouts. */
+typedef maccepa_model RolloutModel;
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+#include "../sketchbook/edinburghvsa/defines.h"
+#include <libedinburghvsa.h>
+typedef edinburghvsa_model RolloutModel;
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** \brief Integration method: semi-implicit (symplectic) Euler. */
+#define VSA_ROLLOUT_EULER 0
+/** \brief Integration method: classical fourth-order Runge-Kutta. */
+#define VSA_ROLLOUT_RK4   1
+
+/** \brief Largest number of threads of a pool (including the calling thread). */
+#define VSA_ROLLOUT_MAX_THREADS 64
+/** \brief Number of rollouts a thread takes from a batch at a time. */
+#define VSA_ROLLOUT_CHUNK 8
+
+/** \brief Rollout engine: integration settings and thread pool. */
+typedef struct {
+	/** \brief Model parameters (initialised with the defaults of the robot, may be changed between batches). */
+	RolloutModel model;
+	/** \brief VSA_ROLLOUT_RK4 (default) or VSA_ROLLOUT_EULER. */
+	int method;
+	/** \brief Time (s) each command is held. Default FRAME_PERIOD. */
+	double period;
+	/** \brief Integration steps per command period. Default 4. */
+	int substeps;
+	/** \brief Non-zero to drive the model with the FIR servo models, zero to apply the commands directly. Default 1. */
+	int servo;
+	/** \brief Number of threads running a batch (including the calling thread). */
+	int threads;
+#ifndef WIN32
+	/** \brief Worker threads (threads-1 of them). */
+	pthread_t thread[VSA_ROLLOUT_MAX_THREADS];
+	/** \brief Protects the batch below. */
+	pthread_mutex_t lock;
+	/** \brief Signals the workers that a batch is ready (or that they should quit). */
+	pthread_cond_t start;
+	/** \brief Signals the calling thread that the workers are finished. */
+	pthread_cond_t done;
+#endif
+	/** \brief Current batch (see vsa_rollout_run()). */
+	double *X;
+	const double *x0, *U;
+	int steps, n;
+	/** \brief Next rollout of the batch to be taken by a thread. */
+	int next;
+	/** \brief Number of workers still running the batch. */
+	int busy;
+	/** \brief Incremented with every batch. */
+	unsigned int generation;
+	/** \brief Set to stop the workers. */
+	int quit;
+} VsaRollout;
+
+/**
+ * \brief Initialise the engine with the default settings and start its threads.
+ * \param[out] R rollout engine.
+ * \param[in] threads number of threads running a batch (including the calling thread), 0 for one per CPU.
+ * \return non-zero on success (if fewer threads could be started, the remaining ones are used).
+ */
+int  vsa_rollout_init ( VsaRollout *R, int threads );
+/**
+ * \brief Stop the threads of the engine.
+ * \param R rollout engine.
+ */
+void vsa_rollout_free ( VsaRollout *R );
+/**
+ * \brief Integrate one rollout in the calling thread.
+ * \param[in] R rollout engine (settings and model only, so this may be called from several threads).
+ * \param[out] X states along the rollout, (steps+1) x DIMX, X[k*DIMX+j] at the start of command period k (X[steps*DIMX+j] is the final state).
+ * \param[in] x0 initial state (position, velocity).
+ * \param[in] U commands, steps x DIMU, U[k*DIMU+i] is command i for period k.
+ * \param[in] steps number of command periods.
+ */
+void vsa_rollout_run_one ( const VsaRollout *R, double *X, const double *x0, const double *U, int steps );
+/**
+ * \brief Integrate a batch of independent rollouts on the thread pool.
+ * \param R rollout engine.
+ * \param[out] X states, n x (steps+1) x DIMX, rollout r at X + r*(steps+1)*DIMX (see vsa_rollout_run_one()).
+ * \param[in] x0 initial states, n x DIMX.
+ * \param[in] U commands, n x steps x DIMU, rollout r at U + r*steps*DIMU.
+ * \param[in] steps number of command periods of each rollout.
+ * \param[in] n number of rollouts.
+ *
+ * Blocks until all rollouts are done. Only one batch may run on an engine
+ * at a time.
+ */
+void vsa_rollout_run ( VsaRollout *R, double *X, const double *x0, const double *U, int steps, int n );
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
@@ -8,6 +8,9 @@ DEF DIMQ = 1 # TODO: how to automatically extract these values from sketchbook/m
 DEF DIMU = 3 #
 DEF DIMY = 5 #
 DEF DIMX = 2*DIMQ
+DEF TIMING_HISTOGRAM_BINS = 80 # must match vsa_arduino_interface.h
+DEF TIMING_HISTOGRAM_BIN_NS = 500000
+DEF HISTORY_LENGTH = 256 # must match vsa_link.h
 
 cdef extern from "../sketchbook/maccepa/defines.h":
 	double U_ULIM_RAD_SERVO0
@@ -16,17 +19,73 @@ cdef extern from "../sketchbook/maccepa/defines.h":
 	double U_LLIM_RAD_SERVO1
 	double U_ULIM_DAMPER0
 	double U_LLIM_DAMPER0
+	int    BAUDRATE
+
+cdef extern from "vsa_estimator.h":
+	ctypedef struct VsaEstimatorNoise:
+		double position
+		double acceleration
+		double jerk
+		double model
+	void vsa_estimator_default_noise ( VsaEstimatorNoise *noise )
 
 cdef extern from "vsa_arduino_interface.h":
 	ctypedef struct ArduinoInterface:
 		pass
+	ctypedef struct ArduinoInterfaceStatistics:
+		unsigned long frames_received
+		unsigned long frames_dropped
+		unsigned long resyncs
+		unsigned long crc_errors
+		unsigned long write_errors
+		unsigned long history_overruns
+	ctypedef struct ArduinoInterfaceOptions:
+		int baudrate
+		int low_latency
+		char *capture_file
+		char *replay_file
+		double replay_speed
+		int thread_priority
+		int thread_cpu
+		int lock_memory
+		int prefault_stack
+	ctypedef struct ArduinoInterfaceTiming:
+		unsigned long intervals
+		long long interval_min_ns
+		long long interval_max_ns
+		double interval_mean_ns
+		double interval_std_ns
+		double jitter_ns
+		unsigned long histogram[TIMING_HISTOGRAM_BINS]
+	ctypedef struct ArduinoInterfaceThreadSettings:
+		int realtime
+		int priority
+		int cpu
+		int memory_locked
+		int stack_prefaulted
 	int  vsa_arduino_interface_init       ( ArduinoInterface *AI, char *device )
+	void vsa_arduino_interface_default_options ( ArduinoInterfaceOptions *options )
+	int  vsa_arduino_interface_init_options    ( ArduinoInterface *AI, char *device, ArduinoInterfaceOptions *options )
 	void vsa_arduino_interface_close      ( ArduinoInterface *AI )
 	void vsa_arduino_interface_write      ( ArduinoInterface *AI, double *u )
 	void vsa_arduino_interface_write_usec ( ArduinoInterface *AI, int *u )
-	void vsa_arduino_interface_read       ( ArduinoInterface *AI, double *y )
-	void vsa_arduino_interface_read_adc   ( ArduinoInterface *AI, int *y )
-	void vsa_arduino_interface_run_step   ( ArduinoInterface *AI, double *u, double *y )
+	int  vsa_arduino_interface_read       ( ArduinoInterface *AI, double *y )
+	int  vsa_arduino_interface_read_adc   ( ArduinoInterface *AI, int *y )
+	int  vsa_arduino_interface_run_step   ( ArduinoInterface *AI, double *u, double *y )
+	int  vsa_arduino_interface_run_trajectory ( ArduinoInterface *AI, double *u, double *y, int length )
+	unsigned int vsa_arduino_interface_snapshot ( ArduinoInterface *AI, double *y, long long *timestamp )
+	int  vsa_arduino_interface_drain      ( ArduinoInterface *AI, double *y, unsigned long *sequence, int max_frames )
+	void vsa_arduino_interface_start_estimator ( ArduinoInterface *AI, VsaEstimatorNoise *noise )
+	void vsa_arduino_interface_stop_estimator  ( ArduinoInterface *AI )
+	int  vsa_arduino_interface_read_estimate   ( ArduinoInterface *AI, double *x )
+	int  vsa_arduino_interface_read_prediction ( ArduinoInterface *AI, double *x )
+	ctypedef int (*ArduinoInterfaceController) ( void *context, const double *y, double *u )
+	void vsa_arduino_interface_set_controller ( ArduinoInterface *AI, ArduinoInterfaceController controller, void *context )
+	void vsa_arduino_interface_get_statistics ( ArduinoInterface *AI, ArduinoInterfaceStatistics *statistics )
+	void vsa_arduino_interface_get_timing ( ArduinoInterface *AI, ArduinoInterfaceTiming *timing )
+	void vsa_arduino_interface_get_thread_settings ( ArduinoInterface *AI, ArduinoInterfaceThreadSettings *settings )
+
+from libc.stdlib cimport malloc, free
 
 cdef extern from "math.h":
 	double M_PI
@@ -42,6 +101,32 @@ cdef extern from "libmaccepa.h":
 	void maccepa_model_get_equilibrium_position_jacobian ( double *   J, double * x, double * u, maccepa_model * model )
 	void maccepa_model_get_stiffness                     ( double *   k, double * x, double * u, maccepa_model * model )
 	void maccepa_model_get_stiffness_jacobian            ( double *   J, double * x, double * u, maccepa_model * model )
+	int  maccepa_model_solve_command                     ( double *   u, double * target, maccepa_model * model )
+
+cdef extern from "maccepa_impedance_controller.h":
+	ctypedef struct maccepa_impedance_controller:
+		double position
+		double gain_p
+		double gain_d
+		double velocity_filter
+		double min_stiffness
+
+	void maccepa_impedance_controller_init       ( maccepa_impedance_controller *C )
+	void maccepa_impedance_controller_set_target ( maccepa_impedance_controller *C, double position, double stiffness )
+	int  maccepa_impedance_controller_step       ( void *context, const double *y, double *u )
+
+cdef extern from "vsa_rollout.h":
+	ctypedef struct VsaRollout:
+		int method
+		double period
+		int substeps
+		int servo
+		int threads
+	int  VSA_ROLLOUT_EULER
+	int  VSA_ROLLOUT_RK4
+	int  vsa_rollout_init ( VsaRollout *R, int threads )
+	void vsa_rollout_free ( VsaRollout *R )
+	void vsa_rollout_run  ( VsaRollout *R, double *X, double *x0, double *U, int steps, int n )
 
 cdef class ModelInterface:
 	"""A class for making dynamics calculations based on a model of the 1-DoF MACCEPA."""
@@ -127,10 +212,83 @@ cdef class ModelInterface:
 		for i in range(0,DIMU): J.append(cJ[i]) # copy to python array
 		return J
 
+	def getCommand(self,q0,k,u=None):
+		"""u, reached = getCommand(q0,k,u=None)
+
+		   Calculate the motor commands giving the equilibrium position q0 and
+		   the stiffness k at the equilibrium (inverse model). The damping
+		   command is taken from u (0 if None). reached is False if the target
+		   is out of range (u is then clipped).
+
+		"""
+		cdef double cu[DIMU]
+		cdef double ctarget[2]
+		for i in range(0,DIMU): cu[i] = 0 if u is None else u[i] # copy to c array
+		ctarget[0] = q0
+		ctarget[1] = k
+		status = maccepa_model_solve_command(cu,ctarget,&self.Model)
+		return [cu[i] for i in range(0,DIMU)], status == 0
+
+
+cdef class RolloutInterface:
+	"""Forward-dynamics rollouts of the model, run in parallel on a pool of threads (see vsa_rollout.h)."""
+
+	cdef VsaRollout R
+	cdef int isOk
+
+	def __init__(self, threads=0, method='rk4', substeps=4, servo=True):
+		"""RolloutInterface(threads=0, method='rk4', substeps=4, servo=True)
+
+		   Start the threads (0: one per CPU). Each command is held for one
+		   frame period and integrated with substeps steps of method ('rk4' or
+		   'euler'). If servo is True, the model is driven with the motor
+		   positions of the FIR servo models instead of the commands.
+		"""
+		self.isOk = vsa_rollout_init(&self.R, threads)
+		self.R.method   = VSA_ROLLOUT_EULER if method == 'euler' else VSA_ROLLOUT_RK4
+		self.R.substeps = substeps
+		self.R.servo    = 1 if servo else 0
+
+	def __dealloc__(self):
+		if self.isOk: vsa_rollout_free(&self.R)
+
+	def run(self,x0,U):
+		"""X = run(x0,U)
+
+		   Integrate len(x0) rollouts, rollout r from the state x0[r] (position,
+		   velocity) under the commands U[r] (U[r][k][i] is command i for
+		   period k, all rollouts with the same number of periods N). X[r][k]
+		   is the state of rollout r at the start of period k (N+1 states).
+		"""
+		cdef int n = len(x0)
+		if n == 0: return []
+		cdef int N = len(U[0])
+		cdef double *cx0 = <double *>malloc(n*DIMX*sizeof(double))
+		cdef double *cU  = <double *>malloc(n*N*DIMU*sizeof(double))
+		cdef double *cX  = <double *>malloc(n*(N+1)*DIMX*sizeof(double))
+		for r in range(0,n):
+			for j in range(0,DIMX): cx0[r*DIMX+j] = x0[r][j] # copy to c array
+			for k in range(0,N):
+				for i in range(0,DIMU): cU[(r*N+k)*DIMU+i] = U[r][k][i]
+		vsa_rollout_run(&self.R,cX,cx0,cU,N,n)
+		X = [[[cX[(r*(N+1)+k)*DIMX+j] for j in range(0,DIMX)] for k in range(0,N+1)] for r in range(0,n)]
+		free(cx0)
+		free(cU)
+		free(cX)
+		return X
+
+	def get_threads(self):
+		"""threads = get_threads()
+
+		   Number of threads running the rollouts (including the calling thread).
+		"""
+		return self.R.threads
+
 
 cdef class HardwareInterface:
 	"""Hardware interface to the 1-DoF MACCEPA (through the Arduino Duemilanove 328)."""
 	cdef ArduinoInterface AI
+	cdef maccepa_impedance_controller C
 	cdef int isOk
 	dimU = DIMU
 	u_ulim=[U_ULIM_RAD_SERVO0,U_ULIM_RAD_SERVO1,U_ULIM_DAMPER0]
@@ -138,8 +296,40 @@ cdef class HardwareInterface:
 	#u_ulim=[U_ULIM_RAD_SERVO0,U_ULIM_RAD_SERVO1]
 	#u_llim=[U_LLIM_RAD_SERVO0,U_LLIM_RAD_SERVO1]
 
-	def __init__(self, port):
-		self.isOk = vsa_arduino_interface_init(&self.AI, port)
+	def __init__(self, port, baudrate=BAUDRATE, low_latency=False, capture=None, replay=None, replay_speed=1.0,
+	             thread_priority=0, thread_cpu=-1, lock_memory=False, prefault_stack=False):
+		"""HardwareInterface(port, baudrate=BAUDRATE, low_latency=False, capture=None, replay=None, replay_speed=1.0,
+		                     thread_priority=0, thread_cpu=-1, lock_memory=False, prefault_stack=False)
+
+		   Open the robot on serial port 'port'. The baudrate must match the one
+		   the sketch was built with (BAUDRATE in sketchbook/*/defines.h). If
+		   low_latency is set, the USB-serial driver is asked to pass on received
+		   data immediately (this may need write access to the FTDI latency_timer
+		   in sysfs).
+
+		   If capture is a file name, all serial traffic is recorded to it (with
+		   timestamps). If replay is a file name, that capture is played back
+		   instead of opening 'port', at replay_speed times real time (0 for as
+		   fast as possible); commands are discarded.
+
+		   thread_priority (SCHED_FIFO priority, 0 for normal scheduling),
+		   thread_cpu (CPU to pin the i/o thread to, -1 for none), lock_memory
+		   and prefault_stack configure the i/o thread for real-time use (see
+		   get_thread_settings()).
+		"""
+		cdef ArduinoInterfaceOptions options
+		vsa_arduino_interface_default_options(&options)
+		options.baudrate    = baudrate
+		options.low_latency = low_latency
+		if capture is not None: options.capture_file = capture
+		if replay  is not None: options.replay_file  = replay
+		options.replay_speed = replay_speed
+		options.thread_priority = thread_priority
+		options.thread_cpu      = thread_cpu
+		options.lock_memory     = lock_memory
+		options.prefault_stack  = prefault_stack
+		maccepa_impedance_controller_init(&self.C)
+		self.isOk = vsa_arduino_interface_init_options(&self.AI, port, &options)
 
 	def __dealloc__(self): 
 		vsa_arduino_interface_close(&self.AI)
@@ -159,10 +349,41 @@ cdef class HardwareInterface:
 			print "Command must be a list of double values of length %d." % DIMU
 			return 
 		for i in range(0,DIMU): cu[i] = u[i] # copy command to c array
-		vsa_arduino_interface_run_step(&self.AI, cu, cy)
+		if not vsa_arduino_interface_run_step(&self.AI, cu, cy): print "Timeout!"
 		for i in range(0,DIMY+1): y.append(cy[i]) # copy to python array
 		return y # return sensor readings
 
+	def run_trajectory(self,u):
+		"""y = run_trajectory(u)
+
+		   Execute the command trajectory u (DIMU x N, i.e., u[i][n] is command
+		   i at step n, e.g., a pylab array zeros([robot.dimU,N])), one step per
+		   frame, and return the sensor readings y (DIMY+1 x N, y[i][n] as
+		   returned by run_step at step n).
+
+		   The trajectory is executed by the i/o thread (command n is sent in
+		   reply to sensor frame n), so the timing is exact to the frame. This
+		   function blocks until the trajectory is complete; afterwards the
+		   last command is held. If the robot stops sending frames, fewer than
+		   N steps are returned.
+		"""
+		if len(u)<DIMU: 
+			print "Command must be an array of DIMU=%d rows." % DIMU
+			return 
+		cdef int N = len(u[0])
+		cdef double *cu = <double *>malloc(N*DIMU*sizeof(double))
+		cdef double *cy = <double *>malloc(N*(DIMY+1)*sizeof(double))
+		cdef int steps = 0
+		if cu != NULL and cy != NULL:
+			for n in range(0,N):
+				for i in range(0,DIMU): cu[n*DIMU+i] = u[i][n] # copy command to c array
+			steps = vsa_arduino_interface_run_trajectory(&self.AI, cu, cy, N)
+			if steps < N: print "Timeout!"
+		y = [[cy[n*(DIMY+1)+i] for n in range(0,steps)] for i in range(0,DIMY+1)] # copy to python array
+		free(cu)
+		free(cy)
+		return y
+
 	def read(self):
 		"""
 		   pos,acc,m1,m2,power,timestamp = read()
@@ -173,7 +394,7 @@ cdef class HardwareInterface:
 		"""
 		cdef double cy[DIMY+1]
 		y=[]; 
-		vsa_arduino_interface_read(&self.AI, cy)
+		if not vsa_arduino_interface_read(&self.AI, cy): print "Timeout!"
 		for i in range(0,DIMY+1): y.append(cy[i]) # copy to python array
 		return y
 
@@ -185,17 +406,159 @@ cdef class HardwareInterface:
 		"""
 		cdef int cy[DIMY+1]
 		y=[];
-		vsa_arduino_interface_read_adc(&self.AI, cy)
+		if not vsa_arduino_interface_read_adc(&self.AI, cy): print "Timeout!"
 		for i in range(0,DIMY+1): y.append(cy[i]) # copy to python array
 		return y
 
+	def snapshot(self):
+		"""(frames, y) = snapshot()
+
+		   Return the number of frames received so far and the most recent
+		   sensor readings (same as read()), without waiting for a new frame.
+		"""
+		cdef double cy[DIMY+1]
+		frames = vsa_arduino_interface_snapshot(&self.AI, cy, NULL)
+		return frames, [cy[i] for i in range(0,DIMY+1)]
+
+	def drain(self):
+		"""frames = drain()
+
+		   Return all frames received since the last call (oldest first) as a
+		   list of (sequence, y) pairs, without waiting. y is as returned by
+		   read(); sequence numbers count from 0 for the first frame, gaps
+		   indicate frames lost on the serial line.
+
+		   Every frame is kept in a history of HISTORY_LENGTH frames (about 5 s),
+		   independently of read() and run_step(), so e.g. a logger or GUI can
+		   call this at its own rate without losing data. Frames not drained in
+		   time are counted in get_statistics()['history_overruns'].
+		"""
+		cdef double cy[HISTORY_LENGTH*(DIMY+1)]
+		cdef unsigned long cs[HISTORY_LENGTH]
+		cdef int n = vsa_arduino_interface_drain(&self.AI, cy, cs, HISTORY_LENGTH)
+		return [(cs[k], [cy[k*(DIMY+1)+i] for i in range(0,DIMY+1)]) for k in range(0,n)]
+
+	def start_impedance_control(self, position, stiffness, gain_d=0):
+		"""stiffness = start_impedance_control(position, stiffness, gain_d=0)
+
+		   Hold the joint at position (rad) with the given passive stiffness
+		   (Nm/rad) plus damping gain_d (Nms/rad), with the controller of
+		   maccepa_impedance_controller.h run by the i/o thread on every frame
+		   (no Python in the loop). May be called again to change the target.
+		   Returns the stiffness actually set (limited by the stiffness motor).
+		"""
+		maccepa_impedance_controller_set_target(&self.C, position, stiffness)
+		self.C.gain_d = gain_d
+		vsa_arduino_interface_set_controller(&self.AI, maccepa_impedance_controller_step, &self.C)
+		return self.C.gain_p
+
+	def stop_control(self):
+		"""stop_control()
+
+		   Stop the controller started with start_impedance_control(); the last
+		   command is held until the next write() or run_step().
+		"""
+		vsa_arduino_interface_set_controller(&self.AI, NULL, NULL)
+
+	def start_estimator(self, position_noise=None, acceleration_noise=None, jerk_noise=None, model_noise=None):
+		"""start_estimator(position_noise=None, acceleration_noise=None, jerk_noise=None, model_noise=None)
+
+		   Run the state estimator in the i/o thread: a Kalman filter fusing the
+		   joint angle and accelerometer readings with the dynamics model,
+		   giving filtered position, velocity and acceleration (see
+		   read_estimate()). The noise parameters are standard deviations
+		   (see vsa_estimator.h), None for the defaults.
+		"""
+		cdef VsaEstimatorNoise noise
+		vsa_estimator_default_noise(&noise)
+		if position_noise     is not None: noise.position     = position_noise
+		if acceleration_noise is not None: noise.acceleration = acceleration_noise
+		if jerk_noise         is not None: noise.jerk         = jerk_noise
+		if model_noise        is not None: noise.model        = model_noise
+		vsa_arduino_interface_start_estimator(&self.AI, &noise)
+
+	def stop_estimator(self):
+		"""stop_estimator()
+
+		   Stop the state estimator.
+		"""
+		vsa_arduino_interface_stop_estimator(&self.AI)
+
+	def read_estimate(self):
+		"""pos,vel,acc,timestamp = read_estimate()
+
+		   Return the latest state estimate, without waiting (None if the
+		   estimator is not running or has not had a frame yet). After read() or
+		   run_step() it belongs to the same frame as the sensor readings.
+		"""
+		cdef double cx[4]
+		if not vsa_arduino_interface_read_estimate(&self.AI, cx): return None
+		return [cx[i] for i in range(0,4)]
+
+	def read_prediction(self):
+		"""pos,vel,acc,time = read_prediction()
+
+		   Return the state predicted (with the dynamics model) for the time at
+		   which a command sent now takes effect on the robot, i.e., after the
+		   transport delay of about 1.4 frame periods (None if the estimator is
+		   not running or the frame period has not been measured yet). Acting
+		   on this rather than on read() allows higher feedback gains.
+		"""
+		cdef double cx[4]
+		if not vsa_arduino_interface_read_prediction(&self.AI, cx): return None
+		return [cx[i] for i in range(0,4)]
+
+	def get_statistics(self):
+		"""stats = get_statistics()
+
+		   Return a dictionary of communication statistics: frames_received,
+		   frames_dropped (from gaps in the frame sequence numbers), resyncs
+		   (number of invalid frames discarded), crc_errors (frames discarded
+		   due to a CRC mismatch), write_errors and history_overruns (frames
+		   lost because drain() was not called in time).
+		"""
+		cdef ArduinoInterfaceStatistics s
+		vsa_arduino_interface_get_statistics(&self.AI, &s)
+		return {'frames_received':s.frames_received, 'frames_dropped':s.frames_dropped,
+		        'resyncs':s.resyncs, 'crc_errors':s.crc_errors, 'write_errors':s.write_errors,
+		        'history_overruns':s.history_overruns}
+
+	def get_timing(self):
+		"""timing = get_timing()
+
+		   Return a dictionary of frame timing statistics (all times in
+		   nanoseconds): intervals (number of inter-frame intervals measured),
+		   interval_min, interval_max, interval_mean, interval_std, jitter
+		   (running mean deviation from the nominal frame period), and
+		   histogram (list of counts, bin i covering
+		   [i*bin_width, (i+1)*bin_width); the last bin also counts all longer
+		   intervals) with its bin_width.
+		"""
+		cdef ArduinoInterfaceTiming t
+		vsa_arduino_interface_get_timing(&self.AI, &t)
+		return {'intervals':t.intervals, 'interval_min':t.interval_min_ns, 'interval_max':t.interval_max_ns,
+		        'interval_mean':t.interval_mean_ns, 'interval_std':t.interval_std_ns, 'jitter':t.jitter_ns,
+		        'histogram':[t.histogram[i] for i in range(0,TIMING_HISTOGRAM_BINS)], 'bin_width':TIMING_HISTOGRAM_BIN_NS}
+
+	def get_thread_settings(self):
+		"""settings = get_thread_settings()
+
+		   Return a dictionary with the scheduling settings in effect for the
+		   i/o thread: realtime, priority, cpu (-1 if not pinned),
+		   memory_locked and stack_prefaulted.
+		"""
+		cdef ArduinoInterfaceThreadSettings s
+		vsa_arduino_interface_get_thread_settings(&self.AI, &s)
+		return {'realtime':s.realtime, 'priority':s.priority, 'cpu':s.cpu,
+		        'memory_locked':s.memory_locked, 'stack_prefaulted':s.stack_prefaulted}
+
 	def write(self, u): 
 		"""write(u)
 
 		   Command new motor positions u0, u1.
 
-		   This function will NOT block, and there is no guarantee
-		   about when the new positions will be sent to the servos.
+		   This function will NOT block. The new positions are sent
+		   in reply to the next frame received from the robot.
 		"""
 		if len(u)<DIMU: 
 			print "Command must be a list of double values of length %d." % DIMU
@@ -211,8 +574,8 @@ cdef class HardwareInterface:
 
 		   Note: 
 
-		 	1. This function will NOT block, and there is no guarantee
-			   about when the new positions will be sent to the servos. 
+		 	1. This function will NOT block. The new positions are sent
+			   in reply to the next frame received from the robot. 
 
 			2. This function will not limit commands to a fixed range!
 
@@ -29,9 +29,7 @@ def execute_test_trajectory():
 	robot.write(u[:,1])
 	time.sleep(3)
 
-	for n in range(0,N):
-		y=robot.run_step(u[:,n])
-		time.sleep(0.02)
+	y=robot.run_trajectory(u) # one step per frame, timed by the i/o thread
 	go_zeros()
 
 def direct_motor_control():
@@ -50,10 +48,11 @@ def direct_motor_control():
 	m1_scope    = gui.Scope(2,680,475,600,200,'Motor 1 Commanded/Actual Positions')
 	
 	m = [0,0]
+	robot.start_estimator()
 	while slb.checkExit() == 0:
 		u = slb.getValues()
 		y = robot.run_step(u)
-		qdot = (y[0]-q)/0.02; q = y[0]; qddot = y[1]; m[0]=y[2]; m[1]=y[3];
+		q,qdot,qddot,t = robot.read_estimate(); m[0]=y[2]; m[1]=y[3]; # filtered state of this frame
 		q_scope    .add([q])
 		qdot_scope .add([qdot])
 		qddot_scope.add([qddot])
@@ -80,12 +79,13 @@ def test_servo1():
 	m1_scope    = gui.Scope(2,680,475,600,200,'Motor 1 Commanded/Actual Positions')
 	
 	m = [0,0]
+	robot.start_estimator()
 	
 	for n in range(0,22):
 		u = slb.getValues()
 		u[0] = useq[n]
 		y = robot.run_step(u)
-		qdot = (y[0]-q)/0.02; q = y[0]; qddot = y[1]; m[0]=y[2]; m[1]=y[3];
+		q,qdot,qddot,t = robot.read_estimate(); m[0]=y[2]; m[1]=y[3]; # filtered state of this frame
 		q_scope    .add([q])
 		qdot_scope .add([qdot])
 		qddot_scope.add([qddot])
@@ -97,7 +97,7 @@ def test_servo1():
 	go_zeros()
 
 def emg_control():
-	"""Control motors directly with EMG."""
+	"""Control equilibrium position and stiffness with EMG (motor commands from the inverse model)."""
 	slb = gui.createSliderBox(10,'EMG Eq. Pos./Stiffness Control')
 	slb.setupSlider(0, 0,2000,'EMG High Pass'     ,0.1)
 	slb.setupSlider(1, 0,2000,'EMG Low Pass'      ,0.1)
@@ -106,22 +106,21 @@ def emg_control():
 	slb.setupSlider(4,-1,10  ,'EMG0 offset (red)' ,0.0001)
 	slb.setupSlider(5, 1,10  ,'EMG1 gain   (blue)',0.1)
 	slb.setupSlider(6,-1,10  ,'EMG1 offset (blue)',0.0001)
-	slb.setupSlider(7, 0,50  ,'u0 gain'           ,0.1)
-	slb.setupSlider(8, 0,50  ,'u1 gain'           ,0.1)
+	slb.setupSlider(7, 0,50  ,'q0 gain'           ,0.1)
+	slb.setupSlider(8, 0,5   ,'k gain'            ,0.01)
 	slb.setupSlider(9,-1,1   ,'Normal / Reverse'  ,1)
 	slb.setValues([60, 600, 2.24, 2.1, 0, 2.9, 0, 0, 0, 1])
 
         emg = audio.AudioInterface()
 
 	emg_scope = gui.Scope(2,620,0,600,200,'EMG Signals')
-	u0_scope  = gui.Scope(2,620,250,600,200,'Desired/actual equilibrium position')
-	u1_scope  = gui.Scope(2,620,475,600,200,'Desired/actual stiffness')
+	q0_scope  = gui.Scope(2,620,250,600,200,'Desired/actual equilibrium position')
+	k_scope   = gui.Scope(2,620,475,600,200,'Desired/actual stiffness')
 
-	u1min = .01
+	kmin = .01
 
 	a  = zeros([2,1])
-	u  = zeros([robot.dimU,1])
-	ud = zeros([robot.dimU,1])
+	u  = [0]*robot.dimU
 	while slb.checkExit()==0:
 		v = slb.getValues()
 		emg.setHP(v[0])
@@ -136,14 +135,16 @@ def emg_control():
 			emg_scope.add(a)
 
 			# estimate desired eq. pos and stiffness
-			ud[0] = v[9]*v[7]*( a[0] - a[1]) # u0 (= q0) -> scaled difference between signals 
-			ud[1] = v[8]*((a[0] + a[1] - math.fabs(a[0] - a[1]))/2)+u1min # u1 (= k) -> min of the two signals
+			q0d = v[9]*v[7]*( a[0] - a[1]) # q0 -> scaled difference between signals 
+			kd  = v[8]*((a[0] + a[1] - math.fabs(a[0] - a[1]))/2)+kmin # k -> min of the two signals
 
-			u = robot.clip_commands(ud)
+			# motor commands realising them (clipped to the motor ranges if out of reach)
+			u = model.getCommand(q0d,kd,u)[0]
+			u = robot.clip_commands(u)
 
 			y = robot.run_step(u)
-			u0_scope.add([ud[0],u[0]])
-			u1_scope.add([ud[1],u[1]])
+			q0_scope.add([q0d,model.getEquilibriumPosition([u[0],0],u)])
+			k_scope .add([kd ,model.getStiffness([u[0],0],u)])
 
 
 if __name__ == "__main__":
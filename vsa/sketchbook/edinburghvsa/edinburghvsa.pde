@@ -24,6 +24,7 @@
  *
  */
 #include "defines.h"
+#include <vsa_frame.h>
 
 union {
 	struct {
@@ -42,11 +43,10 @@ command_buffer;
 /** 
  * \brief Transmit buffer: bit-string used for sending sensor values back to
  *  the PC via the serial interface. Bit-string is TRANSMIT_LENGTH bytes in length (1x unsigned int = 2x char = 2x bytes = 2x 8 bits). 
+ *  This is the payload of the sensor frames (see vsa_frame.h).
  */
 union {
 	struct {
-		/** \brief Header. */
-		unsigned int header;
 		/** \brief Joint potentiometer reading. */
 		unsigned int position;
 		/** \brief Joint accelerometer reading. */
@@ -62,10 +62,19 @@ union {
 /** \brief Temporary variable for storing bytes read from the serial. */
 unsigned char input;
 
-/** \brief Variable for keeping track of which position in receive struct we are reading from. */
-unsigned char receive_position;
+/** \brief Decoder for command frames received from the serial. */
+VsaFrameDecoder decoder;
 
-/** \brief Variable for keeping track of which position in transmit struct we are sending from. */
+/** \brief Encoded sensor frame (transmit_buffer, byte-stuffed and with sequence number and CRC). */
+unsigned char frame[VSA_FRAME_MAX_ENCODED];
+
+/** \brief Length of the encoded sensor frame. */
+unsigned char frame_length;
+
+/** \brief Sequence number of the next sensor frame. */
+unsigned char frame_sequence;
+
+/** \brief Variable for keeping track of which position in the encoded frame we are sending from. */
 unsigned char transmit_position;
 
 int posAccu;
@@ -80,14 +89,13 @@ int motAccu2;
 void setup() {
   
   Serial.begin(BAUDRATE);     // Set the serial speed
-  receive_position = 0;           // reset reading position to zero 
+  vsa_frame_decoder_init(&decoder); // reset command frame decoder
   command_buffer.u0 = U_INIT_SERVO0;     // set initial command for motor 0
   command_buffer.u1 = U_INIT_SERVO1;     // set initial command for motor 1
   posAccu = 0;           // reset sensor measurements to zero
   accAccuX = accAccuY = 0;
   motAccu1 = motAccu2 = 0;
-  transmit_buffer.bytes[0] = 0xFF; // set up headers for transmit_buffer
-  transmit_buffer.bytes[1] = 0xFF; // 
+  frame_length = frame_sequence = 0; // nothing to send yet
 
   digitalWrite(9, LOW);  // set digital pin 9 to LOW (i.e., 0V )
   pinMode(9, OUTPUT);    // set digital pin 9 as an output pin (for sending signal to servo 1).
@@ -146,9 +154,10 @@ ISR(TIMER1_OVF_vect) {
    transmit_buffer.m0 = motAccu1;
    transmit_buffer.m1 = motAccu2;
    posAccu = accAccuY = motAccu1 = motAccu2 = 0; // reset these variables (only needed if using oversampling for noise reduction)
-   transmit_position = 1;          // ??
+   frame_length = vsa_frame_encode(frame, VSA_FRAME_SENSOR, frame_sequence++, transmit_buffer.bytes, TRANSMIT_LENGTH); // encode sensor frame
+   transmit_position = 1;          // the remaining bytes are sent by the USART Tx Complete interrupt
    
-   Serial.write(0xFF);       // write the first header
+   Serial.write(frame[0]);   // write the first byte of the frame
    UCSR0B |= 0x40;
 }
 
@@ -167,28 +176,27 @@ ISR(TIMER2_OVF_vect) {
 }
 
 ISR(USART_TX_vect) {
-   UDR0 = transmit_buffer.bytes[transmit_position++];
-   if (transmit_position>=TRANSMIT_LENGTH) {
+   UDR0 = frame[transmit_position++];
+   if (transmit_position>=frame_length) {
       UCSR0B &= 0xBF;
    }
 }
 
 /** 
- * \brief Main loop. Listens for serial communications, copies these to the command buffer when a full command has been recieved.
+ * \brief Main loop. Listens for serial communications, copies these to the command buffer when a valid command frame has been recieved.
+ *
+ * Corrupted frames (bad CRC, wrong length or type) are dropped, and the decoder resynchronises at the next frame delimiter.
  */
 void loop() {
 	if (Serial.available()>0) {                               // if new data at serial...
 		input = Serial.read();                                // ...read byte
-		if (input == RECEIVE_HEADER) {                        // header flags a new command
-			receive_position = 0;                             // reset receive_position to zero
-		} else {
-			receive_buffer.bytes[receive_position++] = input; // copy byte to receive buffer
-			if (receive_position == RECEIVE_LENGTH) {         // if all bytes have been read, command motors, reset receive_position
-				cli();                                        // suspend interrupts
-				command_buffer = receive_buffer;              // write received data to command_buffer
-				sei();                                        // re-enable interrupts
-				receive_position = 0;                         // reset reading position to zero
-			}
+		if (vsa_frame_decode(&decoder, input) == VSA_FRAME_OK // if a complete, valid command frame has been received...
+		    && decoder.type   == VSA_FRAME_COMMAND
+		    && decoder.length == RECEIVE_LENGTH) {
+			memcpy(receive_buffer.bytes, decoder.payload, RECEIVE_LENGTH); // ...copy payload to receive buffer
+			cli();                                        // suspend interrupts
+			command_buffer = receive_buffer;              // write received data to command_buffer
+			sei();                                        // re-enable interrupts
 		}
 	}
 }
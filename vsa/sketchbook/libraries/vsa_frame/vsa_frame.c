@@ -0,0 +1,125 @@
+/**
+ * \file vsa_frame.c
+ *
+ * \brief Framing layer for the serial protocol between the host and the
+ * Arduino control boards (COBS byte stuffing, sequence numbers, CRC-16).
+ */
+#include "vsa_frame.h"
+
+uint16_t vsa_frame_crc16 ( uint16_t crc, const uint8_t *data, uint8_t length ) {
+	uint8_t i, j;
+
+	/* Bitwise (no table), to keep the sketches' RAM/flash footprint small. */
+	for ( i = 0; i < length; i += 1 ) {
+		crc ^= (uint16_t)data[i] << 8;
+		for ( j = 0; j < 8; j += 1 ) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+/** \brief State of the streaming COBS encoder used by vsa_frame_encode(). */
+typedef struct {
+	uint8_t *frame;
+	/** \brief Position of the code byte of the current block. */
+	uint8_t code_position;
+	/** \brief Next write position. */
+	uint8_t position;
+	/** \brief Code of the current block (1 + number of non-zero bytes). */
+	uint8_t code;
+} CobsEncoder;
+
+static void cobs_put ( CobsEncoder *C, uint8_t byte ) {
+	if (byte != 0) {
+		C->frame[C->position++] = byte;
+		C->code++;
+	}
+	if (byte == 0 || C->code == 0xFF) { /* close the block */
+		C->frame[C->code_position] = C->code;
+		C->code_position = C->position++;
+		C->code = 1;
+	}
+}
+
+uint8_t vsa_frame_encode ( uint8_t *frame, uint8_t type, uint8_t sequence, const uint8_t *payload, uint8_t length ) {
+	CobsEncoder C;
+	uint8_t header[VSA_FRAME_HEADER_LENGTH];
+	uint16_t crc;
+	uint8_t i;
+
+	if (length > VSA_FRAME_MAX_PAYLOAD) return 0;
+
+	header[0] = VSA_FRAME_VERSION;
+	header[1] = type;
+	header[2] = sequence;
+	header[3] = length;
+	crc = vsa_frame_crc16(0xFFFF, header, VSA_FRAME_HEADER_LENGTH);
+	crc = vsa_frame_crc16(crc, payload, length);
+
+	C.frame = frame;
+	C.code_position = 0;
+	C.position = 1;
+	C.code = 1;
+	for ( i = 0; i < VSA_FRAME_HEADER_LENGTH; i += 1 ) cobs_put(&C, header[i]);
+	for ( i = 0; i < length; i += 1 ) cobs_put(&C, payload[i]);
+	cobs_put(&C, crc & 0xFF);
+	cobs_put(&C, crc >> 8);
+	frame[C.code_position] = C.code;
+	frame[C.position++] = VSA_FRAME_DELIMITER;
+	return C.position;
+}
+
+void vsa_frame_decoder_init ( VsaFrameDecoder *D ) {
+	D->position = 0;
+	D->overflow = 0;
+	D->type = D->sequence = D->length = 0;
+	D->payload = D->buffer + VSA_FRAME_HEADER_LENGTH;
+}
+
+/**
+ * \brief COBS decode D->buffer in place, then check the packet.
+ */
+static int8_t decode_packet ( VsaFrameDecoder *D ) {
+	uint8_t *b = D->buffer;
+	uint8_t n = D->position, in = 0, out = 0, code, i;
+	uint16_t crc;
+
+	/* Undo byte stuffing (the output never overtakes the input). */
+	while (in < n) {
+		code = b[in++];
+		if (code == 0 || code - 1 > n - in) return VSA_FRAME_ERROR_ENCODING;
+		for ( i = 1; i < code; i += 1 ) b[out++] = b[in++];
+		if (code < 0xFF && in < n) b[out++] = 0;
+	}
+
+	if (out < VSA_FRAME_HEADER_LENGTH+VSA_FRAME_CRC_LENGTH) return VSA_FRAME_ERROR_LENGTH;
+	if (b[3] != out - VSA_FRAME_HEADER_LENGTH - VSA_FRAME_CRC_LENGTH) return VSA_FRAME_ERROR_LENGTH;
+	if (b[0] != VSA_FRAME_VERSION) return VSA_FRAME_ERROR_VERSION;
+	crc = vsa_frame_crc16(0xFFFF, b, out - VSA_FRAME_CRC_LENGTH);
+	if (b[out-2] != (crc & 0xFF) || b[out-1] != (crc >> 8)) return VSA_FRAME_ERROR_CRC;
+
+	D->type     = b[1];
+	D->sequence = b[2];
+	D->length   = b[3];
+	D->payload  = b + VSA_FRAME_HEADER_LENGTH;
+	return VSA_FRAME_OK;
+}
+
+int8_t vsa_frame_decode ( VsaFrameDecoder *D, uint8_t byte ) {
+	int8_t result;
+
+	if (byte != VSA_FRAME_DELIMITER) {
+		if (D->position < VSA_FRAME_MAX_ENCODED) D->buffer[D->position++] = byte;
+		else                                     D->overflow = 1;
+		return VSA_FRAME_INCOMPLETE;
+	}
+
+	/* Delimiter: the frame is complete (an empty frame, e.g., idle line, is ignored). */
+	if (D->overflow)            result = VSA_FRAME_ERROR_OVERFLOW;
+	else if (D->position == 0)  result = VSA_FRAME_INCOMPLETE;
+	else                        result = decode_packet(D);
+	D->position = 0;
+	D->overflow = 0;
+	return result;
+}
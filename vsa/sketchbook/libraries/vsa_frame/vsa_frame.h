@@ -0,0 +1,125 @@
+/**
+ * \file vsa_frame.h
+ *
+ * \brief Framing layer for the serial protocol between the host and the
+ * Arduino control boards of the variable stiffness actuators.
+ *
+ * This is shared by the host (vsa_arduino_interface.c) and the sketches (as
+ * an Arduino library in sketchbook/libraries), so it is written in plain C
+ * without dynamic memory.
+ *
+ * Each frame is a packet
+ * \code
+ *   version | type | sequence | length | payload[length] | crc16 (lsb, msb)
+ * \endcode
+ * that is COBS byte-stuffed and terminated with a single VSA_FRAME_DELIMITER
+ * (0x00) byte. As the delimiter never occurs inside an encoded frame, the
+ * payload can use all 8 bits of every byte, and a receiver that has lost
+ * track (e.g., due to line noise) is back in sync at the next delimiter,
+ * i.e., after at most one frame. The CRC is CRC-16/CCITT (polynomial 0x1021,
+ * initial value 0xFFFF) over version, type, sequence, length and payload.
+ */
+#ifndef __vsa_frame_h
+#define __vsa_frame_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** \brief Protocol version (first byte of every packet). */
+#define VSA_FRAME_VERSION 1
+/** \brief Frame delimiter (never occurs inside a COBS encoded frame). */
+#define VSA_FRAME_DELIMITER 0x00
+
+/** \brief Frame type of sensor readings (Arduino to host). */
+#define VSA_FRAME_SENSOR  0x01
+/** \brief Frame type of motor commands (host to Arduino). */
+#define VSA_FRAME_COMMAND 0x02
+
+/** \brief Maximum payload length in bytes. */
+#define VSA_FRAME_MAX_PAYLOAD 32
+/** \brief Length of packet header (version, type, sequence, length). */
+#define VSA_FRAME_HEADER_LENGTH 4
+/** \brief Length of CRC. */
+#define VSA_FRAME_CRC_LENGTH 2
+/** \brief Maximum length of a packet before encoding. */
+#define VSA_FRAME_MAX_PACKET (VSA_FRAME_HEADER_LENGTH+VSA_FRAME_MAX_PAYLOAD+VSA_FRAME_CRC_LENGTH)
+/** \brief Maximum length of an encoded frame, including COBS overhead and delimiter. */
+#define VSA_FRAME_MAX_ENCODED (VSA_FRAME_MAX_PACKET+VSA_FRAME_MAX_PACKET/254+2)
+
+/** \brief Return value of vsa_frame_decode(): more bytes needed. */
+#define VSA_FRAME_INCOMPLETE       0
+/** \brief Return value of vsa_frame_decode(): valid frame decoded. */
+#define VSA_FRAME_OK               1
+/** \brief Return value of vsa_frame_decode(): frame longer than VSA_FRAME_MAX_ENCODED. */
+#define VSA_FRAME_ERROR_OVERFLOW  -1
+/** \brief Return value of vsa_frame_decode(): invalid COBS encoding. */
+#define VSA_FRAME_ERROR_ENCODING  -2
+/** \brief Return value of vsa_frame_decode(): packet too short, or length field does not match. */
+#define VSA_FRAME_ERROR_LENGTH    -3
+/** \brief Return value of vsa_frame_decode(): unknown protocol version. */
+#define VSA_FRAME_ERROR_VERSION   -4
+/** \brief Return value of vsa_frame_decode(): CRC mismatch. */
+#define VSA_FRAME_ERROR_CRC       -5
+
+/** \brief Incremental frame decoder. */
+typedef struct {
+	/** \brief Bytes received since the last delimiter (decoded in place once the delimiter arrives). */
+	uint8_t buffer[VSA_FRAME_MAX_ENCODED];
+	/** \brief Number of bytes in buffer. */
+	uint8_t position;
+	/** \brief Set if the current frame did not fit into buffer (it is discarded at the next delimiter). */
+	uint8_t overflow;
+	/** \brief Type of the last decoded frame. */
+	uint8_t type;
+	/** \brief Sequence number of the last decoded frame. */
+	uint8_t sequence;
+	/** \brief Payload length of the last decoded frame. */
+	uint8_t length;
+	/** \brief Payload of the last decoded frame (points into buffer, valid until the next call to vsa_frame_decode()). */
+	uint8_t *payload;
+} VsaFrameDecoder;
+
+/**
+ * \brief Update a CRC-16/CCITT with the given bytes.
+ * \param[in] crc CRC so far (0xFFFF to start).
+ * \param[in] data bytes.
+ * \param[in] length number of bytes.
+ * \return updated CRC.
+ */
+uint16_t vsa_frame_crc16 ( uint16_t crc, const uint8_t *data, uint8_t length );
+/**
+ * \brief Encode a frame.
+ * \param[out] frame encoded frame (at least VSA_FRAME_MAX_ENCODED bytes).
+ * \param[in] type frame type (e.g., VSA_FRAME_SENSOR).
+ * \param[in] sequence sequence number.
+ * \param[in] payload payload bytes.
+ * \param[in] length payload length (at most VSA_FRAME_MAX_PAYLOAD).
+ * \return number of bytes in frame, including the delimiter (0 if length is too large).
+ */
+uint8_t vsa_frame_encode ( uint8_t *frame, uint8_t type, uint8_t sequence, const uint8_t *payload, uint8_t length );
+/**
+ * \brief Reset a decoder (discarding any partially received frame).
+ * \param D decoder.
+ */
+void vsa_frame_decoder_init ( VsaFrameDecoder *D );
+/**
+ * \brief Feed one received byte to a decoder.
+ * \param D decoder.
+ * \param[in] byte received byte.
+ * \return VSA_FRAME_INCOMPLETE, VSA_FRAME_OK (D->type, D->sequence,
+ * D->length and D->payload hold the frame), or one of the (negative)
+ * VSA_FRAME_ERROR_* codes if the frame just completed is invalid.
+ *
+ * \note Bytes received before the first delimiter (e.g., the tail of a frame
+ * that was partly lost) form an invalid frame and are reported as an error.
+ */
+int8_t vsa_frame_decode ( VsaFrameDecoder *D, uint8_t byte );
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
@@ -22,6 +22,7 @@
  * 
  */
 #include "defines.h"
+#include <vsa_frame.h>
 
 union {
 	struct {
@@ -44,11 +45,10 @@ command_buffer;
 /** 
  * \brief Transmit buffer: bit-string used for sending sensor values back to
  *  the PC via the serial interface. Bit-string is TRANSMIT_LENGTH bytes in length (1x unsigned int = 2x char = 2x bytes = 2x 8 bits). 
+ *  This is the payload of the sensor frames (see vsa_frame.h).
  */
 union {
 	struct {
-		/** \brief Header. */
-		unsigned int header;
 		/** \brief Joint position sensor (potentiometer) reading. */
 		unsigned int position;
 		/** \brief Accelerometer reading. */
@@ -66,10 +66,19 @@ union {
 /** \brief Temporary variable for storing bytes read from the serial. */
 unsigned char input;
 
-/** \brief Variable for keeping track of which position in receive struct we are reading from. */
-unsigned char receive_position;
+/** \brief Decoder for command frames received from the serial. */
+VsaFrameDecoder decoder;
 
-/** \brief Variable for keeping track of which position in transmit struct we are sending from. */
+/** \brief Encoded sensor frame (transmit_buffer, byte-stuffed and with sequence number and CRC). */
+unsigned char frame[VSA_FRAME_MAX_ENCODED];
+
+/** \brief Length of the encoded sensor frame. */
+unsigned char frame_length;
+
+/** \brief Sequence number of the next sensor frame. */
+unsigned char frame_sequence;
+
+/** \brief Variable for keeping track of which position in the encoded frame we are sending from. */
 unsigned char transmit_position;
 
 /** \brief Position sensor accumulator.       */
@@ -92,13 +101,12 @@ void setup() {
   Serial.write(0x01);         // Write a bit to the serial using the inbuilt Serial library
                               // - this sets up the communication register 
                               // \todo this should not be necessary, if we find out how to set the serial properly.
-  receive_position = 0;                // Reset command message position counter
+  vsa_frame_decoder_init(&decoder);    // Reset command frame decoder
   
   command_buffer.u0 = U_INIT_SERVO0; // Set initial command for motor 0
   command_buffer.u1 = U_INIT_SERVO1; // Set initial command for motor 1
 
-  transmit_buffer.bytes[0] = TRANSMIT_HEADER0;   // Set transmit headers
-  transmit_buffer.bytes[1] = TRANSMIT_HEADER1;   // 
+  frame_length = frame_sequence = 0;   // Nothing to send yet
   
   posAccu = accAccuY = motAccu1 = motAccu2 = powerAccu = 0; // Reset accumulators
   
@@ -164,7 +172,7 @@ void setup_timers() {
  *   This triggers the following events:
  *     \li The motor commands are copied from the command message buffer to the servos.
  *     \li Timer 2 is reset.
- *     \li The sensor readings are copied from the accumulators to the transmit message buffer.
+ *     \li The sensor readings are copied from the accumulators to the transmit message buffer, which is encoded as a sensor frame.
  *     \li The accumulators are reset.
  */
 ISR(TIMER1_OVF_vect) {
@@ -188,6 +196,9 @@ ISR(TIMER1_OVF_vect) {
    
    // Reset accumulators
    posAccu = accAccuY = motAccu1 = motAccu2 = powerAccu = 0; 
+
+   // Encode sensor frame
+   frame_length = vsa_frame_encode(frame, VSA_FRAME_SENSOR, frame_sequence++, transmit_buffer.bytes, TRANSMIT_LENGTH);
    
    // Reset transmit message position counter
    transmit_position = 0;   
@@ -214,38 +225,37 @@ ISR(TIMER2_OVF_vect) {
  *
  * This is initiated by the USART Tx Complete Interrupt, triggered by setting TXCIE0 bit in UCSR0B
  *
- * The data contained in the transmit message buffer is 
+ * The encoded sensor frame is 
  * copied (byte-wise) to the USART data register (UDR0) 
  * and sent via the serial.
  */
 ISR(USART_TX_vect) {
   
-  // Copy next byte of transmit message buffer to serial register (i.e., send)
-  UDR0 = transmit_buffer.bytes[transmit_position++];
+  // Copy next byte of encoded frame to serial register (i.e., send)
+  UDR0 = frame[transmit_position++];
   
-  // Once we have reached the end of the transmit buffer, switch the TXCIE0 bit of UCSR0B. 
+  // Once we have reached the end of the frame, switch the TXCIE0 bit of UCSR0B. 
   // This resets the USART control.
-  if (transmit_position>=TRANSMIT_LENGTH) {
+  if (transmit_position>=frame_length) {
       UCSR0B &= ~_BV(TXCIE0); 
   }
 }
 
 /** 
- * \brief Main loop. Listens for serial communications, copies these to the command buffer when a full command has been recieved.
+ * \brief Main loop. Listens for serial communications, copies these to the command buffer when a valid command frame has been recieved.
+ *
+ * Corrupted frames (bad CRC, wrong length or type) are dropped, and the decoder resynchronises at the next frame delimiter.
  */
 void loop() {
 	if (Serial.available()>0) {                               // if new data at serial...
 		input = Serial.read();                                // ...read byte
-		if (input == RECEIVE_HEADER) {                        // header flags a new command
-			receive_position = 0;                             // reset receive_position to zero
-		} else {
-			receive_buffer.bytes[receive_position++] = input; // copy byte to receive buffer
-			if (receive_position == RECEIVE_LENGTH) {            // if all bytes have been read, command motors, reset receive_position
-				cli();                                        // suspend interrupts
-				command_buffer = receive_buffer;              // write received data to command_buffer
-				sei();                                        // re-enable interrupts
-				receive_position = 0;                         // reset reading position to zero
-			}
+		if (vsa_frame_decode(&decoder, input) == VSA_FRAME_OK // if a complete, valid command frame has been received...
+		    && decoder.type   == VSA_FRAME_COMMAND
+		    && decoder.length == RECEIVE_LENGTH) {
+			memcpy(receive_buffer.bytes, decoder.payload, RECEIVE_LENGTH); // ...copy payload to receive buffer
+			cli();                                        // suspend interrupts
+			command_buffer = receive_buffer;              // write received data to command_buffer
+			sei();                                        // re-enable interrupts
 		}
 	}
 }
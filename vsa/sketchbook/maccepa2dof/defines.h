@@ -34,18 +34,20 @@
 #define DIMY 6
 #endif
 
-/** \brief Baudrate used for serial communication. */
+/** 
+ * \brief Baudrate used for serial communication.
+ *
+ * \note The host and the sketch must use the same rate. This may be
+ * overridden per robot (e.g., -DBAUDRATE=1000000). The ATmega328 at 16MHz
+ * generates 250000, 500000, 1000000 and 2000000 baud exactly.
+ */
+#ifndef BAUDRATE
 #define BAUDRATE 38400
-/** \brief No. of bytes in 'transmit' bit-string. */
-#define TRANSMIT_LENGTH 2*(DIMY+1)
-/** \brief First header byte of 'transmit' bit-string. */
-#define TRANSMIT_HEADER0 0xFF
-/** \brief Second header byte of 'transmit' bit-string. */
-#define TRANSMIT_HEADER1 0xFF
-/** \brief No. of bytes in 'receive' bit-string. */
+#endif
+/** \brief No. of payload bytes in 'transmit' (sensor) frames (see sketchbook/libraries/vsa_frame). */
+#define TRANSMIT_LENGTH 2*DIMY
+/** \brief No. of payload bytes in 'receive' (command) frames (see sketchbook/libraries/vsa_frame). */
 #define RECEIVE_LENGTH 2*DIMU
-/** \brief Header byte of 'receive' bit-string. */
-#define RECEIVE_HEADER 0xFF
 
 /** \brief PWM output pin on Arduino for controlling Servo 0. */
 #define OUTPUT_PIN_SERVO0 11
@@ -12,6 +12,7 @@
  *
  */
 #include "defines.h"
+#include <vsa_frame.h>
 
 
 #ifdef VARIABLE_DAMPING
@@ -58,11 +59,10 @@ command_buffer;
 /** 
  * \brief Transmit buffer: bit-string used for sending sensor values back to
  *  the PC via the serial interface. Bit-string is TRANSMIT_LENGTH bytes in length (1x unsigned int = 2x char = 2x bytes = 2x 8 bits). 
+ *  This is the payload of the sensor frames (see vsa_frame.h).
  */
 union {
 	struct {
-		/** \brief Header. */
-		unsigned int header;
 		/** \brief Base joint potentiometer reading. */
 		unsigned int q0;
 		/** \brief Second joint potentiometer reading. */
@@ -92,10 +92,19 @@ union {
 /** \brief Temporary variable for storing bytes read from the serial. */
 unsigned char input;
 
-/** \brief Variable for keeping track of which position in receive struct we are reading from. */
-unsigned char receive_position;
+/** \brief Decoder for command frames received from the serial. */
+VsaFrameDecoder decoder;
 
-/** \brief Variable for keeping track of which position in transmit struct we are sending from. */
+/** \brief Encoded sensor frame (transmit_buffer, byte-stuffed and with sequence number and CRC). */
+unsigned char frame[VSA_FRAME_MAX_ENCODED];
+
+/** \brief Length of the encoded sensor frame. */
+unsigned char frame_length;
+
+/** \brief Sequence number of the next sensor frame. */
+unsigned char frame_sequence;
+
+/** \brief Variable for keeping track of which position in the encoded frame we are sending from. */
 unsigned char transmit_position;
 
 /** \brief Sensor accumulator. Each sensor is read at 4x the control frequency. This array contains the sum of these 4 readings, for each sensor. Reading the sensors this way has a filtering effect, that smoothes out noise. */
@@ -115,13 +124,12 @@ void setup() {
   Serial.write(0x01);         // Write a bit to the serial using the inbuilt Serial library
 
   transmit_position=0;                                              // Initialise transmit_position, transmit_buffer
-  for(i=0;i<TRANSMIT_LENGTH;i++) { transmit_buffer.bytes[i]=0x00; } // (headers are fixed, body set to zeros).
-  transmit_buffer.bytes[0] = TRANSMIT_HEADER0;   
-  transmit_buffer.bytes[1] = TRANSMIT_HEADER1;
+  for(i=0;i<TRANSMIT_LENGTH;i++) { transmit_buffer.bytes[i]=0x00; } // (body set to zeros).
+  frame_length = frame_sequence = 0;                                // Nothing to send yet
 
   for(i=0;i<DIMY;i++) { y_acc[i]=0; } // Initialise sensor accumulators
 
-  receive_position=0; // Initialise receive_position, receive_buffer 
+  vsa_frame_decoder_init(&decoder); // Initialise command frame decoder, receive_buffer 
   receive_buffer.u0 =  U_INIT_SERVO0; command_buffer.u0 =  U_INIT_SERVO0; // Set initial command for servo0
   receive_buffer.u1 =  U_INIT_SERVO1; command_buffer.u1 =  U_INIT_SERVO1; // Set initial command for servo1
   receive_buffer.u2 =  U_INIT_SERVO2; command_buffer.u2 =  U_INIT_SERVO2; // Set initial command for servo2
@@ -239,7 +247,7 @@ void setup_timers() {
  * 
  * This triggers the following events:
  *   \li Motor commands are copied from the command buffer to the servos.
- *   \li Sensor readings are copied from the accumulators to the transmit buffer.
+ *   \li Sensor readings are copied from the accumulators to the transmit buffer, which is encoded as a sensor frame.
  *   \li Timer2 and Timer3 are reset (to ensure synchronisation).
  *   \li The accumulators are reset.
  *   \li The serial transmitter is enabled (triggering the USART Tx Complete interrupt).
@@ -287,6 +295,7 @@ ISR(TIMER1_OVF_vect) {
     for(i=0;i<DIMY;i++) { y_acc[i]=0; }
     
     // send readings via serial
+    frame_length = vsa_frame_encode(frame, VSA_FRAME_SENSOR, frame_sequence++, transmit_buffer.bytes, TRANSMIT_LENGTH);
     transmit_position = 0; // reset the transmit position
     UCSR0B |= _BV(TXCIE0); // Switch on the TXCIE0 bit of the USART control and status register (UCSR0B)).
                            // This triggers the USART Transmit Complete Interrupt (USART_TX_vect)
@@ -316,35 +325,34 @@ ISR(TIMER2_OVF_vect) {
 /** 
  * \brief USART Tx Complete Interrupt. 
  *
- * This copies the sensor data in the transmit buffer for serial transmission. When all bytes have been copied, the transmitter is switched off.
+ * This copies the encoded sensor frame for serial transmission. When all bytes have been copied, the transmitter is switched off.
  */
 ISR(USART0_TX_vect) {
-  // Copy next byte of transmit message buffer to serial register (i.e., send)
-  UDR0 = transmit_buffer.bytes[transmit_position++];
+  // Copy next byte of encoded frame to serial register (i.e., send)
+  UDR0 = frame[transmit_position++];
   
-  // Once we have reached the end of the transmit buffer, switch the TXCIE0 bit of UCSR0B. 
+  // Once we have reached the end of the frame, switch the TXCIE0 bit of UCSR0B. 
   // This resets the USART control.
-  if (transmit_position>=TRANSMIT_LENGTH) {
+  if (transmit_position>=frame_length) {
       UCSR0B &= ~_BV(TXCIE0);
   }
 }
 
 /** 
- * \brief Main loop. Listens for serial communications, copies these to the command buffer when a full command has been recieved.
+ * \brief Main loop. Listens for serial communications, copies these to the command buffer when a valid command frame has been recieved.
+ *
+ * Corrupted frames (bad CRC, wrong length or type) are dropped, and the decoder resynchronises at the next frame delimiter.
  */
 void loop() {
 	if (Serial.available()>0) {                               // if new data at serial...
 		input = Serial.read();                                // ...read byte
-		if (input == RECEIVE_HEADER) {                        // header flags a new command
-			receive_position = 0;                             // reset receive_position to zero
-		} else {
-			receive_buffer.bytes[receive_position++] = input; // copy byte to receive buffer
-			if (receive_position == RECEIVE_LENGTH) {         // if all bytes have been read, command motors, reset receive_position
-				cli();                                        // suspend interrupts
-				command_buffer = receive_buffer;              // write received data to command_buffer
-				sei();                                        // re-enable interrupts
-				receive_position = 0;                         // reset reading position to zero
-			}
+		if (vsa_frame_decode(&decoder, input) == VSA_FRAME_OK // if a complete, valid command frame has been received...
+		    && decoder.type   == VSA_FRAME_COMMAND
+		    && decoder.length == RECEIVE_LENGTH) {
+			memcpy(receive_buffer.bytes, decoder.payload, RECEIVE_LENGTH); // ...copy payload to receive buffer
+			cli();                                        // suspend interrupts
+			command_buffer = receive_buffer;              // write received data to command_buffer
+			sei();                                        // re-enable interrupts
 		}
 	}
 }
@@ -0,0 +1,445 @@
+/**
+ * \file edinburghvsa_table.c
+ * \brief Precomputed maps of the equilibrium position and stiffness of the Edinburgh VSA (see edinburghvsa_table.h).
+ * \ingroup edinburghvsa
+ */
+#include <stdlib.h>
+#include <edinburghvsa_table.h>
+
+/** \brief Identifies (and versions) the cache files. */
+static const char magic[8] = "EVSATAB2";
+
+/** \brief Clip v to [lo, hi]. */
+static double clip ( double v, double lo, double hi ) {
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+/**
+ * \brief Equilibrium position and stiffness with their gradients, from the model.
+ * \param[in] model model struct
+ * \param[in] u command
+ * \param[in] start joint position to start the equilibrium search from
+ * \param[out] f q0 and k0
+ * \param[out] J gradients of q0 (J[0], J[1]) and k0 (J[2], J[3])
+ * \return status of the equilibrium search
+ *
+ * The stiffness at the equilibrium changes with u both directly and through
+ * the equilibrium, \f$\nabla k_0=\frac{\partial k}{\partial\mathbf{u}}+\frac{\partial k}{\partial q}\nabla q_0\f$
+ * (all analytic, see edinburghvsa_model_evaluate()).
+ */
+static int exact ( edinburghvsa_model *model, double *u, double start, double *f, double *J ) {
+	edinburghvsa_model_evaluation e;
+	double x[DIMX] = { start, 0 };
+	int status;
+
+	status = edinburghvsa_model_solve_equilibrium_position(&x[0], x, u, model, NULL);
+	edinburghvsa_model_evaluate(&e, x, u, model, NULL);
+
+	f[0] = e.equilibrium_position;
+	f[1] = e.stiffness;
+	J[0] = e.equilibrium_position_jacobian[0];
+	J[1] = e.equilibrium_position_jacobian[1];
+	J[2] = e.stiffness_jacobian[0] + e.stiffness_position_derivative*J[0];
+	J[3] = e.stiffness_jacobian[1] + e.stiffness_position_derivative*J[1];
+
+	return status;
+}
+
+/** \brief Cubic Hermite basis functions (A: values, B: slopes) and their derivatives at s. */
+static void hermite ( double s, double *A, double *B, double *dA, double *dB ) {
+	double s2 = s*s, s3 = s2*s;
+
+	A[0]  = 1-3*s2+2*s3;  A[1]  = 3*s2-2*s3;
+	B[0]  = s-2*s2+s3;    B[1]  = s3-s2;
+	dA[0] = 6*s2-6*s;     dA[1] = 6*s-6*s2;
+	dB[0] = 1-4*s+3*s2;   dB[1] = 3*s2-2*s;
+}
+
+/**
+ * \brief Interpolate within a cell.
+ * \param[in] T table
+ * \param[in] c cell (lower corner node)
+ * \param[in] s position within the cell (0 to 1 along each axis)
+ * \param[out] f q0 and k0
+ * \param[out] J gradients of q0 (J[0], J[1]) and k0 (J[2], J[3])
+ */
+static void interpolate ( const edinburghvsa_table *T, int *c, double *s, double *f, double *J ) {
+	double A0[2], B0[2], dA0[2], dB0[2], A1[2], B1[2], dA1[2], dB1[2];
+	double h0 = T->h[0], h1 = T->h[1];
+	const double *N;
+	int a, b, m;
+
+	hermite(s[0], A0, B0, dA0, dB0);
+	hermite(s[1], A1, B1, dA1, dB1);
+	for ( m = 0; m < 2; m += 1 ) {
+		f[m] = J[2*m] = J[2*m+1] = 0;
+		for ( b = 0; b < 2; b += 1 ) {
+			for ( a = 0; a < 2; a += 1 ) {
+				N = &T->node[((c[1]+b)*T->n[0]+c[0]+a)*EDINBURGHVSA_TABLE_FIELDS + 4*m];
+				f[m]     +=  A0[a]*A1[b]*N[0] + h0* B0[a]*A1[b]*N[1] + h1* A0[a]*B1[b]*N[2] + h0*h1* B0[a]*B1[b]*N[3];
+				J[2*m]   += (dA0[a]*A1[b]*N[0] + h0*dB0[a]*A1[b]*N[1] + h1*dA0[a]*B1[b]*N[2] + h0*h1*dB0[a]*B1[b]*N[3])/h0;
+				J[2*m+1] += (A0[a]*dA1[b]*N[0] + h0*B0[a]*dA1[b]*N[1] + h1*A0[a]*dB1[b]*N[2] + h0*h1*B0[a]*dB1[b]*N[3])/h1;
+			}
+		}
+	}
+}
+
+/**
+ * \brief Derivative of node field m along axis d, by finite differences over the valid neighbours.
+ */
+static double difference ( const edinburghvsa_table *T, int i, int j, int d, int m ) {
+	int stride = d == 0 ? 1 : T->n[0], k = d == 0 ? i : j;
+	int node = j*T->n[0]+i;
+	int lo = k > 0           && T->valid[node-stride] ? node-stride : node;
+	int hi = k < T->n[d]-1   && T->valid[node+stride] ? node+stride : node;
+
+	if (lo == hi) return 0;
+	return (T->node[hi*EDINBURGHVSA_TABLE_FIELDS+m] - T->node[lo*EDINBURGHVSA_TABLE_FIELDS+m])/((hi-lo)/stride*T->h[d]);
+}
+
+/** \brief Allocate the table for n0 x n1 nodes (the model must be set). */
+static int allocate ( edinburghvsa_table *T, int n0, int n1 ) {
+	T->n[0]  = n0;
+	T->n[1]  = n1;
+	T->h[0]  = (T->model.umax[0]-T->model.umin[0])/(n0-1);
+	T->h[1]  = (T->model.umax[1]-T->model.umin[1])/(n1-1);
+	T->node  = malloc(n0*n1*EDINBURGHVSA_TABLE_FIELDS*sizeof(double));
+	T->valid = malloc(n0*n1);
+	T->error = malloc((n0-1)*(n1-1)*2*sizeof(double));
+	if (T->node == NULL || T->valid == NULL || T->error == NULL) {
+		edinburghvsa_table_free(T);
+		return 0;
+	}
+	return 1;
+}
+
+/** \brief Compute the nodes and the cell errors. */
+static void build ( edinburghvsa_table *T ) {
+	/* points at which the interpolation is checked: edge midpoints and a 3x3 grid inside */
+	static const double check[13][2] = { { 0.5, 0 }, { 0.5, 1 }, { 0, 0.5 }, { 1, 0.5 },
+		{ 0.25, 0.25 }, { 0.5, 0.25 }, { 0.75, 0.25 },
+		{ 0.25, 0.5  }, { 0.5, 0.5  }, { 0.75, 0.5  },
+		{ 0.25, 0.75 }, { 0.5, 0.75 }, { 0.75, 0.75 } };
+	int i, j, m, p, c[DIMU], n0 = T->n[0], n1 = T->n[1];
+	double u[DIMU], f[2], J[4], fe[2], Je[4], start = 0, *N, *e;
+
+	for ( j = 0; j < n1; j += 1 ) {
+		for ( i = 0; i < n0; i += 1 ) {
+			/* warm start from the neighbouring node */
+			if      (i > 0 && T->valid[j*n0+i-1])   start = T->node[(j*n0+i-1)*EDINBURGHVSA_TABLE_FIELDS];
+			else if (j > 0 && T->valid[(j-1)*n0+i]) start = T->node[((j-1)*n0+i)*EDINBURGHVSA_TABLE_FIELDS];
+			else                                    start = 0;
+			u[0] = T->model.umin[0] + i*T->h[0];
+			u[1] = T->model.umin[1] + j*T->h[1];
+			T->valid[j*n0+i] = exact(&T->model, u, start, f, J) == EDINBURGHVSA_EQUILIBRIUM_CONVERGED;
+			N = &T->node[(j*n0+i)*EDINBURGHVSA_TABLE_FIELDS];
+			N[0] = f[0]; N[1] = J[0]; N[2] = J[1]; N[3] = 0;
+			N[4] = f[1]; N[5] = J[2]; N[6] = J[3]; N[7] = 0;
+		}
+	}
+
+	/* mixed derivatives */
+	for ( j = 0; j < n1; j += 1 ) {
+		for ( i = 0; i < n0; i += 1 ) {
+			if (!T->valid[j*n0+i]) continue;
+			N = &T->node[(j*n0+i)*EDINBURGHVSA_TABLE_FIELDS];
+			for ( m = 0; m < 8; m += 4 ) {
+				N[m+3] = 0.5*(difference(T, i, j, 1, m+1) + difference(T, i, j, 0, m+2));
+			}
+		}
+	}
+
+	/* interpolation error */
+	for ( j = 0; j < n1-1; j += 1 ) {
+		for ( i = 0; i < n0-1; i += 1 ) {
+			e = &T->error[2*(j*(n0-1)+i)];
+			if (!T->valid[j*n0+i] || !T->valid[j*n0+i+1] || !T->valid[(j+1)*n0+i] || !T->valid[(j+1)*n0+i+1]) {
+				e[0] = e[1] = HUGE_VAL;
+				continue;
+			}
+			e[0] = e[1] = 0;
+			c[0] = i; c[1] = j;
+			for ( p = 0; p < 13; p += 1 ) {
+				interpolate(T, c, (double *)check[p], f, J);
+				u[0] = T->model.umin[0] + (i+check[p][0])*T->h[0];
+				u[1] = T->model.umin[1] + (j+check[p][1])*T->h[1];
+				if (exact(&T->model, u, f[0], fe, Je) != EDINBURGHVSA_EQUILIBRIUM_CONVERGED) {
+					e[0] = e[1] = HUGE_VAL;
+					break;
+				}
+				if (fabs(f[0]-fe[0]) > e[0]) e[0] = fabs(f[0]-fe[0]);
+				if (fabs(f[1]-fe[1]) > e[1]) e[1] = fabs(f[1]-fe[1]);
+			}
+		}
+	}
+}
+
+int edinburghvsa_table_init ( edinburghvsa_table *T, edinburghvsa_model *model, int n0, int n1, const char *cache ) {
+	T->node  = NULL;
+	T->valid = NULL;
+	T->error = NULL;
+	if (n0 < 2 || n1 < 2) return 0;
+	if (cache != NULL && edinburghvsa_table_load(T, cache, model, n0, n1)) return 1;
+
+	T->model = *model;
+	if (!allocate(T, n0, n1)) return 0;
+	build(T);
+	if (cache != NULL && !edinburghvsa_table_save(T, cache)) {
+		fputs("Warning: could not save the Edinburgh VSA table cache.\n",stderr);
+	}
+	return 1;
+}
+
+void edinburghvsa_table_free ( edinburghvsa_table *T ) {
+	free(T->node);
+	free(T->valid);
+	free(T->error);
+	T->node  = NULL;
+	T->valid = NULL;
+	T->error = NULL;
+}
+
+int edinburghvsa_table_save ( const edinburghvsa_table *T, const char *path ) {
+	int n0 = T->n[0], n1 = T->n[1], ok;
+	FILE *file = fopen(path, "wb");
+
+	if (file == NULL) return 0;
+	ok = fwrite(magic, sizeof(magic), 1, file) == 1
+	  && fwrite(T->n, sizeof(T->n), 1, file) == 1
+	  && fwrite(&T->model, sizeof(T->model), 1, file) == 1
+	  && fwrite(T->node, n0*n1*EDINBURGHVSA_TABLE_FIELDS*sizeof(double), 1, file) == 1
+	  && fwrite(T->valid, n0*n1, 1, file) == 1
+	  && fwrite(T->error, (n0-1)*(n1-1)*2*sizeof(double), 1, file) == 1;
+	if (fclose(file) != 0) ok = 0;
+	if (!ok) remove(path);
+	return ok;
+}
+
+int edinburghvsa_table_load ( edinburghvsa_table *T, const char *path, edinburghvsa_model *model, int n0, int n1 ) {
+	char m[sizeof(magic)];
+	int n[DIMU], ok;
+	edinburghvsa_model key;
+	FILE *file = fopen(path, "rb");
+
+	T->node  = NULL;
+	T->valid = NULL;
+	T->error = NULL;
+	if (file == NULL) return 0;
+	ok = fread(m, sizeof(m), 1, file) == 1 && memcmp(m, magic, sizeof(magic)) == 0
+	  && fread(n, sizeof(n), 1, file) == 1 && n[0] == n0 && n[1] == n1
+	  && fread(&key, sizeof(key), 1, file) == 1 && memcmp(&key, model, sizeof(key)) == 0;
+	if (ok) {
+		T->model = *model;
+		ok = allocate(T, n0, n1)
+		  && fread(T->node, n0*n1*EDINBURGHVSA_TABLE_FIELDS*sizeof(double), 1, file) == 1
+		  && fread(T->valid, n0*n1, 1, file) == 1
+		  && fread(T->error, (n0-1)*(n1-1)*2*sizeof(double), 1, file) == 1;
+		if (!ok) edinburghvsa_table_free(T);
+	}
+	fclose(file);
+	return ok;
+}
+
+int edinburghvsa_table_lookup ( const edinburghvsa_table *T, double *u, const double *tolerance, double *q0, double *k, double *Jq0, double *Jk ) {
+	double s[DIMU], f[2], J[4], start = 0;
+	const double *e;
+	int c[DIMU], d, inside = 1, usable, status = EDINBURGHVSA_TABLE_INTERPOLATED;
+
+	for ( d = 0; d < DIMU; d += 1 ) {
+		s[d] = (u[d]-T->model.umin[d])/T->h[d];
+		if (s[d] < 0)           { s[d] = 0;           inside = 0; }
+		if (s[d] > T->n[d]-1)   { s[d] = T->n[d]-1;   inside = 0; }
+		c[d] = (int)s[d];
+		if (c[d] > T->n[d]-2) c[d] = T->n[d]-2;
+		s[d] -= c[d];
+	}
+	e = &T->error[2*(c[1]*(T->n[0]-1)+c[0])];
+	usable = !isinf(e[0]);
+	if (usable) {
+		interpolate(T, c, s, f, J);
+		start = f[0];
+	}
+	if (!usable || (tolerance != NULL && (!inside || e[0] > tolerance[0] || e[1] > tolerance[1]))) {
+		status = exact((edinburghvsa_model *)&T->model, u, start, f, J) == EDINBURGHVSA_EQUILIBRIUM_CONVERGED ? EDINBURGHVSA_TABLE_EXACT : EDINBURGHVSA_TABLE_FAILED;
+	}
+
+	q0[0] = f[0];
+	k[0]  = f[1];
+	if (Jq0 != NULL) { Jq0[0] = J[0]; Jq0[1] = J[1]; }
+	if (Jk  != NULL) { Jk [0] = J[2]; Jk [1] = J[3]; }
+	return status;
+}
+
+/** \brief Default convergence tolerance of the inverse model without a lookup tolerance (q0 in rad, k in Nm/rad). */
+static const double command_tolerance[2] = { 1e-6, 1e-5 };
+
+/**
+ * \brief Newton step \f$-\mathbf{J}^{-1}\mathbf{r}\f$ for the residual r, with J the gradients of q0 (J[0], J[1]) and k0 (J[2], J[3]).
+ * \return zero if J is singular.
+ */
+static int newton_step ( const double *J, const double *r, double *du ) {
+	double det = J[0]*J[3]-J[1]*J[2];
+
+	if (det == 0 || !isfinite(det)) return 0;
+	du[0] = -( J[3]*r[0]-J[1]*r[1])/det;
+	du[1] = -(-J[2]*r[0]+J[0]*r[1])/det;
+	return 1;
+}
+
+/** \brief Number of grid nodes tried as starting points by edinburghvsa_table_solve_command(). */
+#define STARTS 4
+
+/**
+ * \brief Newton iteration of the inverse model from u (see edinburghvsa_table_solve_command()).
+ * \param[out] error weighted squared residual at the returned u.
+ *
+ * Where a motor is at its limit and the step pushes it further, it is held
+ * there and the other motor takes the Gauss-Newton step. Steps that increase
+ * the residual (weighted by the tolerances) are halved. If the residual stops
+ * decreasing, u is the closest the motors get to the target.
+ */
+static int solve_from ( const edinburghvsa_table *T, double *u, double *target, const double *lookup, const double *converge, double *error ) {
+	double f[2], J[4], r[2] = { 0, 0 }, du[2], w[2], u1[DIMU], e2;
+	int d, e, pinned, stalled, iter, halvings = 0;
+
+	w[0] = 1/(converge[0]*converge[0]);
+	w[1] = 1/(converge[1]*converge[1]);
+	*error = HUGE_VAL;
+	du[0] = du[1] = 0;
+	u1[0] = u[0];
+	u1[1] = u[1];
+	for ( iter = 0; iter < EDINBURGHVSA_COMMAND_MAX_ITER; iter += 1 ) {
+		if (edinburghvsa_table_lookup(T, u1, lookup, &f[0], &f[1], &J[0], &J[2]) == EDINBURGHVSA_TABLE_FAILED) e2 = HUGE_VAL;
+		else {
+			r[0] = f[0]-target[0];
+			r[1] = f[1]-target[1];
+			e2   = w[0]*r[0]*r[0] + w[1]*r[1]*r[1];
+		}
+		if (!(e2 < *error)) {
+			/* back off towards u */
+			if (halvings == 8 || *error == HUGE_VAL) break;
+			halvings += 1;
+			du[0] *= 0.5;
+			du[1] *= 0.5;
+			for ( d = 0; d < DIMU; d += 1 ) { u1[d] = clip(u[d]+du[d], T->model.umin[d], T->model.umax[d]); }
+			continue;
+		}
+		halvings = 0;
+		stalled  = *error-e2 < 1e-6*e2;
+		*error = e2;
+		u[0] = u1[0];
+		u[1] = u1[1];
+		if (fabs(r[0]) <= converge[0] && fabs(r[1]) <= converge[1]) return EDINBURGHVSA_COMMAND_EXACT;
+		if (stalled) return EDINBURGHVSA_COMMAND_CLIPPED;
+
+		if (!newton_step(J, r, du)) {
+			/* singular: gradient direction, scaled to a grid cell */
+			du[0] = -(w[0]*J[0]*r[0] + w[1]*J[2]*r[1]);
+			du[1] = -(w[0]*J[1]*r[0] + w[1]*J[3]*r[1]);
+			e2 = hypot(du[0], du[1]);
+			if (!(e2 > 0)) return EDINBURGHVSA_COMMAND_CLIPPED;
+			du[0] *= T->h[0]/e2;
+			du[1] *= T->h[1]/e2;
+		}
+		pinned = -1;
+		for ( d = 0; d < DIMU; d += 1 ) {
+			if ((u[d] <= T->model.umin[d] && du[d] < 0) || (u[d] >= T->model.umax[d] && du[d] > 0)) {
+				if (pinned >= 0) return EDINBURGHVSA_COMMAND_CLIPPED;
+				pinned = d;
+			}
+		}
+		if (pinned >= 0) {
+			e = 1-pinned;
+			du[pinned] = 0;
+			du[e] = -(w[0]*J[e]*r[0] + w[1]*J[2+e]*r[1])/(w[0]*J[e]*J[e] + w[1]*J[2+e]*J[2+e]);
+			if (!(fabs(du[e]) > 1e-9)) return EDINBURGHVSA_COMMAND_CLIPPED;
+		}
+		for ( d = 0; d < DIMU; d += 1 ) {
+			if (fabs(du[d]) > 2*T->h[d]) du[d] = copysign(2*T->h[d], du[d]);
+			u1[d] = clip(u[d]+du[d], T->model.umin[d], T->model.umax[d]);
+		}
+	}
+
+	/* no further progress: u is a local best fit */
+	return halvings == 8 ? EDINBURGHVSA_COMMAND_CLIPPED : EDINBURGHVSA_COMMAND_NOT_CONVERGED;
+}
+
+int edinburghvsa_table_solve_command ( const edinburghvsa_table *T, double *u, double *target, const double *tolerance, int warm ) {
+	double lookup[2], converge[2], scale[2], lo[2] = { HUGE_VAL, HUGE_VAL }, hi[2] = { -HUGE_VAL, -HUGE_VAL };
+	double distance[STARTS], us[DIMU], d2, e2 = HUGE_VAL, best;
+	const double *tol = NULL, *N;
+	int start[STARTS], node, i, m, status = EDINBURGHVSA_COMMAND_NOT_CONVERGED;
+
+	if (tolerance != NULL) {
+		lookup[0] = converge[0] = 0.5*tolerance[0];
+		lookup[1] = converge[1] = 0.5*tolerance[1];
+		tol = lookup;
+	} else {
+		converge[0] = command_tolerance[0];
+		converge[1] = command_tolerance[1];
+	}
+
+	if (warm) {
+		status = solve_from(T, u, target, tol, converge, &e2);
+		if (status == EDINBURGHVSA_COMMAND_EXACT) return status;
+	}
+
+	/* The STARTS nodes closest to the target (relative to the ranges of q0 and k0). */
+	for ( node = 0; node < T->n[0]*T->n[1]; node += 1 ) {
+		if (!T->valid[node]) continue;
+		N = &T->node[node*EDINBURGHVSA_TABLE_FIELDS];
+		for ( m = 0; m < 2; m += 1 ) {
+			if (N[4*m] < lo[m]) lo[m] = N[4*m];
+			if (N[4*m] > hi[m]) hi[m] = N[4*m];
+		}
+	}
+	scale[0] = hi[0] > lo[0] ? 1/(hi[0]-lo[0]) : 1;
+	scale[1] = hi[1] > lo[1] ? 1/(hi[1]-lo[1]) : 1;
+	for ( i = 0; i < STARTS; i += 1 ) { start[i] = -1; distance[i] = HUGE_VAL; }
+	for ( node = 0; node < T->n[0]*T->n[1]; node += 1 ) {
+		if (!T->valid[node]) continue;
+		N  = &T->node[node*EDINBURGHVSA_TABLE_FIELDS];
+		d2 = pow((N[0]-target[0])*scale[0], 2) + pow((N[4]-target[1])*scale[1], 2);
+		for ( i = STARTS-1; i >= 0 && d2 < distance[i]; i -= 1 ) {
+			if (i < STARTS-1) { distance[i+1] = distance[i]; start[i+1] = start[i]; }
+			distance[i] = d2;
+			start[i]    = node;
+		}
+	}
+
+	/* Newton from each of them, until one reaches the target (otherwise keep the best fit). */
+	best = warm ? e2 : HUGE_VAL;
+	for ( i = 0; i < STARTS && start[i] >= 0; i += 1 ) {
+		us[0] = T->model.umin[0] + (start[i]%T->n[0])*T->h[0];
+		us[1] = T->model.umin[1] + (start[i]/T->n[0])*T->h[1];
+		m = solve_from(T, us, target, tol, converge, &e2);
+		if (e2 < best || m == EDINBURGHVSA_COMMAND_EXACT) {
+			best   = e2;
+			status = m;
+			u[0]   = us[0];
+			u[1]   = us[1];
+		}
+		if (m == EDINBURGHVSA_COMMAND_EXACT) break;
+	}
+
+	return status;
+}
+
+int edinburghvsa_table_solve_command_batch ( const edinburghvsa_table *T, double *U, int *status, double *target, int n, const double *tolerance ) {
+	double u[DIMU], t[2];
+	int j, s = EDINBURGHVSA_COMMAND_NOT_CONVERGED, failed = 0;
+
+	u[0] = 0.5*(T->model.umin[0]+T->model.umax[0]);
+	u[1] = 0.5*(T->model.umin[1]+T->model.umax[1]);
+	for ( j = 0; j < n; j += 1 ) {
+		t[0] = target[j];
+		t[1] = target[n+j];
+		s = edinburghvsa_table_solve_command(T, u, t, tolerance, s == EDINBURGHVSA_COMMAND_EXACT);
+		U[j]   = u[0];
+		U[n+j] = u[1];
+		if (status != NULL) status[j] = s;
+		if (s != EDINBURGHVSA_COMMAND_EXACT) failed += 1;
+	}
+
+	return failed;
+}
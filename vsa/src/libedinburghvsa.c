@@ -82,6 +82,9 @@
  * \ingroup edinburghvsa
  * \sa <a href="../m2html/MACCEPA/m-files/dynamics/index.html">Matlab wrappers to this library</a>
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* sincos() */
+#endif
 #include <libedinburghvsa.h>
 
 /**
@@ -99,6 +102,168 @@ cross ( double a[3], double b[3], double c[3] )
 	return ;
 }		/* -----  end of function cross  ----- */
 
+/**
+ * \brief Torque and stiffness due to one spring, with their derivatives with respect to the motor position (and of the stiffness with respect to q).
+ * \param[out] tau torque due to this spring
+ * \param[out] f spring tension \f$\kappa(s-s_0)\f$
+ * \param[out] k stiffness due to this spring
+ * \param[out] dtaudu derivative of the torque with respect to the motor position
+ * \param[out] dkdu derivative of the stiffness with respect to the motor position
+ * \param[out] dkdq derivative of the stiffness with respect to the joint position
+ * \param[in] ai,daidq moment arm and its derivative with respect to q
+ * \param[in] p,dpdu mounting point of the spring on the servo lever and its derivative with respect to the motor position
+ * \param[in] model model struct
+ *
+ * With \f$\mathbf{s}=\mathbf{p}-\mathbf{a}\f$, \f$s=|\mathbf{s}|\f$ and
+ * \f$c=\hat{\mathbf z}^\top(\mathbf{a}\times\mathbf{p})\f$ (so that
+ * \f$\hat{\mathbf z}^\top(\mathbf{a}\times\mathbf{s})=c\f$), the torque is
+ * \f$\tau=\kappa(1-\frac{s_0}{s})c\f$, hence
+ * \f$\frac{\partial\tau}{\partial u}=\kappa\left(\frac{s_0}{s^2}\frac{\partial s}{\partial u}c+(1-\frac{s_0}{s})\frac{\partial c}{\partial u}\right)\f$,
+ * \f$k=-\frac{\partial\tau}{\partial q}\f$ likewise, and
+ * \f$\frac{\partial k}{\partial u}\f$ and \f$\frac{\partial k}{\partial q}\f$ follow by
+ * differentiating once more (the moment arm turns with q, so
+ * \f$\frac{\partial^2\mathbf{a}}{\partial q^2}=-\mathbf{a}\f$), with all cross
+ * products taken with cross().
+ */
+	static void
+spring_derivatives ( double * tau, double * f, double * k, double * dtaudu, double * dkdu, double * dkdq, double ai[3], double daidq[3], double p[3], double dpdu[3], edinburghvsa_model * model )
+{
+	double K = model->spring_constant;
+	double r = model->spring_rest_length;
+	double s[3] = { p[0]-ai[0], p[1]-ai[1], 0 };
+	double n    = sqrt(s[0]*s[0]+s[1]*s[1]);
+	double sa   = s[0]*daidq[0]+s[1]*daidq[1];
+	double dndq = -sa/n;
+	double dndu = (s[0]*dpdu[0]+s[1]*dpdu[1])/n;
+	double d2ndqdu = -(dpdu[0]*daidq[0]+dpdu[1]*daidq[1])/n + sa*dndu/(n*n);
+	double d2ndq2  = (daidq[0]*daidq[0]+daidq[1]*daidq[1] + s[0]*ai[0]+s[1]*ai[1])/n - dndq*dndq/n;
+	double c[3], dcdq[3], dcdu[3], d2cdqdu[3];
+
+	cross(ai   , p   , c      );
+	cross(daidq, p   , dcdq   );
+	cross(ai   , dpdu, dcdu   );
+	cross(daidq, dpdu, d2cdqdu);
+
+	tau[0]    = K*(1-r/n)*c[2];
+	f[0]      = K*(n-r);
+	k[0]      = -K*( r*dndq/(n*n)*c[2] + (1-r/n)*dcdq[2] );
+	dtaudu[0] = K*( r*dndu/(n*n)*c[2] + (1-r/n)*dcdu[2] );
+	dkdu[0]   = -K*( r*( d2ndqdu*c[2] - 2*dndq*dndu*c[2]/n + dndq*dcdu[2] )/(n*n)
+	                + r*dndu/(n*n)*dcdq[2] + (1-r/n)*d2cdqdu[2] );
+	dkdq[0]   = -K*( r*( d2ndq2*c[2] - 2*dndq*dndq*c[2]/n + 2*dndq*dcdq[2] )/(n*n)
+	                - (1-r/n)*c[2] );
+
+	return ;
+}		/* -----  end of function spring_derivatives  ----- */
+
+/**
+ * \brief Sine and cosine of a (with one call where the C library provides sincos()).
+ */
+	static void
+sin_cos ( double a, double * s, double * c )
+{
+#ifdef __GLIBC__
+	sincos(a, s, c);
+#else
+	s[0] = sin(a);
+	c[0] = cos(a);
+#endif
+
+	return ;
+}		/* -----  end of function sin_cos  ----- */
+
+/**
+ * \brief Torque and stiffness of both springs, with their derivatives (see spring_derivatives()).
+ * \param[out] tau actuator torque
+ * \param[out] f tensions of the two springs
+ * \param[out] k stiffness
+ * \param[out] dtaudu derivatives of the actuator torque with respect to the motor positions
+ * \param[out] dkdu derivatives of the stiffness with respect to the motor positions
+ * \param[out] dkdq derivative of the stiffness with respect to the joint position
+ * \param[in] q joint position
+ * \param[in] u command (motor positions in radiens)
+ * \param[in] model model struct
+ */
+	static void
+actuator_derivatives ( double * tau, double * f, double * k, double * dtaudu, double * dkdu, double * dkdq, double q, double * u, edinburghvsa_model * model )
+{
+	double a = model->link_lever_length;
+	double L = model->lever_length;
+	double h = model->joint_to_motor_axis_x_separation;
+	double d = model->joint_to_motor_axis_y_separation;
+	double sinq, cosq, sinu0, cosu0, sinu1, cosu1;
+	double tau1, tau2, k1, k2, dkdq1, dkdq2;
+
+	sin_cos(q   , &sinq , &cosq );
+	sin_cos(u[0], &sinu0, &cosu0);
+	sin_cos(u[1], &sinu1, &cosu1);
+	{
+		double  a1[3]={-a*cosq,-a*sinq,0}, da1dq[3]={ a*sinq,-a*cosq,0};
+		double  a2[3]={ a*cosq, a*sinq,0}, da2dq[3]={-a*sinq, a*cosq,0};
+		double  p1[3]={-h-L*sinu0,-d+L*cosu0,0}, dp1du[3]={-L*cosu0,-L*sinu0,0};
+		double  p2[3]={ h+L*sinu1,-d+L*cosu1,0}, dp2du[3]={ L*cosu1,-L*sinu1,0};
+
+		spring_derivatives(&tau1, &f[0], &k1, &dtaudu[0], &dkdu[0], &dkdq1, a1, da1dq, p1, dp1du, model);
+		spring_derivatives(&tau2, &f[1], &k2, &dtaudu[1], &dkdu[1], &dkdq2, a2, da2dq, p2, dp2du, model);
+	}
+	tau[0]  = tau1+tau2;
+	k[0]    = k1+k2;
+	dkdq[0] = dkdq1+dkdq2;
+
+	return ;
+}		/* -----  end of function actuator_derivatives  ----- */
+
+/**
+ * \brief Actuator torque and stiffness (as edinburghvsa_model_get_actuator_torque() and edinburghvsa_model_get_stiffness(), sharing the common terms).
+ * \param[out] tau actuator torque
+ * \param[out] k stiffness
+ * \param[in] q joint position
+ * \param[in] u command (motor positions in radiens)
+ * \param[in] model model struct
+ *
+ * For each spring, with \f$c=\hat{\mathbf z}^\top(\mathbf{a}_i\times\mathbf{s}_i)=\hat{\mathbf z}^\top(\mathbf{a}_i\times\mathbf{p}_i)\f$,
+ * \f$\tau_i=\kappa(1-\frac{s_0}{s_i})c\f$ (see spring_derivatives()).
+ */
+	static void
+actuator_torque_and_stiffness ( double * tau, double * k, double q, double * u, edinburghvsa_model * model )
+{
+	double a = model->link_lever_length;
+	double L = model->lever_length;
+	double h = model->joint_to_motor_axis_x_separation;
+	double d = model->joint_to_motor_axis_y_separation;
+	double K = model->spring_constant;
+	double r = model->spring_rest_length;
+	double sign[2] = { -1, 1 }; /* a_1 = -a_2 */
+	double p[2][2], sinq, cosq, sinu, cosu, ac, as;
+	double ax, ay, dax, day, sx, sy, n, c, dcdq, dndq;
+	int i;
+
+	sin_cos(q, &sinq, &cosq);
+	ac = a*cosq;
+	as = a*sinq;
+	for ( i = 0; i < 2; i += 1 ) {
+		sin_cos(u[i], &sinu, &cosu);
+		p[i][0] = sign[i]*(h+L*sinu);
+		p[i][1] = -d+L*cosu;
+	}
+	tau[0] = 0;
+	k[0]   = 0;
+	for ( i = 0; i < 2; i += 1 ) {
+		ax   = sign[i]*ac;     ay  = sign[i]*as;
+		dax  = -ay;            day = ax;
+		sx   = p[i][0]-ax;     sy  = p[i][1]-ay;
+		n    = sqrt(sx*sx+sy*sy);
+		/* a x s = a x p, p does not depend on q */
+		c    = ax*p[i][1]-ay*p[i][0];
+		dcdq = dax*p[i][1]-day*p[i][0];
+		dndq = -(sx*dax+sy*day)/n;
+		tau[0] += K*(1-r/n)*c;
+		k[0]   -= K*( r*dndq/(n*n)*c + (1-r/n)*dcdq );
+	}
+
+	return ;
+}		/* -----  end of function actuator_torque_and_stiffness  ----- */
+
 
 /** \brief Initialise model struct (set default parameters).
  *  \param model model struct.
@@ -141,6 +306,8 @@ void edinburghvsa_model_init(edinburghvsa_model *model) {
  *
  *  This implements \f$ \ddot{q}(\mathbf{x},\mathbf{u}) = (\tau_{actuators} - \tau_{damping} - \tau_{gravity} - \tau_{friction})/I \f$
  *
+ *  \note src/vsa_dynamics_edinburghvsa.cpp has a templated copy of these equations
+ *  (for edinburghvsa_model_get_linearization()), which must be kept in sync.
  */
 void edinburghvsa_model_get_acceleration ( double * acc, double * x, double * u, edinburghvsa_model * model ) {
 
@@ -363,11 +530,30 @@ void edinburghvsa_model_get_stiffness ( double * k, double * x, double * u, edin
  *  \param[in]  u command (motor positions in radiens)
  *  \param[in]  model model struct
  *
- *  \todo This calculation is currently based on finite differences. Accuracy
- *  and effieciency could be improved by finding the analytic expression for
- *  this.
+ *  Each spring depends on one motor only, so \f$\frac{\partial k}{\partial u_i}\f$ is the
+ *  derivative of the stiffness due to spring i, differentiated analytically
+ *  (see spring_derivatives()).
+ *
+ *  \sa edinburghvsa_model_get_stiffness_jacobian_fd() for a finite difference version.
  */
 void edinburghvsa_model_get_stiffness_jacobian ( double * J, double * x, double * u, edinburghvsa_model * model ) {
+	double tau, f[2], k, dtaudu[DIMU], dkdq;
+
+	actuator_derivatives(&tau, f, &k, dtaudu, J, &dkdq, x[0], u, model);
+
+	return;
+}     
+
+/** \brief Calculate Jacobian of stiffness with respect to motor commands by central finite differences.
+ *  \param[out] J joint stiffness Jacobian
+ *  \param[in]  x state (velocity, acceleration)
+ *  \param[in]  u command (motor positions in radiens)
+ *  \param[in]  model model struct
+ *
+ *  This is slower and less accurate than edinburghvsa_model_get_stiffness_jacobian(),
+ *  against which it can be used for verification.
+ */
+void edinburghvsa_model_get_stiffness_jacobian_fd ( double * J, double * x, double * u, edinburghvsa_model * model ) {
 	double delta=1e-6;
 	double kp,km,ud[DIMU];
 
@@ -388,43 +574,107 @@ void edinburghvsa_model_get_stiffness_jacobian ( double * J, double * x, double
  *  \param[in]  u command (motor positions in radiens)
  *  \param[in]  model model struct
  *
- *  \todo This uses a line search around the current state. Efficiency could be improved by deriving the roots where tau=0 analytically.
- *
+ *  This searches from x[0], see edinburghvsa_model_solve_equilibrium_position(),
+ *  which also reports whether the search converged.
  */
 void edinburghvsa_model_get_equilibrium_position ( double * q0, double * x, double * u, edinburghvsa_model * model ) {
 
-	double last, step, tau;
-	double xt[DIMX] = {x[0],x[1]};
-	int iter = 0;
+	edinburghvsa_model_solve_equilibrium_position(q0, x, u, model, NULL);
 
-	last = 0.0;
-	step = 0.1;
+	return;
+}     
 
-	while(++iter<100) {
-		edinburghvsa_model_get_actuator_torque( &tau, xt, u, model );
-		if (fabs(tau) < 1e-8){
-			q0[0]=xt[0];
-			return;
-		}
-		if (tau>0) {
-			xt[0] += step;
-			if (last < 0) step*=0.5;
+/** \brief Find the equilibrium position (zero of the actuator torque) with a safeguarded Newton method.
+ *  \param[out] q0 joint equilibrium position (the last iterate if the search failed)
+ *  \param[in]  x state (the search starts from x[0], unless there is a warm start)
+ *  \param[in]  u command (motor positions in radiens)
+ *  \param[in]  model model struct
+ *  \param      cache warm start, or NULL. If valid, the search starts from its
+ *               q0, and it is updated with the result (invalidated on failure).
+ *  \return EDINBURGHVSA_EQUILIBRIUM_CONVERGED, EDINBURGHVSA_EQUILIBRIUM_NOT_CONVERGED
+ *          or EDINBURGHVSA_EQUILIBRIUM_NOT_FOUND.
+ *
+ *  Newton steps \f$q\leftarrow q+\tau/k\f$ use the analytic derivative of the
+ *  torque (\f$\partial\tau/\partial q=-k\f$). Until the root is bracketed by
+ *  iterates of opposite torque, steps are limited to
+ *  EDINBURGHVSA_EQUILIBRIUM_STEP in the direction of the torque (i.e., towards a
+ *  stable equilibrium), within \f$|q|\le\f$ EDINBURGHVSA_EQUILIBRIUM_RANGE (a
+ *  start outside the range is moved to its nearest end). Afterwards, steps
+ *  leaving the bracket are replaced by bisection. The search stops when a step
+ *  is below EDINBURGHVSA_EQUILIBRIUM_TOLERANCE. From a nearby start this
+ *  converges in two to four torque evaluations.
+ *
+ *  Equilibria outside \f$|q|\le\f$ EDINBURGHVSA_EQUILIBRIUM_RANGE are not
+ *  searched for, and are reported as EDINBURGHVSA_EQUILIBRIUM_NOT_FOUND.
+ */
+int edinburghvsa_model_solve_equilibrium_position ( double * q0, double * x, double * u, edinburghvsa_model * model, edinburghvsa_equilibrium_cache * cache ) {
+
+	double q = (cache != NULL && cache->valid) ? cache->q0 : x[0];
+	double tau, k, dq, qp = 0, qm = 0, lo, hi;
+	int hasp = 0, hasm = 0;
+	int iter, status = EDINBURGHVSA_EQUILIBRIUM_NOT_CONVERGED;
+
+	/* start within the range, or the first step leaving it would end the search */
+	if (q >  EDINBURGHVSA_EQUILIBRIUM_RANGE) q =  EDINBURGHVSA_EQUILIBRIUM_RANGE;
+	if (q < -EDINBURGHVSA_EQUILIBRIUM_RANGE) q = -EDINBURGHVSA_EQUILIBRIUM_RANGE;
+
+	for ( iter = 0; iter < EDINBURGHVSA_EQUILIBRIUM_MAX_ITER; iter += 1 ) {
+		actuator_torque_and_stiffness(&tau, &k, q, u, model);
+		if (tau == 0) { status = EDINBURGHVSA_EQUILIBRIUM_CONVERGED; break; }
+		if (tau > 0) { qp = q; hasp = 1; }
+		else         { qm = q; hasm = 1; }
+
+		dq = k > 0 ? tau/k : copysign(EDINBURGHVSA_EQUILIBRIUM_STEP, tau);
+		if (hasp && hasm) {
+			lo = qp < qm ? qp : qm;
+			hi = qp < qm ? qm : qp;
+			if (!(q+dq > lo && q+dq < hi)) dq = 0.5*(lo+hi)-q;
 		} else {
-			xt[0] -= step;
-			if (last > 0) step*=0.5;
+			if (fabs(dq) > EDINBURGHVSA_EQUILIBRIUM_STEP) dq = copysign(EDINBURGHVSA_EQUILIBRIUM_STEP, dq);
+			if (fabs(q+dq) > EDINBURGHVSA_EQUILIBRIUM_RANGE) {
+				if (fabs(q) >= EDINBURGHVSA_EQUILIBRIUM_RANGE) { status = EDINBURGHVSA_EQUILIBRIUM_NOT_FOUND; break; }
+				dq = copysign(EDINBURGHVSA_EQUILIBRIUM_RANGE, dq)-q;
+			}
 		}
-		last = tau;
+		q += dq;
+		if (fabs(dq) < EDINBURGHVSA_EQUILIBRIUM_TOLERANCE) { status = EDINBURGHVSA_EQUILIBRIUM_CONVERGED; break; }
 	}
-#ifdef MEX_INTERFACE
-	mexWarnMsgTxt(
-#else
-	fprintf(stderr,
-#endif
-	"Warning, eq. position calculation may be inaccurate!");
 
-	q0[0]=xt[0];
+	q0[0] = q;
+	if (cache != NULL) {
+		cache->q0    = q;
+		cache->valid = status == EDINBURGHVSA_EQUILIBRIUM_CONVERGED;
+	}
 
-	return;
+	return status;
+}     
+
+/** \brief Find the equilibrium positions for a batch of states and commands (see edinburghvsa_model_solve_equilibrium_position()).
+ *  \param[out] q0 n joint equilibrium positions
+ *  \param[out] status n convergence status, or NULL
+ *  \param[in]  X states (DIMX arrays of n elements: positions, then velocities)
+ *  \param[in]  U commands (DIMU arrays of n elements)
+ *  \param[in]  n number of samples
+ *  \param[in]  model model struct
+ *  \param      cache warm start, or NULL to start each search from its X[j].
+ *               Otherwise each search starts from the previous solution,
+ *               which suits commands along a trajectory.
+ *  \return number of samples for which the search did not converge.
+ */
+int edinburghvsa_model_get_equilibrium_position_batch ( double * q0, int * status, double * X, double * U, int n, edinburghvsa_model * model, edinburghvsa_equilibrium_cache * cache ) {
+
+	double x[DIMX], u[DIMU];
+	int j, s, failed = 0;
+
+	for ( j = 0; j < n; j += 1 ) {
+		x[0] = X[j]; x[1] = X[n+j];
+		u[0] = U[j]; u[1] = U[n+j];
+		s = edinburghvsa_model_solve_equilibrium_position(&q0[j], x, u, model, cache);
+		if (status != NULL) status[j] = s;
+		if (s != EDINBURGHVSA_EQUILIBRIUM_CONVERGED) failed += 1;
+	}
+
+	return failed;
 }     
 
 /** \brief Calculate Jacobian of equilibrium position with respect to motor commands (as a function of current state and command).
@@ -432,9 +682,39 @@ void edinburghvsa_model_get_equilibrium_position ( double * q0, double * x, doub
  *  \param[in]  x state (velocity, acceleration)
  *  \param[in]  u command (motor positions in radiens)
  *  \param[in]  model model struct
- *  \note This calculation is based on finite differences.
+ *
+ *  The equilibrium position \f$q_0\f$ is found once
+ *  (edinburghvsa_model_get_equilibrium_position()). Since
+ *  \f$\tau(q_0(\mathbf{u}),\mathbf{u})=0\f$, the implicit function theorem
+ *  gives \f$\frac{\partial q_0}{\partial u_i}=\frac{\partial\tau}{\partial u_i}/k(q_0,\mathbf{u})\f$.
+ *
+ *  \note The equilibrium is not differentiable where the stiffness
+ *  vanishes; J is then infinite.
+ *
+ *  \sa edinburghvsa_model_get_equilibrium_position_jacobian_fd() for a finite difference version.
  */
 void edinburghvsa_model_get_equilibrium_position_jacobian ( double * J, double * x, double * u, edinburghvsa_model * model ) {
+	double q0, tau, f[2], k, dtaudu[DIMU], dkdu[DIMU], dkdq;
+
+	edinburghvsa_model_get_equilibrium_position(&q0,x,u,model);
+	actuator_derivatives(&tau, f, &k, dtaudu, dkdu, &dkdq, q0, u, model);
+	J[0] = dtaudu[0]/k;
+	J[1] = dtaudu[1]/k;
+
+	return;
+}
+
+/** \brief Calculate Jacobian of equilibrium position with respect to motor commands by central finite differences.
+ *  \param[out] J joint equilibrium position
+ *  \param[in]  x state (velocity, acceleration)
+ *  \param[in]  u command (motor positions in radiens)
+ *  \param[in]  model model struct
+ *
+ *  This needs four equilibrium searches (against one for
+ *  edinburghvsa_model_get_equilibrium_position_jacobian()), and its accuracy
+ *  is limited by their tolerance. It can be used for verification.
+ */
+void edinburghvsa_model_get_equilibrium_position_jacobian_fd ( double * J, double * x, double * u, edinburghvsa_model * model ) {
 	double delta=1e-6;
 	double q0p,q0m,ud[DIMU];
 
@@ -469,3 +749,40 @@ void edinburghvsa_model_get_motor_positions ( double * m, double * x, edinburghv
 	return;
 }
 
+/** 
+ * \brief Calculate all model quantities for one state and command. 
+ * \param[out] e torques, acceleration, stiffness, equilibrium position, their Jacobians and spring forces
+ * \param[in]  x state (position, velocity)
+ * \param[in]  u command (motor positions in radiens)
+ * \param[in]  model model struct
+ * \param      cache warm start for the equilibrium search, or NULL (see edinburghvsa_model_solve_equilibrium_position())
+ *
+ * The results equal those of the individual functions, but the spring
+ * geometry (moment arms, spring vectors and their lengths) is computed once
+ * for the state, and once for the equilibrium, instead of once per function
+ * (and per finite difference).
+ */
+void edinburghvsa_model_evaluate ( edinburghvsa_model_evaluation * e, double * x, double * u, edinburghvsa_model * model, edinburghvsa_equilibrium_cache * cache ) {
+
+	double gc = model->gravity_constant;
+	double q0, tau, f[2], k, dtaudu[DIMU], dkdu[DIMU], dkdq;
+
+	actuator_derivatives(&e->actuator_torque, e->spring_force, &e->stiffness, dtaudu, e->stiffness_jacobian, &e->stiffness_position_derivative, x[0], u, model);
+	e->damping_torque  = model->damping_constant*x[1];
+	e->gravity_torque  = gc != 0 ? gc*sin(x[0]) : 0;
+	e->friction_torque = model->viscous_friction*x[1] + model->coulomb_friction*copysign(1.0,x[1]);
+	e->torque          = e->actuator_torque - e->damping_torque - e->gravity_torque - e->friction_torque;
+	e->acceleration    = e->torque/model->inertia;
+
+	e->equilibrium_status   = edinburghvsa_model_solve_equilibrium_position(&q0, x, u, model, cache);
+	e->equilibrium_position = q0;
+	if (q0 == x[0]) {
+		k = e->stiffness;
+	} else {
+		actuator_derivatives(&tau, f, &k, dtaudu, dkdu, &dkdq, q0, u, model);
+	}
+	e->equilibrium_position_jacobian[0] = dtaudu[0]/k;
+	e->equilibrium_position_jacobian[1] = dtaudu[1]/k;
+
+	return;
+}
@@ -129,8 +129,26 @@
  * \ingroup MACCEPA
  * \sa <a href="../m2html/MACCEPA/m-files/dynamics/index.html">Matlab wrappers to this library</a>
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* sincos() */
+#endif
 #include <libmaccepa.h>
 
+/** \brief Sine and cosine of a (with one call where the C library provides sincos()). */
+static void sin_cos ( double a, double * s, double * c ) {
+#ifdef __GLIBC__
+	sincos(a, s, c);
+#else
+	s[0] = sin(a);
+	c[0] = cos(a);
+#endif
+}
+
+/** \brief Clip v to [lo, hi]. */
+static double clip ( double v, double lo, double hi ) {
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
 /** \brief Initialise model struct (set default parameters).
  *  \param model model struct.
  */
@@ -177,6 +195,8 @@ void maccepa_model_init(maccepa_model *model) {
  *
  *  This implements \f$ \ddot{q}(\mathbf{x},\mathbf{u}) = (\tau_{actuators} - \tau_{damping} - \tau_{gravity} - \tau_{friction})/I \f$
  *
+ *  \note src/vsa_dynamics_maccepa.cpp has a templated copy of these equations
+ *  (for maccepa_model_get_linearization()), which must be kept in sync.
  */
 void maccepa_model_get_acceleration ( double * acc, double * x, double * u, maccepa_model * model ) {
 
@@ -328,11 +348,54 @@ void maccepa_model_get_stiffness ( double * k, double * x, double * u, maccepa_m
  *  \param[in]  u command (motor positions in radiens)
  *  \param[in]  model model struct
  *
- *  \todo This calculation is currently based on finite differences. Accuracy
- *  and effieciency could be improved by finding the analytic expression for
- *  this.
+ *  With \f$\alpha=u_1-q\f$, \f$\beta=ru_2-(C-B)\f$ and
+ *  \f$L=\sqrt{B^2+C^2-2BC\cos\alpha}\f$ (so that
+ *  \f$\frac{\partial L}{\partial\alpha}=\frac{BC\sin\alpha}{L}\f$), this implements
+ *
+ *  \f$\frac{\partial k}{\partial u_1}=-\kappa BC\sin\alpha\left(1+\frac{\beta}{L}\right)-\frac{3\kappa B^2C^2\beta\sin\alpha\cos\alpha}{L^3}+\frac{3\kappa B^3C^3\beta\sin^3\alpha}{L^5}\f$
+ *
+ *  \f$\frac{\partial k}{\partial u_2}=r\left(\frac{\kappa BC\cos\alpha}{L}-\frac{\kappa B^2C^2\sin^2\alpha}{L^3}\right)\f$
+ *
+ *  and zero for the damping command.
+ *
+ *  \sa maccepa_model_get_stiffness_jacobian_fd() for a finite difference version.
  */
 void maccepa_model_get_stiffness_jacobian ( double * J, double * x, double * u, maccepa_model * model ) {
+
+	double B     = model->lever_length;
+	double C     = model->pin_displacement;
+	double kappa = model->spring_constant;
+	double r     = model->drum_radius;
+	double a     = u[0]-x[0];
+	double sa    = sin(a);
+	double ca    = cos(a);
+	double BC    = B*C;
+	double L2    = B*B+C*C-2*BC*ca;
+	double L     = sqrt(L2);
+	double L3    = L2*L;
+	double b     = r*u[1]-(C-B);
+
+	J[0] = -kappa*BC*sa*(1+b/L)
+	       -3*kappa*BC*BC*b*sa*ca/L3
+	       +3*kappa*BC*BC*BC*b*sa*sa*sa/(L3*L2);
+	J[1] = r*(kappa*BC*ca/L - kappa*BC*BC*sa*sa/L3);
+#ifdef  VARIABLE_DAMPING
+	J[2] = 0;
+#endif     /* -----  not VARIABLE_DAMPING  ----- */
+
+	return;
+}     
+
+/** \brief Calculate Jacobian of stiffness with respect to motor commands by central finite differences.
+ *  \param[out] J joint stiffness Jacobian
+ *  \param[in]  x state (velocity, acceleration)
+ *  \param[in]  u command (motor positions in radiens)
+ *  \param[in]  model model struct
+ *
+ *  This is slower and less accurate than maccepa_model_get_stiffness_jacobian(), 
+ *  against which it can be used for verification.
+ */
+void maccepa_model_get_stiffness_jacobian_fd ( double * J, double * x, double * u, maccepa_model * model ) {
 	int i;
 	double delta=1e-6;
 	double kp,km,ud[DIMU];
@@ -465,3 +528,242 @@ void maccepa_model_get_motor_positions ( double * m, double * x, maccepa_model *
 	return;
 }
 
+/** 
+ * \brief Calculate the command giving a desired equilibrium position and stiffness (inverse model). 
+ * \param[out] u command (motor positions in radiens), the damping command (if any) is left unchanged
+ * \param[in]  target desired equilibrium position (rad) and stiffness at the equilibrium (Nm/rad)
+ * \param[in]  model model struct
+ * \return MACCEPA_COMMAND_EXACT, or MACCEPA_COMMAND_CLIPPED if the target cannot be reached within umin and umax (u is then clipped)
+ *
+ * The equilibrium position is \f$u_1\f$. At the equilibrium
+ * (\f$\alpha=0\f$) the stiffness \f$k=\kappa BC(1+\frac{ru_2-(C-B)}{|C-B|})\f$
+ * is linear in \f$u_2\f$, so Newton's method with
+ * maccepa_model_get_stiffness_jacobian() converges in one step.
+ */
+int maccepa_model_solve_command ( double * u, double * target, maccepa_model * model ) {
+
+	double x[DIMX], J[DIMU], k;
+	int i, status = MACCEPA_COMMAND_EXACT;
+
+	u[0] = clip(target[0], model->umin[0], model->umax[0]);
+	u[1] = 0.5*(model->umin[1]+model->umax[1]);
+	x[0] = u[0];
+	x[1] = 0;
+	for ( i = 0; i < MACCEPA_COMMAND_MAX_ITER; i += 1 ) {
+		maccepa_model_get_stiffness(&k, x, u, model);
+		if (fabs(k-target[1]) < MACCEPA_COMMAND_TOLERANCE) break;
+		maccepa_model_get_stiffness_jacobian(J, x, u, model);
+		if (J[1] == 0) break;
+		u[1] = clip(u[1]-(k-target[1])/J[1], model->umin[1], model->umax[1]);
+	}
+	maccepa_model_get_stiffness(&k, x, u, model);
+	if (u[0] != target[0] || fabs(k-target[1]) >= MACCEPA_COMMAND_TOLERANCE) status = MACCEPA_COMMAND_CLIPPED;
+
+	return status;
+}
+
+/** 
+ * \brief Calculate the commands for a batch of desired equilibrium positions and stiffnesses (see maccepa_model_solve_command()). 
+ * \param[out] U commands (DIMU arrays of n elements, the damping commands are left unchanged)
+ * \param[out] status n status values, or NULL
+ * \param[in]  target desired equilibrium positions, then stiffnesses (2 arrays of n elements)
+ * \param[in]  n number of samples
+ * \param[in]  model model struct
+ * \return number of targets that could not be reached
+ */
+int maccepa_model_solve_command_batch ( double * U, int * status, double * target, int n, maccepa_model * model ) {
+
+	double u[DIMU], t[2];
+	int i, j, s, clipped = 0;
+
+	for ( j = 0; j < n; j += 1 ) {
+		for ( i = 0; i < DIMU; i += 1 ) { u[i] = U[i*n+j]; }
+		t[0] = target[j];
+		t[1] = target[n+j];
+		s = maccepa_model_solve_command(u, t, model);
+		U[j]   = u[0];
+		U[n+j] = u[1];
+		if (status != NULL) status[j] = s;
+		if (s != MACCEPA_COMMAND_EXACT) clipped += 1;
+	}
+
+	return clipped;
+}
+
+/** 
+ * \brief Calculate all model quantities for one state and command. 
+ * \param[out] e torques, acceleration, stiffness, equilibrium position, their Jacobians, damping and spring force
+ * \param[in]  x state (position, velocity)
+ * \param[in]  u command (motor positions in radiens)
+ * \param[in]  model model struct
+ *
+ * The results equal those of the individual functions, but the common terms
+ * (\f$\sin\alpha\f$ and \f$\cos\alpha\f$ with \f$\alpha=u_1-q\f$, the spring
+ * length \f$L\f$ and its powers) are computed once.
+ */
+void maccepa_model_evaluate ( maccepa_model_evaluation * e, double * x, double * u, maccepa_model * model ) {
+
+	double B     = model->lever_length;
+	double C     = model->pin_displacement;
+	double kappa = model->spring_constant;
+	double r     = model->drum_radius;
+	double gc    = model->gravity_constant;
+	double BC    = B*C;
+	double kBC   = kappa*BC;
+	double sa, ca, sq, cq;
+	double L2, L, L3, b;
+
+	sin_cos(u[0]-x[0], &sa, &ca);
+	L2 = B*B+C*C-2*BC*ca;
+	L  = sqrt(L2);
+	L3 = L2*L;
+	b  = r*u[1]-(C-B);
+
+	maccepa_model_get_damping(&e->damping, x, u, model);
+	e->actuator_torque = kBC*sa*(1+b/L);
+	e->damping_torque  = e->damping*x[1];
+	if (gc != 0) { sin_cos(x[0], &sq, &cq); e->gravity_torque = gc*sq; }
+	else         { e->gravity_torque = 0; }
+	e->friction_torque = model->viscous_friction*x[1] + model->coulomb_friction*copysign(1.0,x[1]);
+	e->torque          = e->actuator_torque - e->damping_torque - e->gravity_torque - e->friction_torque;
+	e->acceleration    = e->torque/model->inertia;
+
+	e->stiffness       = kBC*ca*(1+b/L) - kBC*BC*sa*sa*b/L3;
+	e->stiffness_jacobian[0] = -kBC*sa*(1+b/L)
+	                           -3*kBC*BC*b*sa*ca/L3
+	                           +3*kBC*BC*BC*b*sa*sa*sa/(L3*L2);
+	e->stiffness_jacobian[1] = r*(kBC*ca/L - kBC*BC*sa*sa/L3);
+
+	e->equilibrium_position = u[0];
+	e->equilibrium_position_jacobian[0] = 1;
+	e->equilibrium_position_jacobian[1] = 0;
+#ifdef  VARIABLE_DAMPING
+	e->stiffness_jacobian[2]            = 0;
+	e->equilibrium_position_jacobian[2] = 0;
+#endif     /* -----  not VARIABLE_DAMPING  ----- */
+
+	e->spring_force = -kappa*(L+b);
+
+	return;
+}
+
+/** 
+ * \brief Calculate total joint torque for a batch of states and commands (see maccepa_model_get_torque()). 
+ * \param[out] tau n torques
+ * \param[in]  X states (DIMX arrays of n elements: positions, then velocities)
+ * \param[in]  U commands (DIMU arrays of n elements)
+ * \param[in]  n number of samples
+ * \param[in]  model model struct
+ *
+ * The four torque terms are evaluated in one pass, with the constant
+ * factors computed once. Samples are processed in blocks of
+ * MACCEPA_BATCH_BLOCK: the sines and cosines are taken first (these are
+ * vectorised too if compiled with -ffast-math, through glibc's vector math
+ * library), then the rest of the expression is evaluated in a loop that is
+ * vectorised with #pragma omp simd (with -fopenmp-simd, otherwise it is a
+ * plain scalar loop).
+ *
+ * \note The damping is evaluated once, for the first sample, as
+ * maccepa_model_get_damping() does not depend on the state or command.
+ */
+void maccepa_model_get_torque_batch ( double * tau, double * X, double * U, int n, maccepa_model * model ) {
+
+	double B     = model->lever_length;
+	double C     = model->pin_displacement;
+	double kBC   = model->spring_constant*B*C;
+	double r     = model->drum_radius;
+	double BBCC  = B*B+C*C;
+	double BC2   = 2*B*C;
+	double CmB   = C-B;
+	double gc    = model->gravity_constant;
+	double fc    = model->coulomb_friction;
+	double *q = X, *qdot = X+n, *u0 = U, *u1 = U+n;
+	double s[MACCEPA_BATCH_BLOCK], c[MACCEPA_BATCH_BLOCK], g[MACCEPA_BATCH_BLOCK];
+	double x0[DIMX], bv;
+	int i, j, m;
+
+	if (n <= 0) return;
+	x0[0] = q[0]; x0[1] = qdot[0];
+	maccepa_model_get_damping(&bv, x0, U, model);
+	bv += model->viscous_friction;
+
+	for ( j = 0; j < n; j += MACCEPA_BATCH_BLOCK ) {
+		m = n-j < MACCEPA_BATCH_BLOCK ? n-j : MACCEPA_BATCH_BLOCK;
+		for ( i = 0; i < m; i += 1 ) {
+			double a = u0[j+i]-q[j+i];
+			s[i] = sin(a);
+			c[i] = cos(a);
+		}
+		if (gc != 0) { for ( i = 0; i < m; i += 1 ) { g[i] = gc*sin(q[j+i]); } }
+		else         { for ( i = 0; i < m; i += 1 ) { g[i] = 0; } }
+#pragma omp simd
+		for ( i = 0; i < m; i += 1 ) {
+			double L = sqrt(BBCC-BC2*c[i]);
+			double v = qdot[j+i];
+			tau[j+i] = kBC*s[i]*(1+(r*u1[j+i]-CmB)/L) - bv*v - g[i] - fc*copysign(1.0,v);
+		}
+	}
+
+	return;
+}
+
+/** 
+ * \brief Calculate joint acceleration for a batch of states and commands (see maccepa_model_get_acceleration() and maccepa_model_get_torque_batch()). 
+ * \param[out] acc n joint accelerations
+ * \param[in]  X states (DIMX arrays of n elements)
+ * \param[in]  U commands (DIMU arrays of n elements)
+ * \param[in]  n number of samples
+ * \param[in]  model model struct
+ */
+void maccepa_model_get_acceleration_batch ( double * acc, double * X, double * U, int n, maccepa_model * model ) {
+
+	double Iinv = 1/model->inertia;
+	int i;
+
+	maccepa_model_get_torque_batch(acc, X, U, n, model);
+#pragma omp simd
+	for ( i = 0; i < n; i += 1 ) { acc[i] *= Iinv; }
+
+	return;
+}
+
+/** 
+ * \brief Calculate stiffness for a batch of states and commands (see maccepa_model_get_stiffness() and maccepa_model_get_torque_batch()). 
+ * \param[out] k n joint stiffnesses
+ * \param[in]  X states (DIMX arrays of n elements)
+ * \param[in]  U commands (DIMU arrays of n elements)
+ * \param[in]  n number of samples
+ * \param[in]  model model struct
+ */
+void maccepa_model_get_stiffness_batch ( double * k, double * X, double * U, int n, maccepa_model * model ) {
+
+	double B     = model->lever_length;
+	double C     = model->pin_displacement;
+	double kappa = model->spring_constant;
+	double r     = model->drum_radius;
+	double BC    = B*C;
+	double BBCC  = B*B+C*C;
+	double CmB   = C-B;
+	double *q = X, *u0 = U, *u1 = U+n;
+	double s[MACCEPA_BATCH_BLOCK], c[MACCEPA_BATCH_BLOCK];
+	int i, j, m;
+
+	for ( j = 0; j < n; j += MACCEPA_BATCH_BLOCK ) {
+		m = n-j < MACCEPA_BATCH_BLOCK ? n-j : MACCEPA_BATCH_BLOCK;
+		for ( i = 0; i < m; i += 1 ) {
+			double a = u0[j+i]-q[j+i];
+			s[i] = sin(a);
+			c[i] = cos(a);
+		}
+#pragma omp simd
+		for ( i = 0; i < m; i += 1 ) {
+			double L2 = BBCC-2*BC*c[i];
+			double L  = sqrt(L2);
+			double b  = r*u1[j+i]-CmB;
+			double bs = BC*s[i];
+			k[j+i] = kappa*BC*c[i]*(1+b/L) - kappa*bs*bs*b/(L2*L);
+		}
+	}
+
+	return;
+}
@@ -0,0 +1,61 @@
+/**
+ * \file maccepa_impedance_controller.c
+ * \brief Example PD/impedance controller for the MACCEPA (see maccepa_impedance_controller.h).
+ * \ingroup MACCEPA
+ */
+#include <maccepa_impedance_controller.h>
+
+/** \brief Clip v to [lo, hi]. */
+static double clip ( double v, double lo, double hi ) {
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+void maccepa_impedance_controller_init ( maccepa_impedance_controller *C ) {
+	int i;
+
+	maccepa_model_init(&C->model);
+	for ( i = 0; i < DIMU; i += 1 ) { C->u[i] = C->model.umin[i]; }
+	C->gain_d          = 0;
+	C->velocity_filter = 0.3;
+	C->min_stiffness   = 0.01;
+	C->x[0] = C->x[1]  = 0;
+	C->time            = -1;
+	maccepa_impedance_controller_set_target(C, 0, 0);
+}
+
+void maccepa_impedance_controller_set_target ( maccepa_impedance_controller *C, double position, double stiffness ) {
+	double x[DIMX], u[DIMU], target[2] = { position, stiffness };
+	int i;
+
+	/* Stiffness motor position giving the desired stiffness at equilibrium. */
+	for ( i = 0; i < DIMU; i += 1 ) { u[i] = C->u[i]; }
+	maccepa_model_solve_command(u, target, &C->model);
+	x[0] = u[0]; x[1] = 0;
+	maccepa_model_get_stiffness(&C->gain_p, x, u, &C->model);
+
+	C->u[1]     = u[1];
+	C->position = position;
+}
+
+int  maccepa_impedance_controller_step ( void *context, const double *y, double *u ) {
+	maccepa_impedance_controller *C = (maccepa_impedance_controller *) context;
+	double q = y[0], t = y[DIMY], tau, k;
+	int i;
+
+	/* Velocity from filtered finite differences of the joint position. */
+	if (C->time >= 0 && t > C->time) {
+		C->x[1] += C->velocity_filter*((q - C->x[0])/(t - C->time) - C->x[1]);
+	}
+	C->x[0] = q;
+	C->time = t;
+
+	/* PD torque, produced by offsetting the equilibrium position by tau/k. */
+	tau = C->gain_p*(C->position - q) - C->gain_d*C->x[1];
+	maccepa_model_get_stiffness(&k, C->x, C->u, &C->model);
+	if (k > C->min_stiffness) C->u[0] = q + tau/k;
+	else                      C->u[0] = C->position;
+	C->u[0] = clip(C->u[0], C->model.umin[0], C->model.umax[0]);
+
+	for ( i = 0; i < DIMU; i += 1 ) { u[i] = C->u[i]; }
+	return 1;
+}
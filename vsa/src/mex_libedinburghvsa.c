@@ -163,6 +163,10 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 				plhs[0] = mxCreateDoubleMatrix(1,2,mxREAL); /* Create output vector */
 				edinburghvsa_model_get_equilibrium_position_jacobian (mxGetPr(plhs[0]), mxGetPr(prhs[1]), mxGetPr(prhs[2]), &model );
 			}
+			else if(strcmp(function,"edinburghvsa_model_get_equilibrium_position_jacobian_fd")==0){
+				plhs[0] = mxCreateDoubleMatrix(1,2,mxREAL); /* Create output vector */
+				edinburghvsa_model_get_equilibrium_position_jacobian_fd (mxGetPr(plhs[0]), mxGetPr(prhs[1]), mxGetPr(prhs[2]), &model );
+			}
 			else if(strcmp(function,"edinburghvsa_model_get_stiffness")==0){
 				plhs[0] = mxCreateDoubleMatrix(1,1,mxREAL); /* Create output vector */
 				edinburghvsa_model_get_stiffness (mxGetPr(plhs[0]), mxGetPr(prhs[1]), mxGetPr(prhs[2]), &model );
@@ -171,6 +175,26 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 				plhs[0] = mxCreateDoubleMatrix(1,2,mxREAL); /* Create output vector */
 				edinburghvsa_model_get_stiffness_jacobian (mxGetPr(plhs[0]), mxGetPr(prhs[1]), mxGetPr(prhs[2]), &model );
 			}
+			else if(strcmp(function,"edinburghvsa_model_get_stiffness_jacobian_fd")==0){
+				plhs[0] = mxCreateDoubleMatrix(1,2,mxREAL); /* Create output vector */
+				edinburghvsa_model_get_stiffness_jacobian_fd (mxGetPr(plhs[0]), mxGetPr(prhs[1]), mxGetPr(prhs[2]), &model );
+			}
+			else if(strcmp(function,"edinburghvsa_model_get_linearization")==0){
+				/* [A,B] = model_edinburghvsa('edinburghvsa_model_get_linearization',x,u), transposed to column major */
+				double A[DIMX*DIMX], B[DIMX*DIMU];
+				int i, j;
+				edinburghvsa_model_get_linearization (A, B, mxGetPr(prhs[1]), mxGetPr(prhs[2]), &model );
+				plhs[0] = mxCreateDoubleMatrix(DIMX,DIMX,mxREAL);
+				for ( i = 0; i < DIMX; i += 1 ) { for ( j = 0; j < DIMX; j += 1 ) { mxGetPr(plhs[0])[j*DIMX+i] = A[i*DIMX+j]; } }
+				if (nlhs > 1) {
+					plhs[1] = mxCreateDoubleMatrix(DIMX,DIMU,mxREAL);
+					for ( i = 0; i < DIMX; i += 1 ) { for ( j = 0; j < DIMU; j += 1 ) { mxGetPr(plhs[1])[j*DIMX+i] = B[i*DIMU+j]; } }
+				}
+			}
+			else if(strcmp(function,"edinburghvsa_model_get_acceleration_hessian")==0){
+				plhs[0] = mxCreateDoubleMatrix(DIMX+DIMU,DIMX+DIMU,mxREAL); /* Create output vector (symmetric) */
+				edinburghvsa_model_get_acceleration_hessian (mxGetPr(plhs[0]), mxGetPr(prhs[1]), mxGetPr(prhs[2]), &model );
+			}
 			else{
 				printf(usage_msg);
 			}
@@ -180,6 +180,26 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 				plhs[0] = mxCreateDoubleMatrix(1,DIMU,mxREAL); /* Create output vector */
 				maccepa_model_get_stiffness_jacobian (mxGetPr(plhs[0]), mxGetPr(prhs[1]), mxGetPr(prhs[2]), &model );
 			}
+			else if(strcmp(function,"maccepa_model_get_stiffness_jacobian_fd")==0){
+				plhs[0] = mxCreateDoubleMatrix(1,DIMU,mxREAL); /* Create output vector */
+				maccepa_model_get_stiffness_jacobian_fd (mxGetPr(plhs[0]), mxGetPr(prhs[1]), mxGetPr(prhs[2]), &model );
+			}
+			else if(strcmp(function,"maccepa_model_get_linearization")==0){
+				/* [A,B] = model_maccepa('maccepa_model_get_linearization',x,u), transposed to column major */
+				double A[DIMX*DIMX], B[DIMX*DIMU];
+				int i, j;
+				maccepa_model_get_linearization (A, B, mxGetPr(prhs[1]), mxGetPr(prhs[2]), &model );
+				plhs[0] = mxCreateDoubleMatrix(DIMX,DIMX,mxREAL);
+				for ( i = 0; i < DIMX; i += 1 ) { for ( j = 0; j < DIMX; j += 1 ) { mxGetPr(plhs[0])[j*DIMX+i] = A[i*DIMX+j]; } }
+				if (nlhs > 1) {
+					plhs[1] = mxCreateDoubleMatrix(DIMX,DIMU,mxREAL);
+					for ( i = 0; i < DIMX; i += 1 ) { for ( j = 0; j < DIMU; j += 1 ) { mxGetPr(plhs[1])[j*DIMX+i] = B[i*DIMU+j]; } }
+				}
+			}
+			else if(strcmp(function,"maccepa_model_get_acceleration_hessian")==0){
+				plhs[0] = mxCreateDoubleMatrix(DIMX+DIMU,DIMX+DIMU,mxREAL); /* Create output vector (symmetric) */
+				maccepa_model_get_acceleration_hessian (mxGetPr(plhs[0]), mxGetPr(prhs[1]), mxGetPr(prhs[2]), &model );
+			}
 			else{
 				printf(usage_msg);
 			}
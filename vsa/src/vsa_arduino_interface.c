@@ -3,107 +3,22 @@
  * \author Matthew Howard (MH), matthew.howard@ed.ac.uk
  *
  * \brief Module for interfacing to variable stiffness actuators (e.g., Edinburgh VSA, MACCEPA).
+ *
+ * This is the robot-specific part (sensor calibration, command limits and
+ * conversion), compiled once per robot; the serial link and i/o thread are in
+ * vsa_link.c.
  */
 #include <vsa_arduino_interface.h>
+#include <stdlib.h>
 #ifdef MEX_INTERFACE
 #include <mex.h>
 #endif
 
 /** 
- * \brief I/O thread function. Continually runs in the background, 
- * reading from the serial. If new data arrives at the serial it is decoded and written to the measured_state variable.
+ * \brief Fill options struct with default settings.
  */
-#ifdef WIN32
-static void threadFunc(LPVOID data) {
-   DWORD timeZero;
-#else
-static void *threadFunc(void *data) {
-	struct timespec tSpec, tSpec0;
-#endif   
-   
-	ArduinoInterface *AI = (ArduinoInterface *) data;
-
-	int i;
-
-	int input = 0;      /** \brief Variable for temporary storage of incoming serial data. */
-	int read_state = 0; /** \brief Variable for keeping track of the stage of parsing of incoming serial data. */
-	int read_sensor = 0;/** \brief Variable for keeping track of which sensor we are reading from. */
-	int y[DIMY];        /** \brief Variable for temporary storage of sensor readings during parsing. */
-	double timestamp;   /** \brief Time stamp of data. */
-
-#ifdef WIN32
-	timeBeginPeriod(1);
-	timeZero = timeGetTime();
-#else
-	clock_gettime(CLOCK_REALTIME, &tSpec0);
-#endif
-
-	AI->thread_state=!THREAD_KILLED;
-	while (AI->thread_state != THREAD_KILLED ) { /* Loop until thread is killed. */
-		if (serialRead(&AI->port, 1, &input) == 0) continue;
-
-		/* Process bit string from serial */
-		switch(read_state) {
-			case  0: if (input == TRANSMIT_HEADER0) read_state++;                break; /* Read first header. */
-			case  1: if (input == TRANSMIT_HEADER1) read_state++;                break; /* Read second header. */
-			case  2: y[read_sensor]  = input    ;   read_state++;                break;
-			case  3: y[read_sensor] += input*256;   read_state++; read_sensor++; break;
-			case  4: y[read_sensor]  = input    ;   read_state++;                break;
-			case  5: y[read_sensor] += input*256;   read_state++; read_sensor++; break;
-			case  6: y[read_sensor]  = input    ;   read_state++;                break;
-			case  7: y[read_sensor] += input*256;   read_state++; read_sensor++; break;
-			case  8: y[read_sensor]  = input    ;   read_state++;                break;
-#ifdef EDINBURGHVSA_INTERFACE
-			case  9: y[read_sensor] += input*256;   read_state=0; read_sensor=0; /* Reset read_state. */
-#endif
-#ifdef MACCEPA_INTERFACE
-			case  9: y[read_sensor] += input*256;   read_state++; read_sensor++; break;
-			case 10: y[read_sensor]  = input    ;   read_state++;                break;
-			case 11: y[read_sensor] += input*256;   read_state=0; read_sensor=0; /* Reset read_state. */
-#endif
-#ifdef MACCEPA2DOF_INTERFACE
-			case  9: y[read_sensor] += input*256;   read_state++; read_sensor++; break;
-			case 10: y[read_sensor]  = input    ;   read_state++;                break;
-			case 11: y[read_sensor] += input*256;   read_state++; read_sensor++; break;
-			case 12: y[read_sensor]  = input    ;   read_state++;                break;
-#ifdef CURRENT_SENSING
-			case 13: y[read_sensor] += input*256;   read_state++; read_sensor++; break;
-			case 14: y[read_sensor]  = input    ;   read_state++;                break;
-			case 15: y[read_sensor] += input*256;   read_state++; read_sensor++; break;
-			case 16: y[read_sensor]  = input    ;   read_state++;                break;
-			case 17: y[read_sensor] += input*256;   read_state++; read_sensor++; break;
-			case 18: y[read_sensor]  = input    ;   read_state++;                break;
-			case 19: y[read_sensor] += input*256;   read_state++; read_sensor++; break;
-			case 20: y[read_sensor]  = input    ;   read_state++;                break;
-			case 21: y[read_sensor] += input*256;   read_state=0; read_sensor=0; /* Reset read_state. */
-#else
-			case 13: y[read_sensor] += input*256;   read_state=0; read_sensor=0; /* Reset read_state. */
-#endif
-#endif
-
-#ifdef WIN32
-				timestamp = (timeGetTime() - timeZero) * 0.001;
-#else
-				clock_gettime(CLOCK_REALTIME, &tSpec);
-				timestamp = (tSpec.tv_sec - tSpec0.tv_sec) + 1e-9*tSpec.tv_nsec;
-#endif
-				LOCK(AI);
-				for ( i = 0; i < DIMY; i += 1 ) { AI->measured_state[i] = y[i]; }
-				AI->timestamp = timestamp;
-				serialWrite(&AI->port, RECEIVE_LENGTH+1, AI->command_buffer); /* Write command to serial */
-				serialFlushOutput (&AI->port); /* flush i/o */
-				serialFlushInput  (&AI->port);
-				AI->readComplete = 1;
-				UNLOCK(AI);
-		}
-	}
-
-#ifdef WIN32
-	timeEndPeriod(1);
-	return;
-#else
-	return NULL;
-#endif
+void vsa_arduino_interface_default_options ( ArduinoInterfaceOptions *options ) {
+	vsa_link_default_options(options, BAUDRATE);
 }
 
 /** 
@@ -111,82 +26,70 @@ static void *threadFunc(void *data) {
  * \param[in] device Name of serial port to which Arduino is connected.
 */
 int  vsa_arduino_interface_init       ( ArduinoInterface *AI, char *device ) {
+	return vsa_arduino_interface_init_options(AI, device, NULL);
+}
+
+/** 
+ * \brief Open serial connection with Arduino board using the given options, start i/o thread in the background. 
+ * \param[in] device Name of serial port to which Arduino is connected.
+ * \param[in] options interface options (if NULL, defaults are used).
+*/
+int  vsa_arduino_interface_init_options ( ArduinoInterface *AI, char *device, ArduinoInterfaceOptions *options ) {
+	ArduinoInterfaceOptions defaults;
+	unsigned char command_buffer[RECEIVE_LENGTH];
+
+	if (options == NULL) {
+		vsa_arduino_interface_default_options(&defaults);
+		options = &defaults;
+	}
+
 	/* Check if port is already open. */
 #ifdef MEX_INTERFACE
-	if (AI->connection_state == ARDUINO_CONNECTED) {
+	if (AI->link.connection_state == ARDUINO_CONNECTED) {
 		mexWarnMsgTxt("Arduino is already open!");
 		return 1;
 	}
 #endif
-	/* Open serial communication. */
-	AI->connection_state = serialOpenByName(&AI->port, device);
-	if (AI->connection_state==ARDUINO_DISCONNECTED) {
-#ifdef MEX_INTERFACE
-		mexErrMsgTxt("Couldn't open the specified port.");
-#else
-		fputs("Couldn't open the specified port.\n",stderr);
-		return 0;
-#endif
-	} 
-	/* Set serial parameters (or close the serial if this fails). */
-	if (!serialSetParameters(&AI->port,BAUDRATE, 8, 0, 1, 10)) { /* BAUDRATE baud, 8 data bits, no parity, 1 stop bit, 10*0.1 = 1 sec. timeout */
-		AI->connection_state = ARDUINO_DISCONNECTED;
-		serialClose(&AI->port);
-#ifdef MEX_INTERFACE
-		mexErrMsgTxt("Couldn't change serial port parameters!");
-#else
-		fputs("Couldn't change serial port parameters!\n",stderr);
-		return 0;
-#endif
-	}
 
 	/* Set initial command */
-	AI->command_buffer[ 0] = RECEIVE_HEADER;        /* header */
-	AI->command_buffer[ 1] = U_INIT_SERVO0 & 0xFE;
-	AI->command_buffer[ 2] = U_INIT_SERVO0 >> 8;
-	AI->command_buffer[ 3] = U_INIT_SERVO1 & 0xFE;
-	AI->command_buffer[ 4] = U_INIT_SERVO1 >> 8;
+	command_buffer[ 0] = U_INIT_SERVO0 & 0xFF;
+	command_buffer[ 1] = U_INIT_SERVO0 >> 8;
+	command_buffer[ 2] = U_INIT_SERVO1 & 0xFF;
+	command_buffer[ 3] = U_INIT_SERVO1 >> 8;
+#ifdef MACCEPA_INTERFACE
+#ifdef VARIABLE_DAMPING
+	command_buffer[ 4] = U_INIT_DAMPER0;
+	command_buffer[ 5] = 0x00;
+#endif
+#endif
 #ifdef MACCEPA2DOF_INTERFACE
-	AI->command_buffer[ 5] = U_INIT_SERVO2 & 0xFE;
-	AI->command_buffer[ 6] = U_INIT_SERVO2 >> 8;
-	AI->command_buffer[ 7] = U_INIT_SERVO3 & 0xFE;
-	AI->command_buffer[ 8] = U_INIT_SERVO3 >> 8;
+	command_buffer[ 4] = U_INIT_SERVO2 & 0xFF;
+	command_buffer[ 5] = U_INIT_SERVO2 >> 8;
+	command_buffer[ 6] = U_INIT_SERVO3 & 0xFF;
+	command_buffer[ 7] = U_INIT_SERVO3 >> 8;
 #ifdef VARIABLE_DAMPING
-	AI->command_buffer[ 9] = U_INIT_DAMPER0;
-	AI->command_buffer[10] = 0x00;
-	AI->command_buffer[11] = U_INIT_DAMPER1;
-	AI->command_buffer[12] = 0x00;
+	command_buffer[ 8] = U_INIT_DAMPER0;
+	command_buffer[ 9] = 0x00;
+	command_buffer[10] = U_INIT_DAMPER1;
+	command_buffer[11] = 0x00;
 #ifdef MAGNET /* if damping and magnet control */
-	AI->command_buffer[13] = U_INIT_MAGNET;
-	AI->command_buffer[14] = 0x00;
+	command_buffer[12] = U_INIT_MAGNET;
+	command_buffer[13] = 0x00;
 #endif
 #else
 #ifdef MAGNET /* if just magnet control */
-	AI->command_buffer[ 9] = U_INIT_MAGNET;
-	AI->command_buffer[10] = 0x00;
+	command_buffer[ 8] = U_INIT_MAGNET;
+	command_buffer[ 9] = 0x00;
 #endif
 #endif
 
 #endif
 
-	/* Flush serial port. */
-	serialFlushInput(&AI->port);
-	serialFlushOutput(&AI->port);
-
-	/* Start i/o thread. */
-#ifdef WIN32
-   InitializeCriticalSection(&AI->threadLock);
-   AI->thread = (HANDLE) _beginthread(threadFunc, 0, AI);
-   if (AI->thread == NULL) {
-      return 0;
-   }
-#else
-   pthread_mutex_init(&AI->threadLock, NULL);
-   pthread_create(&AI->thread, NULL, threadFunc, AI);
-#endif
-   
-	/* Connection successful so set connection_state to ARDUINO_CONNECTED */
-	AI->connection_state = ARDUINO_CONNECTED;
+	AI->controller = NULL;
+	AI->controller_context = NULL;
+	AI->estimating = 0;
+	AI->estimate[VSA_ESTIMATOR_DIMX] = AI->prediction[VSA_ESTIMATOR_DIMX] = -1;
+	if (!vsa_link_open(&AI->link, device, TRANSMIT_LENGTH, RECEIVE_LENGTH, command_buffer, options)) return 0;
 
 #ifdef MEX_INTERFACE
 	/* Prevent matlab from clearing mex file */
@@ -200,7 +103,7 @@ int  vsa_arduino_interface_init       ( ArduinoInterface *AI, char *device ) {
  * \brief Check that Arduino connection has been set up.
  */
 int vsa_arduino_interface_check ( ArduinoInterface *AI ) {
-	if (AI->connection_state == 0) {
+	if (AI->link.connection_state == 0) {
 #ifdef MEX_INTERFACE
 		mexErrMsgTxt("Arduino connection has not been set up yet.");
 #else
@@ -216,33 +119,90 @@ int vsa_arduino_interface_check ( ArduinoInterface *AI ) {
  */
 void vsa_arduino_interface_close      ( ArduinoInterface *AI ) {
 	/* If already closed, return. */
-	if (AI->connection_state == ARDUINO_DISCONNECTED) return;
+	if (AI->link.connection_state == ARDUINO_DISCONNECTED) return;
 
-	/* Kill the i/o thread. */
-	AI->thread_state = THREAD_KILLED; 
-#ifdef WIN32
-	if (AI->thread != NULL) {
-		WaitForSingleObject(AI->thread, INFINITE);
-	}
-#else
-	if (AI->thread != 0) {
-		pthread_join(AI->thread, NULL);
-		pthread_mutex_destroy(&AI->threadLock);
-	}
-#endif
-	/* Close serial */
-	serialClose(&AI->port);
+	vsa_link_close(&AI->link);
 #ifdef MEX_INTERFACE
 	/* Allow matlab to clear mex file again */
 	mexUnlock();
 #endif
-	/* Arduino communication now closed, so update connection_state */
-	AI->connection_state = ARDUINO_DISCONNECTED;
 }
 
-void vsa_arduino_interface_run_step(ArduinoInterface *AI, double *u, double *y ) {
+/**
+ * \brief Unpack the ADC readings of a sensor payload.
+ * \param[in] payload sensor payload (TRANSMIT_LENGTH bytes).
+ * \param[out] m ADC readings.
+ */
+static void parse_state ( const unsigned char *payload, int *m ) {
 	int i;
 
+	for ( i = 0; i < DIMY; i += 1 ) { m[i] = payload[2*i] + 256*payload[2*i+1]; }
+}
+
+/**
+ * \brief Read the latest ADC readings from the link (without waiting).
+ * \param AI arduino interface.
+ * \param[out] m ADC readings.
+ * \param[out] timestamp_ns time stamp of the readings in nanoseconds (may be NULL).
+ * \return sequence number of the readings (see vsa_link_read()).
+ */
+static unsigned int read_state ( ArduinoInterface *AI, int *m, long long *timestamp_ns ) {
+	unsigned char payload[TRANSMIT_LENGTH];
+	unsigned int sequence = vsa_link_read(&AI->link, payload, timestamp_ns);
+
+	parse_state(payload, m);
+	return sequence;
+}
+
+/** 
+ * \brief Convert ADC readings to sensor values in appropriate units (see vsa_arduino_interface_read()).
+ * \param[in] m ADC readings.
+ * \param[in] timestamp_ns time stamp of the readings in nanoseconds (appended to y in seconds).
+ * \param[out] y sensor values.
+ */
+static void convert_state ( const int *m, long long timestamp_ns, double *y ) {
+	double timestamp = 1e-9*timestamp_ns;
+
+#ifdef EDINBURGHVSA_INTERFACE   
+   y[0] =  W_POT_JOINT*(double)m[0]+  C_POT_JOINT;
+   y[1] =  W_ACC_JOINT*(double)m[1]+  C_ACC_JOINT;
+   y[2] = W_POT_SERVO0*(double)m[2]+ C_POT_SERVO0;
+   y[3] = W_POT_SERVO1*(double)m[3]+ C_POT_SERVO1;
+   y[4] = timestamp;
+#endif
+#ifdef MACCEPA_INTERFACE   
+   y[0] =  W_POT_JOINT*(double)m[0]+  C_POT_JOINT;
+   y[1] =  W_ACC_JOINT*(double)m[1]+  C_ACC_JOINT;
+   y[2] = W_POT_SERVO0*(double)m[2]+ C_POT_SERVO0;
+   y[3] = W_POT_SERVO1*(double)m[3]+ C_POT_SERVO1;
+   y[4] = ((5*(double)m[4]/4092)/(CURRENT_RSENSE*(1+(CURRENT_R2/CURRENT_R1))));
+   y[5] = timestamp;
+#endif
+#ifdef MACCEPA2DOF_INTERFACE   
+   y[ 0] = W_POT_JOINT0*(double)m[0] + C_POT_JOINT0;
+   y[ 1] = W_POT_JOINT1*(double)m[1] + C_POT_JOINT1;
+   y[ 2] = W_POT_SERVO0*(double)m[2] + C_POT_SERVO0;
+   y[ 3] = W_POT_SERVO1*(double)m[3] + C_POT_SERVO1;
+   y[ 4] = W_POT_SERVO2*(double)m[4] + C_POT_SERVO2;
+   y[ 5] = W_POT_SERVO3*(double)m[5] + C_POT_SERVO3;
+#ifdef CURRENT_SENSING
+   y[ 6] = ((5*(double)m[6]/4092)/(CURRENT_RSENSE*(1+(CURRENT_R2/CURRENT_R1))));
+   y[ 7] = ((5*(double)m[7]/4092)/(CURRENT_RSENSE*(1+(CURRENT_R2/CURRENT_R1))));
+   y[ 8] = ((5*(double)m[8]/4092)/(CURRENT_RSENSE*(1+(CURRENT_R2/CURRENT_R1))));
+   y[ 9] = ((5*(double)m[9]/4092)/(CURRENT_RSENSE*(1+(CURRENT_R2/CURRENT_R1))));
+   y[10] = timestamp;
+#else
+   y[6] = timestamp;
+#endif
+#endif
+}
+
+/** 
+ * \brief Clip commands to their limits and convert them to a command payload (see vsa_arduino_interface_write()).
+ * \param[in,out] u commands (clipped in place).
+ * \param[out] command_buffer command payload (RECEIVE_LENGTH bytes).
+ */
+static void encode_command ( double *u, unsigned char *command_buffer ) {
 	/* 	Limit commands */
 	if (u[0]<U_LLIM_RAD_SERVO0) u[0] = U_LLIM_RAD_SERVO0; if (u[0]>U_ULIM_RAD_SERVO0) u[0] = U_ULIM_RAD_SERVO0;
 	if (u[1]<U_LLIM_RAD_SERVO1) u[1] = U_LLIM_RAD_SERVO1; if (u[1]>U_ULIM_RAD_SERVO1) u[1] = U_ULIM_RAD_SERVO1;
@@ -273,251 +233,338 @@ void vsa_arduino_interface_run_step(ArduinoInterface *AI, double *u, double *y )
 	int M3 = RAD2USEC_SERVO3(u[3]);
 #endif
 
-	/* Wait 100 milliseconds for reading from serial. */
-	for (i=0;i<TIMEOUT;i++) {
-		if (AI->readComplete==1) break;
-#ifdef WIN32
-		Sleep(1);
-#else
-		usleep(1000);
-#endif
-	}
-#ifdef MEX_INTERFACE
-	if (i>=TIMEOUT) mexErrMsgTxt("Timeout!");
-#else
-	if (i>=TIMEOUT) fputs("Timeout!",stderr);
-#endif
-
-	/* Read arm state, send commands */
-	LOCK(AI);
-	/* Read measured_state */
-#ifdef EDINBURGHVSA_INTERFACE   
-   y[0] =  W_POT_JOINT*(double)AI->measured_state[0]+  C_POT_JOINT;
-   y[1] =  W_ACC_JOINT*(double)AI->measured_state[1]+  C_ACC_JOINT;
-   y[2] = W_POT_SERVO0*(double)AI->measured_state[2]+ C_POT_SERVO0;
-   y[3] = W_POT_SERVO1*(double)AI->measured_state[3]+ C_POT_SERVO1;
-   y[4] = AI->timestamp;
-#endif
-#ifdef MACCEPA_INTERFACE   
-   y[0] =  W_POT_JOINT*(double)AI->measured_state[0]+  C_POT_JOINT;
-   y[1] =  W_ACC_JOINT*(double)AI->measured_state[1]+  C_ACC_JOINT;
-   y[2] = W_POT_SERVO0*(double)AI->measured_state[2]+ C_POT_SERVO0;
-   y[3] = W_POT_SERVO1*(double)AI->measured_state[3]+ C_POT_SERVO1;
-   y[4] = ((5*(double)AI->measured_state[4]/4092)/(CURRENT_RSENSE*(1+(CURRENT_R2/CURRENT_R1))));
-   y[5] = AI->timestamp;
-#endif
-#ifdef MACCEPA2DOF_INTERFACE   
-   y[ 0] = W_POT_JOINT0*(double)AI->measured_state[0] + C_POT_JOINT0;
-   y[ 1] = W_POT_JOINT1*(double)AI->measured_state[1] + C_POT_JOINT1;
-   y[ 2] = W_POT_SERVO0*(double)AI->measured_state[2] + C_POT_SERVO0;
-   y[ 3] = W_POT_SERVO1*(double)AI->measured_state[3] + C_POT_SERVO1;
-   y[ 4] = W_POT_SERVO2*(double)AI->measured_state[4] + C_POT_SERVO2;
-   y[ 5] = W_POT_SERVO3*(double)AI->measured_state[5] + C_POT_SERVO3;
-#ifdef CURRENT_SENSING
-   y[ 6] = ((5*(double)AI->measured_state[6]/4092)/(CURRENT_RSENSE*(1+(CURRENT_R2/CURRENT_R1))));
-   y[ 7] = ((5*(double)AI->measured_state[7]/4092)/(CURRENT_RSENSE*(1+(CURRENT_R2/CURRENT_R1))));
-   y[ 8] = ((5*(double)AI->measured_state[8]/4092)/(CURRENT_RSENSE*(1+(CURRENT_R2/CURRENT_R1))));
-   y[ 9] = ((5*(double)AI->measured_state[9]/4092)/(CURRENT_RSENSE*(1+(CURRENT_R2/CURRENT_R1))));
-   y[10] = AI->timestamp;
-#else
-   y[6] = AI->timestamp;
-#endif
-#endif
 	/* Write values to command buffer. */
-	AI->command_buffer[ 0] = RECEIVE_HEADER;   
-	AI->command_buffer[ 1] = M0 & 0xFE;  /* switch off least significant bit so it can never be equal to the header=0xFF */
-	AI->command_buffer[ 2] = M0 >> 8; 
-	AI->command_buffer[ 3] = M1 & 0xFE;
-	AI->command_buffer[ 4] = M1 >> 8;
+	command_buffer[ 0] = M0;
+	command_buffer[ 1] = M0 >> 8; 
+	command_buffer[ 2] = M1;
+	command_buffer[ 3] = M1 >> 8;
 #ifdef MACCEPA_INTERFACE
 #ifdef VARIABLE_DAMPING
-	AI->command_buffer[ 5] = M2 & 0xFE;  /* switch off least significant bit so it can never be equal to the header=0xFF */
-	AI->command_buffer[ 6] = M2 >> 8; 
+	command_buffer[ 4] = M2;
+	command_buffer[ 5] = M2 >> 8;
 #endif
 #endif
-#ifdef MACCEPA2DOF_INTERFACE   
-	AI->command_buffer[ 5] = M2 & 0xFE;
-	AI->command_buffer[ 6] = M2 >> 8;
-	AI->command_buffer[ 7] = M3 & 0xFE;
-	AI->command_buffer[ 8] = M3 >> 8;
+#ifdef MACCEPA2DOF_INTERFACE
+	command_buffer[ 4] = M2;
+	command_buffer[ 5] = M2 >> 8;
+	command_buffer[ 6] = M3;
+	command_buffer[ 7] = M3 >> 8;
 #ifdef VARIABLE_DAMPING
-	AI->command_buffer[ 9] = (int)u[4];
-	AI->command_buffer[10] = 0x00;
-	AI->command_buffer[11] = (int)u[5];
-	AI->command_buffer[12] = 0x00;
+	command_buffer[ 8] = (int)u[4];
+	command_buffer[ 9] = 0x00;
+	command_buffer[10] = (int)u[5];
+	command_buffer[11] = 0x00;
 #ifdef MAGNET /* if damping and magnet control */
-	AI->command_buffer[13] = (int)u[6];
-	AI->command_buffer[14] = 0x00;
+	command_buffer[12] = (int)u[6];
+	command_buffer[13] = 0x00;
 #endif
 #else
 #ifdef MAGNET /* if just magnet control */
-	AI->command_buffer[ 9] = (int)u[6];
-	AI->command_buffer[10] = 0x00;
+	command_buffer[ 8] = (int)u[6];
+	command_buffer[ 9] = 0x00;
 #endif
 #endif
 #endif
-	AI->readComplete  = 0;
-	UNLOCK(AI);
 }
 
-void vsa_arduino_interface_read ( ArduinoInterface *AI, double *y ) {
-	int i;
+int vsa_arduino_interface_run_step(ArduinoInterface *AI, double *u, double *y ) {
+	unsigned char command_buffer[RECEIVE_LENGTH];
+	int m[DIMY], ok;
+	long long timestamp_ns;
 
-	/* Wait for next serial read. */
-	for (i=0;i<TIMEOUT;i++) {
-		if (AI->readComplete==1) break;
-      #ifdef WIN32
-      Sleep(1);
-      #else
-      usleep(1000);
-      #endif
-   }
-   if (i>=TIMEOUT) fputs("Timeout!",stderr);
-   
-   LOCK(AI);
-#ifdef EDINBURGHVSA_INTERFACE   
-   y[0] =  W_POT_JOINT*(double)AI->measured_state[0]+  C_POT_JOINT;
-   y[1] =  W_ACC_JOINT*(double)AI->measured_state[1]+  C_ACC_JOINT;
-   y[2] = W_POT_SERVO0*(double)AI->measured_state[2]+ C_POT_SERVO0;
-   y[3] = W_POT_SERVO1*(double)AI->measured_state[3]+ C_POT_SERVO1;
-   y[4] = AI->timestamp;
-#endif
-#ifdef MACCEPA_INTERFACE   
-   y[0] =  W_POT_JOINT*(double)AI->measured_state[0]+  C_POT_JOINT;
-   y[1] =  W_ACC_JOINT*(double)AI->measured_state[1]+  C_ACC_JOINT;
-   y[2] = W_POT_SERVO0*(double)AI->measured_state[2]+ C_POT_SERVO0;
-   y[3] = W_POT_SERVO1*(double)AI->measured_state[3]+ C_POT_SERVO1;
-   y[4] = ((5*(double)AI->measured_state[4]/4092)/(CURRENT_RSENSE*(1+(CURRENT_R2/CURRENT_R1))));
-   y[5] = AI->timestamp;
-#endif
-#ifdef MACCEPA2DOF_INTERFACE   
-   y[0] = W_POT_JOINT0*(double)AI->measured_state[0] + C_POT_JOINT0;
-   y[1] = W_POT_JOINT1*(double)AI->measured_state[1] + C_POT_JOINT1;
-   y[2] = W_POT_SERVO0*(double)AI->measured_state[2] + C_POT_SERVO0;
-   y[3] = W_POT_SERVO1*(double)AI->measured_state[3] + C_POT_SERVO1;
-   y[4] = W_POT_SERVO2*(double)AI->measured_state[4] + C_POT_SERVO2;
-   y[5] = W_POT_SERVO3*(double)AI->measured_state[5] + C_POT_SERVO3;
-   y[6] = AI->timestamp;
-#endif
-   AI->readComplete  = 0;
-   UNLOCK(AI);
+	encode_command(u, command_buffer);
+
+	/* Wait (at most TIMEOUT milliseconds) for the next frame, send commands */
+	ok = vsa_link_wait(&AI->link, command_buffer);
+
+	/* Read arm state */
+	read_state(AI, m, &timestamp_ns);
+	convert_state(m, timestamp_ns, y);
+	return ok;
 }
 
-void vsa_arduino_interface_write ( ArduinoInterface *AI, double * u ) { 
+int vsa_arduino_interface_run_trajectory ( ArduinoInterface *AI, double *u, double *y, int length ) {
+	unsigned char *commands, *sensors;
+	long long *timestamps;
+	int m[DIMY], k, steps = 0;
+
+	if (length < 1) return 0;
+	commands   = malloc(length*RECEIVE_LENGTH);
+	sensors    = malloc(length*TRANSMIT_LENGTH);
+	timestamps = malloc(length*sizeof(long long));
+	if (commands == NULL || sensors == NULL || timestamps == NULL) {
+		fputs("Warning: couldn't allocate trajectory buffers.\n",stderr);
+	} else {
+		/* Clip and convert all commands up front, the i/o thread then only copies them. */
+		for ( k = 0; k < length; k += 1 ) encode_command(u + k*DIMU, commands + k*RECEIVE_LENGTH);
+
+		/* with length >= 1, this only fails if another trajectory is running */
+		if (vsa_link_trajectory_start(&AI->link, commands, sensors, timestamps, length)) {
+			steps = vsa_link_trajectory_wait(&AI->link);
+		} else {
+			fputs("Warning: a trajectory is already running.\n",stderr);
+		}
 
-	/* 	Limit commands */
-	if (u[0]<U_LLIM_RAD_SERVO0) u[0] = U_LLIM_RAD_SERVO0; if (u[0]>U_ULIM_RAD_SERVO0) u[0] = U_ULIM_RAD_SERVO0;
-	if (u[1]<U_LLIM_RAD_SERVO1) u[1] = U_LLIM_RAD_SERVO1; if (u[1]>U_ULIM_RAD_SERVO1) u[1] = U_ULIM_RAD_SERVO1;
+		for ( k = 0; k < steps; k += 1 ) {
+			parse_state(sensors + k*TRANSMIT_LENGTH, m);
+			convert_state(m, timestamps[k], y + k*(DIMY+1));
+		}
+	}
+	free(commands);
+	free(sensors);
+	free(timestamps);
+	return steps;
+}
+
+#ifdef ESTIMATOR_INTERFACE
+/** 
+ * \brief Process model of the state estimator (see vsa_estimator.h).
+ */
+static void estimator_model ( void *model, double *x, double *u, double *acc ) {
 #ifdef MACCEPA_INTERFACE
-#ifdef VARIABLE_DAMPING
-	if (u[2]<U_LLIM_DAMPER0   ) u[2] = U_LLIM_DAMPER0   ; if (u[2]>U_ULIM_DAMPER0   ) u[2] = U_ULIM_DAMPER0   ;
-#endif
-#endif
-#ifdef MACCEPA2DOF_INTERFACE
-	if (u[2]<U_LLIM_RAD_SERVO2) u[2] = U_LLIM_RAD_SERVO2; if (u[2]>U_ULIM_RAD_SERVO2) u[2] = U_ULIM_RAD_SERVO2;
-	if (u[3]<U_LLIM_RAD_SERVO3) u[3] = U_LLIM_RAD_SERVO3; if (u[3]>U_ULIM_RAD_SERVO3) u[3] = U_ULIM_RAD_SERVO3;
-#ifdef VARIABLE_DAMPING
-	if (u[4]<U_LLIM_DAMPER0   ) u[4] = U_LLIM_DAMPER0   ; if (u[4]>U_ULIM_DAMPER0   ) u[4] = U_ULIM_DAMPER0   ;
-	if (u[5]<U_LLIM_DAMPER1   ) u[5] = U_LLIM_DAMPER1   ; if (u[5]>U_ULIM_DAMPER1   ) u[5] = U_ULIM_DAMPER1   ;
+	maccepa_model_get_acceleration(acc, x, u, (maccepa_model *) model);
 #endif
+#ifdef EDINBURGHVSA_INTERFACE
+	edinburghvsa_model_get_acceleration(acc, x, u, (edinburghvsa_model *) model);
 #endif
+}
 
-	/* Convert units from (radians) to (0.5 usec). */
-	int M0 = RAD2USEC_SERVO0(u[0]);
-	int M1 = RAD2USEC_SERVO1(u[1]);
+/** 
+ * \brief Convert a command payload back to commands (the inverse of encode_command()).
+ * \param[in] command command payload (RECEIVE_LENGTH bytes).
+ * \param[out] u commands.
+ */
+static void decode_command ( const unsigned char *command, double *u ) {
+	u[0] = USEC2RAD(command[0] | command[1] << 8, RAD2USEC_SERVO0, (U_MIN_RAD_SERVO0), (U_MAX_RAD_SERVO0));
+	u[1] = USEC2RAD(command[2] | command[3] << 8, RAD2USEC_SERVO1, (U_MIN_RAD_SERVO1), (U_MAX_RAD_SERVO1));
 #ifdef MACCEPA_INTERFACE
 #ifdef VARIABLE_DAMPING
-	int M2 = DUTY2PWM_DAMPER0(u[2]);
+	u[2] = USEC2RAD(command[4] | command[5] << 8, DUTY2PWM_DAMPER0, (U_MIN_DUTY_DAMPER0), (U_MAX_DUTY_DAMPER0));
 #endif
 #endif
-#ifdef MACCEPA2DOF_INTERFACE
-	int M2 = RAD2USEC_SERVO2(u[2]);
-	int M3 = RAD2USEC_SERVO3(u[3]);
+}
+
+/** 
+ * \brief Update the state estimator with a frame, and predict the state at the time the reply takes effect.
+ * \param AI arduino interface.
+ * \param[in] y sensor readings.
+ *
+ * Over the next period, the robot applies the command sent in reply to the
+ * previous frame (the reply to this frame, which a controller may still
+ * change, only takes effect at the next frame), so the prediction uses the
+ * command the link last sent (VsaLink::sent_command).
+ */
+static void update_estimate ( ArduinoInterface *AI, const double *y ) {
+	const unsigned char *command = AI->link.sent_command;
+	double u[DIMU], x[VSA_ESTIMATOR_DIMX], period;
+	int predicted;
+
+	/* The model is driven by the measured motor positions (the servos lag behind their commands). */
+	decode_command(command, u);
+	u[0] = y[2];
+	u[1] = y[3];
+	vsa_estimator_update(&AI->estimator, y[DIMY], y[0], y[1], u);
+
+	/* Predict over the transport delay: the rest of the sensor averaging
+	 * window at the measured motor positions, then one frame period with the
+	 * command that is applied next (see vsa_arduino_interface_read_prediction()). */
+	period    = AI->estimator.period;
+	predicted = period > 0;
+	if (predicted) {
+		memcpy(x, AI->estimator.x, sizeof(x));
+		vsa_estimator_integrate(&AI->estimator, x, SENSOR_DELAY*period, u);
+		decode_command(command, u);
+		vsa_estimator_integrate(&AI->estimator, x, period, u);
+	}
+
+	LOCK(&AI->link);
+	memcpy(AI->estimate, AI->estimator.x, sizeof(AI->estimator.x));
+	AI->estimate[VSA_ESTIMATOR_DIMX] = y[DIMY];
+	if (predicted) {
+		memcpy(AI->prediction, x, sizeof(x));
+		AI->prediction[VSA_ESTIMATOR_DIMX] = y[DIMY] + (SENSOR_DELAY + 1)*period;
+	}
+	UNLOCK(&AI->link);
+}
 #endif
 
-	LOCK(AI);
-	AI->command_buffer[ 0] = RECEIVE_HEADER;   
-	AI->command_buffer[ 1] = M0 & 0xFE; 
-	AI->command_buffer[ 2] = M0 >> 8; 
-	AI->command_buffer[ 3] = M1 & 0xFE;
-	AI->command_buffer[ 4] = M1 >> 8;
-#ifdef MACCEPA_INTERFACE
-#ifdef VARIABLE_DAMPING
-	AI->command_buffer[ 5] = M2 & 0xFE;
-	AI->command_buffer[ 6] = M2 >> 8;
+/** 
+ * \brief Frame handler running the estimator and the controller of AI (see
+ * vsa_arduino_interface_start_estimator() and vsa_arduino_interface_set_controller()).
+ */
+static void process_frame ( void *data, const unsigned char *payload, long long timestamp_ns, unsigned char *command ) {
+	ArduinoInterface *AI = (ArduinoInterface *) data;
+	int m[DIMY];
+	double y[DIMY+1], u[DIMU];
+
+	parse_state(payload, m);
+	convert_state(m, timestamp_ns, y);
+#ifdef ESTIMATOR_INTERFACE
+	if (AI->estimating) update_estimate(AI, y);
 #endif
+	if (AI->controller != NULL && AI->controller(AI->controller_context, y, u)) encode_command(u, command);
+}
+
+/** 
+ * \brief Remove the frame handler of AI, so that its estimator and controller may be changed.
+ */
+static void suspend_frame_handler ( ArduinoInterface *AI ) {
+	vsa_link_set_frame_handler(&AI->link, NULL, NULL);
+}
+
+/** 
+ * \brief Install the frame handler of AI, if it has anything to do.
+ */
+static void resume_frame_handler ( ArduinoInterface *AI ) {
+	if (AI->controller != NULL || AI->estimating) vsa_link_set_frame_handler(&AI->link, process_frame, AI);
+}
+
+void vsa_arduino_interface_set_controller ( ArduinoInterface *AI, ArduinoInterfaceController controller, void *context ) {
+	/* Stop the old controller first, so that process_frame never sees a half-updated pair. */
+	suspend_frame_handler(AI);
+	AI->controller = controller;
+	AI->controller_context = context;
+	resume_frame_handler(AI);
+}
+
+void vsa_arduino_interface_start_estimator ( ArduinoInterface *AI, const VsaEstimatorNoise *noise ) {
+#ifdef ESTIMATOR_INTERFACE
+	suspend_frame_handler(AI);
+#ifdef MACCEPA_INTERFACE
+	maccepa_model_init(&AI->model);
 #endif
-#ifdef MACCEPA2DOF_INTERFACE
-	AI->command_buffer[ 5] = M2 & 0xFE;
-	AI->command_buffer[ 6] = M2 >> 8;
-	AI->command_buffer[ 7] = M3 & 0xFE;
-	AI->command_buffer[ 8] = M3 >> 8;
-#ifdef VARIABLE_DAMPING
-	AI->command_buffer[ 9] = (int)u[4];
-	AI->command_buffer[10] = 0x00;
-	AI->command_buffer[11] = (int)u[5];
-	AI->command_buffer[12] = 0x00;
-#ifdef MAGNET /* if damping and magnet control */
-	AI->command_buffer[13] = (int)u[6];
-	AI->command_buffer[14] = 0x00;
+#ifdef EDINBURGHVSA_INTERFACE
+	edinburghvsa_model_init(&AI->model);
 #endif
+	vsa_estimator_init(&AI->estimator, noise, estimator_model, &AI->model);
+	AI->estimate[VSA_ESTIMATOR_DIMX] = AI->prediction[VSA_ESTIMATOR_DIMX] = -1; /* no estimate before the next frame */
+	AI->estimating = 1;
+	resume_frame_handler(AI);
 #else
-#ifdef MAGNET /* if just magnet control */
-	AI->command_buffer[ 9] = (int)u[6];
-	AI->command_buffer[10] = 0x00;
-#endif
-#endif
+	(void) AI;
+	(void) noise;
+	fputs("Warning: this robot has no state estimator.\n",stderr);
 #endif
-	serialWrite(&AI->port, RECEIVE_LENGTH+1, AI->command_buffer);
-	UNLOCK(AI);
+}
+
+void vsa_arduino_interface_stop_estimator ( ArduinoInterface *AI ) {
+	suspend_frame_handler(AI);
+	AI->estimating = 0;
+	resume_frame_handler(AI);
+}
+
+int vsa_arduino_interface_read_estimate ( ArduinoInterface *AI, double *x ) {
+	int ok;
+
+	LOCK(&AI->link);
+	ok = AI->estimating && AI->estimate[VSA_ESTIMATOR_DIMX] >= 0;
+	if (ok) memcpy(x, AI->estimate, sizeof(AI->estimate));
+	UNLOCK(&AI->link);
+	return ok;
+}
+
+int vsa_arduino_interface_read_prediction ( ArduinoInterface *AI, double *x ) {
+	int ok;
+
+	LOCK(&AI->link);
+	ok = AI->estimating && AI->prediction[VSA_ESTIMATOR_DIMX] >= 0;
+	if (ok) memcpy(x, AI->prediction, sizeof(AI->prediction));
+	UNLOCK(&AI->link);
+	return ok;
+}
+
+int vsa_arduino_interface_read ( ArduinoInterface *AI, double *y ) {
+	int m[DIMY], ok;
+	long long timestamp_ns;
+
+	/* Wait for next serial read. */
+	ok = vsa_link_wait(&AI->link, NULL);
+
+	read_state(AI, m, &timestamp_ns);
+	convert_state(m, timestamp_ns, y);
+	return ok;
+}
+
+void vsa_arduino_interface_write ( ArduinoInterface *AI, double * u ) { 
+	unsigned char command_buffer[RECEIVE_LENGTH];
+
+	encode_command(u, command_buffer);
+	vsa_link_set_command(&AI->link, command_buffer); /* command is sent by the i/o thread with the next frame */
 }
 
 void vsa_arduino_interface_write_usec ( ArduinoInterface *AI, int * u ) { 
-	int i,j=1;
-	LOCK(AI);
-	AI->command_buffer[0] = RECEIVE_HEADER;
+	unsigned char command_buffer[RECEIVE_LENGTH];
+	int i,j=0;
    	for ( i = 0; i < DIMU; i += 1 ) {
-		AI->command_buffer[j  ] = u[i] & 0xFE; 
-		AI->command_buffer[j+1] = u[i] >> 8; 
+		command_buffer[j  ] = u[i]; 
+		command_buffer[j+1] = u[i] >> 8; 
 		j+=2;
    	}
 #ifdef MACCEPA2DOF_INTERFACE
 #ifdef VARIABLE_DAMPING
-	AI->command_buffer[ 9]=u[4];
-	AI->command_buffer[10]=0x00;
-	AI->command_buffer[11]=u[5];
-	AI->command_buffer[12]=0x00;
+	command_buffer[ 8]=u[4];
+	command_buffer[ 9]=0x00;
+	command_buffer[10]=u[5];
+	command_buffer[11]=0x00;
 #ifdef MAGNET /* if damping and magnet control */
-	AI->command_buffer[13] = u[6];
-	AI->command_buffer[14] = 0x00;
+	command_buffer[12] = u[6];
+	command_buffer[13] = 0x00;
 #endif
 #else
 #ifdef MAGNET /* if just magnet control */
-	AI->command_buffer[ 9] = u[6];
-	AI->command_buffer[10] = 0x00;
+	command_buffer[ 8] = u[6];
+	command_buffer[ 9] = 0x00;
 #endif
 #endif
 #endif
-	serialWrite(&AI->port, RECEIVE_LENGTH+1, AI->command_buffer);
-	UNLOCK(AI);
+	vsa_link_set_command(&AI->link, command_buffer); /* command is sent by the i/o thread with the next frame */
 }
 
-void vsa_arduino_interface_read_adc ( ArduinoInterface *AI, int * y) {
-	int i;
+int vsa_arduino_interface_read_adc ( ArduinoInterface *AI, int * y) {
+	int ok;
 
-	for (i=0;i<TIMEOUT;i++) {
-		if (AI->readComplete==1) break;
-#ifdef WIN32
-		Sleep(1);
-#else
-		usleep(1000);
-#endif
+	ok = vsa_link_wait(&AI->link, NULL);
+
+	read_state(AI, y, NULL);
+	return ok;
+}
+
+unsigned int vsa_arduino_interface_snapshot ( ArduinoInterface *AI, double *y, long long *timestamp ) {
+	int m[DIMY];
+	long long timestamp_ns;
+	unsigned int sequence;
+
+	sequence = read_state(AI, m, &timestamp_ns);
+	convert_state(m, timestamp_ns, y);
+	if (timestamp != NULL) *timestamp = timestamp_ns;
+	return sequence/2;
+}
+
+int vsa_arduino_interface_drain ( ArduinoInterface *AI, double *y, unsigned long *sequence, int max_frames ) {
+	VsaLinkFrame frames[16];
+	int m[DIMY], n, k, count = 0;
+
+	/* Take the frames from the link in small batches, to keep the copies on the stack. */
+	while (count < max_frames) {
+		n = vsa_link_drain(&AI->link, frames, max_frames - count < 16 ? max_frames - count : 16);
+		if (n == 0) break;
+		for ( k = 0; k < n; k += 1, count += 1 ) {
+			parse_state(frames[k].payload, m);
+			convert_state(m, frames[k].timestamp_ns, y + count*(DIMY+1));
+			if (sequence != NULL) sequence[count] = frames[k].sequence;
+		}
 	}
-	if (i>=TIMEOUT) fputs("Timeout!",stderr);
+	return count;
+}
 
-	LOCK(AI);
-	for (i=0;i<DIMY;i++) y[i] = AI->measured_state[i];
-	AI->readComplete  = 0;
-	UNLOCK(AI);
+void vsa_arduino_interface_get_statistics ( ArduinoInterface *AI, ArduinoInterfaceStatistics *statistics ) {
+	vsa_link_get_statistics(&AI->link, statistics);
 }
 
+void vsa_arduino_interface_get_timing ( ArduinoInterface *AI, ArduinoInterfaceTiming *timing ) {
+	vsa_link_get_timing(&AI->link, timing);
+}
+
+void vsa_arduino_interface_get_thread_settings ( ArduinoInterface *AI, ArduinoInterfaceThreadSettings *settings ) {
+	vsa_link_get_thread_settings(&AI->link, settings);
+}
@@ -0,0 +1,59 @@
+/**
+ * \file vsa_dynamics_edinburghvsa.cpp
+ *
+ * \brief Dynamics traits and exact linearisations (see vsa_dynamics.h) of the Edinburgh VSA.
+ *
+ * \note The acceleration below is a hand-written copy of the equations of
+ * edinburghvsa_model_get_acceleration() in libedinburghvsa.c, over a generic scalar type;
+ * nothing but test/test_dynamics.c (make test) keeps the two in sync, so a
+ * change to either must be made to both.
+ */
+#include <vsa_dynamics.h>
+#include <libedinburghvsa.h>
+
+/** \brief Edinburgh VSA dynamics (the equations of libedinburghvsa.c over a generic scalar type). */
+struct EdinburghvsaDynamics {
+	typedef edinburghvsa_model model;
+	static const int dim_u = DIMU;
+
+	/** \brief Joint acceleration, as edinburghvsa_model_get_acceleration(). */
+	template <typename S> static S acceleration ( const S *x, const S *u, const model *m ) {
+		double a = m->link_lever_length;
+		double L = m->lever_length;
+		double h = m->joint_to_motor_axis_x_separation;
+		double d = m->joint_to_motor_axis_y_separation;
+		double K = m->spring_constant;
+		double r = m->spring_rest_length;
+
+		/* moment arms a1 = -a2, springs s_i from the moment arms to the motor levers */
+		S cosq = cos(x[0]);
+		S sinq = sin(x[0]);
+		S a1x = -a*cosq, a1y = -a*sinq;
+		S a2x =  a*cosq, a2y =  a*sinq;
+		S s1x = -h-L*sin(u[0])-a1x, s1y = -d+L*cos(u[0])-a1y;
+		S s2x =  h+L*sin(u[1])-a2x, s2y = -d+L*cos(u[1])-a2y;
+		S n1 = sqrt(s1x*s1x+s1y*s1y);
+		S n2 = sqrt(s2x*s2x+s2y*s2y);
+		S f1 = K*(n1-r)/n1;
+		S f2 = K*(n2-r)/n2;
+
+		S tau_actuator = f1*(a1x*s1y-a1y*s1x) + f2*(a2x*s2y-a2y*s2x);
+		S tau_damping  = m->damping_constant*x[1];
+		S tau_gravity  = m->gravity_constant*sin(x[0]);
+		S tau_friction = m->viscous_friction*x[1] + m->coulomb_friction*copysign(1.0,vsa_value(x[1]));
+
+		return (tau_actuator - tau_damping - tau_gravity - tau_friction)/m->inertia;
+	}
+};
+
+void edinburghvsa_model_get_linearization ( double * A, double * B, double * x, double * u, edinburghvsa_model * model ) {
+	VsaDynamics<EdinburghvsaDynamics>::linearization(A, B, NULL, x, u, model);
+}
+
+void edinburghvsa_model_get_linearization_batch ( double * A, double * B, double * X, double * U, int n, edinburghvsa_model * model ) {
+	VsaDynamics<EdinburghvsaDynamics>::linearization_batch(A, B, X, U, n, model);
+}
+
+void edinburghvsa_model_get_acceleration_hessian ( double * H, double * x, double * u, edinburghvsa_model * model ) {
+	VsaDynamics<EdinburghvsaDynamics>::acceleration_hessian(H, x, u, model);
+}
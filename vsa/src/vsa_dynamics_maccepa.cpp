@@ -0,0 +1,50 @@
+/**
+ * \file vsa_dynamics_maccepa.cpp
+ *
+ * \brief Dynamics traits and exact linearisations (see vsa_dynamics.h) of the MACCEPA.
+ *
+ * \note The acceleration below is a hand-written copy of the equations of
+ * maccepa_model_get_acceleration() in libmaccepa.c, over a generic scalar type;
+ * nothing but test/test_dynamics.c (make test) keeps the two in sync, so a
+ * change to either must be made to both.
+ */
+#include <vsa_dynamics.h>
+#include <libmaccepa.h>
+
+/** \brief MACCEPA dynamics (the equations of libmaccepa.c over a generic scalar type). */
+struct MaccepaDynamics {
+	typedef maccepa_model model;
+	static const int dim_u = DIMU;
+
+	/** \brief Joint acceleration, as maccepa_model_get_acceleration(). */
+	template <typename S> static S acceleration ( const S *x, const S *u, const model *m ) {
+		double k = m->spring_constant;
+		double B = m->lever_length;
+		double C = m->pin_displacement;
+		double r = m->drum_radius;
+#ifdef VARIABLE_DAMPING
+		double b = 0; /* see maccepa_model_get_damping() */
+#else
+		double b = m->damping_constant;
+#endif
+		S a = u[0]-x[0];
+		S tau_actuator = k*B*C*sin(a)*( 1 + (r*u[1]-(C-B))/sqrt(B*B+C*C-2*B*C*cos(a)) );
+		S tau_damping  = b*x[1];
+		S tau_gravity  = m->gravity_constant*sin(x[0]);
+		S tau_friction = m->viscous_friction*x[1] + m->coulomb_friction*copysign(1.0,vsa_value(x[1]));
+
+		return (tau_actuator - tau_damping - tau_gravity - tau_friction)/m->inertia;
+	}
+};
+
+void maccepa_model_get_linearization ( double * A, double * B, double * x, double * u, maccepa_model * model ) {
+	VsaDynamics<MaccepaDynamics>::linearization(A, B, NULL, x, u, model);
+}
+
+void maccepa_model_get_linearization_batch ( double * A, double * B, double * X, double * U, int n, maccepa_model * model ) {
+	VsaDynamics<MaccepaDynamics>::linearization_batch(A, B, X, U, n, model);
+}
+
+void maccepa_model_get_acceleration_hessian ( double * H, double * x, double * u, maccepa_model * model ) {
+	VsaDynamics<MaccepaDynamics>::acceleration_hessian(H, x, u, model);
+}
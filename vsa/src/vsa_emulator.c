@@ -0,0 +1,428 @@
+/**
+ * \file vsa_emulator.c
+ * \brief Pseudo-terminal emulator of the Arduino control boards of the variable stiffness actuators.
+ *
+ * Opens a pseudo-terminal pair and speaks the same serial protocol as the
+ * sketches in sketchbook/ (sensor frames sent every period, command frames
+ * received from the host, see vsa_frame.h), so that
+ * vsa_arduino_interface.c can be run and benchmarked without hardware.
+ * Like vsa_arduino_interface.c, this is compiled once per robot with
+ * -DMACCEPA_INTERFACE, -DEDINBURGHVSA_INTERFACE or -DMACCEPA2DOF_INTERFACE.
+ *
+ * The plant is simulated with the dynamics libraries (libmaccepa,
+ * libedinburghvsa). The servos are modelled as rate limited
+ * (SERVO_SPEED). The 2-DOF MACCEPA has no dynamics model yet, so its joints
+ * follow the equilibrium position servos with a first order lag.
+ *
+ * Usage:
+ * \code
+ *   build/maccepa_emulator [-p period_ms] [-n frames] [-l link]
+ * \endcode
+ * The name of the emulated serial device (e.g., /dev/pts/3, or the symlink
+ * given with -l) is printed on startup; pass this to
+ * vsa_arduino_interface_init(). When the emulator exits (after n frames, or on
+ * SIGINT/SIGTERM) it prints the loop latency (time from sending a frame to
+ * receiving the host's command), the frame timing jitter and the throughput.
+ */
+#define _GNU_SOURCE
+#include <vsa_arduino_interface.h>
+#ifdef MACCEPA_INTERFACE
+#include <libmaccepa.h>
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+#include <libedinburghvsa.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdlib.h>
+
+/** \brief Servo speed (rad/s) used to rate limit the emulated servo positions. */
+#define SERVO_SPEED 7.0
+/** \brief Integration step (s) for simulating the plant dynamics. */
+#define INTEGRATION_STEP 0.001
+/** \brief Time constant (s) of the joints of models without dynamics (2-DOF MACCEPA). */
+#define JOINT_TIME_CONSTANT 0.05
+
+/** \brief Convert a sensor reading y back to ADC steps, by inverting the calibration y = W*adc + C. */
+#define Y2ADC(y,W,C) adc_clip(floor(((y)-(C))/(W)+0.5))
+
+#ifdef MACCEPA2DOF_INTERFACE
+/** \brief Number of joints of the emulated robot. */
+#define NJOINTS 2
+/** \brief Number of servos of the emulated robot. */
+#define NSERVOS 4
+#else
+#define NJOINTS 1
+#define NSERVOS 2
+#endif
+
+/** \brief Statistics of a timing quantity (in seconds). */
+typedef struct {
+	unsigned long n;
+	double sum, sumsq, min, max;
+} TimingStatistics;
+
+/** \brief Emulator state. */
+typedef struct {
+	/** \brief Master side of the pseudo-terminal (emulated Arduino end). */
+	int master;
+	/** \brief Slave side of the pseudo-terminal (kept open so the master does not see a hang-up while the host reconnects). */
+	int slave;
+
+	/** \brief Joint positions and velocities. */
+	double q[NJOINTS], qdot[NJOINTS];
+	/** \brief Joint accelerations (for the accelerometer). */
+	double qddot[NJOINTS];
+	/** \brief Servo positions (rad). */
+	double m[NSERVOS];
+	/** \brief Active command (rad, or duty cycle for dampers), as set at the last frame. */
+	double u[DIMU];
+	/** \brief Most recently received command (applied at the next frame, like the sketches' Timer 1 interrupt). */
+	double u_received[DIMU];
+
+	/** \brief Receive buffer for command bytes (payload of the last valid command frame). */
+	unsigned char receive_buffer[RECEIVE_LENGTH];
+	/** \brief Decoder for command frames. */
+	VsaFrameDecoder decoder;
+	/** \brief Sequence number of the last frame sent. */
+	unsigned char sequence;
+
+#ifdef MACCEPA_INTERFACE
+	maccepa_model model;
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+	edinburghvsa_model model;
+#endif
+
+	/** \brief Frames sent and commands received. */
+	unsigned long frames_sent, commands_received, frames_unanswered;
+	/** \brief Invalid command frames discarded. */
+	unsigned long frame_errors;
+	/** \brief Bytes sent to / received from the host. */
+	unsigned long bytes_out, bytes_in;
+	/** \brief Set once a command has been received in reply to the last frame sent. */
+	int answered;
+	/** \brief Time at which the last frame was sent. */
+	struct timespec t_sent;
+	/** \brief Loop latency (frame sent to command received). */
+	TimingStatistics latency;
+	/** \brief Deviation of frame send times from the nominal schedule. */
+	TimingStatistics jitter;
+} Emulator;
+
+/** \brief Set by the signal handler to stop the emulator. */
+static volatile sig_atomic_t stop = 0;
+
+static void handle_signal ( int sig ) {
+	(void) sig;
+	stop = 1;
+}
+
+static double timespec_diff ( struct timespec *a, struct timespec *b ) {
+	return (a->tv_sec - b->tv_sec) + 1e-9*(a->tv_nsec - b->tv_nsec);
+}
+
+static void timespec_add ( struct timespec *t, double dt ) {
+	long ns = (long)(dt*1e9);
+	t->tv_sec  += ns / 1000000000L;
+	t->tv_nsec += ns % 1000000000L;
+	if (t->tv_nsec >= 1000000000L) { t->tv_sec++; t->tv_nsec -= 1000000000L; }
+}
+
+static void timing_add ( TimingStatistics *s, double v ) {
+	if (s->n == 0 || v < s->min) s->min = v;
+	if (s->n == 0 || v > s->max) s->max = v;
+	s->sum   += v;
+	s->sumsq += v*v;
+	s->n++;
+}
+
+static void timing_print ( const char *name, TimingStatistics *s ) {
+	double mean, var;
+	if (s->n == 0) { printf("%-20s: no samples\n", name); return; }
+	mean = s->sum/s->n;
+	var  = s->sumsq/s->n - mean*mean;
+	printf("%-20s: mean %.3f, std %.3f, min %.3f, max %.3f (ms, %lu samples)\n",
+	       name, 1e3*mean, 1e3*sqrt(var > 0 ? var : 0), 1e3*s->min, 1e3*s->max, s->n);
+}
+
+static int adc_clip ( double adc ) {
+	if (adc < 0) return 0;
+	if (adc > 0xFFFF) return 0xFFFF;
+	return (int)adc;
+}
+
+/**
+ * \brief Decode a received command bit-string (units of 0.5 usec) into radiens.
+ */
+static void decode_command ( Emulator *E ) {
+	int M[DIMU], i;
+
+	for ( i = 0; i < DIMU; i += 1 ) {
+		M[i] = E->receive_buffer[2*i] + 256*E->receive_buffer[2*i+1];
+	}
+	E->u_received[0] = USEC2RAD(M[0], RAD2USEC_SERVO0, (U_MIN_RAD_SERVO0), (U_MAX_RAD_SERVO0));
+	E->u_received[1] = USEC2RAD(M[1], RAD2USEC_SERVO1, (U_MIN_RAD_SERVO1), (U_MAX_RAD_SERVO1));
+#ifdef MACCEPA_INTERFACE
+#ifdef VARIABLE_DAMPING
+	E->u_received[2] = USEC2RAD(M[2], DUTY2PWM_DAMPER0, (U_MIN_DUTY_DAMPER0), (U_MAX_DUTY_DAMPER0));
+#endif
+#endif
+#ifdef MACCEPA2DOF_INTERFACE
+	E->u_received[2] = USEC2RAD(M[2], RAD2USEC_SERVO2, (U_MIN_RAD_SERVO2), (U_MAX_RAD_SERVO2));
+	E->u_received[3] = USEC2RAD(M[3], RAD2USEC_SERVO3, (U_MIN_RAD_SERVO3), (U_MAX_RAD_SERVO3));
+	for ( i = 4; i < DIMU; i += 1 ) { E->u_received[i] = M[i]; } /* dampers/magnet (not emulated) */
+#endif
+}
+
+/**
+ * \brief Encode the current plant state as ADC readings (inverse of the conversions in vsa_arduino_interface_read).
+ */
+static void encode_sensors ( Emulator *E, int *adc ) {
+#ifdef EDINBURGHVSA_INTERFACE
+	adc[0] = Y2ADC(E->q[0]    , W_POT_JOINT , C_POT_JOINT );
+	adc[1] = Y2ADC(E->qddot[0], W_ACC_JOINT , C_ACC_JOINT );
+	adc[2] = Y2ADC(E->m[0]    , W_POT_SERVO0, C_POT_SERVO0);
+	adc[3] = Y2ADC(E->m[1]    , W_POT_SERVO1, C_POT_SERVO1);
+#endif
+#ifdef MACCEPA_INTERFACE
+	adc[0] = Y2ADC(E->q[0]    , W_POT_JOINT , C_POT_JOINT );
+	adc[1] = Y2ADC(E->qddot[0], W_ACC_JOINT , C_ACC_JOINT );
+	adc[2] = Y2ADC(E->m[0]    , W_POT_SERVO0, C_POT_SERVO0);
+	adc[3] = Y2ADC(E->m[1]    , W_POT_SERVO1, C_POT_SERVO1);
+	adc[4] = 0; /* current sensor (not emulated) */
+#endif
+#ifdef MACCEPA2DOF_INTERFACE
+	int i;
+	adc[0] = Y2ADC(E->q[0], W_POT_JOINT0, C_POT_JOINT0);
+	adc[1] = Y2ADC(E->q[1], W_POT_JOINT1, C_POT_JOINT1);
+	adc[2] = Y2ADC(E->m[0], W_POT_SERVO0, C_POT_SERVO0);
+	adc[3] = Y2ADC(E->m[1], W_POT_SERVO1, C_POT_SERVO1);
+	adc[4] = Y2ADC(E->m[2], W_POT_SERVO2, C_POT_SERVO2);
+	adc[5] = Y2ADC(E->m[3], W_POT_SERVO3, C_POT_SERVO3);
+	for ( i = 6; i < DIMY; i += 1 ) { adc[i] = 0; } /* current sensors (not emulated) */
+#endif
+}
+
+/**
+ * \brief Simulate the plant over one frame period with the active command.
+ */
+static void step_plant ( Emulator *E, double period ) {
+	int i, j, n = (int)ceil(period/INTEGRATION_STEP);
+	double h = period/n;
+
+	for ( j = 0; j < n; j += 1 ) {
+		/* rate limited servos */
+		for ( i = 0; i < NSERVOS; i += 1 ) {
+			double d = E->u[i] - E->m[i];
+			if (d >  SERVO_SPEED*h) d =  SERVO_SPEED*h;
+			if (d < -SERVO_SPEED*h) d = -SERVO_SPEED*h;
+			E->m[i] += d;
+		}
+#ifdef MACCEPA2DOF_INTERFACE
+		for ( i = 0; i < NJOINTS; i += 1 ) {
+			double qdot = (E->m[2*i] - E->q[i])/JOINT_TIME_CONSTANT;
+			E->qddot[i] = (qdot - E->qdot[i])/h;
+			E->qdot[i]  = qdot;
+			E->q[i]    += h*qdot;
+		}
+#else
+		{
+			double x[DIMX] = { E->q[0], E->qdot[0] };
+			double mu[DIMU];
+			for ( i = 0; i < DIMU; i += 1 ) { mu[i] = i < NSERVOS ? E->m[i] : E->u[i]; }
+#ifdef MACCEPA_INTERFACE
+			maccepa_model_get_acceleration(E->qddot, x, mu, &E->model);
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+			edinburghvsa_model_get_acceleration(E->qddot, x, mu, &E->model);
+#endif
+			/* semi-implicit Euler */
+			E->qdot[0] += h*E->qddot[0];
+			E->q[0]    += h*E->qdot[0];
+			if (E->q[0] >  M_PI/2) { E->q[0] =  M_PI/2; E->qdot[0] = 0; }
+			if (E->q[0] < -M_PI/2) { E->q[0] = -M_PI/2; E->qdot[0] = 0; }
+		}
+#endif
+	}
+}
+
+/**
+ * \brief Send a sensor frame to the host.
+ */
+static void send_frame ( Emulator *E ) {
+	unsigned char payload[TRANSMIT_LENGTH], frame[VSA_FRAME_MAX_ENCODED];
+	int adc[DIMY], i, n, length, sent = 0;
+
+	encode_sensors(E, adc);
+	for ( i = 0; i < DIMY; i += 1 ) {
+		payload[2*i  ] = adc[i] & 0xFF;
+		payload[2*i+1] = adc[i] >> 8;
+	}
+	length = vsa_frame_encode(frame, VSA_FRAME_SENSOR, ++E->sequence, payload, TRANSMIT_LENGTH);
+	while (sent < length) {
+		n = write(E->master, frame+sent, length-sent);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN) break; /* host is not reading, drop the rest (as the UART would) */
+			perror("write");
+			stop = 1;
+			return;
+		}
+		sent += n;
+	}
+	E->bytes_out += sent;
+	E->frames_sent++;
+	if (E->frames_sent > 1 && !E->answered) E->frames_unanswered++;
+	E->answered = 0;
+	clock_gettime(CLOCK_MONOTONIC, &E->t_sent);
+}
+
+/**
+ * \brief Parse bytes received from the host (like the sketches' loop()).
+ *
+ * The loop latency is measured from the frame sent to the first command
+ * that echoes its sequence number.
+ */
+static void receive ( Emulator *E ) {
+	unsigned char buffer[256];
+	struct timespec t;
+	int n, i;
+
+	n = read(E->master, buffer, sizeof(buffer));
+	if (n <= 0) return;
+	E->bytes_in += n;
+
+	for ( i = 0; i < n; i += 1 ) {
+		int result = vsa_frame_decode(&E->decoder, buffer[i]);
+		if (result == VSA_FRAME_INCOMPLETE) continue;
+		if (result < 0 || E->decoder.type != VSA_FRAME_COMMAND || E->decoder.length != RECEIVE_LENGTH) {
+			E->frame_errors++;
+			continue;
+		}
+		memcpy(E->receive_buffer, E->decoder.payload, RECEIVE_LENGTH);
+		decode_command(E);
+		E->commands_received++;
+		if (!E->answered && E->frames_sent > 0 && E->decoder.sequence == E->sequence) {
+			clock_gettime(CLOCK_MONOTONIC, &t);
+			timing_add(&E->latency, timespec_diff(&t, &E->t_sent));
+			E->answered = 1;
+		}
+	}
+}
+
+static void usage ( const char *name ) {
+	fprintf(stderr,
+	"Usage: %s [-p period_ms] [-n frames] [-l link]\n"
+	"  -p period_ms  frame period in milliseconds (default %g)\n"
+	"  -n frames     number of frames to send before exiting (default 0, run until interrupted)\n"
+	"  -l link       create a symlink with this name to the emulated serial device\n", name, 1e3*FRAME_PERIOD);
+}
+
+int main ( int argc, char **argv ) {
+	Emulator E;
+	struct termios tio;
+	struct timespec start, next, t;
+	struct pollfd pfd;
+	double period = FRAME_PERIOD, elapsed;
+	unsigned long frames = 0;
+	char *link_name = NULL;
+	char slave_name[128];
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "p:n:l:h")) != -1) {
+		switch (opt) {
+			case 'p': period    = 1e-3*atof(optarg); break;
+			case 'n': frames    = strtoul(optarg, NULL, 10); break;
+			case 'l': link_name = optarg; break;
+			default : usage(argv[0]); return 1;
+		}
+	}
+	if (period <= 0) { usage(argv[0]); return 1; }
+
+	memset(&E, 0, sizeof(E));
+	vsa_frame_decoder_init(&E.decoder);
+#ifdef MACCEPA_INTERFACE
+	maccepa_model_init(&E.model);
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+	edinburghvsa_model_init(&E.model);
+#endif
+
+	/* Start at the initial commands of the sketches. */
+	for ( i = 0; i < RECEIVE_LENGTH; i += 1 ) { E.receive_buffer[i] = 0; }
+	E.receive_buffer[0] = U_INIT_SERVO0 & 0xFF; E.receive_buffer[1] = U_INIT_SERVO0 >> 8;
+	E.receive_buffer[2] = U_INIT_SERVO1 & 0xFF; E.receive_buffer[3] = U_INIT_SERVO1 >> 8;
+#ifdef MACCEPA2DOF_INTERFACE
+	E.receive_buffer[4] = U_INIT_SERVO2 & 0xFF; E.receive_buffer[5] = U_INIT_SERVO2 >> 8;
+	E.receive_buffer[6] = U_INIT_SERVO3 & 0xFF; E.receive_buffer[7] = U_INIT_SERVO3 >> 8;
+#endif
+	decode_command(&E);
+	memcpy(E.u, E.u_received, sizeof(E.u));
+	for ( i = 0; i < NSERVOS; i += 1 ) { E.m[i] = E.u[i]; }
+#ifdef MACCEPA2DOF_INTERFACE
+	for ( i = 0; i < NJOINTS; i += 1 ) { E.q[i] = E.m[2*i]; }
+#endif
+
+	/* Open pseudo-terminal pair in raw mode (so nothing is echoed before the host configures the port). */
+	if (openpty(&E.master, &E.slave, slave_name, NULL, NULL)) {
+		perror("openpty");
+		return 1;
+	}
+	tcgetattr(E.slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(E.slave, TCSANOW, &tio);
+	fcntl(E.master, F_SETFL, fcntl(E.master, F_GETFL) | O_NONBLOCK);
+
+	if (link_name != NULL) {
+		unlink(link_name);
+		if (symlink(slave_name, link_name)) { perror("symlink"); return 1; }
+	}
+	printf("%s\n", link_name != NULL ? link_name : slave_name);
+	fflush(stdout);
+
+	signal(SIGINT , handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	pfd.fd     = E.master;
+	pfd.events = POLLIN;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	next = start;
+	while (!stop && (frames == 0 || E.frames_sent < frames)) {
+		/* Frame tick (the sketches' Timer 1 overflow): send sensor readings, then apply the latest command. */
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		if (E.frames_sent > 0) timing_add(&E.jitter, timespec_diff(&t, &next));
+		step_plant(&E, period);
+		send_frame(&E);
+		memcpy(E.u, E.u_received, sizeof(E.u));
+
+		/* Receive commands until the next tick. */
+		timespec_add(&next, period);
+		while (!stop) {
+			struct timespec remaining = {0, 0};
+			clock_gettime(CLOCK_MONOTONIC, &t);
+			elapsed = timespec_diff(&next, &t);
+			if (elapsed <= 0) break;
+			timespec_add(&remaining, elapsed);
+			if (ppoll(&pfd, 1, &remaining, NULL) > 0 && (pfd.revents & POLLIN)) receive(&E);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	elapsed = timespec_diff(&t, &start);
+	printf("frames sent         : %lu\n", E.frames_sent);
+	printf("commands received   : %lu (%lu frames without reply, %lu invalid frames)\n", E.commands_received, E.frames_unanswered, E.frame_errors);
+	printf("throughput          : %.1f frames/s, %.0f bytes/s out, %.0f bytes/s in\n",
+	       elapsed > 0 ? E.frames_sent/elapsed : 0, elapsed > 0 ? E.bytes_out/elapsed : 0, elapsed > 0 ? E.bytes_in/elapsed : 0);
+	timing_print("loop latency", &E.latency);
+	timing_print("frame jitter", &E.jitter);
+
+	if (link_name != NULL) unlink(link_name);
+	close(E.master);
+	close(E.slave);
+	return 0;
+}
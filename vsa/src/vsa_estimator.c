@@ -0,0 +1,152 @@
+/**
+ * \file vsa_estimator.c
+ *
+ * \brief Extended Kalman filter fusing joint potentiometer and accelerometer (see vsa_estimator.h).
+ */
+#include <math.h>
+#include <string.h>
+#include <vsa_estimator.h>
+
+#define N VSA_ESTIMATOR_DIMX
+
+/** \brief Finite difference steps for linearising the process model (position, velocity). */
+static const double delta[2] = { 1e-4, 1e-3 };
+
+void vsa_estimator_default_noise ( VsaEstimatorNoise *noise ) {
+	noise->position     = 0.002;
+	noise->acceleration = 1;
+	noise->jerk         = 20;
+	noise->model        = 5;
+}
+
+void vsa_estimator_init ( VsaEstimator *E, const VsaEstimatorNoise *noise, VsaEstimatorModel model, void *model_data ) {
+	if (noise != NULL) E->noise = *noise;
+	else vsa_estimator_default_noise(&E->noise);
+	E->model      = model;
+	E->model_data = model_data;
+	memset(E->x, 0, sizeof(E->x));
+	memset(E->P, 0, sizeof(E->P));
+	E->time   = -1;
+	E->period = 0;
+}
+
+/**
+ * \brief Start from the measurements, with the velocity unknown.
+ */
+static void reset ( VsaEstimator *E, double position, double acceleration ) {
+	memset(E->P, 0, sizeof(E->P));
+	E->x[0] = position;
+	E->x[1] = 0;
+	E->x[2] = acceleration;
+	E->P[0][0] = E->noise.position*E->noise.position;
+	E->P[1][1] = 1;
+	E->P[2][2] = E->noise.acceleration*E->noise.acceleration;
+}
+
+/**
+ * \brief Propagate the state and covariance over dt.
+ */
+static void predict ( VsaEstimator *E, double dt, double *u ) {
+	double F[N][N] = { { 1, dt, 0.5*dt*dt }, { 0, 1, dt }, { 0, 0, 1 } };
+	double FP[N][N], xp[2], xd[2], ap, am, A[2], s2 = E->noise.jerk*E->noise.jerk;
+	int i, j, k;
+
+	xp[0] = E->x[0] + dt*E->x[1] + 0.5*dt*dt*E->x[2];
+	xp[1] = E->x[1] + dt*E->x[2];
+	E->x[0] = xp[0];
+	E->x[1] = xp[1];
+
+	if (E->model != NULL) {
+		/* Acceleration from the process model, linearised around the propagated state. */
+		E->model(E->model_data, xp, u, &E->x[2]);
+		for ( i = 0; i < 2; i += 1 ) {
+			xd[0] = xp[0]; xd[1] = xp[1]; xd[i] += delta[i]; E->model(E->model_data, xd, u, &ap);
+			xd[0] = xp[0]; xd[1] = xp[1]; xd[i] -= delta[i]; E->model(E->model_data, xd, u, &am);
+			A[i] = (ap - am)/(2*delta[i]);
+		}
+		for ( j = 0; j < N; j += 1 ) { F[2][j] = A[0]*F[0][j] + A[1]*F[1][j]; }
+	}
+
+	/* P = F P F' + Q */
+	for ( i = 0; i < N; i += 1 ) {
+		for ( j = 0; j < N; j += 1 ) {
+			FP[i][j] = 0;
+			for ( k = 0; k < N; k += 1 ) { FP[i][j] += F[i][k]*E->P[k][j]; }
+		}
+	}
+	for ( i = 0; i < N; i += 1 ) {
+		for ( j = 0; j < N; j += 1 ) {
+			E->P[i][j] = 0;
+			for ( k = 0; k < N; k += 1 ) { E->P[i][j] += FP[i][k]*F[j][k]; }
+		}
+	}
+	/* white jerk */
+	E->P[0][0] += s2*dt*dt*dt*dt*dt/20;
+	E->P[0][1] += s2*dt*dt*dt*dt/8;  E->P[1][0] += s2*dt*dt*dt*dt/8;
+	E->P[0][2] += s2*dt*dt*dt/6;     E->P[2][0] += s2*dt*dt*dt/6;
+	E->P[1][1] += s2*dt*dt*dt/3;
+	E->P[1][2] += s2*dt*dt/2;        E->P[2][1] += s2*dt*dt/2;
+	E->P[2][2] += s2*dt;
+	if (E->model != NULL) E->P[2][2] += E->noise.model*E->noise.model;
+}
+
+/**
+ * \brief Correct the state with the measured position and acceleration (H selects x[0] and x[2]).
+ */
+static void correct ( VsaEstimator *E, double position, double acceleration ) {
+	double S00 = E->P[0][0] + E->noise.position*E->noise.position;
+	double S01 = E->P[0][2];
+	double S11 = E->P[2][2] + E->noise.acceleration*E->noise.acceleration;
+	double det = S00*S11 - S01*S01;
+	double Si00 = S11/det, Si01 = -S01/det, Si11 = S00/det;
+	double r0 = position - E->x[0], r1 = acceleration - E->x[2];
+	double K[N][2], HP[2][N];
+	int i, j;
+
+	for ( i = 0; i < N; i += 1 ) {
+		K[i][0] = E->P[i][0]*Si00 + E->P[i][2]*Si01;
+		K[i][1] = E->P[i][0]*Si01 + E->P[i][2]*Si11;
+		HP[0][i] = E->P[0][i];
+		HP[1][i] = E->P[2][i];
+	}
+	for ( i = 0; i < N; i += 1 ) {
+		E->x[i] += K[i][0]*r0 + K[i][1]*r1;
+		for ( j = 0; j < N; j += 1 ) { E->P[i][j] -= K[i][0]*HP[0][j] + K[i][1]*HP[1][j]; }
+	}
+	/* keep P symmetric */
+	for ( i = 0; i < N; i += 1 ) {
+		for ( j = 0; j < i; j += 1 ) { E->P[i][j] = E->P[j][i] = 0.5*(E->P[i][j] + E->P[j][i]); }
+	}
+}
+
+void vsa_estimator_update ( VsaEstimator *E, double time, double position, double acceleration, double *u ) {
+	double dt = time - E->time;
+
+	if (E->time < 0 || dt <= 0 || dt > VSA_ESTIMATOR_MAX_GAP) {
+		reset(E, position, acceleration);
+	} else {
+		predict(E, dt, u);
+		correct(E, position, acceleration);
+		E->period += E->period > 0 ? (dt - E->period)/16 : dt;
+	}
+	E->time = time;
+}
+
+void vsa_estimator_integrate ( const VsaEstimator *E, double *x, double duration, double *u ) {
+	int i, n = (int)ceil(duration/VSA_ESTIMATOR_STEP);
+	double h;
+
+	if (duration <= 0) return;
+	if (E->model == NULL) {
+		x[0] += duration*x[1] + 0.5*duration*duration*x[2];
+		x[1] += duration*x[2];
+		return;
+	}
+	h = duration/n;
+	for ( i = 0; i < n; i += 1 ) {
+		E->model(E->model_data, x, u, &x[2]);
+		x[1] += h*x[2];
+		x[0] += h*x[1];
+	}
+	E->model(E->model_data, x, u, &x[2]);
+}
@@ -0,0 +1,654 @@
+/** 
+ * \file vsa_link.c
+ *
+ * \brief Serial link to the Arduino control boards of the variable stiffness
+ * actuators (i/o thread, framing, statistics), independent of the robot type.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* pthread_setaffinity_np() */
+#endif
+#include <vsa_link.h>
+#include <errno.h>
+#ifndef WIN32
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+/** \brief Clock used for time stamping frames (not subject to NTP slewing or steps). */
+#ifdef CLOCK_MONOTONIC_RAW
+#define FRAME_CLOCK CLOCK_MONOTONIC_RAW
+#else
+#define FRAME_CLOCK CLOCK_MONOTONIC
+#endif
+#ifdef MEX_INTERFACE
+#include <mex.h>
+#endif
+
+/** 
+ * \brief Fill the receive ring buffer with everything currently buffered by the serial driver.
+ * \param L link.
+ * \return Number of bytes read, 0 on timeout, -1 on error.
+ *
+ * Waits (at most TIMEOUT milliseconds) for the serial port to become readable,
+ * then reads as many bytes as are available (up to the contiguous free space
+ * in the ring buffer) with a single call to serialRead.
+ */
+static int rx_buffer_fill ( VsaLink *L ) {
+	unsigned int used  = L->rx_head - L->rx_tail;
+	unsigned int index = L->rx_head & (RX_BUFFER_LENGTH-1);
+	unsigned int space = RX_BUFFER_LENGTH - index;
+	int n;
+
+	if (space > RX_BUFFER_LENGTH - used) space = RX_BUFFER_LENGTH - used;
+	if (space == 0) return 0;
+
+	n = serialWaitInput(&L->port, TIMEOUT);
+	if (n <= 0) return n;
+
+	n = serialRead(&L->port, space, &L->rx_buffer[index]);
+	if (n > 0) L->rx_head += n;
+	return n;
+}
+
+/** 
+ * \brief Write a command frame to the serial port (called from the i/o thread only).
+ * \param L link.
+ * \param[in] frame encoded command frame (see vsa_frame_encode()).
+ * \param[in] length length of frame.
+ *
+ * Loops over partial writes, so that a complete frame is handed to the
+ * driver. Nothing is flushed: pending input (e.g., the start of the next
+ * frame) and output are left intact.
+ */
+static void send_command ( VsaLink *L, unsigned char *frame, int length ) {
+	int sent = 0, n;
+
+	while (sent < length) {
+		n = serialWrite(&L->port, length-sent, frame+sent);
+		if (n <= 0) {
+			LOCK(L);
+			L->statistics.write_errors++;
+			UNLOCK(L);
+			return;
+		}
+		sent += n;
+	}
+}
+
+/** 
+ * \brief Publish the payload of a new sensor frame (i/o thread only).
+ * \param L link.
+ * \param[in] payload sensor payload (transmit_length bytes).
+ * \param[in] timestamp_ns time stamp of the frame (nanoseconds).
+ *
+ * sensor_payload and timestamp_ns are protected by a sequence lock rather than
+ * threadLock: the writer never waits for readers, and readers retry
+ * (vsa_link_read()) if they overlapped with an update.
+ */
+static void publish_state ( VsaLink *L, const unsigned char *payload, long long timestamp_ns ) {
+	unsigned int sequence = SEQLOCK_LOAD(&L->state_sequence);
+
+	SEQLOCK_STORE(&L->state_sequence, sequence + 1); /* odd: update in progress */
+	SEQLOCK_FENCE();
+	memcpy((void *)L->sensor_payload, payload, L->transmit_length);
+	L->timestamp_ns = timestamp_ns;
+	SEQLOCK_FENCE();
+	SEQLOCK_STORE(&L->state_sequence, sequence + 2);
+}
+
+/** 
+ * \brief Append a sensor frame to the history (i/o thread only, with L locked).
+ * \param L link.
+ * \param[in] payload sensor payload (transmit_length bytes).
+ * \param[in] timestamp_ns time stamp of the frame (nanoseconds).
+ * \param[in] sequence frame number.
+ *
+ * If the history is full, the oldest frame is dropped.
+ */
+static void record_history ( VsaLink *L, const unsigned char *payload, long long timestamp_ns, unsigned long sequence ) {
+	VsaLinkFrame *F;
+
+	if (L->history_head - L->history_tail == HISTORY_LENGTH) {
+		L->history_tail++;
+		L->statistics.history_overruns++;
+	}
+	F = &L->history[L->history_head++ & (HISTORY_LENGTH-1)];
+	memcpy(F->payload, payload, L->transmit_length);
+	F->timestamp_ns = timestamp_ns;
+	F->sequence     = sequence;
+}
+
+/** 
+ * \brief Wait (with L locked) until the i/o thread has changed *value (e.g., completed a new frame).
+ * \param L link.
+ * \param value flag or counter protected by threadLock, updated by the i/o thread with every frame.
+ * \param old value to wait for a change from.
+ * \return 1 if *value changed, 0 if it did not within TIMEOUT milliseconds.
+ *
+ * The deadline is absolute (monotonic clock), so spurious wake-ups do not
+ * extend the wait.
+ */
+static int wait_change ( VsaLink *L, int *value, int old ) {
+#ifdef WIN32
+	ULONGLONG deadline = GetTickCount64() + TIMEOUT, now;
+
+	while (*value == old) {
+		now = GetTickCount64();
+		if (now >= deadline) return 0;
+		SleepConditionVariableCS(&L->frameReady, &L->threadLock, (DWORD)(deadline - now));
+	}
+#else
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec  += TIMEOUT / 1000;
+	deadline.tv_nsec += (TIMEOUT % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) { deadline.tv_sec++; deadline.tv_nsec -= 1000000000L; }
+
+	while (*value == old) {
+		if (pthread_cond_timedwait(&L->frameReady, &L->threadLock, &deadline) == ETIMEDOUT) return *value != old;
+	}
+#endif
+	return 1;
+}
+
+/** 
+ * \brief Add an inter-frame interval to the timing statistics (called from the i/o thread, with L locked).
+ * \param L link.
+ * \param[in] interval time (in nanoseconds) between the arrival of two consecutive frames.
+ */
+static void update_timing ( VsaLink *L, long long interval ) {
+	ArduinoInterfaceTiming *T = &L->timing;
+	long long bin = interval / TIMING_HISTOGRAM_BIN_NS;
+	double deviation = fabs(interval - FRAME_PERIOD*1e9);
+	double delta = interval - T->interval_mean_ns;
+
+	if (T->intervals == 0 || interval < T->interval_min_ns) T->interval_min_ns = interval;
+	if (T->intervals == 0 || interval > T->interval_max_ns) T->interval_max_ns = interval;
+	/* Running mean and variance (Welford). */
+	T->intervals++;
+	T->interval_mean_ns += delta / T->intervals;
+	L->timing_m2 += delta * (interval - T->interval_mean_ns);
+	T->interval_std_ns = T->intervals > 1 ? sqrt(L->timing_m2 / (T->intervals - 1)) : 0;
+	/* Running jitter estimate as in RTP (RFC 3550), relative to the nominal frame period. */
+	T->jitter_ns += (deviation - T->jitter_ns) / 16;
+
+	if (bin < 0) bin = 0;
+	if (bin >= TIMING_HISTOGRAM_BINS) bin = TIMING_HISTOGRAM_BINS - 1;
+	T->histogram[bin]++;
+}
+
+/** 
+ * \brief Touch PREFAULT_STACK_SIZE bytes of stack, so that the pages are
+ * mapped (and, with mlockall(), locked) before the i/o loop starts.
+ */
+static void prefault_stack ( void ) {
+	volatile unsigned char stack[PREFAULT_STACK_SIZE];
+	int i;
+
+	for ( i = 0; i < PREFAULT_STACK_SIZE; i += 1024 ) stack[i] = 0;
+	(void)stack[0];
+}
+
+/** 
+ * \brief I/O thread function. Continually runs in the background, 
+ * reading from the serial. If new data arrives at the serial it is decoded and its payload published (see vsa_link_read()).
+ */
+#ifdef WIN32
+static void threadFunc(LPVOID data) {
+	LARGE_INTEGER frequency, counter, counter0;
+#else
+static void *threadFunc(void *data) {
+	struct timespec tSpec, tSpec0;
+#endif   
+   
+	VsaLink *L = (VsaLink *) data;
+
+	int result;         /** \brief Result of decoding the latest byte. */
+	VsaFrameDecoder decoder; /** \brief Decoder for incoming serial data. */
+	long long timestamp; /** \brief Time stamp of data (nanoseconds since the thread started). */
+	long long previous = -1; /** \brief Time stamp of the previous frame, -1 before the first frame. */
+	int sequence = -1;  /** \brief Sequence number of previous frame (for detecting dropped frames), -1 before the first frame. */
+	unsigned long frame_number = 0; /** \brief Frame number (sequence numbers unwrapped) of the current frame. */
+	unsigned char command[VSA_FRAME_MAX_PAYLOAD]; /** \brief Copy of the command to be sent in reply to a frame. */
+	unsigned char frame[VSA_FRAME_MAX_ENCODED]; /** \brief Encoded command frame. */
+	int frame_length;   /** \brief Length of encoded command frame. */
+	int step;           /** \brief Current step of the command trajectory. */
+	int stepped;        /** \brief Non-zero if the frame was replied to with a step of the trajectory. */
+	VsaLinkFrameHandler handler; /** \brief Frame handler to call for the current frame (NULL if none). */
+	void *context;      /** \brief Context of the frame handler. */
+
+#ifdef WIN32
+	timeBeginPeriod(1);
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter0);
+#else
+	clock_gettime(FRAME_CLOCK, &tSpec0);
+#endif
+
+	if (L->thread_settings.stack_prefaulted) prefault_stack();
+
+	L->rx_head = L->rx_tail = 0;
+	vsa_frame_decoder_init(&decoder);
+	L->thread_state=!THREAD_KILLED;
+	while (L->thread_state != THREAD_KILLED ) { /* Loop until thread is killed. */
+		int n = rx_buffer_fill(L);
+		if (n == 0) continue;
+		if (n < 0) { /* serial error (e.g., device unplugged), back off before retrying */
+#ifdef WIN32
+			Sleep(TIMEOUT);
+#else
+			usleep(TIMEOUT*1000);
+#endif
+			continue;
+		}
+
+		/* Process bit string from serial */
+		while (L->rx_tail != L->rx_head) {
+			result = vsa_frame_decode(&decoder, L->rx_buffer[L->rx_tail++ & (RX_BUFFER_LENGTH-1)]);
+			if (result == VSA_FRAME_INCOMPLETE) continue;
+			if (result < 0 || decoder.type != VSA_FRAME_SENSOR || decoder.length != L->transmit_length) {
+				/* Invalid frame: drop it, the decoder is back in sync at the next delimiter. */
+				LOCK(L);
+				L->statistics.resyncs++;
+				if (result == VSA_FRAME_ERROR_CRC) L->statistics.crc_errors++;
+				UNLOCK(L);
+				continue;
+			}
+#ifdef WIN32
+			QueryPerformanceCounter(&counter);
+			counter.QuadPart -= counter0.QuadPart;
+			timestamp = counter.QuadPart / frequency.QuadPart * 1000000000LL + counter.QuadPart % frequency.QuadPart * 1000000000LL / frequency.QuadPart;
+#else
+			clock_gettime(FRAME_CLOCK, &tSpec);
+			timestamp = (tSpec.tv_sec - tSpec0.tv_sec) * 1000000000LL + (tSpec.tv_nsec - tSpec0.tv_nsec);
+#endif
+			publish_state(L, decoder.payload, timestamp);
+			LOCK(L);
+			L->statistics.frames_received++;
+			if (sequence >= 0) L->statistics.frames_dropped += (unsigned char)(decoder.sequence - sequence - 1);
+			if (sequence >= 0) frame_number += (unsigned char)(decoder.sequence - sequence);
+			record_history(L, decoder.payload, timestamp, frame_number);
+			/* Inter-frame intervals are only meaningful between consecutive frames. */
+			if (sequence >= 0 && decoder.sequence == (unsigned char)(sequence + 1)) update_timing(L, timestamp - previous);
+			previous = timestamp;
+			stepped = (L->trajectory_commands != NULL);
+			if (stepped) { /* record the frame, reply with the next command of the trajectory */
+				step = L->trajectory_position;
+				memcpy(L->trajectory_sensors + step*L->transmit_length, decoder.payload, L->transmit_length);
+				if (L->trajectory_timestamps != NULL) L->trajectory_timestamps[step] = timestamp;
+				memcpy(L->command_buffer, L->trajectory_commands + step*L->receive_length, L->receive_length);
+				if (++L->trajectory_position == L->trajectory_length) L->trajectory_commands = NULL; /* done, hold the last command */
+			}
+			memcpy(command, L->command_buffer, L->receive_length);
+			/* The frame handler computes the command in reply to this frame (outside the lock, see vsa_link_set_frame_handler()). */
+			handler = L->frame_handler;
+			context = L->frame_handler_context;
+			L->frame_handler_busy = (handler != NULL);
+			if (handler == NULL) {
+				L->readComplete = 1;
+				SIGNAL_FRAME(L);
+			}
+			UNLOCK(L);
+			sequence = decoder.sequence;
+
+			if (handler != NULL) {
+				handler(context, decoder.payload, timestamp, command);
+				LOCK(L);
+				if (stepped) memcpy(command, L->command_buffer, L->receive_length); /* the trajectory takes precedence */
+				else         memcpy(L->command_buffer, command, L->receive_length);
+				L->frame_handler_busy = 0;
+				L->readComplete = 1; /* readers see the frame once the handler is done with it */
+				SIGNAL_FRAME(L);
+				UNLOCK(L);
+			}
+
+			/* Write command to serial (outside the lock, so that readers are not held up). */
+			memcpy(L->sent_command, command, L->receive_length);
+			frame_length = vsa_frame_encode(frame, VSA_FRAME_COMMAND, decoder.sequence, command, L->receive_length);
+			send_command(L, frame, frame_length);
+		}
+	}
+
+#ifdef WIN32
+	timeEndPeriod(1);
+	return;
+#else
+	return NULL;
+#endif
+}
+
+/** 
+ * \brief Apply options.thread_priority and options.thread_cpu to the (running) i/o thread.
+ * \param L link.
+ * \param[in] options interface options.
+ *
+ * Failures are not fatal (the interface works with normal scheduling), but
+ * are reported on stderr.
+ */
+static void set_thread_scheduling ( VsaLink *L, const ArduinoInterfaceOptions *options ) {
+#ifdef WIN32
+	if (options->thread_priority > 0 && !SetThreadPriority(L->thread, THREAD_PRIORITY_TIME_CRITICAL)) {
+		fputs("Warning: couldn't raise priority of i/o thread.\n",stderr);
+	}
+	if (options->thread_cpu >= 0) {
+		if (SetThreadAffinityMask(L->thread, (DWORD_PTR)1 << options->thread_cpu)) L->thread_settings.cpu = options->thread_cpu;
+		else fprintf(stderr,"Warning: couldn't pin i/o thread to CPU %d.\n", options->thread_cpu);
+	}
+#else
+	struct sched_param param;
+	cpu_set_t cpus;
+	int error;
+
+	if (options->thread_priority > 0) {
+		param.sched_priority = options->thread_priority;
+		error = pthread_setschedparam(L->thread, SCHED_FIFO, &param);
+		if (error) fprintf(stderr,"Warning: couldn't set SCHED_FIFO priority %d for i/o thread (%s).\n", options->thread_priority, strerror(error));
+	}
+	if (options->thread_cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(options->thread_cpu, &cpus);
+		error = pthread_setaffinity_np(L->thread, sizeof(cpus), &cpus);
+		if (error) fprintf(stderr,"Warning: couldn't pin i/o thread to CPU %d (%s).\n", options->thread_cpu, strerror(error));
+	}
+#endif
+}
+
+#ifndef WIN32
+/** \brief Number of open links that have locked the process memory, protected by memory_lock_mutex. */
+static int memory_lock_count = 0;
+static pthread_mutex_t memory_lock_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** 
+ * \brief Lock the process memory for a link (options.lock_memory).
+ * \return non-zero on success (errno is set on failure).
+ *
+ * mlockall() and munlockall() act on the whole process, so the locks of the
+ * links are counted: memory is locked by the first link that asks for it,
+ * and unlocked (unlock_memory()) when the last of these is closed.
+ */
+static int lock_memory ( void ) {
+	int ok = 1;
+
+	pthread_mutex_lock(&memory_lock_mutex);
+	if (memory_lock_count == 0) ok = (mlockall(MCL_CURRENT | MCL_FUTURE) == 0);
+	if (ok) memory_lock_count += 1;
+	pthread_mutex_unlock(&memory_lock_mutex);
+	return ok;
+}
+
+/** \brief Release the memory lock of a link (see lock_memory()). */
+static void unlock_memory ( void ) {
+	pthread_mutex_lock(&memory_lock_mutex);
+	if (memory_lock_count > 0 && --memory_lock_count == 0) munlockall();
+	pthread_mutex_unlock(&memory_lock_mutex);
+}
+#endif
+
+void vsa_link_default_options ( ArduinoInterfaceOptions *options, int baudrate ) {
+	options->baudrate    = baudrate;
+	options->low_latency = 0;
+	options->capture_file = NULL;
+	options->replay_file  = NULL;
+	options->replay_speed = 1;
+	options->thread_priority = 0;
+	options->thread_cpu      = -1;
+	options->lock_memory     = 0;
+	options->prefault_stack  = 0;
+}
+
+int  vsa_link_open ( VsaLink *L, const char *device, int transmit_length, int receive_length, const unsigned char *command, const ArduinoInterfaceOptions *options ) {
+	if (transmit_length > VSA_FRAME_MAX_PAYLOAD || receive_length > VSA_FRAME_MAX_PAYLOAD) {
+		fputs("Frame payload too long.\n",stderr);
+		return 0;
+	}
+
+	/* Open serial communication (or the capture file to replay). */
+	if (options->replay_file != NULL) {
+		L->connection_state = serialOpenReplay(&L->port, options->replay_file, options->replay_speed);
+	} else {
+		L->connection_state = serialOpenByName(&L->port, (char *)device);
+	}
+	if (L->connection_state==ARDUINO_DISCONNECTED) {
+#ifdef MEX_INTERFACE
+		mexErrMsgTxt("Couldn't open the specified port.");
+#else
+		fputs("Couldn't open the specified port.\n",stderr);
+		return 0;
+#endif
+	} 
+	/* Set serial parameters (or close the serial if this fails). */
+	if (!serialSetParameters(&L->port,options->baudrate, 8, 0, 1, 10)) { /* options->baudrate baud, 8 data bits, no parity, 1 stop bit, 10*0.1 = 1 sec. timeout */
+		L->connection_state = ARDUINO_DISCONNECTED;
+		serialClose(&L->port);
+#ifdef MEX_INTERFACE
+		mexErrMsgTxt("Couldn't change serial port parameters!");
+#else
+		fputs("Couldn't change serial port parameters!\n",stderr);
+		return 0;
+#endif
+	}
+
+	/* Optionally switch on low-latency mode (failure is not fatal, the port just keeps the driver defaults). */
+	if (options->low_latency && !serialSetLowLatency(&L->port, 1)) {
+		fputs("Warning: couldn't switch serial port to low-latency mode.\n",stderr);
+	}
+
+	/* Optionally record all traffic (failure is not fatal, the robot is still usable). */
+	if (options->capture_file != NULL && !serialCaptureStart(&L->port, options->capture_file)) {
+		fputs("Warning: couldn't start serial capture.\n",stderr);
+	}
+
+	/* Set initial command */
+	L->transmit_length = transmit_length;
+	L->receive_length  = receive_length;
+	memcpy(L->command_buffer, command, receive_length);
+	memcpy(L->sent_command,   command, receive_length);
+	L->trajectory_commands = NULL;
+	L->trajectory_position = L->trajectory_length = 0;
+	L->frame_handler = NULL;
+	L->frame_handler_context = NULL;
+	L->frame_handler_busy = 0;
+
+	/* Flush serial port (discard stale data from before the connection was set up). */
+	serialFlushInput(&L->port);
+	serialFlushOutput(&L->port);
+	L->readComplete = 0;
+	L->state_sequence = 0;
+	memset((void *)L->sensor_payload, 0, sizeof(L->sensor_payload));
+	L->timestamp_ns = 0;
+	memset(&L->statistics, 0, sizeof(L->statistics));
+	L->history_head = L->history_tail = 0;
+	memset(&L->timing, 0, sizeof(L->timing));
+	L->timing_m2 = 0;
+
+	/* Optionally lock memory (before starting the thread, so that its stack is locked, too). */
+	L->thread_settings.memory_locked    = 0;
+	L->thread_settings.stack_prefaulted = options->prefault_stack;
+	L->thread_settings.cpu              = -1;
+	if (options->lock_memory) {
+#ifdef WIN32
+		fputs("Warning: memory locking is not supported on this platform.\n",stderr);
+#else
+		if (lock_memory()) L->thread_settings.memory_locked = 1;
+		else fprintf(stderr,"Warning: couldn't lock memory (%s).\n", strerror(errno));
+#endif
+	}
+
+	/* Start i/o thread. */
+#ifdef WIN32
+   InitializeCriticalSection(&L->threadLock);
+   InitializeConditionVariable(&L->frameReady);
+   L->thread = (HANDLE) _beginthread(threadFunc, 0, L);
+   if (L->thread == NULL) {
+      return 0;
+   }
+#else
+   pthread_mutex_init(&L->threadLock, NULL);
+   {
+      pthread_condattr_t attr; /* frameReady is waited on with monotonic deadlines (see wait_change) */
+      pthread_condattr_init(&attr);
+      pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+      pthread_cond_init(&L->frameReady, &attr);
+      pthread_condattr_destroy(&attr);
+   }
+   pthread_create(&L->thread, NULL, threadFunc, L);
+#endif
+	set_thread_scheduling(L, options);
+   
+	/* Connection successful so set connection_state to ARDUINO_CONNECTED */
+	L->connection_state = ARDUINO_CONNECTED;
+
+	return 1;
+}
+
+void vsa_link_close ( VsaLink *L ) {
+	/* If already closed, return. */
+	if (L->connection_state == ARDUINO_DISCONNECTED) return;
+
+	/* Kill the i/o thread. */
+	L->thread_state = THREAD_KILLED; 
+#ifdef WIN32
+	if (L->thread != NULL) {
+		WaitForSingleObject(L->thread, INFINITE);
+	}
+#else
+	if (L->thread != 0) {
+		pthread_join(L->thread, NULL);
+		pthread_cond_destroy(&L->frameReady);
+		pthread_mutex_destroy(&L->threadLock);
+	}
+#endif
+#ifndef WIN32
+	if (L->thread_settings.memory_locked) {
+		unlock_memory();
+		L->thread_settings.memory_locked = 0;
+	}
+#endif
+	/* Let the last command go out before closing (serialClose discards pending output). */
+	serialDrainOutput(&L->port);
+	/* Close serial */
+	serialClose(&L->port);
+	/* Arduino communication now closed, so update connection_state */
+	L->connection_state = ARDUINO_DISCONNECTED;
+}
+
+int  vsa_link_wait ( VsaLink *L, const unsigned char *command ) {
+	int ok;
+
+	LOCK(L);
+	ok = wait_change(L, &L->readComplete, 0);
+	L->readComplete = 0;
+	if (command != NULL) memcpy(L->command_buffer, command, L->receive_length);
+	UNLOCK(L);
+	return ok;
+}
+
+void vsa_link_set_command ( VsaLink *L, const unsigned char *command ) {
+	LOCK(L);
+	memcpy(L->command_buffer, command, L->receive_length);
+	UNLOCK(L); /* command is sent by the i/o thread with the next frame */
+}
+
+int  vsa_link_trajectory_start ( VsaLink *L, const unsigned char *commands, unsigned char *sensors, long long *timestamps, int length ) {
+	int ok;
+
+	if (length < 1) return 0;
+	LOCK(L);
+	ok = (L->trajectory_commands == NULL);
+	if (ok) {
+		L->trajectory_sensors    = sensors;
+		L->trajectory_timestamps = timestamps;
+		L->trajectory_length     = length;
+		L->trajectory_position   = 0;
+		L->trajectory_commands   = commands; /* the i/o thread starts with the next frame */
+	}
+	UNLOCK(L);
+	return ok;
+}
+
+int  vsa_link_trajectory_wait ( VsaLink *L ) {
+	int steps;
+
+	LOCK(L);
+	while (L->trajectory_commands != NULL) {
+		if (!wait_change(L, &L->trajectory_position, L->trajectory_position)) {
+			L->trajectory_commands = NULL; /* no frames, give up (the caller may then release the buffers) */
+		}
+	}
+	steps = L->trajectory_position;
+	UNLOCK(L);
+	return steps;
+}
+
+void vsa_link_set_frame_handler ( VsaLink *L, VsaLinkFrameHandler handler, void *context ) {
+	LOCK(L);
+	L->frame_handler         = handler;
+	L->frame_handler_context = context;
+	while (L->frame_handler_busy) wait_change(L, &L->frame_handler_busy, 1); /* let a running call finish */
+	UNLOCK(L);
+}
+
+unsigned int vsa_link_read ( VsaLink *L, unsigned char *payload, long long *timestamp_ns ) {
+	unsigned int before, after;
+	long long t;
+
+	do {
+		before = SEQLOCK_LOAD(&L->state_sequence);
+		SEQLOCK_FENCE();
+		memcpy(payload, (void *)L->sensor_payload, L->transmit_length);
+		t = L->timestamp_ns;
+		SEQLOCK_FENCE();
+		after = SEQLOCK_LOAD(&L->state_sequence);
+	} while ((before & 1) || before != after);
+
+	if (timestamp_ns != NULL) *timestamp_ns = t;
+	return after;
+}
+
+int  vsa_link_drain ( VsaLink *L, VsaLinkFrame *frames, int max_frames ) {
+	int n = 0;
+
+	LOCK(L);
+	while (n < max_frames && L->history_tail != L->history_head) {
+		frames[n++] = L->history[L->history_tail++ & (HISTORY_LENGTH-1)];
+	}
+	UNLOCK(L);
+	return n;
+}
+
+void vsa_link_get_statistics ( VsaLink *L, ArduinoInterfaceStatistics *statistics ) {
+	LOCK(L);
+	*statistics = L->statistics;
+	UNLOCK(L);
+}
+
+void vsa_link_get_timing ( VsaLink *L, ArduinoInterfaceTiming *timing ) {
+	LOCK(L);
+	*timing = L->timing;
+	UNLOCK(L);
+}
+
+void vsa_link_get_thread_settings ( VsaLink *L, ArduinoInterfaceThreadSettings *settings ) {
+#ifdef WIN32
+	*settings = L->thread_settings;
+	settings->priority = GetThreadPriority(L->thread);
+	settings->realtime = (settings->priority == THREAD_PRIORITY_TIME_CRITICAL);
+#else
+	struct sched_param param;
+	cpu_set_t cpus;
+	int policy, i;
+
+	*settings = L->thread_settings;
+	settings->realtime = 0;
+	settings->priority = 0;
+	settings->cpu      = -1;
+	if (pthread_getschedparam(L->thread, &policy, &param) == 0) {
+		settings->realtime = (policy == SCHED_FIFO || policy == SCHED_RR);
+		settings->priority = param.sched_priority;
+	}
+	if (pthread_getaffinity_np(L->thread, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) == 1) {
+		for ( i = 0; i < CPU_SETSIZE; i += 1 ) if (CPU_ISSET(i, &cpus)) settings->cpu = i;
+	}
+#endif
+}
@@ -18,25 +18,48 @@ static char usage_msg[]=
 "Usage of Edinburgh VSA MEX interface:\n" \
 "  edinburghvsa('I', device) opens the Arduino board on the specified serial port device,\n" \
 "                       e.g., /dev/ttyUSB0 on Linux or COM1 on Windows. \n" \
+"  edinburghvsa('I', device, baudrate) as above, using the given baudrate.\n" \
 "  edinburghvsa('C')         closes the connection.\n" \
+"  [Y,seq] = edinburghvsa('D') returns all frames received since the last call (columns of Y)\n" \
+"                       and their frame numbers (gaps: frames lost on the serial line).\n" \
+"  x = edinburghvsa('E')       returns the state estimate (joint angle, velocity, acceleration\n" \
+"                       and timestamp), starting the estimator on the first call.\n" \
+"  x = edinburghvsa('P')       returns the state predicted for when a command sent now takes\n" \
+"                       effect (joint angle, velocity, acceleration and time).\n" \
 "  y = edinburghvsa(u)       move motors to u(1),u(2) and read joint angle,\n" \
-"                       acceleration, motor 1 pot, motor 2 pot and timestamp.";
+"                       acceleration, motor 1 pot, motor 2 pot and timestamp.\n" \
+"  Y = edinburghvsa(U)       execute the trajectory U (one column per frame) and return\n" \
+"                       the sensor readings of each frame as the columns of Y.\n";
 #endif
 #ifdef MACCEPA_INTERFACE
 "Usage of MACCEPA MEX interface:\n" \
 "  maccepa('I', device) opens the Arduino board on the specified serial port device,\n" \
 "                       e.g., /dev/ttyUSB0 on Linux or COM1 on Windows. \n" \
+"  maccepa('I', device, baudrate) as above, using the given baudrate.\n" \
 "  maccepa('C')         closes the connection.\n" \
+"  [Y,seq] = maccepa('D') returns all frames received since the last call (columns of Y)\n" \
+"                       and their frame numbers (gaps: frames lost on the serial line).\n" \
+"  x = maccepa('E')       returns the state estimate (joint angle, velocity, acceleration\n" \
+"                       and timestamp), starting the estimator on the first call.\n" \
+"  x = maccepa('P')       returns the state predicted for when a command sent now takes\n" \
+"                       effect (joint angle, velocity, acceleration and time).\n" \
 "  y = maccepa(u)       move motors to u(1),u(2) and read joint angle,\n" \
-"                       acceleration, motor positions, motor current and timestamp.\n";
+"                       acceleration, motor positions, motor current and timestamp.\n" \
+"  Y = maccepa(U)       execute the trajectory U (one column per frame) and return\n" \
+"                       the sensor readings of each frame as the columns of Y.\n";
 #endif
 #ifdef MACCEPA2DOF_INTERFACE
 "Usage of 2-DOF MACCEPA MEX interface:\n" \
 "  maccepa2dof('I', device) opens the Arduino board on the specified serial port device,\n" \
 "                       e.g., /dev/ttyUSB0 on Linux or COM1 on Windows. \n" \
+"  maccepa2dof('I', device, baudrate) as above, using the given baudrate.\n" \
 "  maccepa2dof('C')         closes the connection.\n" \
+"  [Y,seq] = maccepa2dof('D') returns all frames received since the last call (columns of Y)\n" \
+"                       and their frame numbers (gaps: frames lost on the serial line).\n" \
 "  y = maccepa2dof(u)   move motors to u(1),...,u(4), damper pots to u(5),u(6) and read joint angles,\n" \
-"                       motor positions, motor currents and timestamp.\n";
+"                       motor positions, motor currents and timestamp.\n" \
+"  Y = maccepa2dof(U)   execute the trajectory U (one column per frame) and return\n" \
+"                       the sensor readings of each frame as the columns of Y.\n";
 #endif
 
 /** 
@@ -56,6 +79,9 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 		char action[2];
 		char device[128];
 		double t;
+		ArduinoInterfaceOptions options;
+		unsigned long sequence[HISTORY_LENGTH];
+		int n;
 
 		mxGetString(prhs[0], action, 2);
 
@@ -66,11 +92,40 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 					return;
 				}
 				mxGetString(prhs[1], device, 128); /* get port name */
-				vsa_arduino_interface_init(&AI, device); /* open arduino communication */
+				vsa_arduino_interface_default_options(&options);
+				if (nrhs > 2 && mxIsDouble(prhs[2])) options.baudrate = (int)mxGetScalar(prhs[2]); /* get baudrate */
+				vsa_arduino_interface_init_options(&AI, device, &options); /* open arduino communication */
 				return;
 			case 'C': /* First char is a 'C' -> close arduino */
 				vsa_arduino_interface_close(&AI);                    /* close arduino communication */
 				return;
+			case 'D': /* First char is a 'D' -> return all frames received since the last call */
+				vsa_arduino_interface_check(&AI);
+				plhs[0] = mxCreateDoubleMatrix(DIMY+1,HISTORY_LENGTH,mxREAL);
+				n = vsa_arduino_interface_drain(&AI, mxGetPr(plhs[0]), sequence, HISTORY_LENGTH);
+				mxSetN(plhs[0], n);
+				if (nlhs > 1) {
+					plhs[1] = mxCreateDoubleMatrix(1,n,mxREAL);
+					for ( i = 0; i < n; i += 1 ) { mxGetPr(plhs[1])[i] = sequence[i]; }
+				}
+				return;
+#ifdef ESTIMATOR_INTERFACE
+			case 'E': /* First char is an 'E' -> return the state estimate */
+				vsa_arduino_interface_check(&AI);
+				if (!AI.estimating) {
+					double y[DIMY+1];
+					vsa_arduino_interface_start_estimator(&AI, NULL);
+					vsa_arduino_interface_read(&AI, y); /* wait for the first update */
+				}
+				plhs[0] = mxCreateDoubleMatrix(VSA_ESTIMATOR_DIMX+1,1,mxREAL);
+				if (!vsa_arduino_interface_read_estimate(&AI, mxGetPr(plhs[0]))) mexErrMsgTxt("Timeout!");
+				return;
+			case 'P': /* First char is a 'P' -> return the predicted state */
+				vsa_arduino_interface_check(&AI);
+				plhs[0] = mxCreateDoubleMatrix(VSA_ESTIMATOR_DIMX+1,1,mxREAL);
+				if (!vsa_arduino_interface_read_prediction(&AI, mxGetPr(plhs[0]))) mexErrMsgTxt("No prediction, start the estimator with 'E' first.");
+				return;
+#endif
 			default:
 				printf(usage_msg);
 				return;
@@ -111,13 +166,27 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 		/* write raw values to servos (units of PWM microseconds, no command limits!) */
 		vsa_arduino_interface_write_usec(&AI, (int*)u);
 		/* read raw ADC values */
-		vsa_arduino_interface_read_adc  (&AI, (int*)mxGetPr(plhs[0]));
+		if (!vsa_arduino_interface_read_adc(&AI, (int*)mxGetPr(plhs[0]))) mexWarnMsgTxt("Timeout!");
 #else
-		vsa_arduino_interface_run_step(&AI, u, mxGetPr(plhs[0])); /* Send command to motors. */
+		if (!vsa_arduino_interface_run_step(&AI, u, mxGetPr(plhs[0]))) mexErrMsgTxt("Timeout!"); /* Send command to motors. */
 #endif
 #else
 		double u[DIMU]; for ( i = 0; i < DIMU; i += 1 ) { u[i] = pm[i]; }
-		vsa_arduino_interface_run_step(&AI, u, mxGetPr(plhs[0])); /* Send command to motors. */
+		if (!vsa_arduino_interface_run_step(&AI, u, mxGetPr(plhs[0]))) mexErrMsgTxt("Timeout!"); /* Send command to motors. */
+#endif
+#ifndef MEX_RAW_VALUES
+	} else if (mxGetM(prhs[0]) == DIMU && mxGetN(prhs[0]) > 1) { /* trajectory, one column per frame */
+		int N = mxGetN(prhs[0]), steps;
+		double *u;
+
+		vsa_arduino_interface_check(&AI); /* Check that serial connection has been made with Arduino. */
+
+		u = mxMalloc(N*DIMU*sizeof(double)); /* copy, as commands are clipped in place */
+		memcpy(u, mxGetPr(prhs[0]), N*DIMU*sizeof(double));
+		plhs[0] = mxCreateDoubleMatrix(DIMY+1,N,mxREAL); /* Create output matrix */
+		steps = vsa_arduino_interface_run_trajectory(&AI, u, mxGetPr(plhs[0]), N);
+		mxFree(u);
+		if (steps < N) mexErrMsgTxt("Timeout!");
 #endif
 	} else {
 		printf(usage_msg);
@@ -0,0 +1,32 @@
+/**
+ * \file vsa_robot_edinburghvsa.cpp
+ *
+ * \brief Robot traits and C entry points (see vsa_robots.h) for the Edinburgh VSA.
+ */
+#include <math.h>
+#include <vsa_interface.h>
+#include <vsa_robots.h>
+#define EDINBURGHVSA_INTERFACE
+#include <vsa_commands.h>
+
+/** \brief Edinburgh VSA traits (from sketchbook/edinburghvsa/defines.h). */
+struct EdinburghVsa {
+	static const int dim_y = DIMY;
+	static const int dim_u = DIMU;
+	static const int baudrate = BAUDRATE;
+	static constexpr double sensor_gain  [dim_y] = { W_POT_JOINT, W_ACC_JOINT, W_POT_SERVO0, W_POT_SERVO1 };
+	static constexpr double sensor_offset[dim_y] = { C_POT_JOINT, C_ACC_JOINT, C_POT_SERVO0, C_POT_SERVO1 };
+	static constexpr double u_llim[dim_u] = { U_LLIM_RAD_SERVO0, U_LLIM_RAD_SERVO1 };
+	static constexpr double u_ulim[dim_u] = { U_ULIM_RAD_SERVO0, U_ULIM_RAD_SERVO1 };
+	static constexpr int    u_init[dim_u] = { U_INIT_SERVO0, U_INIT_SERVO1 };
+	static inline int command ( int i, double u ) {
+		return i == 0 ? RAD2USEC_SERVO0(u) : RAD2USEC_SERVO1(u);
+	}
+};
+constexpr double EdinburghVsa::sensor_gain[];
+constexpr double EdinburghVsa::sensor_offset[];
+constexpr double EdinburghVsa::u_llim[];
+constexpr double EdinburghVsa::u_ulim[];
+constexpr int    EdinburghVsa::u_init[];
+
+VSA_ROBOT_DEFINE(edinburghvsa, EdinburghVsaInterface, EdinburghVsa)
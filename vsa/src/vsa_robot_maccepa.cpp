@@ -0,0 +1,48 @@
+/**
+ * \file vsa_robot_maccepa.cpp
+ *
+ * \brief Robot traits and C entry points (see vsa_robots.h) for the MACCEPA.
+ */
+#include <math.h>
+#include <vsa_interface.h>
+#include <vsa_robots.h>
+#define MACCEPA_INTERFACE
+#include <vsa_commands.h>
+
+/** \brief Gain from ADC steps to current (A) of the current sensing circuit. */
+#define W_CURRENT 5.0/(4092*CURRENT_RSENSE*(1+(CURRENT_R2/CURRENT_R1)))
+
+/** \brief MACCEPA traits (from sketchbook/maccepa/defines.h). */
+struct Maccepa {
+	static const int dim_y = DIMY;
+	static const int dim_u = DIMU;
+	static const int baudrate = BAUDRATE;
+	static constexpr double sensor_gain  [dim_y] = { W_POT_JOINT, W_ACC_JOINT, W_POT_SERVO0, W_POT_SERVO1, W_CURRENT };
+	static constexpr double sensor_offset[dim_y] = { C_POT_JOINT, C_ACC_JOINT, C_POT_SERVO0, C_POT_SERVO1, 0 };
+#ifdef VARIABLE_DAMPING
+	static constexpr double u_llim[dim_u] = { U_LLIM_RAD_SERVO0, U_LLIM_RAD_SERVO1, U_LLIM_DAMPER0 };
+	static constexpr double u_ulim[dim_u] = { U_ULIM_RAD_SERVO0, U_ULIM_RAD_SERVO1, U_ULIM_DAMPER0 };
+	static constexpr int    u_init[dim_u] = { U_INIT_SERVO0, U_INIT_SERVO1, U_INIT_DAMPER0 };
+#else
+	static constexpr double u_llim[dim_u] = { U_LLIM_RAD_SERVO0, U_LLIM_RAD_SERVO1 };
+	static constexpr double u_ulim[dim_u] = { U_ULIM_RAD_SERVO0, U_ULIM_RAD_SERVO1 };
+	static constexpr int    u_init[dim_u] = { U_INIT_SERVO0, U_INIT_SERVO1 };
+#endif
+	static inline int command ( int i, double u ) {
+		switch (i) {
+		case 0:  return RAD2USEC_SERVO0(u);
+		case 1:  return RAD2USEC_SERVO1(u);
+#ifdef VARIABLE_DAMPING
+		case 2:  return DUTY2PWM_DAMPER0(u);
+#endif
+		default: return 0;
+		}
+	}
+};
+constexpr double Maccepa::sensor_gain[];
+constexpr double Maccepa::sensor_offset[];
+constexpr double Maccepa::u_llim[];
+constexpr double Maccepa::u_ulim[];
+constexpr int    Maccepa::u_init[];
+
+VSA_ROBOT_DEFINE(maccepa, MaccepaInterface, Maccepa)
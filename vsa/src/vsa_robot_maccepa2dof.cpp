@@ -0,0 +1,66 @@
+/**
+ * \file vsa_robot_maccepa2dof.cpp
+ *
+ * \brief Robot traits and C entry points (see vsa_robots.h) for the 2-DOF MACCEPA.
+ */
+#include <math.h>
+#include <vsa_interface.h>
+#include <vsa_robots.h>
+#define MACCEPA2DOF_INTERFACE
+#include <vsa_commands.h>
+
+/** \brief Gain from ADC steps to current (A) of the current sensing circuits. */
+#define W_CURRENT 5.0/(4092*CURRENT_RSENSE*(1+(CURRENT_R2/CURRENT_R1)))
+
+/* Dampers and magnet are commanded directly in device units (see vsa_arduino_interface_write()). */
+#ifdef VARIABLE_DAMPING
+#define DAMPER_LLIM , U_LLIM_DAMPER0, U_LLIM_DAMPER1
+#define DAMPER_ULIM , U_ULIM_DAMPER0, U_ULIM_DAMPER1
+#define DAMPER_INIT , U_INIT_DAMPER0, U_INIT_DAMPER1
+#else
+#define DAMPER_LLIM
+#define DAMPER_ULIM
+#define DAMPER_INIT
+#endif
+#ifdef MAGNET
+#define MAGNET_LLIM , U_MAGNET_OFF
+#define MAGNET_ULIM , U_MAGNET_ON
+#define MAGNET_INIT , U_INIT_MAGNET
+#else
+#define MAGNET_LLIM
+#define MAGNET_ULIM
+#define MAGNET_INIT
+#endif
+
+/** \brief 2-DOF MACCEPA traits (from sketchbook/maccepa2dof/defines.h). */
+struct Maccepa2Dof {
+	static const int dim_y = DIMY;
+	static const int dim_u = DIMU;
+	static const int baudrate = BAUDRATE;
+#ifdef CURRENT_SENSING
+	static constexpr double sensor_gain  [dim_y] = { W_POT_JOINT0, W_POT_JOINT1, W_POT_SERVO0, W_POT_SERVO1, W_POT_SERVO2, W_POT_SERVO3, W_CURRENT, W_CURRENT, W_CURRENT, W_CURRENT };
+	static constexpr double sensor_offset[dim_y] = { C_POT_JOINT0, C_POT_JOINT1, C_POT_SERVO0, C_POT_SERVO1, C_POT_SERVO2, C_POT_SERVO3, 0, 0, 0, 0 };
+#else
+	static constexpr double sensor_gain  [dim_y] = { W_POT_JOINT0, W_POT_JOINT1, W_POT_SERVO0, W_POT_SERVO1, W_POT_SERVO2, W_POT_SERVO3 };
+	static constexpr double sensor_offset[dim_y] = { C_POT_JOINT0, C_POT_JOINT1, C_POT_SERVO0, C_POT_SERVO1, C_POT_SERVO2, C_POT_SERVO3 };
+#endif
+	static constexpr double u_llim[dim_u] = { U_LLIM_RAD_SERVO0, U_LLIM_RAD_SERVO1, U_LLIM_RAD_SERVO2, U_LLIM_RAD_SERVO3 DAMPER_LLIM MAGNET_LLIM };
+	static constexpr double u_ulim[dim_u] = { U_ULIM_RAD_SERVO0, U_ULIM_RAD_SERVO1, U_ULIM_RAD_SERVO2, U_ULIM_RAD_SERVO3 DAMPER_ULIM MAGNET_ULIM };
+	static constexpr int    u_init[dim_u] = { U_INIT_SERVO0, U_INIT_SERVO1, U_INIT_SERVO2, U_INIT_SERVO3 DAMPER_INIT MAGNET_INIT };
+	static inline int command ( int i, double u ) {
+		switch (i) {
+		case 0:  return RAD2USEC_SERVO0(u);
+		case 1:  return RAD2USEC_SERVO1(u);
+		case 2:  return RAD2USEC_SERVO2(u);
+		case 3:  return RAD2USEC_SERVO3(u);
+		default: return (int)u;
+		}
+	}
+};
+constexpr double Maccepa2Dof::sensor_gain[];
+constexpr double Maccepa2Dof::sensor_offset[];
+constexpr double Maccepa2Dof::u_llim[];
+constexpr double Maccepa2Dof::u_ulim[];
+constexpr int    Maccepa2Dof::u_init[];
+
+VSA_ROBOT_DEFINE(maccepa2dof, Maccepa2DofInterface, Maccepa2Dof)
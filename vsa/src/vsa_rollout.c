@@ -0,0 +1,218 @@
+/**
+ * \file vsa_rollout.c
+ *
+ * \brief Forward-dynamics rollouts of the robot models on a thread pool (see
+ * vsa_rollout.h), compiled once per robot.
+ */
+#include <vsa_rollout.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+/** \brief Joint acceleration of the model. */
+static void acceleration ( const VsaRollout *R, double *x, double *u, double *acc ) {
+#ifdef MACCEPA_INTERFACE
+	maccepa_model_get_acceleration(acc, x, u, (maccepa_model *) &R->model);
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+	edinburghvsa_model_get_acceleration(acc, x, u, (edinburghvsa_model *) &R->model);
+#endif
+}
+
+/** \brief Motor positions from the command history of the servos (see vsa_rollout.h). */
+static void motor_positions ( const VsaRollout *R, double *history, double *m ) {
+#ifdef MACCEPA_INTERFACE
+	maccepa_model_get_motor_positions(m, history, (maccepa_model *) &R->model);
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+	edinburghvsa_model_get_motor_positions(m, history, (edinburghvsa_model *) &R->model);
+#endif
+}
+
+/** \brief Advance x by one step of length h under the command u. */
+static void step ( const VsaRollout *R, double *x, double *u, double h ) {
+	double k[4][DIMX], xt[DIMX], a;
+	int i;
+
+	if (R->method == VSA_ROLLOUT_EULER) {
+		acceleration(R, x, u, &a);
+		x[1] += h*a;
+		x[0] += h*x[1];
+		return;
+	}
+	/* RK4 on (q, dq/dt) */
+	k[0][0] = x[1]; acceleration(R, x, u, &k[0][1]);
+	for ( i = 1; i < 4; i += 1 ) {
+		double c = i < 3 ? 0.5*h : h;
+		xt[0] = x[0] + c*k[i-1][0];
+		xt[1] = x[1] + c*k[i-1][1];
+		k[i][0] = xt[1];
+		acceleration(R, xt, u, &k[i][1]);
+	}
+	for ( i = 0; i < DIMX; i += 1 ) { x[i] += h*(k[0][i] + 2*k[1][i] + 2*k[2][i] + k[3][i])/6; }
+}
+
+void vsa_rollout_run_one ( const VsaRollout *R, double *X, const double *x0, const double *U, int steps ) {
+	double x[DIMX], u[DIMU], m[2], history[2*FILTER_DIMENSION], h = R->period/R->substeps;
+	int i, j, k, s;
+
+	x[0] = X[0] = x0[0];
+	x[1] = X[1] = x0[1];
+	if (steps < 1) return;
+	for ( j = 0; j < FILTER_DIMENSION; j += 1 ) {
+		history[j]                  = U[0];
+		history[j+FILTER_DIMENSION] = U[1];
+	}
+	for ( k = 0; k < steps; k += 1 ) {
+		for ( i = 0; i < DIMU; i += 1 ) { u[i] = U[k*DIMU+i]; }
+		if (R->servo) {
+			for ( j = 0; j < FILTER_DIMENSION-1; j += 1 ) {
+				history[j]                  = history[j+1];
+				history[j+FILTER_DIMENSION] = history[j+1+FILTER_DIMENSION];
+			}
+			history[FILTER_DIMENSION-1]   = u[0];
+			history[2*FILTER_DIMENSION-1] = u[1];
+			motor_positions(R, history, m);
+			u[0] = m[0];
+			u[1] = m[1];
+		}
+		for ( s = 0; s < R->substeps; s += 1 ) { step(R, x, u, h); }
+		X[(k+1)*DIMX]   = x[0];
+		X[(k+1)*DIMX+1] = x[1];
+	}
+}
+
+/** \brief Run rollouts of the current batch until none are left (called by all threads of the pool). */
+static void work ( VsaRollout *R ) {
+	int r, first;
+
+	for ( ; ; ) {
+#ifndef WIN32
+		pthread_mutex_lock(&R->lock);
+#endif
+		first    = R->next;
+		R->next += VSA_ROLLOUT_CHUNK;
+#ifndef WIN32
+		pthread_mutex_unlock(&R->lock);
+#endif
+		if (first >= R->n) return;
+		for ( r = first; r < R->n && r < first + VSA_ROLLOUT_CHUNK; r += 1 ) {
+			vsa_rollout_run_one(R, R->X + r*(R->steps+1)*DIMX, R->x0 + r*DIMX, R->U + r*R->steps*DIMU, R->steps);
+		}
+	}
+}
+
+#ifndef WIN32
+/** \brief Worker thread: run each batch, until told to quit. */
+static void *worker ( void *context ) {
+	VsaRollout *R = (VsaRollout *) context;
+	unsigned int seen;
+
+	/* the generation set by vsa_rollout_init(): a batch may already have
+	   been posted by the time this thread gets the lock */
+	seen = 0;
+	pthread_mutex_lock(&R->lock);
+	for ( ; ; ) {
+		while (!R->quit && R->generation == seen) pthread_cond_wait(&R->start, &R->lock);
+		if (R->quit) break;
+		seen = R->generation;
+		pthread_mutex_unlock(&R->lock);
+
+		work(R);
+
+		pthread_mutex_lock(&R->lock);
+		R->busy -= 1;
+		if (R->busy == 0) pthread_cond_signal(&R->done);
+	}
+	pthread_mutex_unlock(&R->lock);
+	return NULL;
+}
+#endif
+
+int vsa_rollout_init ( VsaRollout *R, int threads ) {
+	int i;
+
+#ifdef MACCEPA_INTERFACE
+	maccepa_model_init(&R->model);
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+	edinburghvsa_model_init(&R->model);
+#endif
+	R->method     = VSA_ROLLOUT_RK4;
+	R->period     = FRAME_PERIOD;
+	R->substeps   = 4;
+	R->servo      = 1;
+	R->X          = NULL;
+	R->x0         = NULL;
+	R->U          = NULL;
+	R->steps      = 0;
+	R->n          = 0;
+	R->next       = 0;
+	R->busy       = 0;
+	R->generation = 0;
+	R->quit       = 0;
+
+#ifdef WIN32
+	R->threads = 1;
+#else
+	if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1) threads = 1;
+	if (threads > VSA_ROLLOUT_MAX_THREADS) threads = VSA_ROLLOUT_MAX_THREADS;
+	pthread_mutex_init(&R->lock, NULL);
+	pthread_cond_init(&R->start, NULL);
+	pthread_cond_init(&R->done, NULL);
+	for ( i = 0; i < threads-1; i += 1 ) {
+		if (pthread_create(&R->thread[i], NULL, worker, R) != 0) {
+			fputs("Warning: couldn't start all rollout threads.\n",stderr);
+			break;
+		}
+	}
+	R->threads = i+1;
+#endif
+	return 1;
+}
+
+void vsa_rollout_free ( VsaRollout *R ) {
+#ifndef WIN32
+	int i;
+
+	pthread_mutex_lock(&R->lock);
+	R->quit = 1;
+	pthread_cond_broadcast(&R->start);
+	pthread_mutex_unlock(&R->lock);
+	for ( i = 0; i < R->threads-1; i += 1 ) { pthread_join(R->thread[i], NULL); }
+	pthread_cond_destroy(&R->done);
+	pthread_cond_destroy(&R->start);
+	pthread_mutex_destroy(&R->lock);
+#endif
+	R->threads = 0;
+}
+
+void vsa_rollout_run ( VsaRollout *R, double *X, const double *x0, const double *U, int steps, int n ) {
+#ifndef WIN32
+	pthread_mutex_lock(&R->lock);
+#endif
+	R->X     = X;
+	R->x0    = x0;
+	R->U     = U;
+	R->steps = steps;
+	R->n     = n;
+	R->next  = 0;
+#ifndef WIN32
+	/* wake the workers only if there is more than one chunk */
+	if (R->threads > 1 && n > VSA_ROLLOUT_CHUNK) {
+		R->busy = R->threads-1;
+		R->generation += 1;
+		pthread_cond_broadcast(&R->start);
+	}
+	pthread_mutex_unlock(&R->lock);
+#endif
+
+	work(R);
+
+#ifndef WIN32
+	pthread_mutex_lock(&R->lock);
+	while (R->busy > 0) pthread_cond_wait(&R->done, &R->lock);
+	pthread_mutex_unlock(&R->lock);
+#endif
+}
@@ -0,0 +1,103 @@
+/**
+ * \file test_dynamics.c
+ *
+ * \brief Test of the exact linearisations (see vsa_dynamics.h), compiled
+ * once per robot (with MACCEPA_INTERFACE or EDINBURGHVSA_INTERFACE defined).
+ *
+ * The templated acceleration of src/vsa_dynamics_<robot>.cpp is a second copy
+ * of the equations of lib<robot>.c, so this checks that the two agree:
+ * get_linearization() against central differences of get_acceleration(), and
+ * get_acceleration_hessian() against central differences of
+ * get_linearization(), at random states and commands.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#ifdef MACCEPA_INTERFACE
+#include "../sketchbook/maccepa/defines.h"
+#include <libmaccepa.h>
+typedef maccepa_model Model;
+#define model_init              maccepa_model_init
+#define get_acceleration        maccepa_model_get_acceleration
+#define get_linearization       maccepa_model_get_linearization
+#define get_acceleration_hessian maccepa_model_get_acceleration_hessian
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+#include "../sketchbook/edinburghvsa/defines.h"
+#include <libedinburghvsa.h>
+typedef edinburghvsa_model Model;
+#define model_init              edinburghvsa_model_init
+#define get_acceleration        edinburghvsa_model_get_acceleration
+#define get_linearization       edinburghvsa_model_get_linearization
+#define get_acceleration_hessian edinburghvsa_model_get_acceleration_hessian
+#endif
+
+#define DIMZ (DIMX+DIMU)
+/** \brief Number of random points. */
+#define POINTS 1000
+/** \brief Finite difference step. */
+#define DELTA 1e-5
+/** \brief Largest error allowed, relative to max(1, |exact|). */
+#define TOLERANCE 1e-6
+
+static double uniform ( double lo, double hi ) {
+	return lo + (hi - lo)*rand()/RAND_MAX;
+}
+
+/** \brief Check one derivative, and report it if wrong. */
+static int check ( const char *name, int i, int j, double exact, double fd, double *z ) {
+	double scale = fabs(exact) > 1 ? fabs(exact) : 1;
+	int k;
+
+	if (fabs(exact - fd) <= TOLERANCE*scale) return 0;
+	fprintf(stderr, "%s(%d,%d) = %g, central differences %g at (x,u) = (", name, i, j, exact, fd);
+	for ( k = 0; k < DIMZ; k += 1 ) { fprintf(stderr, k ? ", %g" : "%g", z[k]); }
+	fputs(").\n", stderr);
+	return 1;
+}
+
+int main ( void ) {
+	Model model;
+	double z[DIMZ], zp[DIMZ], zm[DIMZ], A[DIMX*DIMX], B[DIMX*DIMU], Ap[DIMX*DIMX], Bp[DIMX*DIMU], Am[DIMX*DIMX], Bm[DIMX*DIMU];
+	double H[DIMZ*DIMZ], ap, am, exact, fd, worst = 0;
+	int p, i, j, errors = 0;
+
+	model_init(&model);
+	srand(1);
+	for ( p = 0; p < POINTS; p += 1 ) {
+		z[0] = uniform(-1, 1);
+		/* keep clear of the Coulomb friction discontinuity at zero velocity */
+		z[1] = uniform(0.1, 3)*(rand() & 1 ? 1 : -1);
+		for ( i = 0; i < DIMU; i += 1 ) { z[DIMX+i] = uniform(-1, 1); }
+#ifdef MACCEPA_INTERFACE
+		z[DIMX+1] = uniform(0, 1.5); /* pretension */
+#endif
+		get_linearization(A, B, z, z+DIMX, &model);
+		get_acceleration_hessian(H, z, z+DIMX, &model);
+
+		for ( j = 0; j < DIMZ; j += 1 ) {
+			for ( i = 0; i < DIMZ; i += 1 ) { zp[i] = zm[i] = z[i]; }
+			zp[j] += DELTA;
+			zm[j] -= DELTA;
+
+			/* first derivatives: the acceleration row of A and B */
+			get_acceleration(&ap, zp, zp+DIMX, &model);
+			get_acceleration(&am, zm, zm+DIMX, &model);
+			fd    = (ap - am)/(2*DELTA);
+			exact = j < DIMX ? A[DIMX+j] : B[DIMU+j-DIMX];
+			errors += check("d acc/dz", 0, j, exact, fd, z);
+			if (fabs(exact - fd) > worst) worst = fabs(exact - fd);
+
+			/* second derivatives: column j of H from the linearisations */
+			get_linearization(Ap, Bp, zp, zp+DIMX, &model);
+			get_linearization(Am, Bm, zm, zm+DIMX, &model);
+			for ( i = 0; i < DIMZ; i += 1 ) {
+				fd = i < DIMX ? (Ap[DIMX+i] - Am[DIMX+i])/(2*DELTA) : (Bp[DIMU+i-DIMX] - Bm[DIMU+i-DIMX])/(2*DELTA);
+				errors += check("H", i, j, H[i*DIMZ+j], fd, z);
+			}
+		}
+	}
+	printf("largest error of the linearisation: %g\n", worst);
+	puts(errors ? "test_dynamics: FAILED" : "test_dynamics: ok");
+	return errors != 0;
+}
@@ -0,0 +1,48 @@
+/**
+ * \file test_edinburghvsa_equilibrium.c
+ *
+ * \brief Test of edinburghvsa_model_solve_equilibrium_position(): searches
+ * starting inside and outside EDINBURGHVSA_EQUILIBRIUM_RANGE (from x[0] and
+ * from a warm start) must all find the same zero of the actuator torque.
+ */
+#include <stdio.h>
+#include <math.h>
+#include "../sketchbook/edinburghvsa/defines.h"
+#include <libedinburghvsa.h>
+
+int main ( void ) {
+	static double starts[] = { 0.0, 0.5, -0.5, 1.5, -1.5, 1.8, -1.8, 2.5, -3.0, 10.0 };
+	static double commands[][DIMU] = { { 0.3, -0.2 }, { 0.0, 0.0 }, { -0.6, 0.4 }, { 1.0, 0.9 } };
+	edinburghvsa_model model;
+	edinburghvsa_equilibrium_cache cache;
+	double x[DIMX] = { 0, 0 }, q0, ref, tau, xe[DIMX];
+	int c, i, s, failed = 0;
+
+	edinburghvsa_model_init(&model);
+	for ( c = 0; c < (int) (sizeof(commands)/sizeof(commands[0])); c += 1 ) {
+		x[0] = 0;
+		edinburghvsa_model_solve_equilibrium_position(&ref, x, commands[c], &model, NULL);
+		for ( i = 0; i < (int) (sizeof(starts)/sizeof(starts[0])); i += 1 ) {
+			/* cold start from x[0] */
+			x[0] = starts[i];
+			s = edinburghvsa_model_solve_equilibrium_position(&q0, x, commands[c], &model, NULL);
+			xe[0] = q0; xe[1] = 0;
+			edinburghvsa_model_get_actuator_torque(&tau, xe, commands[c], &model);
+			if (s != EDINBURGHVSA_EQUILIBRIUM_CONVERGED || fabs(q0-ref) > 1e-8 || fabs(tau) > 1e-6) {
+				fprintf(stderr, "u = (%g, %g), start %g: status %d, q0 %g (expected %g), torque %g.\n", commands[c][0], commands[c][1], starts[i], s, q0, ref, tau);
+				failed = 1;
+			}
+			/* warm start */
+			x[0]        = 0;
+			cache.q0    = starts[i];
+			cache.valid = 1;
+			s = edinburghvsa_model_solve_equilibrium_position(&q0, x, commands[c], &model, &cache);
+			if (s != EDINBURGHVSA_EQUILIBRIUM_CONVERGED || fabs(q0-ref) > 1e-8 || !cache.valid) {
+				fprintf(stderr, "u = (%g, %g), warm start %g: status %d, q0 %g (expected %g).\n", commands[c][0], commands[c][1], starts[i], s, q0, ref);
+				failed = 1;
+			}
+		}
+	}
+	puts(failed ? "test_edinburghvsa_equilibrium: FAILED" : "test_edinburghvsa_equilibrium: ok");
+	return failed;
+}
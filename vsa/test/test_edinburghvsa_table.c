@@ -0,0 +1,144 @@
+/**
+ * \file test_edinburghvsa_table.c
+ *
+ * \brief Test of the equilibrium table of the Edinburgh VSA (see
+ * edinburghvsa_table.h): interpolated q0 and k must agree with
+ * edinburghvsa_model_solve_equilibrium_position() to within (about) the error
+ * reported for their cell, lookups outside the tolerance or the grid must fall back to
+ * the model, and the cache file must be reloaded for the same model and grid
+ * only.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../sketchbook/edinburghvsa/defines.h"
+#include <libedinburghvsa.h>
+#include <edinburghvsa_table.h>
+
+/** \brief Grid size (small, to keep the test fast). */
+#define N0 9
+#define N1 7
+/** \brief Number of random lookups. */
+#define POINTS 1000
+/** \brief Margin on the cell errors, which are measured at 13 points of each cell (not bounds). */
+#define MARGIN 1.25
+/** \brief Cache file (removed by make clean). */
+#define CACHE "build/test_edinburghvsa_table.cache"
+
+static double uniform ( double lo, double hi ) {
+	return lo + (hi - lo)*rand()/RAND_MAX;
+}
+
+/** \brief Equilibrium position and stiffness from the model. */
+static int model_equilibrium ( edinburghvsa_model *model, double *u, double *q0, double *k ) {
+	double x[DIMX] = { 0, 0 };
+	int status;
+
+	status = edinburghvsa_model_solve_equilibrium_position(&x[0], x, u, model, NULL);
+	edinburghvsa_model_get_stiffness(k, x, u, model);
+	*q0 = x[0];
+	return status;
+}
+
+/** \brief Non-zero if the two tables hold the same values. */
+static int same_table ( const edinburghvsa_table *A, const edinburghvsa_table *B ) {
+	int n0 = A->n[0], n1 = A->n[1];
+
+	return n0 == B->n[0] && n1 == B->n[1]
+	    && memcmp(A->node, B->node, n0*n1*EDINBURGHVSA_TABLE_FIELDS*sizeof(double)) == 0
+	    && memcmp(A->valid, B->valid, n0*n1) == 0
+	    && memcmp(A->error, B->error, (n0-1)*(n1-1)*2*sizeof(double)) == 0;
+}
+
+int main ( void ) {
+	edinburghvsa_model model, other;
+	edinburghvsa_table T, L, M;
+	double u[DIMU], q0, k, q0m, km, tolerance[2];
+	const double *e;
+	int p, d, c[DIMU], s, valid = 0, failed = 0;
+
+	edinburghvsa_model_init(&model);
+	remove(CACHE);
+	if (!edinburghvsa_table_init(&T, &model, N0, N1, CACHE)) {
+		fputs("could not build the table.\n", stderr);
+		puts("test_edinburghvsa_table: FAILED");
+		return 1;
+	}
+
+	/* interpolation against the model, within the error of the cell */
+	srand(1);
+	for ( p = 0; p < POINTS; p += 1 ) {
+		for ( d = 0; d < DIMU; d += 1 ) {
+			u[d] = uniform(model.umin[d], model.umax[d]);
+			c[d] = (int)((u[d]-model.umin[d])/T.h[d]);
+			if (c[d] > T.n[d]-2) c[d] = T.n[d]-2;
+		}
+		e = &T.error[2*(c[1]*(N0-1)+c[0])];
+		if (isinf(e[0])) continue;
+		valid += 1;
+		s = edinburghvsa_table_lookup(&T, u, NULL, &q0, &k, NULL, NULL);
+		if (model_equilibrium(&model, u, &q0m, &km) != EDINBURGHVSA_EQUILIBRIUM_CONVERGED) continue;
+		if (s != EDINBURGHVSA_TABLE_INTERPOLATED || fabs(q0-q0m) > MARGIN*e[0] + 1e-9 || fabs(k-km) > MARGIN*e[1] + 1e-9) {
+			fprintf(stderr, "u = (%g, %g): status %d, q0 %g, k %g (model %g, %g, cell error %g, %g).\n", u[0], u[1], s, q0, k, q0m, km, e[0], e[1]);
+			failed = 1;
+		}
+
+		/* a tolerance below the cell error falls back to the model */
+		tolerance[0] = 0.5*e[0];
+		tolerance[1] = 0.5*e[1];
+		s = edinburghvsa_table_lookup(&T, u, tolerance, &q0, &k, NULL, NULL);
+		if (s != EDINBURGHVSA_TABLE_EXACT || fabs(q0-q0m) > 1e-8 || fabs(k-km) > 1e-6*(1+fabs(km))) {
+			fprintf(stderr, "u = (%g, %g), tolerance (%g, %g): status %d, q0 %g, k %g (model %g, %g).\n", u[0], u[1], tolerance[0], tolerance[1], s, q0, k, q0m, km);
+			failed = 1;
+		}
+	}
+	if (valid < POINTS/2) {
+		fprintf(stderr, "only %d of %d lookups fell in valid cells.\n", valid, POINTS);
+		failed = 1;
+	}
+
+	/* outside the grid, with a tolerance, the model is used */
+	tolerance[0] = tolerance[1] = HUGE_VAL;
+	u[0] = model.umax[0] + 0.1;
+	u[1] = 0.5*(model.umin[1]+model.umax[1]);
+	s = edinburghvsa_table_lookup(&T, u, tolerance, &q0, &k, NULL, NULL);
+	if (model_equilibrium(&model, u, &q0m, &km) == EDINBURGHVSA_EQUILIBRIUM_CONVERGED
+	 && (s != EDINBURGHVSA_TABLE_EXACT || fabs(q0-q0m) > 1e-8)) {
+		fprintf(stderr, "u = (%g, %g) outside the grid: status %d, q0 %g (model %g).\n", u[0], u[1], s, q0, q0m);
+		failed = 1;
+	}
+
+	/* the cache file holds the same table, for the same model and grid only */
+	if (!edinburghvsa_table_load(&L, CACHE, &model, N0, N1) || !same_table(&T, &L)) {
+		fputs("the cache file does not reload the table.\n", stderr);
+		failed = 1;
+	}
+	edinburghvsa_table_free(&L);
+	if (edinburghvsa_table_load(&L, CACHE, &model, N0+1, N1)) {
+		fputs("the cache file was loaded for a different grid.\n", stderr);
+		failed = 1;
+	}
+	edinburghvsa_table_free(&L);
+	other = model;
+	other.spring_constant *= 1.1;
+	if (edinburghvsa_table_load(&L, CACHE, &other, N0, N1)) {
+		fputs("the cache file was loaded for a different model.\n", stderr);
+		failed = 1;
+	}
+	edinburghvsa_table_free(&L);
+
+	/* a different model rebuilds the table and replaces the cache */
+	if (!edinburghvsa_table_init(&L, &other, N0, N1, CACHE) || same_table(&T, &L)
+	 || edinburghvsa_table_load(&M, CACHE, &model, N0, N1)) {
+		fputs("the table was not rebuilt for a different model.\n", stderr);
+		failed = 1;
+	}
+	edinburghvsa_table_free(&M);
+	edinburghvsa_table_free(&L);
+	edinburghvsa_table_free(&T);
+	remove(CACHE);
+
+	puts(failed ? "test_edinburghvsa_table: FAILED" : "test_edinburghvsa_table: ok");
+	return failed;
+}
@@ -0,0 +1,113 @@
+/**
+ * \file test_estimator.c
+ *
+ * \brief Test of the state estimator (see vsa_estimator.h) on a simulated
+ * MACCEPA trajectory: frames with jittered periods and noisy potentiometer
+ * and accelerometer readings. The velocity estimate must beat finite
+ * differences of the readings, and the one-frame prediction of
+ * vsa_estimator_integrate() must beat holding the latest reading.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include "../sketchbook/maccepa/defines.h"
+#include <libmaccepa.h>
+#include <vsa_link.h>
+#include <vsa_estimator.h>
+
+/** \brief Number of frames simulated (the first SETTLE are not scored). */
+#define FRAMES 3000
+#define SETTLE 50
+/** \brief Integration steps of the simulated plant per frame. */
+#define SUBSTEPS 40
+
+/** \brief Uniform random number in (0,1) (own generator, so the test is reproducible). */
+static double uniform ( void ) {
+	static unsigned long long s = 88172645463325252ULL;
+	s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+	return ((s >> 11) + 0.5)/9007199254740992.0;
+}
+
+/** \brief Standard normal random number (Box-Muller). */
+static double normal ( void ) {
+	return sqrt(-2*log(uniform()))*cos(2*M_PI*uniform());
+}
+
+static void model ( void *data, double *x, double *u, double *acc ) {
+	maccepa_model_get_acceleration(acc, x, u, (maccepa_model *) data);
+}
+
+/** \brief Motor positions (and damping command) at time t. */
+static void command ( double t, double *u ) {
+	int i;
+
+	for ( i = 0; i < DIMU; i += 1 ) { u[i] = 0; }
+	u[0] = 0.6*sin(2*M_PI*0.5*t) + 0.3*sin(2*M_PI*1.3*t);
+	u[1] = 1.0 + 0.4*sin(2*M_PI*0.2*t);
+}
+
+int main ( void ) {
+	maccepa_model M;
+	VsaEstimator E;
+	VsaEstimatorNoise noise;
+	double x[DIMX] = { 0, 0 }, u[DIMU], acc, t = 0, dt, h, y[2], y_old = 0, period = FRAME_PERIOD;
+	double xp[VSA_ESTIMATOR_DIMX], q_predicted = 0, q_held = 0;
+	double e_kf = 0, e_fd = 0, e_pred = 0, e_hold = 0;
+	int k, s, n = 0, failed = 0;
+
+	maccepa_model_init(&M);
+	vsa_estimator_default_noise(&noise);
+	vsa_estimator_init(&E, &noise, model, &M);
+
+	for ( k = 0; k < FRAMES; k += 1 ) {
+		/* plant over one frame period (+-10% jitter), semi-implicit Euler with fine steps */
+		dt = period*(0.9 + 0.2*uniform());
+		h  = dt/SUBSTEPS;
+		command(t, u);
+		for ( s = 0; s < SUBSTEPS; s += 1 ) {
+			maccepa_model_get_acceleration(&acc, x, u, &M);
+			x[1] += h*acc;
+			x[0] += h*x[1];
+		}
+		t += dt;
+		maccepa_model_get_acceleration(&acc, x, u, &M);
+
+		/* noisy readings: 2 mrad potentiometer, 1 rad/s^2 accelerometer */
+		y[0] = x[0] + noise.position*normal();
+		y[1] = acc  + noise.acceleration*normal();
+		vsa_estimator_update(&E, t, y[0], y[1], u);
+
+		if (k >= SETTLE) {
+			e_kf   += (E.x[1] - x[1])*(E.x[1] - x[1]);
+			e_fd   += ((y[0] - y_old)/dt - x[1])*((y[0] - y_old)/dt - x[1]);
+			e_pred += (q_predicted - x[0])*(q_predicted - x[0]);
+			e_hold += (q_held - x[0])*(q_held - x[0]);
+			n      += 1;
+		}
+		y_old = y[0];
+
+		/* predict the position at the next frame (the command is known ahead) */
+		memcpy(xp, E.x, sizeof(xp));
+		command(t, u);
+		vsa_estimator_integrate(&E, xp, E.period > 0 ? E.period : period, u);
+		q_predicted = xp[0];
+		q_held      = y[0];
+	}
+	e_kf   = sqrt(e_kf/n);
+	e_fd   = sqrt(e_fd/n);
+	e_pred = sqrt(e_pred/n);
+	e_hold = sqrt(e_hold/n);
+	printf("velocity RMS error  : %.3f rad/s (finite differences %.3f rad/s)\n", e_kf, e_fd);
+	printf("prediction RMS error: %.4f rad (latest reading %.4f rad)\n", e_pred, e_hold);
+
+	if (!(e_kf < 0.5*e_fd && e_kf < 0.2)) {
+		fputs("velocity estimate not better than finite differences.\n", stderr);
+		failed = 1;
+	}
+	if (!(e_pred < 0.5*e_hold && e_pred < 0.01)) {
+		fputs("prediction not better than the latest reading.\n", stderr);
+		failed = 1;
+	}
+	puts(failed ? "test_estimator: FAILED" : "test_estimator: ok");
+	return failed;
+}
@@ -0,0 +1,98 @@
+/**
+ * \file test_jacobians.c
+ *
+ * \brief Test of the analytic Jacobians of the robot models, compiled once per
+ * robot (with MACCEPA_INTERFACE or EDINBURGHVSA_INTERFACE defined): each is
+ * checked against its finite difference version (the *_fd functions) at
+ * random states and commands over umin..umax.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#ifdef MACCEPA_INTERFACE
+#include "../sketchbook/maccepa/defines.h"
+#include <libmaccepa.h>
+typedef maccepa_model Model;
+#define model_init                maccepa_model_init
+#define get_stiffness             maccepa_model_get_stiffness
+#define get_stiffness_jacobian    maccepa_model_get_stiffness_jacobian
+#define get_stiffness_jacobian_fd maccepa_model_get_stiffness_jacobian_fd
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+#include "../sketchbook/edinburghvsa/defines.h"
+#include <libedinburghvsa.h>
+typedef edinburghvsa_model Model;
+#define model_init                edinburghvsa_model_init
+#define get_stiffness             edinburghvsa_model_get_stiffness
+#define get_stiffness_jacobian    edinburghvsa_model_get_stiffness_jacobian
+#define get_stiffness_jacobian_fd edinburghvsa_model_get_stiffness_jacobian_fd
+#endif
+
+/** \brief Number of random points. */
+#define POINTS 2000
+/** \brief Largest error allowed, relative to max(1, |exact|) (the *_fd functions use steps of 1e-6). */
+#define TOLERANCE 1e-6
+
+static double uniform ( double lo, double hi ) {
+	return lo + (hi - lo)*rand()/RAND_MAX;
+}
+
+/** \brief Compare two Jacobians, and report the first wrong element. */
+static int check ( const char *name, const double *exact, const double *fd, int n, const double *x, const double *u, double *worst ) {
+	int i;
+
+	for ( i = 0; i < n; i += 1 ) {
+		double scale = fabs(exact[i]) > 1 ? fabs(exact[i]) : 1;
+		double error = fabs(exact[i] - fd[i])/scale;
+
+		if (error > *worst) *worst = error;
+		if (error > TOLERANCE) {
+			fprintf(stderr, "%s[%d] = %g, finite differences %g at x = (%g, %g), u = (%g, %g).\n", name, i, exact[i], fd[i], x[0], x[1], u[0], u[1]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main ( void ) {
+	Model model;
+	double x[DIMX], u[DIMU], J[DIMU], Jfd[DIMU], worst = 0;
+	int p, i, errors = 0;
+#ifdef EDINBURGHVSA_INTERFACE
+	double q0, k;
+	int skipped = 0;
+#endif
+
+	model_init(&model);
+	srand(1);
+	for ( p = 0; p < POINTS; p += 1 ) {
+		x[0] = uniform(-1, 1);
+		x[1] = uniform(-3, 3);
+		for ( i = 0; i < DIMU; i += 1 ) { u[i] = uniform(model.umin[i], model.umax[i]); }
+
+		get_stiffness_jacobian   (J  , x, u, &model);
+		get_stiffness_jacobian_fd(Jfd, x, u, &model);
+		errors += check("stiffness Jacobian", J, Jfd, DIMU, x, u, &worst);
+
+#ifdef EDINBURGHVSA_INTERFACE
+		/* the equilibrium Jacobian is infinite where the stiffness at the equilibrium vanishes */
+		edinburghvsa_model_get_equilibrium_position(&q0, x, u, &model);
+		x[0] = q0;
+		get_stiffness(&k, x, u, &model);
+		if (k < 1e-3) { skipped += 1; continue; }
+		edinburghvsa_model_get_equilibrium_position_jacobian   (J  , x, u, &model);
+		edinburghvsa_model_get_equilibrium_position_jacobian_fd(Jfd, x, u, &model);
+		errors += check("equilibrium position Jacobian", J, Jfd, DIMU, x, u, &worst);
+#endif
+	}
+	printf("largest relative error of the Jacobians: %g\n", worst);
+#ifdef EDINBURGHVSA_INTERFACE
+	printf("equilibrium Jacobian skipped (vanishing stiffness) at %d of %d points\n", skipped, POINTS);
+	if (skipped > POINTS/10) {
+		fprintf(stderr, "equilibrium Jacobian skipped at %d of %d points.\n", skipped, POINTS);
+		errors += 1;
+	}
+#endif
+	puts(errors ? "test_jacobians: FAILED" : "test_jacobians: ok");
+	return errors != 0;
+}
@@ -0,0 +1,44 @@
+/**
+ * \file test_rollout.c
+ *
+ * \brief Test of the rollout engine (see vsa_rollout.h), compiled once per
+ * robot: batches posted right after vsa_rollout_init() (before the workers
+ * are waiting) must complete, and give the same states as single rollouts.
+ */
+#include <vsa_rollout.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define THREADS 8
+#define N       64
+#define STEPS   20
+#define REPEATS 50
+
+int main ( void ) {
+	static double X[N*(STEPS+1)*DIMX], Y[(STEPS+1)*DIMX], x0[N*DIMX], U[N*STEPS*DIMU];
+	VsaRollout R;
+	int i, r, k, failed = 0;
+
+	/* a deadlock of the pool fails the test instead of hanging it */
+	alarm(60);
+	srand(1);
+	for ( i = 0; i < N*DIMX; i += 1 ) { x0[i] = 0.5*((double) rand()/RAND_MAX - 0.5); }
+	for ( i = 0; i < N*STEPS*DIMU; i += 1 ) { U[i] = (double) rand()/RAND_MAX - 0.5; }
+
+	for ( k = 0; k < REPEATS; k += 1 ) {
+		vsa_rollout_init(&R, THREADS);
+		memset(X, 0, sizeof(X));
+		vsa_rollout_run(&R, X, x0, U, STEPS, N);
+		for ( r = 0; r < N; r += 1 ) {
+			vsa_rollout_run_one(&R, Y, x0 + r*DIMX, U + r*STEPS*DIMU, STEPS);
+			if (memcmp(Y, X + r*(STEPS+1)*DIMX, sizeof(Y)) != 0) {
+				fprintf(stderr, "rollout %d of batch %d differs from a single rollout.\n", r, k);
+				failed = 1;
+			}
+		}
+		vsa_rollout_free(&R);
+	}
+	puts(failed ? "test_rollout: FAILED" : "test_rollout: ok");
+	return failed;
+}
@@ -0,0 +1,169 @@
+/**
+ * \file test_solve_command.c
+ *
+ * \brief Test of the inverse models, compiled once per robot (with
+ * MACCEPA_INTERFACE or EDINBURGHVSA_INTERFACE defined): the commands found by
+ * maccepa_model_solve_command() and edinburghvsa_table_solve_command() for
+ * random reachable targets must give those targets in the forward model, and
+ * targets below the reachable stiffness must be reported as clipped, with the
+ * command at the limit of the motors. (The stiffness of the Edinburgh VSA
+ * peaks inside the range, so the closest command to too high a stiffness is
+ * not at a limit.)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#ifdef MACCEPA_INTERFACE
+#include "../sketchbook/maccepa/defines.h"
+#include <libmaccepa.h>
+typedef maccepa_model Model;
+#define model_init    maccepa_model_init
+#define get_stiffness maccepa_model_get_stiffness
+#define EXACT         MACCEPA_COMMAND_EXACT
+#define CLIPPED       MACCEPA_COMMAND_CLIPPED
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+#include "../sketchbook/edinburghvsa/defines.h"
+#include <libedinburghvsa.h>
+#include <edinburghvsa_table.h>
+typedef edinburghvsa_model Model;
+#define model_init    edinburghvsa_model_init
+#define get_stiffness edinburghvsa_model_get_stiffness
+#define EXACT         EDINBURGHVSA_COMMAND_EXACT
+#define CLIPPED       EDINBURGHVSA_COMMAND_CLIPPED
+/** \brief Grid size of the table. */
+#define GRID 33
+/** \brief Table the Edinburgh VSA commands are solved on. */
+static edinburghvsa_table T;
+#endif
+
+/** \brief Number of random targets. */
+#define POINTS 500
+/** \brief Accuracy the targets are solved to (q0 in rad, k in Nm/rad). */
+static const double tolerance[2] = { 1e-6, 1e-5 };
+
+static double uniform ( double lo, double hi ) {
+	return lo + (hi - lo)*rand()/RAND_MAX;
+}
+
+/** \brief Equilibrium position and stiffness of the forward model, zero if there is no equilibrium. */
+static int forward ( Model *model, double *u, double *f ) {
+	double x[DIMX] = { 0, 0 };
+
+#ifdef MACCEPA_INTERFACE
+	maccepa_model_get_equilibrium_position(&x[0], x, u, model);
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+	if (edinburghvsa_model_solve_equilibrium_position(&x[0], x, u, model, NULL) != EDINBURGHVSA_EQUILIBRIUM_CONVERGED) return 0;
+#endif
+	get_stiffness(&f[1], x, u, model);
+	f[0] = x[0];
+	return 1;
+}
+
+/** \brief Solve for the command of a target (u holds the damping command, if any). */
+static int solve ( Model *model, double *u, double *target ) {
+#ifdef MACCEPA_INTERFACE
+	return maccepa_model_solve_command(u, target, model);
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+	(void) model;
+	return edinburghvsa_table_solve_command(&T, u, target, tolerance, 0);
+#endif
+}
+
+/** \brief Non-zero if motor d of u is at umin or umax. */
+static int at_limit ( Model *model, double *u, int d ) {
+	return u[d] == model->umin[d] || u[d] == model->umax[d];
+}
+
+int main ( void ) {
+	Model model;
+	double u[DIMU], v[DIMU], f[2], target[2], lo, hi;
+	int p, i, s, reached = 0, failed = 0;
+#ifdef EDINBURGHVSA_INTERFACE
+	double r0, r1;
+#endif
+
+	model_init(&model);
+#ifdef EDINBURGHVSA_INTERFACE
+	if (!edinburghvsa_table_init(&T, &model, GRID, GRID, NULL)) {
+		fputs("could not build the table.\n", stderr);
+		puts("test_solve_command: FAILED");
+		return 1;
+	}
+#endif
+
+	/* random reachable targets, back through the forward model */
+	srand(1);
+	for ( p = 0; p < POINTS; p += 1 ) {
+		for ( i = 0; i < DIMU; i += 1 ) { v[i] = u[i] = uniform(model.umin[i], model.umax[i]); }
+		if (!forward(&model, v, target)) continue;
+		s = solve(&model, u, target);
+		if (s != EXACT || !forward(&model, u, f) || fabs(f[0]-target[0]) > tolerance[0] || fabs(f[1]-target[1]) > tolerance[1]) {
+			fprintf(stderr, "target (%g, %g) from u = (%g, %g): status %d, u = (%g, %g) gives (%g, %g).\n", target[0], target[1], v[0], v[1], s, u[0], u[1], f[0], f[1]);
+			failed = 1;
+		}
+		reached += 1;
+	}
+	if (reached < POINTS/2) {
+		fprintf(stderr, "only %d of %d random commands have an equilibrium.\n", reached, POINTS);
+		failed = 1;
+	}
+
+	/* unreachable stiffness: below the smallest at the corners of the range by half the spread */
+	for ( i = 0; i < DIMU; i += 1 ) { u[i] = 0.5*(model.umin[i]+model.umax[i]); }
+	lo = HUGE_VAL;
+	hi = -HUGE_VAL;
+	for ( p = 0; p < 4; p += 1 ) {
+		u[0] = p & 1 ? model.umax[0] : model.umin[0];
+		u[1] = p & 2 ? model.umax[1] : model.umin[1];
+		if (!forward(&model, u, f)) continue;
+		if (f[1] < lo) { lo = f[1]; target[0] = f[0]; }
+		if (f[1] > hi) hi = f[1];
+	}
+	target[1] = lo - 0.5*(hi-lo) - 0.1;
+	s = solve(&model, u, target);
+	if (s != CLIPPED || !at_limit(&model, u, 1)) {
+		fprintf(stderr, "unreachable target (%g, %g): status %d, u = (%g, %g).\n", target[0], target[1], s, u[0], u[1]);
+		failed = 1;
+	}
+
+#ifdef MACCEPA_INTERFACE
+	/* unreachable equilibrium position: u[0] is clipped */
+	target[0] = model.umax[0] + 0.2;
+	target[1] = lo;
+	s = solve(&model, u, target);
+	if (s != CLIPPED || u[0] != model.umax[0]) {
+		fprintf(stderr, "unreachable target (%g, %g): status %d, u = (%g, %g).\n", target[0], target[1], s, u[0], u[1]);
+		failed = 1;
+	}
+#endif
+#ifdef EDINBURGHVSA_INTERFACE
+	/*
+	 * Half the stiffness of a point on the edge u[1] = umin[1] (where the
+	 * stiffness is lowest for the same equilibrium position): from there, the
+	 * search must hold u[1] at its limit and move u[0] to fit the target as
+	 * well as it can.
+	 */
+	v[0] = 0.5*(model.umin[0]+model.umax[0]);
+	v[1] = model.umin[1];
+	forward(&model, v, f);
+	target[0] = f[0];
+	target[1] = 0.5*f[1];
+	r0 = hypot((f[0]-target[0])/tolerance[0], (f[1]-target[1])/tolerance[1]);
+	u[0] = v[0];
+	u[1] = v[1];
+	s = edinburghvsa_table_solve_command(&T, u, target, tolerance, 1);
+	forward(&model, u, f);
+	r1 = hypot((f[0]-target[0])/tolerance[0], (f[1]-target[1])/tolerance[1]);
+	if (s != CLIPPED || u[1] != model.umin[1] || at_limit(&model, u, 0) || !(r1 <= r0)) {
+		fprintf(stderr, "target (%g, %g) below the edge: status %d, u = (%g, %g), residual %g (edge point %g).\n", target[0], target[1], s, u[0], u[1], r1, r0);
+		failed = 1;
+	}
+	edinburghvsa_table_free(&T);
+#endif
+
+	puts(failed ? "test_solve_command: FAILED" : "test_solve_command: ok");
+	return failed;
+}